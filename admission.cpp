@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+#include "utils.h"
+#include "admission.h"
+
+// A wait this long for the event loop to wake up means it was asleep, rather than coming straight back round to events it
+// already had
+#define ADMISSION_IDLE_US 100
+
+// what a window over the latency objective brings the game limit down to, as a share of the games that were live, and
+// what a window under it raises a limit that turned games away by
+#define GAME_LIMIT_DECREASE 0.9
+#define GAME_LIMIT_INCREASE 1.05
+
+// the bucket for a latency: exact below 8 us, and then four to each power of two
+static int latency_bucket(uint64_t us){
+    if (us < 8)
+        return (int)us;
+    int high_bit = 63 - __builtin_clzll(us);
+    int bucket = (high_bit - 1) * 4 + (int)((us >> (high_bit - 2)) & 3);
+    return (bucket < ADMISSION_LATENCY_BUCKETS) ? bucket : ADMISSION_LATENCY_BUCKETS - 1;
+}
+
+// the highest latency in a bucket
+static uint32_t bucket_limit(int bucket){
+    if (bucket < 8)
+        return (uint32_t)bucket;
+    int high_bit = bucket / 4 + 1;
+    uint64_t low = (uint64_t)(4 + bucket % 4) << (high_bit - 2);
+    return (uint32_t)(low + (1ULL << (high_bit - 2)) - 1);
+}
+
+AdmissionControl::AdmissionControl(int shard, const AdmissionLimits &limits, MemoryBudget *budget)
+    : connections_refused(0), games_shed(0), connections_dropped(0), shard(shard), limits(limits),
+      max_queued_bytes((size_t)limits.max_queued_frames * DEFAULT_BUFLEN), budget(budget), budget_added(0),
+      tokens(limits.accept_rate), tokens_time(Clock::now()), batch_start(tokens_time), complete_batch_start(tokens_time),
+      last_batch_end(tokens_time), batch_complete(true), window_frames(0), window_start(tokens_time), window_shed(0),
+      p99_us(0), game_limit(std::numeric_limits<double>::infinity()), shedding(false){
+    memset(latencies, 0, sizeof(latencies));
+}
+
+void AdmissionControl::begin_batch(bool more_waiting){
+    if (batch_complete)
+        complete_batch_start = batch_start;
+    batch_start = Clock::now();
+    batch_complete = !more_waiting;
+}
+
+void AdmissionControl::end_batch(long frames, size_t queued_bytes, int live_games){
+    Clock::time_point now = Clock::now();
+    if (frames > 0 && limits.latency_slo_ms > 0){
+        bool slept = batch_start - last_batch_end > std::chrono::microseconds(ADMISSION_IDLE_US);
+        Clock::time_point arrived = slept ? batch_start : complete_batch_start;
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(now - arrived).count();
+        latencies[latency_bucket(us)] += (uint32_t)frames;
+        window_frames += frames;
+    }
+    last_batch_end = now;
+    if (budget != NULL && (long)queued_bytes != budget_added){
+        budget->add((long)queued_bytes - budget_added);
+        budget_added = (long)queued_bytes;
+    }
+    if (now - window_start >= std::chrono::milliseconds(ADMISSION_WINDOW_MS))
+        end_window(now, live_games);
+}
+
+// Takes the p99 of the window that's ending, moves the game limit by it, and starts the next window
+void AdmissionControl::end_window(Clock::time_point now, int live_games){
+    p99_us = 0;
+    long rank = window_frames - window_frames / 100; // the frame at the 99th percentile, counting from 1
+    long seen = 0;
+    for (int i = 0; i < ADMISSION_LATENCY_BUCKETS && window_frames > 0; i++){
+        seen += latencies[i];
+        if (seen >= rank){
+            p99_us = bucket_limit(i);
+            break;
+        }
+    }
+    bool shed = games_shed > window_shed;
+    memset(latencies, 0, sizeof(latencies));
+    window_frames = 0;
+    window_start = now;
+    window_shed = games_shed;
+
+    if (limits.latency_slo_ms > 0 && p99_us > (uint32_t)limits.latency_slo_ms * 1000)
+        game_limit = std::max(1.0, std::min(game_limit, (double)live_games) * GAME_LIMIT_DECREASE);
+    else if (shed)
+        game_limit *= GAME_LIMIT_INCREASE;
+
+    if (shed != shedding){
+        shedding = shed;
+        if (shedding && budget != NULL && budget->spent())
+            printf("[shard %d] Shedding new games: the memory budget is spent.\n", shard);
+        else if (shedding)
+            printf("[shard %d] Shedding new games past %.0f live games: p99 turn latency %.1f ms (objective %d ms).\n",
+                shard, game_limit, p99_us / 1000.0, limits.latency_slo_ms);
+        else
+            printf("[shard %d] Taking new games again: p99 turn latency %.1f ms.\n", shard, p99_us / 1000.0);
+    }
+}
+
+bool AdmissionControl::admit_connection(){
+    if (limits.accept_rate <= 0)
+        return true;
+    Clock::time_point now = Clock::now();
+    tokens += std::chrono::duration<double>(now - tokens_time).count() * limits.accept_rate;
+    if (tokens > limits.accept_rate)
+        tokens = limits.accept_rate;
+    tokens_time = now;
+    if (tokens < 1){
+        connections_refused++;
+        return false;
+    }
+    tokens -= 1;
+    return true;
+}
+
+bool AdmissionControl::admit_game(int live_games){
+    if (live_games >= game_limit || (budget != NULL && budget->spent())){
+        games_shed++;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,119 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Admission control: what keeps games fast when more players turn up than the server can serve. A server that takes every
+// game past its capacity makes every game slow, and keeps getting slower for as long as players arrive faster than games
+// end. Instead, each shard
+// - bounds every connection's output queue: a connection that lets more than max_queued_frames frames pile up unread is
+//   dropped rather than queued for without end
+// - counts its queued output against a memory budget shared by every shard
+// - takes at most accept_rate new connections a second on the game port, with up to a second's worth at once
+// - and sheds new games past a limit on its live games, telling their players to try again in retry_after_s seconds, and
+//   all new games while the memory budget is spent.
+// Games that have started are never shed, and neither are players coming back to a game on the resume port.
+
+// The limit follows the shard's p99 turn latency, window by window: a window over the latency objective brings the limit
+// down to 90% of the games that were live, and a window under it raises a limit that was turning games away by 5%. Games
+// last minutes, so a switch that took every new game the moment latency was back under the objective would let in a
+// window's worth of arrivals at a time, which then stay.
+
+// A shard can't see when a frame arrived, only when its event loop woke up and when it finished each batch. A frame answered
+// in a batch arrived after the last batch before it that took every event there was started, or, if the loop was asleep in
+// between, woke the loop up. So it waited at most from the start of that batch (or of its own batch, after a sleep) to the
+// end of its own, which is the latency each frame is counted with for the p99.
+
+// how long each window of latencies the p99 is taken over is
+#define ADMISSION_WINDOW_MS 500
+// log-linear buckets of microseconds, four to each power of two, up to half a minute
+#define ADMISSION_LATENCY_BUCKETS 100
+
+struct AdmissionLimits {
+    int latency_slo_ms; // shed new games while the p99 turn latency is over this, 0 for no objective
+    long memory_budget; // bytes of output queued across every shard before new games are shed, 0 for no budget
+    int max_queued_frames; // per connection, 0 for no bound
+    double accept_rate; // new connections a second each shard takes on the game port, 0 for no limit
+    int retry_after_s; // what shed players are told to wait before trying again
+};
+
+// The output queued on every shard's connections, against the budget. Each shard adds what its queues grew or shrank by
+// once per batch, so it's one atomic add per batch
+class MemoryBudget {
+    public:
+        explicit MemoryBudget(long budget) : budget(budget), used(0){}
+
+        void add(long bytes){
+            used.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        bool spent() const{
+            return used.load(std::memory_order_relaxed) > budget;
+        }
+
+    private:
+        long budget;
+        std::atomic<long> used;
+};
+
+// One shard's admission control. Only the shard's thread uses it, so nothing in it is locked
+class AdmissionControl {
+    public:
+        // budget is shared by every shard, or NULL for no budget
+        AdmissionControl(int shard, const AdmissionLimits &limits, MemoryBudget *budget);
+
+        // Backends call begin_batch() when the event loop wakes up, with whether there were more events than it took, and the
+        // shard calls end_batch() when the batch has been handled, with how many frames it received, how many bytes of output
+        // its connections have queued and how many games it has going
+        void begin_batch(bool more_waiting);
+        void end_batch(long frames, size_t queued_bytes, int live_games);
+
+        // whether to take a new connection on the game port, which uses up one of the accept rate's tokens
+        bool admit_connection();
+
+        // whether to start a new game, with live_games going already
+        bool admit_game(int live_games);
+
+        // whether a connection with this many bytes already queued gets no more
+        bool queue_full(size_t queued_bytes) const{
+            return limits.max_queued_frames > 0 && queued_bytes >= max_queued_bytes;
+        }
+
+        int retry_after_s() const{
+            return limits.retry_after_s;
+        }
+
+        // for the shard's statistics
+        long connections_refused, games_shed, connections_dropped;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        void end_window(Clock::time_point now, int live_games);
+
+        int shard;
+        AdmissionLimits limits;
+        size_t max_queued_bytes;
+        MemoryBudget *budget;
+        long budget_added; // what this shard has added to the budget so far
+
+        double tokens; // new connections that can be taken right now
+        Clock::time_point tokens_time;
+
+        // when the current batch started, and the last one before it that took every event there was
+        Clock::time_point batch_start, complete_batch_start, last_batch_end;
+        bool batch_complete;
+
+        uint32_t latencies[ADMISSION_LATENCY_BUCKETS]; // frames, by their latency, in the current window
+        long window_frames;
+        Clock::time_point window_start;
+        long window_shed; // games_shed when the window started
+        uint32_t p99_us; // over the last window
+        double game_limit; // games past this are shed. Infinite until latency first goes over the objective
+        bool shedding; // in the last window, for the log
+};
+
+#endif // ADMISSION_H
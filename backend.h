@@ -0,0 +1,114 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "session.h"
+
+// The server's I/O backends. Each one runs a shard's event loop on the calling thread: it listens on the port, accepts
+// connections, feeds what they send to the shard and sends what the shard queues, until main() asks it to stop (see
+// ShardControl). Both backends drive the same Shard, so games behave the same whichever one is running, and either can hand
+// its shard over to the other.
+
+// epoll (epoll_backend.cpp) works on any Linux kernel, but costs a syscall for every recv() and send() on top of
+// epoll_wait(). io_uring (uring_backend.cpp) needs Linux 6.0 or newer for multishot recv and ring-provided buffers, and
+// batches a whole loop iteration's worth of accepts, receives and sends into one io_uring_enter() call.
+
+enum IOBackend {EpollBackend, UringBackend};
+
+struct ServerOptions {
+    const char *port;
+    int resume_port; // with a state directory, shard K also listens on resume_port + K for players coming back to games
+    bool gateway; // shard K listens on resume_port + K for a gateway's players too, with or without a state directory
+    int shards;
+    IOBackend backend;
+    ShardConfig shard_config;
+};
+
+// What main() can ask of a running shard: stop, copy everything for a handoff, or stop and export what's changed since
+// the copy (see handoff.h)
+enum ShardRequest {NoRequest, StopShard, CopyShard, HandOffShard};
+
+// How main() and a shard's thread talk. main() posts a request, which wakes the shard up between two batches of events, and
+// waits for it to be done
+struct ShardControl {
+    int wake_fd; // an eventfd, written to when a request is posted
+    std::atomic<int> request;
+
+    // what CopyShard and HandOffShard export into, and the CLOCK_MONOTONIC time a new server's shard started serving at
+    ShardHandoff copy, final;
+    uint64_t started_ns;
+
+    // For a new server's shard: the old shard's copy, to get ready to take over from, or NULL. Once it's ready, it waits
+    // for an answer, by which time adopt_final has the old shard's final handoff
+    const ShardHandoff *adopt;
+    const ShardHandoff *adopt_final;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool done; // the request has been carried out
+    int answer; // -1 until main() answers
+
+    ShardControl() : wake_fd(-1), request(NoRequest), started_ns(0), adopt(NULL), adopt_final(NULL), done(false),
+                     answer(-1){}
+
+    void post(ShardRequest r){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = false;
+            answer = -1;
+        }
+        request = r;
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) != sizeof(one))
+            perror("eventfd write() error");
+    }
+
+    // the shard's side: called when wake_fd is readable
+    ShardRequest take_request(){
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            perror("eventfd read() error");
+        return (ShardRequest)request.exchange(NoRequest);
+    }
+
+    void finish(){
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        changed.notify_all();
+    }
+
+    void wait_done(){
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]{ return done; });
+    }
+
+    // After HandOffShard, whether the new server took over (and the shard exits) or not (and it carries on). A new server's
+    // shard is told to take over once it's ready, and is done again once it's running
+    void give_answer(bool yes){
+        std::lock_guard<std::mutex> lock(mutex);
+        answer = yes;
+        done = false;
+        changed.notify_all();
+    }
+
+    bool wait_answer(){
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]{ return answer >= 0; });
+        return answer == 1;
+    }
+};
+
+void run_epoll_shard(int index, const ServerOptions &options, ShardControl &control);
+void run_uring_shard(int index, const ServerOptions &options, ShardControl &control);
+
+// whether this kernel has everything the io_uring backend uses
+bool uring_supported();
+
+#endif // BACKEND_H
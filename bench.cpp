@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "utils.h"
+#include "game.h"
+#include "pool.h"
+#include "engine.h"
+#include "move_codec.h"
+#include "board_view.h"
+
+// Reports how much memory a game takes and how quickly games can be created and torn down, both from a SlabPool
+// (the way the server does it) and from the global heap for comparison.
+
+// Then runs perft (counting every sequence of legal moves to a given depth) in each variant, as a check on the rules and a
+// measure of how fast moves are generated and made. En passant isn't played, so the counts for standard chess come out
+// below the usual ones once a pawn could be taken en passant (from depth 5 in the start position).
+
+// Last, stores games the bot played against itself in each of the ways a game's moves can be kept: as the text a client
+// types ("e2e4\n"), as PGN move text ("1. e4 e5 2. Nf3"), and with the move codec (see move_codec.h), and reports the bytes
+// per game and how many moves per second each writes and reads back. Reading text or PGN includes playing the moves, as
+// the codec's decoder does.
+
+// And plays the same games back as the client shows them on a terminal, to report the bytes written to it per move when
+// every board is printed in full and when only what changed is redrawn (see board_view.h).
+
+#define BENCH_GAMES 1000000
+
+// the stored games: how many, how long at most, and how many times each is written and read for the timings
+#define CODEC_GAMES 16
+#define CODEC_MAX_PLIES 200
+#define CODEC_PASSES 20
+
+// a position with every kind of move in it close to the root, castle-ing in particular ("Kiwipete")
+#define KIWIPETE_FEN "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"
+
+// keeps the compiler from optimizing away games that are never looked at
+static volatile int sink;
+
+// the number of move sequences depth half moves long from the position. A game that's been won (in King of the Hill) has
+// no moves after it
+template <typename Variant>
+static long perft(BasicGame<Variant> &game, char player_color, int depth){
+    std::vector<Move> moves;
+    game.generate_moves(player_color, moves);
+    if (depth == 1)
+        return (long)moves.size();
+    char opponent = (player_color == 'W') ? 'B' : 'W';
+    long nodes = 0;
+    for (const Move &move : moves){
+        BasicGame<Variant> child = game;
+        child.make_move(move, player_color);
+        if (!child.get_white_won() && !child.get_black_won())
+            nodes += perft(child, opponent, depth - 1);
+    }
+    return nodes;
+}
+
+template <typename Variant>
+static void report_perft(const char *name, BasicGame<Variant> game, int depth){
+    auto start = std::chrono::steady_clock::now();
+    long nodes = perft(game, game.get_side_to_move(), depth);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Perft %-32s depth %d: %10ld nodes in %.2f s (%.0f nodes/sec)\n", name, depth, nodes, seconds, nodes / seconds);
+}
+
+// Plays the bot against itself from a few random opening moves, searching two plies deep so the games are quick to make
+static std::vector<std::vector<Move>> self_play_games(){
+    std::mt19937 rng(1);
+    std::atomic<bool> stop(false);
+    SearchLimits limits = {};
+    limits.max_depth = 2;
+    std::vector<std::vector<Move>> games;
+    std::vector<Move> legal;
+    for (int i = 0; i < CODEC_GAMES; i++){
+        Game game;
+        std::vector<Move> moves;
+        int random_plies = 2 + rng() % 8;
+        while ((int)moves.size() < CODEC_MAX_PLIES && !game.get_white_won() && !game.get_black_won()
+            && game.get_draw_reason() == DrawReason::NoDraw){
+            char side = game.get_side_to_move();
+            Move move;
+            if ((int)moves.size() < random_plies){
+                game.generate_moves(side, legal);
+                move = legal[rng() % legal.size()];
+            } else {
+                SearchResult result = search_position(game, side, limits, stop);
+                if (!result.found_move)
+                    break;
+                move = result.best_move;
+            }
+            moves.push_back(move);
+            game.make_move(move, side);
+        }
+        games.push_back(moves);
+    }
+    return games;
+}
+
+static bool same_moves(const std::vector<Move> &a, const std::vector<Move> &b){
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++){
+        if (a[i].from_row != b[i].from_row || a[i].from_col != b[i].from_col || a[i].to_row != b[i].to_row
+            || a[i].to_col != b[i].to_col || a[i].promotion != b[i].promotion)
+            return false;
+    }
+    return true;
+}
+
+// The ways a game is stored. Each writes a game's moves into a string, and reads them back from one by playing them
+struct GameFormat {
+    const char *name;
+    void (*write)(const std::vector<Move> &moves, std::string &out);
+    bool (*read)(const std::string &in, std::vector<Move> &moves);
+};
+
+static void write_text(const std::vector<Move> &moves, std::string &out){
+    char buf[DEFAULT_BUFLEN];
+    for (const Move &move : moves){
+        Game::format_move(move, buf);
+        out += buf;
+    }
+}
+
+static bool read_text(const std::string &in, std::vector<Move> &moves){
+    Game game;
+    char buf[DEFAULT_BUFLEN];
+    size_t pos = 0;
+    while (pos < in.size()){
+        size_t end = in.find('\n', pos);
+        if (end == std::string::npos)
+            return false;
+        in.copy(buf, end + 1 - pos, pos);
+        buf[end + 1 - pos] = '\0';
+        Move move;
+        if (!Game::parse_move(buf, move) || game.make_move(move, game.get_side_to_move()) != MoveResult::Valid)
+            return false;
+        moves.push_back(move);
+        pos = end + 1;
+    }
+    return true;
+}
+
+static void write_pgn(const std::vector<Move> &moves, std::string &out){
+    Game game;
+    for (size_t i = 0; i < moves.size(); i++){
+        if (i % 2 == 0)
+            out += std::to_string(i / 2 + 1) + ". ";
+        out += format_san(game, moves[i]);
+        out += ' ';
+        game.make_move(moves[i], game.get_side_to_move());
+    }
+}
+
+static bool read_pgn(const std::string &in, std::vector<Move> &moves){
+    Game game;
+    size_t pos = 0;
+    while (pos < in.size()){
+        size_t end = in.find(' ', pos);
+        if (end == std::string::npos)
+            end = in.size();
+        // skip the move numbers
+        if (in[end - 1] != '.'){
+            Move move;
+            if (!parse_san(game, in.c_str() + pos, move))
+                return false;
+            game.make_move(move, game.get_side_to_move());
+            moves.push_back(move);
+        }
+        pos = end + 1;
+    }
+    return true;
+}
+
+template <MoveCoding coding>
+static void write_coded(const std::vector<Move> &moves, std::string &out){
+    MoveEncoder encoder(Game(), coding);
+    for (const Move &move : moves)
+        encoder.add(move);
+    encoder.finish(out);
+}
+
+static bool read_coded(const std::string &in, std::vector<Move> &moves){
+    MoveDecoder decoder(Game(), in.data(), in.size());
+    if (!decoder.ok())
+        return false;
+    Move move;
+    while (decoder.next(move))
+        moves.push_back(move);
+    return decoder.remaining() == 0;
+}
+
+static const GameFormat GAME_FORMATS[] = {
+    {"text", write_text, read_text},
+    {"PGN move text", write_pgn, read_pgn},
+    {"move codec, index", write_coded<MoveCoding::Index>, read_coded},
+    {"move codec, ranked", write_coded<MoveCoding::Ranked>, read_coded},
+};
+
+static void report_game_formats(const std::vector<std::vector<Move>> &games){
+    long total_moves = 0;
+    for (const std::vector<Move> &moves : games)
+        total_moves += (long)moves.size();
+    printf("Stored games: %d self-play games, %.1f moves per game\n", CODEC_GAMES, (double)total_moves / CODEC_GAMES);
+
+    for (const GameFormat &format : GAME_FORMATS){
+        std::vector<std::string> stored(games.size());
+        auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < CODEC_PASSES; pass++){
+            for (size_t i = 0; i < games.size(); i++){
+                stored[i].clear();
+                format.write(games[i], stored[i]);
+            }
+        }
+        double write_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        bool round_trip = true;
+        std::vector<Move> moves;
+        start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < CODEC_PASSES; pass++){
+            for (size_t i = 0; i < games.size(); i++){
+                moves.clear();
+                if (!format.read(stored[i], moves) || !same_moves(moves, games[i]))
+                    round_trip = false;
+            }
+        }
+        double read_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        size_t bytes = 0;
+        for (const std::string &game : stored)
+            bytes += game.size();
+        double moves_timed = (double)total_moves * CODEC_PASSES;
+        printf("Stored as %-20s %7.1f bytes per game (%.2f bits per move), written at %9.0f moves/sec, read at %9.0f moves/sec%s\n",
+            format.name, (double)bytes / CODEC_GAMES, bytes * 8.0 / total_moves, moves_timed / write_seconds,
+            moves_timed / read_seconds, round_trip ? "" : " (DIDN'T READ BACK THE SAME MOVES)");
+    }
+}
+
+// the terminal the games are played back on, tall enough for the board and the messages under it
+#define REDRAW_TERMINAL_ROWS 40
+
+static void report_redraws(const std::vector<std::vector<Move>> &games){
+    char board[DEFAULT_BUFLEN];
+    std::string out;
+    long total_moves = 0;
+    size_t printed = 0, redrawn = 0, first_draws = 0;
+    for (const std::vector<Move> &moves : games){
+        Game game;
+        BoardView view;
+        view.resize(REDRAW_TERMINAL_ROWS);
+        game.format_table_to_print(board);
+        out.clear();
+        view.draw(board, out);
+        first_draws += out.size();
+        for (const Move &move : moves){
+            game.make_move(move, game.get_side_to_move());
+            game.format_table_to_print(board);
+            out.clear();
+            view.draw(board, out);
+            redrawn += out.size();
+            printed += PRINTED_BOARD_SIZE + 1; // printed in full with printf("%s\n")
+        }
+        total_moves += (long)moves.size();
+    }
+    printf("Terminal output per move: %.1f bytes printing every board, %.1f bytes redrawing what changed "
+        "(after a first draw of %.0f bytes)\n", (double)printed / total_moves, (double)redrawn / total_moves,
+        (double)first_draws / games.size());
+}
+
+int main(){
+    printf("Bytes per game: %zu (trivially copyable: %s)\n", sizeof(Game),
+        std::is_trivially_copyable<Game>::value ? "yes" : "no");
+
+    SlabPool<Game> pool(1024);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_GAMES; i++){
+        Game *game = pool.acquire();
+        sink = game->get_evaluation();
+        pool.release(game);
+    }
+    double pool_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Games created per second (pool): %.0f\n", BENCH_GAMES / pool_seconds);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_GAMES; i++){
+        Game *game = new Game();
+        sink = game->get_evaluation();
+        delete game;
+    }
+    double heap_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Games created per second (heap): %.0f\n", BENCH_GAMES / heap_seconds);
+
+    Game kiwipete;
+    kiwipete.load_fen(KIWIPETE_FEN);
+    Chess960Game kiwipete_960;
+    kiwipete_960.load_fen(KIWIPETE_FEN);
+    report_perft("standard, start position", Game(), 5);
+    report_perft("standard, Kiwipete", kiwipete, 4);
+    report_perft("Chess960, start position 518", Chess960Game(STANDARD_START_POSITION), 5);
+    report_perft("Chess960, Kiwipete", kiwipete_960, 4);
+    report_perft("Chess960, start position 0", Chess960Game(0), 5);
+    report_perft("King of the Hill, start position", KingOfTheHillGame(), 5);
+
+    std::vector<std::vector<Move>> games = self_play_games();
+    report_game_formats(games);
+    report_redraws(games);
+
+    return 0;
+}
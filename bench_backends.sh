@@ -0,0 +1,26 @@
+#!/bin/sh
+# Compares the server's epoll and io_uring backends under the same load. For each backend it starts a server, runs
+# loadgen against it, stops the server and prints loadgen's report along with the server's syscalls per frame.
+#
+# usage: ./bench_backends.sh [build dir] [connections] [seconds]
+# The defaults are build, 10000 and 10. The server and loadgen each need a file descriptor per connection, so the hard
+# open file limit (ulimit -Hn) has to be above the connection count. Both raise their soft limit to it.
+
+BUILD=${1:-build}
+CONNECTIONS=${2:-10000}
+DURATION=${3:-10}
+PORT=27099
+
+for BACKEND in epoll uring; do
+    echo "== $BACKEND, $CONNECTIONS connections, $DURATION s"
+    LOG=$(mktemp)
+    "$BUILD/server" --backend "$BACKEND" --quiet --port $PORT > "$LOG" 2>&1 &
+    SERVER=$!
+    sleep 1
+    "$BUILD/loadgen" --port $PORT --connections "$CONNECTIONS" --duration "$DURATION"
+    kill -TERM $SERVER
+    wait $SERVER
+    grep -E "syscalls|plain sends|Using epoll" "$LOG"
+    rm -f "$LOG"
+    echo
+done
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Measures what the gateway adds to every message. Starts a number of one-shard servers on localhost as nodes, runs loadgen
+# against the first node directly, and then against a gateway in front of all of them, and prints both reports along
+# with the gateway's syscalls and CPU time per frame it relayed. The difference in move latency is the gateway's extra hop.
+#
+# Halfway through the gateway run, one more node is added to the node list and the gateway is told to reread it, and every
+# node's frame count shows new games moving onto the new node.
+#
+# usage: ./bench_gateway.sh [build dir] [nodes] [connections] [seconds]
+# The defaults are build, 3, 1000 and 10. Through the gateway every connection takes three file descriptors (the client's,
+# and the gateway's two), so the hard open file limit (ulimit -Hn) has to be above three times the connection count.
+
+BUILD=${1:-build}
+NODES=${2:-3}
+CONNECTIONS=${3:-1000}
+DURATION=${4:-10}
+PORT=27098
+NODE_PORT=27100
+GATEWAY_PORT=27200
+
+DIR=$(mktemp -d)
+NODE_LIST="$DIR/nodes"
+: > "$NODE_LIST"
+PIDS=""
+for i in $(seq 0 "$NODES"); do
+    "$BUILD/server" --quiet --gateway --port $((PORT - i - 1)) --resume-port $((NODE_PORT + i)) > "$DIR/node$i" 2>&1 &
+    PIDS="$PIDS $!"
+    if [ "$i" -lt "$NODES" ]; then
+        echo "localhost:$((NODE_PORT + i))" >> "$NODE_LIST"
+    fi
+done
+sleep 1
+
+echo "== direct to one node, $CONNECTIONS connections, $DURATION s"
+"$BUILD/loadgen" --port $((PORT - 1)) --connections "$CONNECTIONS" --duration "$DURATION"
+echo
+
+echo "== through the gateway to $NODES node(s), $CONNECTIONS connections, $DURATION s"
+"$BUILD/gateway" --nodes "$NODE_LIST" --port $GATEWAY_PORT > "$DIR/gateway" 2>&1 &
+GATEWAY=$!
+sleep 1
+"$BUILD/loadgen" --port $GATEWAY_PORT --connections "$CONNECTIONS" --duration "$DURATION" &
+LOADGEN=$!
+sleep $((DURATION / 2))
+echo "localhost:$((NODE_PORT + NODES))" >> "$NODE_LIST"
+kill -HUP $GATEWAY
+wait $LOADGEN
+kill -TERM $GATEWAY
+wait $GATEWAY
+cat "$DIR/gateway"
+echo
+
+# the first node's count includes the direct run
+for PID in $PIDS; do
+    kill -TERM "$PID"
+    wait "$PID"
+done
+for i in $(seq 0 "$NODES"); do
+    echo "node $i: $(grep -o "[0-9]* frames" "$DIR/node$i")"
+done
+rm -rf "$DIR"
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Shows what admission control does past the server's capacity. Players arrive at a fixed rate whatever the server's latency
+# (loadgen --arrival-rate), and each plays one game with a think time per move. It runs once against a server that takes
+# every game and once against one with a latency objective (see admission.h), and prints both loadgen reports along with
+# what the second server shed.
+#
+# Pick a rate about twice what the server keeps up with: past it, the first server's p99 over each fifth of the run keeps
+# growing, while the second's holds near where the objective puts it and the players over capacity are turned away.
+#
+# usage: ./bench_overload.sh [build dir] [players per second] [seconds] [objective ms] [think ms]
+# The defaults are build, 160, 30, 10 and 20. The objective has to be above the server's p99 when it's lightly loaded, or the
+# server keeps shedding down to a handful of games.
+
+BUILD=${1:-build}
+RATE=${2:-160}
+DURATION=${3:-30}
+OBJECTIVE=${4:-10}
+THINK=${5:-20}
+PORT=27097
+
+for SLO in 0 "$OBJECTIVE"; do
+    if [ "$SLO" = 0 ]; then
+        echo "== every game taken, $RATE players a second, $DURATION s"
+    else
+        echo "== $SLO ms latency objective, $RATE players a second, $DURATION s"
+    fi
+    LOG=$(mktemp)
+    "$BUILD/server" --quiet --port $PORT --latency-slo-ms "$SLO" > "$LOG" 2>&1 &
+    SERVER=$!
+    sleep 1
+    "$BUILD/loadgen" --port $PORT --connections 0 --arrival-rate "$RATE" --think-ms "$THINK" --duration "$DURATION"
+    kill -TERM $SERVER
+    wait $SERVER
+    grep "admission:" "$LOG"
+    rm -f "$LOG"
+    echo
+done
@@ -0,0 +1,142 @@
+#include <string.h>
+
+#include "board_view.h"
+
+// the first screen row messages scroll in, leaving a blank line under the board
+#define MESSAGE_ROW (PRINTED_BOARD_ROWS + 2)
+// the fewest rows messages get before the board isn't kept on screen at all
+#define MIN_MESSAGE_ROWS 3
+// Moving the cursor costs up to 8 bytes ("\x1b[22;44H"), so a run of changed characters is carried on over up to this many
+// unchanged ones rather than starting a new run after them
+#define MAX_GAP 6
+
+BoardView::BoardView() : has_board(false), drawn(false), rows(0){
+    memset(last, ' ', sizeof(last));
+}
+
+bool BoardView::is_board(const std::string &text){
+    if (text.size() != PRINTED_BOARD_SIZE)
+        return false;
+    for (int i = 0; i < PRINTED_BOARD_ROWS; i++){
+        if (text[(i + 1) * PRINTED_BOARD_COLS - 1] != '\n')
+            return false;
+    }
+    // the board's top edge, under the two rows of White's captured pieces
+    return text.compare(2 * PRINTED_BOARD_COLS, 7, "  +----") == 0;
+}
+
+void BoardView::resize(int rows){
+    this->rows = rows;
+    drawn = false;
+}
+
+bool BoardView::fits() const{
+    return rows >= MESSAGE_ROW + MIN_MESSAGE_ROWS - 1;
+}
+
+// writes n in decimal at out, returning the digits written. Safe in a signal handler, unlike snprintf
+static size_t write_number(char *out, int n){
+    char digits[12];
+    size_t len = 0;
+    do {
+        digits[len++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    for (size_t i = 0; i < len; i++)
+        out[i] = digits[len - 1 - i];
+    return len;
+}
+
+static size_t write_text(char *out, const char *text){
+    size_t len = strlen(text);
+    memcpy(out, text, len);
+    return len;
+}
+
+// "\x1b[row;colH", moving the cursor (rows and columns count from 1)
+static size_t write_move(char *out, int row, int col){
+    size_t len = write_text(out, "\x1b[");
+    len += write_number(out + len, row);
+    out[len++] = ';';
+    len += write_number(out + len, col);
+    out[len++] = 'H';
+    return len;
+}
+
+size_t BoardView::repaint(char *out) const{
+    if (!has_board || !fits())
+        return 0;
+    // no scroll region while the screen's cleared, then the board, then messages scroll below it from the bottom line
+    size_t len = write_text(out, "\x1b[r\x1b[H\x1b[2J");
+    memcpy(out + len, last, PRINTED_BOARD_SIZE);
+    len += PRINTED_BOARD_SIZE;
+    len += write_text(out + len, "\x1b[");
+    len += write_number(out + len, MESSAGE_ROW);
+    out[len++] = ';';
+    len += write_number(out + len, rows);
+    out[len++] = 'r';
+    len += write_move(out + len, rows, 1);
+    return len;
+}
+
+void BoardView::draw(const char *board, std::string &out){
+    if (!fits() || !drawn){
+        memcpy(last, board, PRINTED_BOARD_SIZE);
+        has_board = true;
+    }
+    if (!fits()){
+        out.append(board, PRINTED_BOARD_SIZE);
+        out += '\n';
+        drawn = false;
+        return;
+    }
+    if (!drawn){
+        char buf[BOARD_VIEW_REPAINT_SIZE];
+        out.append(buf, repaint(buf));
+        drawn = true;
+        return;
+    }
+
+    // the changed characters, a run at a time, with the cursor put back where the messages are afterwards
+    size_t start = out.size();
+    out += "\x1b" "7";
+    bool changed = false;
+    for (int row = 0; row < PRINTED_BOARD_ROWS; row++){
+        const char *was = last + row * PRINTED_BOARD_COLS;
+        const char *now = board + row * PRINTED_BOARD_COLS;
+        int col = 0;
+        while (col < PRINTED_BOARD_COLS - 1){
+            if (was[col] == now[col]){
+                col++;
+                continue;
+            }
+            // a run from here to the last changed character that's no more than MAX_GAP past the one before
+            int end = col + 1, last_changed = col;
+            while (end < PRINTED_BOARD_COLS - 1 && end - last_changed <= MAX_GAP){
+                if (was[end] != now[end])
+                    last_changed = end;
+                end++;
+            }
+            char move[16];
+            out.append(move, write_move(move, row + 1, col + 1));
+            out.append(now + col, last_changed + 1 - col);
+            changed = true;
+            col = last_changed + 1;
+        }
+    }
+    if (changed)
+        out += "\x1b" "8";
+    else
+        out.resize(start);
+    memcpy(last, board, PRINTED_BOARD_SIZE);
+}
+
+void BoardView::finish(std::string &out){
+    if (!drawn)
+        return;
+    char move[16];
+    out += "\x1b[r";
+    out.append(move, write_move(move, rows, 1));
+    out += '\n';
+    drawn = false;
+}
@@ -0,0 +1,48 @@
+#ifndef BOARD_VIEW_H
+#define BOARD_VIEW_H
+
+#include <string>
+
+#include "game.h"
+
+// The client's board on an ANSI terminal. Instead of printing every board the server sends below the last one, it keeps
+// the board at the top of the screen and the server's messages scrolling underneath (in a scroll region), and when a new
+// board comes in it only rewrites the characters that changed, with the cursor moved to each. A move changes two squares,
+// and a capture a slot in the captured pieces too, so that's tens of bytes instead of the whole kilobyte of the board.
+// The whole screen is repainted the first time, and after the terminal is resized.
+
+// the most repaint() writes
+#define BOARD_VIEW_REPAINT_SIZE (PRINTED_BOARD_SIZE + 64)
+
+class BoardView {
+    public:
+        BoardView();
+
+        // whether text (a frame up to its '$') is a board, as Game::format_table_to_print writes it
+        static bool is_board(const std::string &text);
+
+        // The terminal's height. The next draw() repaints everything, since the terminal may have moved things around
+        void resize(int rows);
+
+        // Appends to out what takes the screen from the last board drawn to this one. On a terminal too short for the
+        // board and a few lines of messages under it, that's the whole board, printed like any other message
+        void draw(const char *board, std::string &out);
+
+        // Writes the escape sequences that repaint the whole screen with the last board drawn into out, which has room for
+        // BOARD_VIEW_REPAINT_SIZE bytes, and returns how many there are (0 if there's no board yet, or no room). It doesn't
+        // allocate or touch anything else, so it can be called from a signal handler
+        size_t repaint(char *out) const;
+
+        // Appends to out what gives the terminal back its whole screen to scroll, for when the client exits
+        void finish(std::string &out);
+
+    private:
+        bool fits() const;
+
+        char last[PRINTED_BOARD_SIZE]; // the last board drawn
+        bool has_board; // last holds a board
+        bool drawn; // last is on the screen, with the layout around it
+        int rows;
+};
+
+#endif // BOARD_VIEW_H
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+#include "checkpoint.h"
+
+static std::string snapshot_path(const std::string &dir, int shard){
+    return dir + "/shard-" + std::to_string(shard) + ".snapshot";
+}
+
+static std::string journal_path(const std::string &dir, int shard, uint64_t seq){
+    return dir + "/shard-" + std::to_string(shard) + ".journal." + std::to_string(seq);
+}
+
+// the sequence numbers of the shard's journal files, in order
+static std::vector<uint64_t> list_journals(const std::string &dir, int shard){
+    std::vector<uint64_t> seqs;
+    std::string prefix = "shard-" + std::to_string(shard) + ".journal.";
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+        return seqs;
+    while (struct dirent *entry = readdir(d)){
+        if (strncmp(entry->d_name, prefix.c_str(), prefix.size()) != 0)
+            continue;
+        char *end;
+        uint64_t seq = strtoull(entry->d_name + prefix.size(), &end, 10);
+        if (*end == '\0' && end != entry->d_name + prefix.size())
+            seqs.push_back(seq);
+    }
+    closedir(d);
+    std::sort(seqs.begin(), seqs.end());
+    return seqs;
+}
+
+// writes all of len bytes, returning false on an error
+static bool write_all(int fd, const void *data, size_t len){
+    const char *p = (const char*)data;
+    while (len > 0){
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0){
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+Journal::Journal(const std::string &dir, int shard) : dir(dir), shard(shard), fd(-1), seq(0), appended_count(0){
+}
+
+Journal::~Journal(){
+    flush();
+    if (fd >= 0)
+        close(fd);
+}
+
+bool Journal::open(uint64_t seq){
+    if (fd >= 0)
+        close(fd);
+    this->seq = seq;
+    appended_count = 0;
+    std::string path = journal_path(dir, shard, seq);
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0){
+        perror("journal open() error");
+        return false;
+    }
+    return true;
+}
+
+void Journal::append(const JournalRecord &record){
+    pending.push_back(record);
+    appended_count++;
+}
+
+void Journal::flush(){
+    if (pending.empty())
+        return;
+    if (fd >= 0 && !write_all(fd, pending.data(), pending.size() * sizeof(JournalRecord)))
+        perror("journal write() error");
+    pending.clear();
+}
+
+uint64_t Journal::rotate(){
+    flush();
+    open(seq + 1);
+    return seq;
+}
+
+// Writes the snapshot to a temporary file and renames it over the last one once it's safely on disk, so a crash while
+// writing leaves the last snapshot (and the journals after it) in place. Returns false on an error
+static bool write_snapshot(const std::string &dir, int shard, const std::vector<SessionRecord> &records, uint64_t journal_seq){
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.record_size = sizeof(SessionRecord);
+    header.journal_seq = journal_seq;
+    header.count = records.size();
+    header.created_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::string path = snapshot_path(dir, shard);
+    std::string temp_path = path + ".tmp";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0){
+        perror("snapshot open() error");
+        return false;
+    }
+    bool ok = write_all(fd, &header, sizeof(header)) && write_all(fd, records.data(), records.size() * sizeof(SessionRecord))
+        && fsync(fd) == 0;
+    if (!ok)
+        perror("snapshot write() error");
+    close(fd);
+    if (!ok || rename(temp_path.c_str(), path.c_str()) != 0){
+        if (ok)
+            perror("snapshot rename() error");
+        unlink(temp_path.c_str());
+        return false;
+    }
+    // make the rename itself durable before the journals it replaces are deleted
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0){
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return true;
+}
+
+SnapshotWriter::SnapshotWriter(const std::string &dir, int shard)
+    : dir(dir), shard(shard), journal_seq(0), has_work(false), writing(false), stopping(false){
+    thread = std::thread(&SnapshotWriter::run, this);
+}
+
+SnapshotWriter::~SnapshotWriter(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_one();
+    thread.join();
+}
+
+bool SnapshotWriter::busy(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return has_work || writing;
+}
+
+void SnapshotWriter::write(std::vector<SessionRecord> &records, uint64_t journal_seq){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->records.swap(records);
+        this->journal_seq = journal_seq;
+        has_work = true;
+    }
+    records.clear();
+    work_ready.notify_one();
+}
+
+void SnapshotWriter::run(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while (1){
+        work_ready.wait(lock, [this]{ return has_work || stopping; });
+        if (!has_work)
+            return;
+        std::vector<SessionRecord> snapshot;
+        snapshot.swap(records);
+        uint64_t seq = journal_seq;
+        has_work = false;
+        writing = true;
+        lock.unlock();
+
+        if (write_snapshot(dir, shard, snapshot, seq)){
+            for (uint64_t old : list_journals(dir, shard)){
+                if (old < seq)
+                    unlink(journal_path(dir, shard, old).c_str());
+            }
+        }
+
+        lock.lock();
+        writing = false;
+        // hand the memory back for the next snapshot, unless the next one is already waiting
+        if (!has_work){
+            snapshot.clear();
+            records.swap(snapshot);
+        }
+    }
+}
+
+static double ms_since(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Maps the shard's snapshot and copies its records out. Returns the first journal file it doesn't cover, or 0 if there's
+// no usable snapshot
+static uint64_t load_snapshot(const std::string &dir, int shard, std::vector<SessionRecord> &records){
+    std::string path = snapshot_path(dir, shard);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+        if (errno != ENOENT)
+            perror("snapshot open() error");
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)){
+        printf("[shard %d] Ignoring %s, which is too short to be a snapshot.\n", shard, path.c_str());
+        close(fd);
+        return 0;
+    }
+    void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED){
+        perror("snapshot mmap() error");
+        return 0;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader*)mem;
+    uint64_t journal_seq = 0;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION
+        || header->record_size != sizeof(SessionRecord)){
+        printf("[shard %d] Ignoring %s, which was written by a different version of the server.\n", shard, path.c_str());
+    } else if (sizeof(SnapshotHeader) + header->count * sizeof(SessionRecord) != (uint64_t)st.st_size){
+        printf("[shard %d] Ignoring %s, which isn't the size its header says.\n", shard, path.c_str());
+    } else {
+        const SessionRecord *first = (const SessionRecord*)(header + 1);
+        records.assign(first, first + header->count);
+        journal_seq = header->journal_seq;
+    }
+    munmap(mem, st.st_size);
+    return journal_seq;
+}
+
+// Reads a journal file whole. A record cut short by a crash mid write is dropped
+static bool read_journal(const std::string &path, std::vector<JournalRecord> &journal){
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0){
+        close(fd);
+        return false;
+    }
+    journal.resize(st.st_size / sizeof(JournalRecord));
+    size_t want = journal.size() * sizeof(JournalRecord), got = 0;
+    while (got < want){
+        ssize_t n = read(fd, (char*)journal.data() + got, want - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+    journal.resize(got / sizeof(JournalRecord));
+    return true;
+}
+
+bool load_shard_state(const std::string &dir, int shard, std::vector<SessionRecord> &records, uint64_t &next_journal_seq,
+    RestoreStats &stats){
+    stats.games = 0;
+    stats.journal_records = 0;
+    stats.snapshot_ms = 0;
+    stats.journal_ms = 0;
+    records.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t first_seq = load_snapshot(dir, shard, records);
+    stats.snapshot_ms = ms_since(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<uint64_t> seqs = list_journals(dir, shard);
+    next_journal_seq = std::max<uint64_t>({1, first_seq, seqs.empty() ? 0 : seqs.back() + 1});
+    if (first_seq == 0 && seqs.empty())
+        return false;
+
+    std::unordered_map<uint64_t, size_t> index;
+    index.reserve(records.size());
+    for (size_t i = 0; i < records.size(); i++)
+        index[records[i].id] = i;
+
+    std::vector<JournalRecord> journal;
+    for (uint64_t seq : seqs){
+        if (seq < first_seq || !read_journal(journal_path(dir, shard, seq), journal))
+            continue;
+        for (const JournalRecord &entry : journal){
+            stats.journal_records++;
+            auto it = index.find(entry.game_id);
+            if (entry.type == JournalType::GameStarted){
+                // a game started after the journal moved on may already be in the snapshot
+                if (it != index.end())
+                    continue;
+                SessionRecord record = SessionRecord(); // zeroed, with the game at its start position
+                record.id = entry.game_id;
+                record.resume_codes[0] = entry.resume_codes[0];
+                record.resume_codes[1] = entry.resume_codes[1];
+                record.to_move = 'W';
+                record.bot_game = entry.bot_game;
+                index[entry.game_id] = records.size();
+                records.push_back(record);
+            } else if (entry.type == JournalType::MovePlayed){
+                // skip moves the snapshot's copy of the game already has
+                if (it == index.end() || entry.ply != records[it->second].plies)
+                    continue;
+                SessionRecord &record = records[it->second];
+                Move move;
+                move.from_row = entry.from_row;
+                move.from_col = entry.from_col;
+                move.to_row = entry.to_row;
+                move.to_col = entry.to_col;
+                move.promotion = entry.promotion;
+                record.game.make_move(move, entry.color);
+                record.plies++;
+                record.to_move = (entry.color == 'W') ? 'B' : 'W';
+            } else if (entry.type == JournalType::GameEnded){
+                if (it == index.end())
+                    continue;
+                records[it->second].id = 0; // dropped below
+                index.erase(it);
+            }
+        }
+    }
+    records.erase(std::remove_if(records.begin(), records.end(), [](const SessionRecord &r){ return r.id == 0; }),
+        records.end());
+    stats.journal_ms = ms_since(start);
+    stats.games = (long)records.size();
+    return true;
+}
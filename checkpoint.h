@@ -0,0 +1,152 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "game.h"
+
+// Keeps the server's games across restarts. Each shard writes two kinds of files into the state directory:
+
+// - A journal (shard-K.journal.N) of every game started, move played and game ended, appended once per batch of events.
+// - Every so often a snapshot (shard-K.snapshot) of every live game. Game is trivially copyable, so a snapshot is just a
+//   header followed by an array of fixed size records that can be mapped into memory and read in place, flags, dead lists
+//   and all. Writing it to disk happens on a background thread; the event loop only copies its games into memory, a chunk
+//   at a time between batches of events, so a shard with 100k games never stalls for the whole copy.
+
+// A checkpoint starts by moving the journal on to a new file, and the snapshot records the first journal file it doesn't
+// cover. On restart a shard maps its snapshot and replays only the journal files from there on. Games copied after the
+// journal moved on may already include some of the moves in the newer journal, so every record counts the plies played,
+// and replaying skips moves a game already has. Once a snapshot is safely renamed into place, the journals before it are
+// deleted.
+
+// Journals are written with plain write() calls, so they survive the server crashing or being killed, but not the machine
+// going down. Snapshots are fsync'd before they replace the last one.
+
+#define SNAPSHOT_MAGIC "CHSNAP1"
+#define SNAPSHOT_VERSION 1
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size; // sizeof(SessionRecord), so a build with a different Game layout refuses the file
+    uint64_t journal_seq; // the first journal file the snapshot doesn't cover
+    uint64_t count; // records following the header
+    uint64_t created_ms; // unix time
+};
+
+// one live game
+struct SessionRecord {
+    uint64_t id;
+    uint32_t resume_codes[2]; // White's and Black's
+    uint32_t plies; // moves played so far
+    char to_move;
+    uint8_t bot_game;
+    uint8_t padding[2];
+    Game game;
+};
+
+enum JournalType : uint8_t {
+    GameStarted = 1,
+    MovePlayed,
+    GameEnded
+};
+
+struct JournalRecord {
+    uint64_t game_id;
+    uint8_t type;
+    char color; // the mover, for MovePlayed
+    uint8_t from_row, from_col, to_row, to_col;
+    char promotion;
+    uint8_t bot_game; // for GameStarted
+    uint32_t ply; // for MovePlayed, the plies played before this one
+    uint32_t resume_codes[2]; // for GameStarted
+    uint32_t padding;
+};
+
+// what restoring a shard took, for the startup log
+struct RestoreStats {
+    long games;
+    long journal_records;
+    double snapshot_ms;
+    double journal_ms;
+};
+
+// Appends journal records, buffered until flush() so a whole batch of events costs one write()
+class Journal {
+    public:
+        Journal(const std::string &dir, int shard);
+        ~Journal();
+
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+
+        // opens journal file seq, which new records go to
+        bool open(uint64_t seq);
+
+        void append(const JournalRecord &record);
+        void flush();
+
+        // flushes and moves on to the next journal file. Returns the new file's sequence number
+        uint64_t rotate();
+
+        // the journal file records are going to
+        uint64_t sequence(){
+            return seq;
+        }
+
+        // records appended since the current file was opened
+        long appended(){
+            return appended_count;
+        }
+
+    private:
+        std::string dir;
+        int shard;
+        int fd;
+        uint64_t seq;
+        long appended_count;
+        std::vector<JournalRecord> pending;
+};
+
+// Writes snapshots on a thread of its own
+class SnapshotWriter {
+    public:
+        SnapshotWriter(const std::string &dir, int shard);
+
+        // waits for the last snapshot to be written
+        ~SnapshotWriter();
+
+        SnapshotWriter(const SnapshotWriter&) = delete;
+        SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+        // whether a snapshot is still being written, in which case the next checkpoint has to wait
+        bool busy();
+
+        // Hands over a snapshot to write. records is swapped with an empty vector, so the caller can reuse the memory of
+        // the snapshot before last.
+        void write(std::vector<SessionRecord> &records, uint64_t journal_seq);
+
+    private:
+        void run();
+
+        std::string dir;
+        int shard;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::vector<SessionRecord> records;
+        uint64_t journal_seq;
+        bool has_work, writing, stopping;
+};
+
+// Loads a shard's games from its snapshot and journals into records. next_journal_seq is set to the journal file the
+// shard should write next. Returns false (with no games) if the directory has no state for the shard.
+bool load_shard_state(const std::string &dir, int shard, std::vector<SessionRecord> &records, uint64_t &next_journal_seq,
+    RestoreStats &stats);
+
+#endif // CHECKPOINT_H
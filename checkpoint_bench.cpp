@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+#include "game.h"
+#include "checkpoint.h"
+
+// Measures how quickly a server with many live games gets them back after a restart. It writes the state a shard would
+// leave behind (a snapshot of every game, plus a journal of the moves played since) into DIR/snapshot, and the same games
+// as a journal alone into DIR/journal, then times loading each and checks they come out the same.
+
+// The games are random legal move sequences. Only a thousand or so distinct games are played out and then reused under
+// different ids, which makes no difference to restoring them but makes setting up 100k games quick.
+
+// "server --state-dir DIR/snapshot --max-sessions N" then restores the games as shard 0 would, and prints how long it took
+// before it started serving.
+
+// Usage: checkpoint_bench [--games N] [--tail-moves N] [--dir DIR]
+
+#define DISTINCT_GAMES 1024
+#define MAX_PLIES 40
+
+static double ms_since(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static JournalRecord move_record(uint64_t id, const Move &move, char color, uint32_t ply){
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.game_id = id;
+    record.type = JournalType::MovePlayed;
+    record.color = color;
+    record.from_row = move.from_row;
+    record.from_col = move.from_col;
+    record.to_row = move.to_row;
+    record.to_col = move.to_col;
+    record.promotion = move.promotion;
+    record.ply = ply;
+    return record;
+}
+
+// plays one random legal move for whoever's turn it is. Returns false if the game is over
+static bool play_random_move(SessionRecord &record, std::mt19937 &rng, std::vector<Move> &moves, Move &played){
+    if (record.game.get_white_won() || record.game.get_black_won() || record.game.get_draw_reason() != DrawReason::NoDraw)
+        return false;
+    record.game.generate_moves(record.to_move, moves);
+    if (moves.empty())
+        return false;
+    played = moves[rng() % moves.size()];
+    record.game.make_move(played, record.to_move);
+    record.plies++;
+    record.to_move = (record.to_move == 'W') ? 'B' : 'W';
+    return true;
+}
+
+static void remove_state(const std::string &dir){
+    std::string command = "rm -rf '" + dir + "'";
+    if (system(command.c_str()) != 0)
+        printf("Couldn't clear %s.\n", dir.c_str());
+    mkdir(dir.c_str(), 0755);
+}
+
+int main(int argc, char* argv[]){
+    long game_count = 100000;
+    long tail_moves = 10000;
+    std::string dir = "checkpoint_bench_state";
+    for (int i = 1; i < argc; i++){
+        if (i + 1 < argc && strcmp(argv[i], "--games") == 0){
+            game_count = atol(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--tail-moves") == 0){
+            tail_moves = atol(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--dir") == 0){
+            dir = argv[++i];
+        } else {
+            printf("Usage: checkpoint_bench [--games N] [--tail-moves N] [--dir DIR]\n");
+            return 1;
+        }
+    }
+    if (game_count < 1 || tail_moves < 0){
+        printf("Usage: checkpoint_bench [--games N] [--tail-moves N] [--dir DIR]\n");
+        return 1;
+    }
+    mkdir(dir.c_str(), 0755);
+    std::string snapshot_dir = dir + "/snapshot";
+    std::string journal_dir = dir + "/journal";
+    remove_state(snapshot_dir);
+    remove_state(journal_dir);
+
+    // play out the distinct games, remembering their moves for the journal
+    std::mt19937 rng(1);
+    std::vector<Move> moves;
+    std::vector<SessionRecord> distinct(DISTINCT_GAMES);
+    std::vector<std::vector<Move>> distinct_moves(DISTINCT_GAMES);
+    for (int i = 0; i < DISTINCT_GAMES; i++){
+        SessionRecord &record = distinct[i];
+        record = SessionRecord();
+        record.to_move = 'W';
+        int plies = rng() % MAX_PLIES;
+        Move move;
+        while ((int)record.plies < plies && play_random_move(record, rng, moves, move))
+            distinct_moves[i].push_back(move);
+    }
+
+    // Every game, as a snapshot would have it. In the journal only state every game is started and has its moves
+    std::vector<SessionRecord> records(game_count);
+    Journal full_journal(journal_dir, 0);
+    full_journal.open(1);
+    for (long i = 0; i < game_count; i++){
+        records[i] = distinct[i % DISTINCT_GAMES];
+        records[i].id = i + 1;
+        records[i].resume_codes[0] = rng();
+        records[i].resume_codes[1] = rng();
+
+        JournalRecord start;
+        memset(&start, 0, sizeof(start));
+        start.game_id = records[i].id;
+        start.type = JournalType::GameStarted;
+        start.resume_codes[0] = records[i].resume_codes[0];
+        start.resume_codes[1] = records[i].resume_codes[1];
+        full_journal.append(start);
+        char color = 'W';
+        uint32_t ply = 0;
+        for (const Move &move : distinct_moves[i % DISTINCT_GAMES]){
+            full_journal.append(move_record(records[i].id, move, color, ply++));
+            color = (color == 'W') ? 'B' : 'W';
+        }
+        if (i % 4096 == 0)
+            full_journal.flush();
+    }
+
+    // the snapshot, written the way a shard's checkpoint writes it
+    SnapshotWriter *writer = new SnapshotWriter(snapshot_dir, 0);
+    std::vector<SessionRecord> snapshot = records;
+    auto start = std::chrono::steady_clock::now();
+    writer->write(snapshot, 2);
+    while (writer->busy())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double write_ms = ms_since(start);
+    delete writer;
+
+    // moves played since the snapshot, which go in both states' journals
+    Journal tail(snapshot_dir, 0);
+    tail.open(2);
+    long tail_played = 0;
+    for (long i = 0; i < tail_moves; i++){
+        SessionRecord &record = records[rng() % game_count];
+        uint32_t ply = record.plies;
+        char color = record.to_move;
+        Move move;
+        if (!play_random_move(record, rng, moves, move))
+            continue;
+        JournalRecord entry = move_record(record.id, move, color, ply);
+        tail.append(entry);
+        full_journal.append(entry);
+        tail_played++;
+    }
+    tail.flush();
+    full_journal.flush();
+
+    printf("%ld games, %zu bytes each in a snapshot (%.1f MB), %ld moves played since the snapshot\n", game_count,
+        sizeof(SessionRecord), game_count * sizeof(SessionRecord) / 1048576.0, tail_played);
+    printf("Snapshot written (and fsync'd) in %.1f ms\n", write_ms);
+
+    std::vector<SessionRecord> from_snapshot, from_journal;
+    uint64_t next_seq;
+    RestoreStats stats;
+    start = std::chrono::steady_clock::now();
+    load_shard_state(snapshot_dir, 0, from_snapshot, next_seq, stats);
+    printf("Snapshot + journal: restored %ld games in %.1f ms (snapshot %.1f ms, %ld journal records %.1f ms)\n",
+        stats.games, ms_since(start), stats.snapshot_ms, stats.journal_records, stats.journal_ms);
+    start = std::chrono::steady_clock::now();
+    load_shard_state(journal_dir, 0, from_journal, next_seq, stats);
+    printf("Journal only:       restored %ld games in %.1f ms (%ld journal records)\n", stats.games, ms_since(start),
+        stats.journal_records);
+
+    // both ways should give back exactly the games the shard had
+    // (compared by FEN and position key, since Game has padding and unused history that can differ)
+    std::unordered_map<uint64_t, SessionRecord*> expected;
+    for (SessionRecord &record : records)
+        expected[record.id] = &record;
+    long mismatches = 0;
+    char fen[DEFAULT_BUFLEN], expected_fen[DEFAULT_BUFLEN];
+    for (std::vector<SessionRecord> *restored : {&from_snapshot, &from_journal}){
+        if (restored->size() != records.size())
+            mismatches++;
+        for (SessionRecord &record : *restored){
+            auto it = expected.find(record.id);
+            if (it == expected.end() || it->second->plies != record.plies || it->second->to_move != record.to_move){
+                mismatches++;
+                continue;
+            }
+            record.game.format_fen(fen);
+            it->second->game.format_fen(expected_fen);
+            if (strcmp(fen, expected_fen) != 0 || record.game.position_key() != it->second->game.position_key())
+                mismatches++;
+        }
+    }
+    printf("Restored games match: %s\n", mismatches == 0 ? "yes" : "NO");
+    return mismatches == 0 ? 0 : 1;
+}
@@ -1,110 +1,258 @@
-#include <winsock2.h>
-#include <ws2tcpip.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <string>
-#pragma comment(lib, "ws2_32.lib") 
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#endif
 
+#include "net.h"
 #include "utils.h"
+#include "board_view.h"
 
 // Chess board is 8x8 tiles
 
-int main(int argc, char* argv[]){ // Don't pass any aruguments if you want to connect to localhost
-    // printf("argument passed: %s\n", argv[1]);
+// Frames asking for a move start with a line listing every legal move, i.e. "Legal moves: e2e3 e2e4 e7e8q ...\n". The line
+// isn't printed, but what's typed is checked against it before it's sent, so an illegal move is caught here rather than costing
+// a trip to the server, and a pawn move to the last row without a piece is asked about here.
+static const char *LEGAL_MOVES_PREFIX = "Legal moves:";
 
-    // WSA startup
-    WSADATA wsaData;
+// On a terminal that understands ANSI escapes, the board is kept at the top of the screen and only what changes in it is
+// redrawn (see board_view.h), unless --plain is passed. Anywhere else every board is printed as it comes, as on Windows
+static bool use_board_view = false;
+#ifndef _WIN32
+static BoardView board_view;
+static sigset_t resize_signals; // SIGWINCH, which is blocked except while the client waits (see waiting())
 
-    int iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
-    if (iResult != 0){
-        printf("WSAStartup error: %d\n", iResult);
+static int terminal_rows(){
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0)
+        return 0;
+    return size.ws_row;
+}
+
+// Repaints the whole screen at the terminal's new size. It only runs while the client waits for the server or for input,
+// so it never lands in the middle of other output
+static void on_resize(int){
+    static char buf[BOARD_VIEW_REPAINT_SIZE];
+    int saved_errno = errno;
+    board_view.resize(terminal_rows());
+    size_t len = board_view.repaint(buf), done = 0;
+    while (done < len){
+        ssize_t n = write(STDOUT_FILENO, buf + done, len - done);
+        if (n <= 0)
+            break;
+        done += (size_t)n;
     }
+    errno = saved_errno;
+}
+#endif
 
-    // getting select ports
-    struct addrinfo *result = NULL, *ptr = NULL, hints;
-    ZeroMemory(&hints, sizeof(hints));
-    hints.ai_family   = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-
-    iResult = getaddrinfo(argv[1], DEFAULT_PORT, &hints, &result);
-    if (iResult != 0){
-        printf("getaddrinfo() error: %d\n", iResult);
-        WSACleanup();
-        return 1;
+// Called with true before the client waits for the server or for input, and with false after
+static void waiting(bool on){
+#ifndef _WIN32
+    if (!use_board_view)
+        return;
+    if (on)
+        fflush(stdout);
+    sigprocmask(on ? SIG_UNBLOCK : SIG_BLOCK, &resize_signals, NULL);
+#else
+    (void)on;
+#endif
+}
+
+static char *read_line(char *buf, int size){
+    waiting(true);
+    char *line = fgets(buf, size, stdin);
+    waiting(false);
+    return line;
+}
+
+// Prints what the server sent up to its delimiter
+static void show(const std::string &text){
+#ifndef _WIN32
+    if (use_board_view && BoardView::is_board(text)){
+        std::string out;
+        board_view.draw(text.data(), out);
+        fwrite(out.data(), 1, out.size(), stdout);
+        return;
     }
+#endif
+    printf("%s\n", text.c_str());
+}
 
-    // Creating Socket
-    SOCKET connectSocket = INVALID_SOCKET;
+// Reads a line of input into sendbuf. A move that isn't in legal_moves (kept as " e2e3 e2e4 ... ") is refused, and asked for
+// again, and one that is is sent in lower case. Returns false once stdin runs out.
+static bool read_input(char sendbuf[DEFAULT_BUFLEN], const std::string &legal_moves){
+    while (1){
+        memset(sendbuf, 0, DEFAULT_BUFLEN);
+        if (read_line(sendbuf, DEFAULT_BUFLEN) == NULL)
+            return false;
+        std::string input(sendbuf);
+        while (!input.empty() && (input.back() == '\n' || input.back() == '\r'))
+            input.pop_back();
+        for (char &ch : input)
+            ch = (char)tolower((unsigned char)ch);
+        if (legal_moves.empty())
+            return true;
 
-    for (ptr = result; ptr != NULL; ptr = ptr->ai_next){
-        connectSocket = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-        if (connectSocket == INVALID_SOCKET){
-            printf("socket() error: %d\n", WSAGetLastError());
-            WSACleanup();
-            return 1;
+        // a pawn move to the last row needs a piece to promote to
+        if (input.size() == 4 && legal_moves.find(" " + input + "q ") != std::string::npos){
+            printf("What piece will you promote your pawn to? Type q, r, b or n: ");
+            fflush(stdout);
+            char piece[16];
+            if (read_line(piece, sizeof(piece)) == NULL)
+                return false;
+            input += (char)tolower((unsigned char)piece[0]);
         }
+        if (input == "resign" || legal_moves.find(" " + input + " ") != std::string::npos){
+            snprintf(sendbuf, DEFAULT_BUFLEN, "%s\n", input.c_str());
+            return true;
+        }
+        printf("That isn't a legal move. Your legal moves are:%s\nTry again: ", legal_moves.c_str());
+        fflush(stdout);
+    }
+}
 
-        // Connect to server
-        iResult = connect(connectSocket, ptr->ai_addr, ptr->ai_addrlen);
-        if (iResult == 0) {
-            break;
+// Usage: client [host] [--resume GAME CODE] [--plain]
+// Don't pass a host if you want to connect to localhost. With --resume, the client goes back to a game the server restarted
+// in the middle of, with the game number and resume code the server gave when the game started. With --plain, every board
+// is printed in full below the last, even on a terminal.
+int main(int argc, char* argv[]){
+    const char *host = NULL;
+    const char *resume_game = NULL;
+    const char *resume_code = NULL;
+    bool plain = false;
+    for (int i = 1; i < argc; i++){
+        if (i + 2 < argc && strcmp(argv[i], "--resume") == 0){
+            resume_game = argv[++i];
+            resume_code = argv[++i];
+        } else if (strcmp(argv[i], "--plain") == 0){
+            plain = true;
+        } else if (host == NULL && argv[i][0] != '-'){
+            host = argv[i];
         } else {
-            // printf("connect() error: %d\n", iResult);
-            closesocket(connectSocket);
-            connectSocket = INVALID_SOCKET;
-        } 
+            printf("Usage: client [host] [--resume GAME CODE] [--plain]\n");
+            return 1;
+        }
     }
-    
 
-    freeaddrinfo(result);
+#ifndef _WIN32
+    const char *term = getenv("TERM");
+    use_board_view = !plain && isatty(STDOUT_FILENO) && term != NULL && strcmp(term, "dumb") != 0;
+    if (use_board_view){
+        sigemptyset(&resize_signals);
+        sigaddset(&resize_signals, SIGWINCH);
+        sigprocmask(SIG_BLOCK, &resize_signals, NULL);
+        board_view.resize(terminal_rows());
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = on_resize;
+        action.sa_flags = SA_RESTART; // so the recv() and read() it interrupts carry on
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGWINCH, &action, NULL);
+    }
+#else
+    (void)plain;
+#endif
+
+    if (!net_startup())
+        return 1;
 
+    // a game's number says which shard has it, and each shard takes players coming back on a port of its own
+    char port[16];
+    if (resume_game != NULL)
+        snprintf(port, sizeof(port), "%d", DEFAULT_RESUME_PORT + (int)(strtoull(resume_game, NULL, 10) >> GAME_SHARD_SHIFT));
+    else
+        snprintf(port, sizeof(port), "%s", DEFAULT_PORT);
+    socket_t connectSocket = net_connect(host, port);
     if (connectSocket == INVALID_SOCKET){
         printf("Unable to connect to server.\n");
-        WSACleanup();
+        net_cleanup();
         return 1;
     }
 
-        
     // read input string from stdin
     char sendbuf[DEFAULT_BUFLEN];
 
+    if (resume_game != NULL){
+        memset(sendbuf, 0, DEFAULT_BUFLEN);
+        snprintf(sendbuf, DEFAULT_BUFLEN, "resume %s %s\n", resume_game, resume_code);
+        if (net_send_all(connectSocket, sendbuf, DEFAULT_BUFLEN) == SOCKET_ERROR){
+            printf("send() error: %d\n", net_last_error());
+            net_close(connectSocket);
+            net_cleanup();
+            return 1;
+        }
+    }
+
     // recieve data from server
     char recvbuf[DEFAULT_BUFLEN];
 
     // loop that recieves data. That data that the server sends will have a delimiter (null char). After
     // the delimiter, there will be an indication as to whether the client should expect to recieve more data ('R')
     // or if the client should send data ('S')
+    int iResult;
     char next_step = 'R';
+    std::string legal_moves; // from the last frame that asked for a move
     do {
         if (next_step == 'R'){
-            iResult = recv(connectSocket, recvbuf, DEFAULT_BUFLEN, 0);
+            // every message is a whole DEFAULT_BUFLEN frame, however TCP happens to split it up
+            waiting(true);
+            iResult = net_recv_all(connectSocket, recvbuf, DEFAULT_BUFLEN);
+            waiting(false);
             if (iResult > 0){
+                recvbuf[DEFAULT_BUFLEN - 1] = '\0';
                 std::string s(recvbuf);
-                int idx = s.find('$'); // get index of delimiter
+                size_t idx = s.find('$'); // get index of delimiter
+                if (idx == std::string::npos || idx + 1 >= s.size()){
+                    printf("Malformed message from server.\n");
+                    break;
+                }
                 std::string subs = s.substr(0,idx);
-                printf("%s\n", subs.c_str()); // print up until delimiter
+                if (subs.compare(0, strlen(LEGAL_MOVES_PREFIX), LEGAL_MOVES_PREFIX) == 0){
+                    size_t line_end = subs.find('\n');
+                    legal_moves = subs.substr(strlen(LEGAL_MOVES_PREFIX), line_end - strlen(LEGAL_MOVES_PREFIX)) + " ";
+                    subs = (line_end == std::string::npos) ? "" : subs.substr(line_end + 1);
+                }
+                show(subs); // print up until delimiter
                 next_step = s.at(idx+1); // Get either an 'S' for send or an 'R' for receive after the delimiter.
             } else if (iResult == 0){
                 printf("Connection to server closed.\n");
             } else {
-                printf("Error with receiving data from server: %d\n", WSAGetLastError());
+                printf("Error with receiving data from server: %d\n", net_last_error());
             }
         } else if (next_step == 'S'){
-            fgets(sendbuf, DEFAULT_BUFLEN, stdin);
-            iResult = send(connectSocket, sendbuf, DEFAULT_BUFLEN, 0);
+            if (!read_input(sendbuf, legal_moves))
+                break;
+            iResult = net_send_all(connectSocket, sendbuf, DEFAULT_BUFLEN);
             if (iResult == SOCKET_ERROR){
-                printf("send() error: %d\n", WSAGetLastError());
+                printf("send() error: %d\n", net_last_error());
                 break;
             }
             next_step = 'R';
         } else if (next_step == 'E'){
             printf("Server is ending the game.");
             break;
+        } else {
+            printf("Malformed message from server.\n");
+            break;
         }
     } while (iResult > 0);
 
-    closesocket(connectSocket);
-    WSACleanup();
+#ifndef _WIN32
+    if (use_board_view){
+        std::string out;
+        board_view.finish(out);
+        fwrite(out.data(), 1, out.size(), stdout);
+    }
+#endif
+    net_close(connectSocket);
+    net_cleanup();
 
     return 0;
-}
\ No newline at end of file
+}
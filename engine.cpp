@@ -0,0 +1,348 @@
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+
+#include "engine.h"
+#include "game.h"
+
+// Everything a search needs to know about when it has to stop, and the table it shares with other searches
+struct SearchContext {
+    std::chrono::steady_clock::time_point deadline;
+    bool has_deadline;
+    bool waiting_for_ponderhit; // the clock hasn't started yet because limits.pondering is still true
+    std::chrono::steady_clock::time_point ponder_deadline;
+    const SearchLimits *limits;
+    const std::atomic<bool> *stop;
+    long nodes;
+    long counted_nodes; // how many of the nodes have been added to limits->node_counter
+    bool aborted;
+    // The root was already drawn, which a game never forgets, so every position below it is drawn too. The search looks
+    // past those draws to tell the moves apart, and reports the draw as the score
+    bool root_drawn;
+};
+
+// rough piece values used only for ordering captures
+static int order_value(char type){
+    switch (type){
+        case 'P': return 1;
+        case 'N': return 3;
+        case 'B': return 3;
+        case 'R': return 5;
+        case 'Q': return 9;
+        case 'K': return 100;
+        default: return 0;
+    }
+}
+
+static void start_clock(SearchContext &ctx){
+    ctx.has_deadline = ctx.limits->time_budget_ms > 0;
+    ctx.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ctx.limits->time_budget_ms);
+}
+
+static void count_nodes(SearchContext &ctx){
+    if (ctx.limits->node_counter != NULL)
+        ctx.limits->node_counter->fetch_add(ctx.nodes - ctx.counted_nodes, std::memory_order_relaxed);
+    ctx.counted_nodes = ctx.nodes;
+}
+
+// Checking the clock is a lot slower than searching a node, so only look every 1024 nodes
+static bool out_of_time(SearchContext &ctx){
+    if (!ctx.aborted && (ctx.nodes & 1023) == 0){
+        count_nodes(ctx);
+        if (ctx.waiting_for_ponderhit && !ctx.limits->pondering->load(std::memory_order_relaxed)){
+            ctx.waiting_for_ponderhit = false;
+            start_clock(ctx);
+        }
+        if (ctx.stop->load(std::memory_order_relaxed)
+            || (ctx.limits->max_nodes > 0 && ctx.nodes >= ctx.limits->max_nodes)
+            || (ctx.has_deadline && !ctx.waiting_for_ponderhit && std::chrono::steady_clock::now() >= ctx.deadline)
+            || (ctx.waiting_for_ponderhit && ctx.limits->max_ponder_ms > 0 && std::chrono::steady_clock::now() >= ctx.ponder_deadline))
+            ctx.aborted = true;
+    }
+    return ctx.aborted;
+}
+
+static bool same_move(const Move &a, const Move &b){
+    return a.from_row == b.from_row && a.from_col == b.from_col && a.to_row == b.to_row && a.to_col == b.to_col
+        && a.promotion == b.promotion;
+}
+
+// moves the given move to the front of the list, keeping the order of the rest
+static void move_to_front(std::vector<Move> &moves, const Move &move){
+    for (size_t i = 0; i < moves.size(); i++){
+        if (same_move(moves[i], move)){
+            std::rotate(moves.begin(), moves.begin() + i, moves.begin() + i + 1);
+            return;
+        }
+    }
+}
+
+// Mate scores count plies from the root, but a table entry can be reached again at a different ply. They're stored
+// counting from the position itself and converted back when read.
+static int score_to_table(int score, int ply){
+    if (score >= MATE_SCORE - MAX_SEARCH_DEPTH)
+        return score + ply;
+    if (score <= -MATE_SCORE + MAX_SEARCH_DEPTH)
+        return score - ply;
+    return score;
+}
+
+static int score_from_table(int score, int ply){
+    if (score >= MATE_SCORE - MAX_SEARCH_DEPTH)
+        return score - ply;
+    if (score <= -MATE_SCORE + MAX_SEARCH_DEPTH)
+        return score + ply;
+    return score;
+}
+
+// whether a table entry settles the node without searching it, and if so with what score
+static bool table_cutoff(const TableEntry &entry, int depth, int alpha, int beta, int ply, int &score){
+    if (entry.depth < depth)
+        return false;
+    score = score_from_table(entry.score, ply);
+    return entry.bound == Bound::Exact || (entry.bound == Bound::Lower && score >= beta)
+        || (entry.bound == Bound::Upper && score <= alpha);
+}
+
+// Sorts captures to the front, most valuable victim first and least valuable attacker first among equal victims.
+// Promotions count as capturing a queen.
+static void order_moves(Game &game, std::vector<Move> &moves){
+    std::vector<std::pair<int, Move>> scored;
+    scored.reserve(moves.size());
+    for (const Move &m : moves){
+        int score = 0;
+        Piece victim = game.get_piece(m.to_row, m.to_col);
+        if (!victim.empty())
+            score = order_value(victim.type) * 16 - order_value(game.get_piece(m.from_row, m.from_col).type);
+        if (m.promotion == 'Q')
+            score += order_value('Q') * 16;
+        scored.push_back({score, m});
+    }
+    std::stable_sort(scored.begin(), scored.end(), [](const std::pair<int, Move> &a, const std::pair<int, Move> &b){
+        return a.first > b.first;
+    });
+    for (size_t i = 0; i < moves.size(); i++)
+        moves[i] = scored[i].second;
+}
+
+// evaluation from the point of view of the player to move
+static int relative_evaluation(Game &game, char player_color){
+    return (player_color == 'W') ? game.get_evaluation() : -game.get_evaluation();
+}
+
+// Only searches captures, so the evaluation at the leaves of the main search is never taken halfway through a trade.
+// The player to move can always "stand pat" and decline to capture.
+static int quiescence(Game &game, char player_color, int alpha, int beta, SearchContext &ctx){
+    ctx.nodes++;
+    if (out_of_time(ctx))
+        return 0;
+
+    int stand_pat = relative_evaluation(game, player_color);
+    if (stand_pat >= beta)
+        return stand_pat;
+    if (stand_pat > alpha)
+        alpha = stand_pat;
+
+    std::vector<Move> moves;
+    game.generate_moves(player_color, moves);
+    std::vector<Move> captures;
+    for (const Move &m : moves){
+        if (!game.get_piece(m.to_row, m.to_col).empty())
+            captures.push_back(m);
+    }
+    order_moves(game, captures);
+
+    char opponent = (player_color == 'W') ? 'B' : 'W';
+    for (const Move &m : captures){
+        Game child = game;
+        child.make_move(m, player_color);
+        int score = -quiescence(child, opponent, -beta, -alpha, ctx);
+        if (ctx.aborted)
+            return 0;
+        if (score >= beta)
+            return score;
+        if (score > alpha)
+            alpha = score;
+    }
+    return alpha;
+}
+
+static int negamax(Game &game, char player_color, int depth, int alpha, int beta, int ply, SearchContext &ctx){
+    ctx.nodes++;
+    if (out_of_time(ctx))
+        return 0;
+
+    if (ply > 0 && !ctx.root_drawn && game.get_draw_reason() != DrawReason::NoDraw)
+        return 0;
+
+    TranspositionTable *table = ctx.limits->table;
+    EvalCache *cache = depth >= SHARED_CACHE_MIN_DEPTH ? ctx.limits->shared_cache : NULL;
+    uint64_t key = 0;
+    TableEntry entry;
+    bool have_entry = false;
+    int table_score;
+    if (table != NULL || cache != NULL)
+        key = game.position_key();
+    if (table != NULL){
+        have_entry = table->probe(key, entry);
+        if (have_entry && table_cutoff(entry, depth, alpha, beta, ply, table_score))
+            return table_score;
+    }
+    if (cache != NULL){
+        TableEntry shared;
+        if (cache->lookup(key, shared)){
+            if (table_cutoff(shared, depth, alpha, beta, ply, table_score))
+                return table_score;
+            if (!have_entry || !entry.has_move){
+                entry = shared;
+                have_entry = true;
+            }
+        }
+    }
+
+    std::vector<Move> moves;
+    game.generate_moves(player_color, moves);
+    if (moves.empty())
+        return game.in_check(player_color) ? -MATE_SCORE + ply : 0;
+
+    if (depth == 0)
+        return quiescence(game, player_color, alpha, beta, ctx);
+
+    order_moves(game, moves);
+    if (have_entry && entry.has_move)
+        move_to_front(moves, entry.best_move);
+
+    char opponent = (player_color == 'W') ? 'B' : 'W';
+    int alpha_start = alpha;
+    int best = -MATE_SCORE - 1;
+    Move best_move = moves[0];
+    for (const Move &m : moves){
+        Game child = game;
+        child.make_move(m, player_color);
+        int score = -negamax(child, opponent, depth - 1, -beta, -alpha, ply + 1, ctx);
+        if (ctx.aborted)
+            return 0;
+        if (score > best){
+            best = score;
+            best_move = m;
+        }
+        if (score > alpha)
+            alpha = score;
+        if (alpha >= beta)
+            break;
+    }
+
+    // when every move failed low none of them is known to be best, so no move is stored
+    Bound bound = (best <= alpha_start) ? Bound::Upper : (best >= beta ? Bound::Lower : Bound::Exact);
+    const Move *stored_move = (bound == Bound::Upper) ? NULL : &best_move;
+    if (table != NULL)
+        table->store(key, score_to_table(best, ply), depth, bound, stored_move);
+    if (cache != NULL)
+        cache->insert(key, score_to_table(best, ply), depth, bound, stored_move);
+    return best;
+}
+
+SearchResult search_position(const Game &game, char player_color, const SearchLimits &limits, const std::atomic<bool> &stop,
+    const SearchProgress &progress){
+    SearchContext ctx;
+    ctx.limits = &limits;
+    ctx.stop = &stop;
+    ctx.nodes = 0;
+    ctx.counted_nodes = 0;
+    ctx.aborted = false;
+    ctx.waiting_for_ponderhit = limits.pondering != NULL && limits.pondering->load();
+    ctx.has_deadline = false;
+    ctx.ponder_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(limits.max_ponder_ms);
+    if (!ctx.waiting_for_ponderhit)
+        start_clock(ctx);
+
+    SearchResult result;
+    result.found_move = false;
+    result.score = 0;
+    result.depth = 0;
+    result.nodes = 0;
+
+    Game root = game;
+    std::vector<Move> moves;
+    root.generate_moves(player_color, moves);
+    if (moves.empty())
+        return result;
+
+    // always have something to play, even if not a single iteration finishes in time
+    order_moves(root, moves);
+    uint64_t root_key = root.position_key();
+    TableEntry entry;
+    if ((limits.table != NULL && limits.table->probe(root_key, entry) && entry.has_move)
+        || (limits.shared_cache != NULL && limits.shared_cache->lookup(root_key, entry) && entry.has_move))
+        move_to_front(moves, entry.best_move);
+    result.best_move = moves[0];
+    result.found_move = true;
+
+    // A GUI can set up a game that's over, with a king captured. There's nothing to search there, so it gets the score it
+    // already has and the first legal move. A position past a draw nobody claimed is searched, since the GUI plays on
+    if (root.get_white_won() || root.get_black_won()){
+        result.score = (root.get_white_won() == (player_color == 'W')) ? MATE_SCORE : -MATE_SCORE;
+        if (progress)
+            progress(result);
+        return result;
+    }
+    ctx.root_drawn = root.get_draw_reason() != DrawReason::NoDraw;
+
+    int max_depth = (limits.max_depth > 0 && limits.max_depth < MAX_SEARCH_DEPTH) ? limits.max_depth : MAX_SEARCH_DEPTH;
+    char opponent = (player_color == 'W') ? 'B' : 'W';
+    for (int depth = 1; depth <= max_depth; depth++){
+        int alpha = -MATE_SCORE - 1;
+        int beta = MATE_SCORE + 1;
+        Move best_move = moves[0];
+        for (const Move &m : moves){
+            Game child = root;
+            child.make_move(m, player_color);
+            int score = -negamax(child, opponent, depth - 1, -beta, -alpha, 1, ctx);
+            if (ctx.aborted)
+                break;
+            if (score > alpha){
+                alpha = score;
+                best_move = m;
+            }
+        }
+        if (ctx.aborted)
+            break;
+
+        result.best_move = best_move;
+        result.score = ctx.root_drawn ? 0 : alpha;
+        result.depth = depth;
+        result.nodes = ctx.nodes;
+        if (limits.table != NULL)
+            limits.table->store(root_key, alpha, depth, Bound::Exact, &best_move);
+        if (limits.shared_cache != NULL && depth >= SHARED_CACHE_MIN_DEPTH)
+            limits.shared_cache->insert(root_key, alpha, depth, Bound::Exact, &best_move);
+        count_nodes(ctx);
+        if (progress)
+            progress(result);
+
+        // search the best move first on the next iteration, since it's most likely to still be best
+        move_to_front(moves, best_move);
+
+        // no point searching deeper once a forced mate has been found
+        if (alpha >= MATE_SCORE - MAX_SEARCH_DEPTH || alpha <= -MATE_SCORE + MAX_SEARCH_DEPTH)
+            break;
+    }
+
+    result.nodes = ctx.nodes;
+    count_nodes(ctx);
+    return result;
+}
+
+SearchResult search_position(const Game &game, char player_color, int time_budget_ms, const std::atomic<bool> &stop){
+    SearchLimits limits;
+    limits.time_budget_ms = time_budget_ms > 0 ? time_budget_ms : 1; // 0 would mean no limit at all
+    limits.max_depth = 0;
+    limits.max_nodes = 0;
+    limits.pondering = NULL;
+    limits.max_ponder_ms = 0;
+    limits.table = NULL;
+    limits.shared_cache = NULL;
+    limits.node_counter = NULL;
+    return search_position(game, player_color, limits, stop);
+}
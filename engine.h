@@ -0,0 +1,66 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <atomic>
+#include <functional>
+
+#include "game.h"
+#include "transposition.h"
+#include "eval_cache.h"
+
+// The bot's search. It's a plain alpha-beta (negamax) search with iterative deepening: it searches the position one ply deep,
+// then two, then three, and so on until the time budget runs out, always keeping the best move of the last depth it finished.
+// Captures are searched first (most valuable victim, least valuable attacker), and the leaves are extended with a capture-only
+// quiescence search so the bot doesn't stop counting in the middle of a trade. With a transposition table, positions already
+// searched deeply enough are cut off, and the best move found for a position last time is searched first.
+
+// Scores are in centipawns from the point of view of the player to move. Being checkmated is scored as -MATE_SCORE plus the
+// number of plies until it happens, so the bot prefers the fastest mate and the slowest loss.
+#define MATE_SCORE 100000
+#define MAX_SEARCH_DEPTH 64
+
+// Only nodes with at least this many plies left to search use the shared eval cache. Shallower ones are cheaper to search
+// again than to look up in a table every thread in the process is using.
+#define SHARED_CACHE_MIN_DEPTH 2
+
+struct SearchResult {
+    Move best_move;
+    bool found_move; // false if the player had no legal moves at all
+    int score;
+    int depth; // the deepest iteration that finished
+    long nodes;
+};
+
+struct SearchLimits {
+    int time_budget_ms; // 0 to search until stop becomes true (or max_depth is reached)
+    int max_depth; // 0 for MAX_SEARCH_DEPTH
+    long max_nodes; // 0 for no limit
+
+    // While this is true the clock doesn't run: the search keeps going until it's set to false, and only then does the time
+    // budget start. Used to think on the opponent's time. NULL if the search never waits like that.
+    const std::atomic<bool> *pondering;
+    int max_ponder_ms; // gives up if it's still pondering after this long. 0 for no limit
+
+    // NULL to search without a transposition table. Several searches can share one, which is how they help each other
+    TranspositionTable *table;
+
+    // NULL for none. Checked after the transposition table, for positions other games' searches already looked at
+    EvalCache *shared_cache;
+
+    // if not NULL, nodes are added to it as they're searched, to count the nodes of several threads searching together
+    std::atomic<long> *node_counter;
+};
+
+// called after every iteration that finishes, with what's known so far
+typedef std::function<void(const SearchResult &result)> SearchProgress;
+
+// Searches the position for the given player within the limits, or until stop becomes true. The game passed in is left
+// untouched.
+SearchResult search_position(const Game &game, char player_color, const SearchLimits &limits, const std::atomic<bool> &stop,
+    const SearchProgress &progress = nullptr);
+
+// Searches the position for the given player for up to time_budget_ms milliseconds, or until stop becomes true.
+// The game passed in is left untouched.
+SearchResult search_position(const Game &game, char player_color, int time_budget_ms, const std::atomic<bool> &stop);
+
+#endif // ENGINE_H
@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "engine_pool.h"
+
+PonderBudget::PonderBudget(int engine_threads, int percent)
+    : ms_per_ms(engine_threads * percent / 100.0), last_refill(std::chrono::steady_clock::now()){
+    // a few seconds of it can build up, so a burst of games that all start pondering at once isn't starved
+    max_available_ms = ms_per_ms * 5000;
+    available_ms = max_available_ms;
+}
+
+// must be called with the mutex held
+void PonderBudget::refill(){
+    auto now = std::chrono::steady_clock::now();
+    double elapsed_ms = std::chrono::duration<double, std::milli>(now - last_refill).count();
+    last_refill = now;
+    available_ms += elapsed_ms * ms_per_ms;
+    if (available_ms > max_available_ms)
+        available_ms = max_available_ms;
+}
+
+int PonderBudget::acquire(int max_ms){
+    std::lock_guard<std::mutex> lock(mutex);
+    refill();
+    int granted = (available_ms < max_ms) ? (int)available_ms : max_ms;
+    if (granted < 1)
+        return 0;
+    available_ms -= granted;
+    return granted;
+}
+
+void PonderBudget::release(int unused_ms){
+    std::lock_guard<std::mutex> lock(mutex);
+    refill();
+    available_ms += unused_ms;
+    if (available_ms > max_available_ms)
+        available_ms = max_available_ms;
+}
+
+EnginePool::EnginePool(int threads, int hash_mb, PonderBudget *ponder_budget, EvalCache *shared_cache)
+    : use_table(hash_mb > 0), ponder_budget(ponder_budget), shared_cache(shared_cache), busy_threads(0), next_job_id(1), shutting_down(false),
+      read_fd(-1), write_fd(-1){
+    if (use_table){
+        table.resize(hash_mb);
+        table.new_search();
+    }
+
+#ifdef __linux__
+    read_fd = write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (read_fd < 0)
+        perror("eventfd() error");
+#elif !defined(_WIN32)
+    int fds[2];
+    if (pipe(fds) == 0){
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        read_fd = fds[0];
+        write_fd = fds[1];
+    } else {
+        perror("pipe() error");
+    }
+#endif
+
+    for (int i = 0; i < threads; i++)
+        this->threads.emplace_back(&EnginePool::worker, this);
+}
+
+EnginePool::~EnginePool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shutting_down = true;
+        for (auto &entry : jobs)
+            entry.second->stop = true;
+    }
+    job_available.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+
+#ifndef _WIN32
+    if (read_fd >= 0)
+        close(read_fd);
+    if (write_fd >= 0 && write_fd != read_fd)
+        close(write_fd);
+#endif
+}
+
+int EnginePool::submit(const Game &game, char player_color, int time_budget_ms){
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->game = game;
+    job->player_color = player_color;
+    job->time_budget_ms = time_budget_ms;
+    job->max_ponder_ms = 0;
+    job->stop = false;
+    job->pondering = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job->id = next_job_id++;
+        jobs[job->id] = job;
+        queue.push_back(job);
+
+        // A normal search shouldn't wait behind pondering. If every thread is busy (or promised to a queued job), stop a
+        // ponder job to make room. It loses at most its unfinished iteration, since the rest is in the table.
+        if (busy_threads + (int)queue.size() > (int)threads.size()){
+            for (std::shared_ptr<Job> &ponder : running_ponders){
+                if (!ponder->stop && ponder->pondering){
+                    ponder->stop = true;
+                    break;
+                }
+            }
+        }
+    }
+    job_available.notify_one();
+    return job->id;
+}
+
+int EnginePool::submit_ponder(const Game &game, char player_color, int time_budget_ms, int max_ponder_ms){
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->game = game;
+    job->player_color = player_color;
+    job->time_budget_ms = time_budget_ms;
+    job->max_ponder_ms = max_ponder_ms;
+    job->stop = false;
+    job->pondering = true;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job->id = next_job_id++;
+        jobs[job->id] = job;
+        ponder_queue.push_back(job);
+    }
+    job_available.notify_one();
+    return job->id;
+}
+
+bool EnginePool::ponderhit(int job_id){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(job_id);
+    if (it == jobs.end() || it->second->stop)
+        return false;
+
+    std::shared_ptr<Job> job = it->second;
+    job->ponderhit_time = std::chrono::steady_clock::now();
+    job->pondering = false;
+
+    // one that never got a thread is a normal job now, and waits with the others
+    auto queued = std::find(ponder_queue.begin(), ponder_queue.end(), job);
+    if (queued != ponder_queue.end()){
+        ponder_queue.erase(queued);
+        queue.push_back(job);
+        job_available.notify_one();
+    }
+    return true;
+}
+
+bool EnginePool::expected_reply(const Game &game, char player_color, Move &reply){
+    TableEntry entry;
+    Game position = game;
+    if (!use_table || !table.probe(position.position_key(), entry) || !entry.has_move)
+        return false;
+    std::vector<Move> moves;
+    position.generate_moves(player_color, moves);
+    for (const Move &m : moves){
+        if (m.from_row == entry.best_move.from_row && m.from_col == entry.best_move.from_col && m.to_row == entry.best_move.to_row
+            && m.to_col == entry.best_move.to_col && m.promotion == entry.best_move.promotion){
+            reply = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+void EnginePool::cancel(int job_id){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(job_id);
+    if (it == jobs.end())
+        return; // already completed
+
+    std::shared_ptr<Job> job = it->second;
+    job->stop = true;
+
+    // a job that's still queued will never reach a thread, so complete it here
+    auto queued = std::find(queue.begin(), queue.end(), job);
+    auto ponder_queued = std::find(ponder_queue.begin(), ponder_queue.end(), job);
+    if (queued != queue.end() || ponder_queued != ponder_queue.end()){
+        if (queued != queue.end())
+            queue.erase(queued);
+        else
+            ponder_queue.erase(ponder_queued);
+        jobs.erase(it);
+        EngineCompletion completion;
+        completion.job_id = job_id;
+        completion.cancelled = true;
+        completion.result = SearchResult(); // no move, zero nodes
+        completions.push_back(completion);
+        signal_completion();
+    }
+}
+
+bool EnginePool::poll_completion(EngineCompletion &completion){
+    std::lock_guard<std::mutex> lock(mutex);
+    if (completions.empty())
+        return false;
+    completion = completions.front();
+    completions.pop_front();
+
+    // once the queue is empty, drain the notify fd so it stops showing as readable
+#ifndef _WIN32
+    if (completions.empty() && read_fd >= 0){
+        char drain[64];
+        while (read(read_fd, drain, sizeof(drain)) > 0);
+    }
+#endif
+    return true;
+}
+
+int EnginePool::notify_fd(){
+    return read_fd;
+}
+
+// must be called with the mutex held, right after pushing a completion
+void EnginePool::signal_completion(){
+#ifdef __linux__
+    uint64_t one = 1;
+    if (write_fd >= 0 && write(write_fd, &one, sizeof(one)) < 0)
+        perror("eventfd write error");
+#elif !defined(_WIN32)
+    char one = 1;
+    if (write_fd >= 0 && write(write_fd, &one, 1) < 0)
+        perror("pipe write error");
+#endif
+}
+
+void EnginePool::worker(){
+    while (1){
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_available.wait(lock, [this]{ return shutting_down || !queue.empty() || !ponder_queue.empty(); });
+            if (shutting_down)
+                return;
+            // normal searches always go first
+            if (!queue.empty()){
+                job = queue.front();
+                queue.pop_front();
+            } else {
+                job = ponder_queue.front();
+                ponder_queue.pop_front();
+                running_ponders.push_back(job);
+            }
+            busy_threads++;
+        }
+
+        run_job(job);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        busy_threads--;
+        running_ponders.erase(std::remove(running_ponders.begin(), running_ponders.end(), job), running_ponders.end());
+    }
+}
+
+void EnginePool::run_job(std::shared_ptr<Job> job){
+    SearchLimits limits;
+    limits.time_budget_ms = job->time_budget_ms > 0 ? job->time_budget_ms : 1;
+    limits.max_depth = 0;
+    limits.max_nodes = 0;
+    limits.pondering = &job->pondering;
+    limits.max_ponder_ms = 0;
+    limits.table = use_table ? &table : NULL;
+    limits.shared_cache = shared_cache;
+    limits.node_counter = NULL;
+
+    // pondering takes its time out of the budget up front, and gives back whatever it didn't use
+    int granted_ms = 0;
+    auto start = std::chrono::steady_clock::now();
+    if (job->pondering){
+        granted_ms = ponder_budget != NULL ? ponder_budget->acquire(job->max_ponder_ms) : job->max_ponder_ms;
+        limits.max_ponder_ms = granted_ms;
+        if (granted_ms == 0){
+            // the budget is spent, so skip it. ponderhit() doesn't take a stopped job, so the caller will submit a normal one
+            std::lock_guard<std::mutex> lock(mutex);
+            if (job->pondering)
+                job->stop = true;
+        }
+    }
+
+    SearchResult result = SearchResult();
+    if (!job->stop){
+        if (!job->pondering && use_table)
+            table.age();
+        result = search_position(job->game, job->player_color, limits, job->stop);
+    }
+
+    if (granted_ms > 0 && ponder_budget != NULL){
+        std::lock_guard<std::mutex> lock(mutex);
+        auto ponder_end = job->pondering ? std::chrono::steady_clock::now() : job->ponderhit_time;
+        int used_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(ponder_end - start).count();
+        if (used_ms < granted_ms)
+            ponder_budget->release(granted_ms - used_ms);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.erase(job->id);
+    EngineCompletion completion;
+    completion.job_id = job->id;
+    completion.cancelled = job->stop;
+    completion.result = result;
+    completions.push_back(completion);
+    signal_completion();
+}
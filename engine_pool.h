@@ -0,0 +1,139 @@
+#ifndef ENGINE_POOL_H
+#define ENGINE_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "game.h"
+#include "engine.h"
+#include "transposition.h"
+
+// A pool of threads dedicated to running the bot's searches, so a bot that's thinking never holds up the network loop.
+// The network loop submits (position, time budget) jobs and goes straight back to serving sockets. When a search finishes,
+// its result is put on a completion queue and the pool's notify fd becomes readable, so the network loop can wait on it
+// alongside its sockets and collect the result with poll_completion().
+
+// A job can be cancelled at any point (i.e. when its player disconnects or resigns). A job that hasn't started yet is dropped,
+// and a running search stops at its next clock check. Either way a completion with cancelled set is still delivered, so
+// every submitted job gets exactly one completion.
+
+// The pool can also ponder: search the position after the reply it expects from the opponent while the opponent is still
+// thinking. If the opponent plays that reply, ponderhit() turns the ponder job into a normal search whose time budget starts
+// then, so the bot keeps the tree it already searched. If not, the ponder job is cancelled, but whatever it stored in the
+// pool's transposition table still helps the real search. Ponder jobs only get threads that no normal search is waiting for,
+// a normal search that finds every thread busy stops a ponder job to make room, and the time they spend is capped by a
+// PonderBudget shared by every pool in the process.
+
+// Lets pondering use a set share of the engine threads' CPU time, across every pool that shares it. The share builds up over
+// time (up to a few seconds worth), and every ponder job takes its time out of it before it starts and gives back what it
+// didn't use. When it's spent, ponder jobs are skipped until it builds up again.
+class PonderBudget {
+    public:
+        // percent of engine_threads threads' time can go to pondering
+        PonderBudget(int engine_threads, int percent);
+
+        // takes up to max_ms milliseconds of pondering. Returns how many were granted, which is 0 if the budget is spent
+        int acquire(int max_ms);
+
+        // gives back the part of a grant that wasn't used
+        void release(int unused_ms);
+
+    private:
+        void refill();
+
+        std::mutex mutex;
+        double available_ms;
+        double ms_per_ms; // how much pondering time builds up per millisecond
+        double max_available_ms;
+        std::chrono::steady_clock::time_point last_refill;
+};
+
+struct EngineCompletion {
+    int job_id;
+    bool cancelled;
+    SearchResult result;
+};
+
+class EnginePool {
+    public:
+        // Starts the given number of search threads, which share a transposition table of hash_mb megabytes (none if it's 0).
+        // With a ponder budget, ponder jobs are capped by it; without one they're capped only by max_ponder_ms. The searches
+        // also use the shared eval cache, if there is one (see eval_cache.h).
+        EnginePool(int threads, int hash_mb = 0, PonderBudget *ponder_budget = NULL, EvalCache *shared_cache = NULL);
+
+        // cancels whatever is still running and joins the threads
+        ~EnginePool();
+
+        EnginePool(const EnginePool&) = delete;
+        EnginePool& operator=(const EnginePool&) = delete;
+
+        // queues a search for the given player in the given position, and returns an id for the job
+        int submit(const Game &game, char player_color, int time_budget_ms);
+
+        // Queues a search that ponders the given position (the one after the opponent's expected reply) for up to
+        // max_ponder_ms milliseconds. Once ponderhit() is called it searches for time_budget_ms more, like a submitted job.
+        int submit_ponder(const Game &game, char player_color, int time_budget_ms, int max_ponder_ms);
+
+        // The opponent played the expected reply: the ponder job carries on as a normal search, and its completion is the
+        // bot's move. Returns false if the ponder job has already finished or been stopped, in which case it's up to the
+        // caller to submit a normal search.
+        bool ponderhit(int job_id);
+
+        // Looks up the reply the bot expects the given player to make in this position, from the best moves the searches
+        // stored in the table. Returns false if there isn't a legal one.
+        bool expected_reply(const Game &game, char player_color, Move &reply);
+
+        // cancels a job if it hasn't finished yet
+        void cancel(int job_id);
+
+        // takes one finished job off the completion queue. Returns false if there isn't one
+        bool poll_completion(EngineCompletion &completion);
+
+        // readable whenever the completion queue isn't empty (an eventfd on Linux, the read end of a pipe on other POSIX
+        // systems). -1 on Windows, where callers have to poll_completion() on a timer instead
+        int notify_fd();
+
+    private:
+        struct Job {
+            int id;
+            Game game;
+            char player_color;
+            int time_budget_ms;
+            int max_ponder_ms;
+            std::atomic<bool> stop;
+            std::atomic<bool> pondering; // a ponder job that hasn't had its ponderhit yet
+            std::chrono::steady_clock::time_point ponderhit_time;
+        };
+
+        void worker();
+        void run_job(std::shared_ptr<Job> job);
+        void signal_completion();
+
+        std::vector<std::thread> threads;
+        TranspositionTable table;
+        bool use_table;
+        PonderBudget *ponder_budget;
+        EvalCache *shared_cache;
+
+        std::mutex mutex;
+        std::condition_variable job_available;
+        std::deque<std::shared_ptr<Job>> queue; // jobs waiting for a thread
+        std::deque<std::shared_ptr<Job>> ponder_queue; // ponder jobs waiting for a thread nothing in queue needs
+        std::vector<std::shared_ptr<Job>> running_ponders; // ponder jobs on a thread, which a normal job can stop
+        int busy_threads;
+        std::unordered_map<int, std::shared_ptr<Job>> jobs; // every job that hasn't completed yet, by id
+        std::deque<EngineCompletion> completions;
+        int next_job_id;
+        bool shutting_down;
+
+        int read_fd, write_fd; // the same eventfd twice on Linux, the two ends of a pipe elsewhere
+};
+
+#endif // ENGINE_POOL_H
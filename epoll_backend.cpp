@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <vector>
+
+#include "net.h"
+#include "backend.h"
+
+// The epoll backend: sockets are non-blocking, epoll_wait() says which ones are ready, and every ready socket is drained
+// with recv() and filled with send() until they'd block.
+
+#define MAX_EVENTS 256
+#define RECV_CHUNK 65536
+
+struct EpollLoop {
+    int epfd;
+    Shard *shard;
+    long syscalls; // every epoll_wait(), recv(), send() and epoll_ctl() made, for comparing backends
+};
+
+// epoll_data for the fds that aren't connections. Connections use their Connection pointer
+static char LISTEN_TAG, RESUME_TAG, ENGINE_TAG, TIMER_TAG, WAKE_TAG;
+
+static void update_events(EpollLoop &loop, Connection *c, bool want_write){
+    if (c->want_write == want_write)
+        return;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | (want_write ? (uint32_t)EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(loop.epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    loop.syscalls++;
+    c->want_write = want_write;
+}
+
+static void close_connection(EpollLoop &loop, Connection *c){
+    epoll_ctl(loop.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    net_close(c->fd);
+    loop.syscalls += 2;
+    loop.shard->close_connection(c);
+}
+
+// Sends as much of a connection's queued output as the socket will take. If the socket fills up, EPOLLOUT is turned on
+// so the rest goes out when there's room again. A connection that isn't reading what it's sent is closed instead
+static void flush_connection(EpollLoop &loop, Connection *c){
+    if (c->too_slow){
+        close_connection(loop, c);
+        return;
+    }
+    while (c->out_offset < c->outbuf.size()){
+        ssize_t n;
+        {
+            TimelineSpan span(TimelineSend, c->fd);
+            n = send(c->fd, c->outbuf.data() + c->out_offset, c->outbuf.size() - c->out_offset, MSG_NOSIGNAL);
+            span.arg = (n > 0) ? n : 0;
+        }
+        loop.syscalls++;
+        if (n < 0){
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                update_events(loop, c, true);
+                return;
+            }
+            close_connection(loop, c);
+            return;
+        }
+        c->out_offset += n;
+    }
+    loop.shard->output_sent(c);
+    update_events(loop, c, false);
+    if (c->close_after_flush){
+        shutdown(c->fd, SHUT_WR);
+        close_connection(loop, c);
+    }
+}
+
+static void accept_connections(EpollLoop &loop, socket_t listen_fd, bool resuming){
+    while (1){
+        socket_t fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        loop.syscalls++;
+        if (fd == INVALID_SOCKET){
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                printf("[shard %d] accept() error: %d\n", loop.shard->get_index(), errno);
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        Connection *c = loop.shard->open_connection(fd, resuming);
+        if (c == NULL){
+            net_close(fd);
+            continue;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        epoll_ctl(loop.epfd, EPOLL_CTL_ADD, fd, &ev);
+        loop.syscalls += 2;
+    }
+}
+
+// Reads everything available on a connection. Returns false once the connection has been closed
+static bool read_connection(EpollLoop &loop, Connection *c, char *scratch){
+    while (1){
+        ssize_t n;
+        {
+            TimelineSpan span(TimelineRecv, c->fd);
+            n = recv(c->fd, scratch, RECV_CHUNK, 0);
+            span.arg = (n > 0) ? n : 0;
+        }
+        loop.syscalls++;
+        if (n > 0){
+            loop.shard->receive(c, scratch, (int)n);
+            if (c->closed)
+                return false;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (n < 0 && errno == EINTR)
+            continue;
+        close_connection(loop, c);
+        return false;
+    }
+}
+
+// Sends everything the shard queued while handling a batch of events. A flush that fails closes its connection, which can
+// queue a frame for the opponent, so the list can still grow while it's walked
+static void flush_pending(EpollLoop &loop){
+    Shard &shard = *loop.shard;
+    for (size_t i = 0; i < shard.pending_writes.size(); i++){
+        Connection *c = shard.pending_writes[i];
+        c->write_pending = false;
+        if (!c->closed)
+            flush_connection(loop, c);
+    }
+    shard.pending_writes.clear();
+    shard.release_closed();
+}
+
+// starts watching a connection the shard adopted from another server
+static void watch_connection(EpollLoop &loop, Connection *c){
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = c;
+    epoll_ctl(loop.epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    loop.syscalls++;
+}
+
+void run_epoll_shard(int index, const ServerOptions &options, ShardControl &control){
+    char thread_name[32];
+    snprintf(thread_name, sizeof(thread_name), "shard %d (epoll)", index);
+    timeline_name_thread(thread_name);
+
+    const ShardHandoff *adopt = control.adopt;
+    // an adopting shard listens on the sockets it was handed
+    socket_t listen_fd = (adopt != NULL) ? adopt->fds[0] : net_listen(options.port, true);
+    if (listen_fd == INVALID_SOCKET || !net_set_nonblocking(listen_fd)){
+        printf("[shard %d] Couldn't listen on port %s.\n", index, options.port);
+        exit(1);
+    }
+
+    socket_t resume_fd = INVALID_SOCKET;
+    if (adopt != NULL && adopt->header.listen_fds > 1){
+        resume_fd = adopt->fds[1];
+    } else if (options.shard_config.state_dir != NULL || options.gateway){
+        char resume_port[16];
+        snprintf(resume_port, sizeof(resume_port), "%d", options.resume_port + index);
+        resume_fd = net_listen(resume_port, false);
+        if (resume_fd == INVALID_SOCKET || !net_set_nonblocking(resume_fd)){
+            printf("[shard %d] Couldn't listen on port %s.\n", index, resume_port);
+            exit(1);
+        }
+    }
+
+    Shard shard(index, options.shard_config, adopt);
+    EpollLoop loop;
+    loop.epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop.shard = &shard;
+    loop.syscalls = 0;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &LISTEN_TAG;
+    epoll_ctl(loop.epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = &WAKE_TAG;
+    epoll_ctl(loop.epfd, EPOLL_CTL_ADD, control.wake_fd, &ev);
+    if (shard.engine_fd() >= 0){
+        ev.data.ptr = &ENGINE_TAG;
+        epoll_ctl(loop.epfd, EPOLL_CTL_ADD, shard.engine_fd(), &ev);
+    }
+    if (resume_fd != INVALID_SOCKET){
+        ev.data.ptr = &RESUME_TAG;
+        epoll_ctl(loop.epfd, EPOLL_CTL_ADD, resume_fd, &ev);
+    }
+    if (shard.timer_fd() >= 0){
+        ev.data.ptr = &TIMER_TAG;
+        epoll_ctl(loop.epfd, EPOLL_CTL_ADD, shard.timer_fd(), &ev);
+    }
+
+    // A new server's shard watches the copied connections straight away, which reads nothing from them while the old shard
+    // is still serving them, so only connections opened since the copy are left to add once the old shard has stopped
+    for (Connection *c : shard.adopted)
+        watch_connection(loop, c);
+    shard.adopted.clear();
+    if (adopt != NULL){
+        control.finish();
+        control.wait_answer();
+        std::vector<socket_t> dropped;
+        shard.adopt_final(*control.adopt_final, dropped);
+        // this process's copies of closed connections have to come off the epoll set by hand, since the old server's
+        // copies keep the sockets open
+        for (socket_t fd : dropped){
+            epoll_ctl(loop.epfd, EPOLL_CTL_DEL, fd, NULL);
+            net_close(fd);
+        }
+        for (Connection *c : shard.adopted)
+            watch_connection(loop, c);
+        shard.adopted.clear();
+        flush_pending(loop);
+        control.started_ns = handoff_clock_ns();
+        control.finish();
+    }
+
+    std::vector<char> scratch(RECV_CHUNK);
+    struct epoll_event events[MAX_EVENTS];
+    bool running = true;
+    bool copying = false;
+    while (running){
+        // while copying for a handoff, the loop comes back round without waiting to copy the next chunk
+        int n = epoll_wait(loop.epfd, events, MAX_EVENTS, shard.copying() ? 0 : -1);
+        loop.syscalls++;
+        if (n < 0){
+            if (errno == EINTR)
+                continue;
+            printf("[shard %d] epoll_wait() error: %d\n", index, errno);
+            break;
+        }
+
+        shard.begin_batch(n == MAX_EVENTS);
+        ShardRequest request = NoRequest;
+        for (int i = 0; i < n; i++){
+            void *tag = events[i].data.ptr;
+            if (tag == &LISTEN_TAG){
+                accept_connections(loop, listen_fd, false);
+            } else if (tag == &RESUME_TAG){
+                accept_connections(loop, resume_fd, true);
+            } else if (tag == &ENGINE_TAG){
+                shard.handle_engine_completions();
+            } else if (tag == &TIMER_TAG){
+                shard.handle_timer();
+            } else if (tag == &WAKE_TAG){
+                request = control.take_request();
+            } else {
+                Connection *c = (Connection*)tag;
+                if (c->closed)
+                    continue; // closed earlier in this batch
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                    if (!read_connection(loop, c, scratch.data()))
+                        continue;
+                }
+                if (events[i].events & EPOLLOUT)
+                    flush_connection(loop, c);
+            }
+        }
+
+        shard.end_batch();
+        flush_pending(loop);
+
+        if (copying && !shard.copying()){
+            copying = false;
+            control.finish();
+        }
+        if (request == StopShard){
+            running = false;
+        } else if (request == CopyShard){
+            ShardHandoff &copy = control.copy;
+            copy.header.listen_fds = (resume_fd != INVALID_SOCKET) ? 2 : 1;
+            copy.fds.push_back(listen_fd);
+            if (resume_fd != INVALID_SOCKET)
+                copy.fds.push_back(resume_fd);
+            shard.start_copy(copy);
+            copying = true;
+        } else if (request == HandOffShard){
+            // epoll only ever reports readiness, so nothing is in flight on the sockets between two batches
+            uint64_t stopped_ns = handoff_clock_ns();
+            shard.export_final(control.copy, control.final);
+            control.final.header.stopped_ns = stopped_ns;
+            control.finish();
+            if (control.wait_answer()){
+                shard.handed_over();
+                running = false;
+            }
+        }
+    }
+
+    long frames = shard.frames_received + shard.frames_queued;
+    printf("[shard %d] epoll: %ld syscalls for %ld frames (%.2f per frame)\n", index, loop.syscalls, frames,
+        frames ? (double)loop.syscalls / frames : 0.0);
+    // after a handoff, this only closes this process's copies of the sockets
+    close(loop.epfd);
+    net_close(listen_fd);
+    if (resume_fd != INVALID_SOCKET)
+        net_close(resume_fd);
+}
@@ -0,0 +1,142 @@
+#include <cstdio>
+#include <cctype>
+
+#include "eval.h"
+
+// Material values, in the order P N B R Q K. The king's value only has to be large enough that losing it outweighs
+// everything else on the board, since capturing the king is what ends the game.
+static int piece_values[6] = {100, 320, 330, 500, 900, 20000};
+
+// Piece-square tables, in the order P N B R Q K. Row 0 is rank 8 and row 7 is rank 1, from white's point of view.
+static int piece_square_tables[6][8][8] = {
+    { // pawn
+        {  0,  0,  0,  0,  0,  0,  0,  0},
+        { 50, 50, 50, 50, 50, 50, 50, 50},
+        { 10, 10, 20, 30, 30, 20, 10, 10},
+        {  5,  5, 10, 25, 25, 10,  5,  5},
+        {  0,  0,  0, 20, 20,  0,  0,  0},
+        {  5, -5,-10,  0,  0,-10, -5,  5},
+        {  5, 10, 10,-20,-20, 10, 10,  5},
+        {  0,  0,  0,  0,  0,  0,  0,  0}
+    },
+    { // knight
+        {-50,-40,-30,-30,-30,-30,-40,-50},
+        {-40,-20,  0,  0,  0,  0,-20,-40},
+        {-30,  0, 10, 15, 15, 10,  0,-30},
+        {-30,  5, 15, 20, 20, 15,  5,-30},
+        {-30,  0, 15, 20, 20, 15,  0,-30},
+        {-30,  5, 10, 15, 15, 10,  5,-30},
+        {-40,-20,  0,  5,  5,  0,-20,-40},
+        {-50,-40,-30,-30,-30,-30,-40,-50}
+    },
+    { // bishop
+        {-20,-10,-10,-10,-10,-10,-10,-20},
+        {-10,  0,  0,  0,  0,  0,  0,-10},
+        {-10,  0,  5, 10, 10,  5,  0,-10},
+        {-10,  5,  5, 10, 10,  5,  5,-10},
+        {-10,  0, 10, 10, 10, 10,  0,-10},
+        {-10, 10, 10, 10, 10, 10, 10,-10},
+        {-10,  5,  0,  0,  0,  0,  5,-10},
+        {-20,-10,-10,-10,-10,-10,-10,-20}
+    },
+    { // rook
+        {  0,  0,  0,  0,  0,  0,  0,  0},
+        {  5, 10, 10, 10, 10, 10, 10,  5},
+        { -5,  0,  0,  0,  0,  0,  0, -5},
+        { -5,  0,  0,  0,  0,  0,  0, -5},
+        { -5,  0,  0,  0,  0,  0,  0, -5},
+        { -5,  0,  0,  0,  0,  0,  0, -5},
+        { -5,  0,  0,  0,  0,  0,  0, -5},
+        {  0,  0,  0,  5,  5,  0,  0,  0}
+    },
+    { // queen
+        {-20,-10,-10, -5, -5,-10,-10,-20},
+        {-10,  0,  0,  0,  0,  0,  0,-10},
+        {-10,  0,  5,  5,  5,  5,  0,-10},
+        { -5,  0,  5,  5,  5,  5,  0, -5},
+        {  0,  0,  5,  5,  5,  5,  0, -5},
+        {-10,  5,  5,  5,  5,  5,  0,-10},
+        {-10,  0,  5,  0,  0,  0,  0,-10},
+        {-20,-10,-10, -5, -5,-10,-10,-20}
+    },
+    { // king
+        {-30,-40,-40,-50,-50,-40,-40,-30},
+        {-30,-40,-40,-50,-50,-40,-40,-30},
+        {-30,-40,-40,-50,-50,-40,-40,-30},
+        {-30,-40,-40,-50,-50,-40,-40,-30},
+        {-20,-30,-30,-40,-40,-30,-30,-20},
+        {-10,-20,-20,-20,-20,-20,-20,-10},
+        { 20, 20,  0,  0,  0,  0, 20, 20},
+        { 20, 30, 10,  0,  0, 10, 30, 20}
+    }
+};
+
+// maps a piece type character to its index in the weight arrays, or -1 if it isn't a piece
+static int piece_index(char type){
+    switch (type){
+        case 'P': return 0;
+        case 'N': return 1;
+        case 'B': return 2;
+        case 'R': return 3;
+        case 'Q': return 4;
+        case 'K': return 5;
+        default: return -1;
+    }
+}
+
+int piece_square_value(char color, char type, int row, int col){
+    int idx = piece_index(type);
+    if (idx < 0)
+        return 0;
+    if (color == 'W')
+        return piece_values[idx] + piece_square_tables[idx][row][col];
+    else // black pieces read the tables mirrored, so black's back rank (row 0) lines up with white's (row 7)
+        return -(piece_values[idx] + piece_square_tables[idx][7-row][col]);
+}
+
+// reads the next integer from the file, skipping whitespace and '#' comment lines
+static bool read_weight(FILE *f, int &out){
+    int c;
+    while ((c = fgetc(f)) != EOF){
+        if (c == '#'){
+            while ((c = fgetc(f)) != EOF && c != '\n');
+        } else if (!isspace(c)){
+            ungetc(c, f);
+            return fscanf(f, "%d", &out) == 1;
+        }
+    }
+    return false;
+}
+
+bool load_eval_weights(const char *path){
+    FILE *f = fopen(path, "r");
+    if (f == NULL){
+        printf("Could not open eval weights file %s\n", path);
+        return false;
+    }
+
+    // read everything into temporaries first so a malformed file leaves the current weights untouched
+    int values[6];
+    int tables[6][8][8];
+    bool ok = true;
+    for (int i = 0; i < 6 && ok; i++)
+        ok = read_weight(f, values[i]);
+    for (int i = 0; i < 6 && ok; i++)
+        for (int row = 0; row < 8 && ok; row++)
+            for (int col = 0; col < 8 && ok; col++)
+                ok = read_weight(f, tables[i][row][col]);
+    fclose(f);
+
+    if (!ok){
+        printf("Eval weights file %s is malformed, keeping built-in weights\n", path);
+        return false;
+    }
+
+    for (int i = 0; i < 6; i++){
+        piece_values[i] = values[i];
+        for (int row = 0; row < 8; row++)
+            for (int col = 0; col < 8; col++)
+                piece_square_tables[i][row][col] = tables[i][row][col];
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+// Static evaluation used by the bot. The score of a position is the sum, over every piece on the board, of the piece's
+// material value plus a piece-square bonus for the tile it stands on. Scores are in centipawns from white's point of view
+// (positive is good for white, negative is good for black).
+
+// Because the score is a plain sum over tiles, the Game never has to recompute it from scratch: every time a tile
+// of the table is overwritten, the value of the old occupant is subtracted and the value of the new occupant is added
+// (see Game::set_tile). That keeps evaluating a position O(1) no matter how many moves have been made.
+
+// The piece-square tables are laid out exactly like Game's table: row 0 is rank 8 (black's back rank) and row 7 is
+// rank 1 (white's back rank), from white's perspective. Black pieces read the tables mirrored vertically.
+
+// Returns the signed value (positive for white pieces, negative for black pieces) of a piece of the given color ('W' or 'B')
+// and type standing at (row, col). Empty tiles (type ' ') are worth 0.
+int piece_square_value(char color, char type, int row, int col);
+
+// Replaces the built-in weights with ones read from a plain text file. The file holds whitespace separated integers:
+// first the six material values in the order P N B R Q K, then six 8x8 tables in that same piece order, each written
+// row 0 (rank 8) first. Lines starting with '#' are comments. Returns false (and keeps the current weights) if the file
+// can't be read or is malformed.
+// Weights must be loaded before any Game is constructed, since games only update their score incrementally, which is why
+// only uci and tournament take them (with --eval-weights, before they make a game). The server doesn't: its snapshots keep
+// every game's running score, which a restart with other weights would leave wrong.
+bool load_eval_weights(const char *path);
+
+#endif // EVAL_H
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include "eval_cache.h"
+
+#define REFERENCED(bit) (uint8_t)(1 << (bit))
+
+EvalCache::EvalCache(size_t megabytes, int shard_count){
+    this->shard_count = 1;
+    shard_shift = 64;
+    while (this->shard_count * 2 <= shard_count){
+        this->shard_count *= 2;
+        shard_shift--;
+    }
+
+    // the largest power of two buckets per shard that keeps the whole cache within its size
+    size_t bucket_bytes = EVAL_CACHE_WAYS * sizeof(Slot) + 2;
+    size_t buckets = 1;
+    while (buckets * 2 * bucket_bytes * this->shard_count <= megabytes * 1024 * 1024)
+        buckets *= 2;
+
+    shards = new Shard[this->shard_count];
+    for (int i = 0; i < this->shard_count; i++){
+        Shard &shard = shards[i];
+        // calloc, so the kernel only hands over pages as they're first touched
+        shard.slots = static_cast<Slot*>(std::calloc(buckets * EVAL_CACHE_WAYS, sizeof(Slot)));
+        shard.referenced = static_cast<uint8_t*>(std::calloc(buckets, 1));
+        shard.hands = static_cast<uint8_t*>(std::calloc(buckets, 1));
+        if (shard.slots == NULL || shard.referenced == NULL || shard.hands == NULL)
+            throw std::bad_alloc();
+        shard.bucket_count = buckets;
+        shard.lookups = 0;
+        shard.hits = 0;
+        shard.inserts = 0;
+        shard.evictions = 0;
+        for (int b = 0; b < EVAL_CACHE_LATENCY_BUCKETS; b++){
+            shard.lookup_latency[b] = 0;
+            shard.insert_latency[b] = 0;
+        }
+    }
+}
+
+EvalCache::~EvalCache(){
+    for (int i = 0; i < shard_count; i++){
+        std::free(shards[i].slots);
+        std::free(shards[i].referenced);
+        std::free(shards[i].hands);
+    }
+    delete[] shards;
+}
+
+EvalCache::Shard &EvalCache::shard_for(uint64_t key){
+    return shards[shard_shift == 64 ? 0 : key >> shard_shift];
+}
+
+// Timing every operation would cost more than most operations do, so only 1 in 64 on each thread is timed
+static bool sample_latency(){
+    static thread_local unsigned operations = 0;
+    return (++operations & 63) == 0;
+}
+
+static void record_latency(std::atomic<long> *histogram, std::chrono::steady_clock::time_point start){
+    long ns = (long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    int bucket = 0;
+    while (bucket < EVAL_CACHE_LATENCY_BUCKETS - 1 && ns >= (2l << bucket))
+        bucket++;
+    histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+bool EvalCache::lookup(uint64_t key, TableEntry &entry){
+    Shard &shard = shard_for(key);
+    if (!sample_latency())
+        return find(shard, key, entry);
+    auto start = std::chrono::steady_clock::now();
+    bool hit = find(shard, key, entry);
+    record_latency(shard.lookup_latency, start);
+    return hit;
+}
+
+void EvalCache::insert(uint64_t key, int score, int depth, Bound bound, const Move *best_move){
+    Shard &shard = shard_for(key);
+    if (!sample_latency()){
+        store(shard, key, score, depth, bound, best_move);
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    store(shard, key, score, depth, bound, best_move);
+    record_latency(shard.insert_latency, start);
+}
+
+bool EvalCache::find(Shard &shard, uint64_t key, TableEntry &entry){
+    shard.lookups.fetch_add(1, std::memory_order_relaxed);
+    size_t bucket = key & (shard.bucket_count - 1);
+    Slot *slots = &shard.slots[bucket * EVAL_CACHE_WAYS];
+    for (int way = 0; way < EVAL_CACHE_WAYS; way++){
+        uint64_t data = __atomic_load_n(&slots[way].data, __ATOMIC_RELAXED);
+        if (data == 0 || (__atomic_load_n(&slots[way].key_xor_data, __ATOMIC_RELAXED) ^ data) != key)
+            continue;
+        // give the slot its second chance. Checking first keeps hits on a popular position from all writing the same line
+        if (!(__atomic_load_n(&shard.referenced[bucket], __ATOMIC_RELAXED) & REFERENCED(way)))
+            __atomic_fetch_or(&shard.referenced[bucket], REFERENCED(way), __ATOMIC_RELAXED);
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+        unpack_table_entry(data, entry);
+        return true;
+    }
+    return false;
+}
+
+void EvalCache::store(Shard &shard, uint64_t key, int score, int depth, Bound bound, const Move *best_move){
+    shard.inserts.fetch_add(1, std::memory_order_relaxed);
+    size_t bucket = key & (shard.bucket_count - 1);
+    Slot *slots = &shard.slots[bucket * EVAL_CACHE_WAYS];
+
+    // the position's own slot if it has one, otherwise an empty one
+    int victim = -1;
+    int empty = -1;
+    for (int way = 0; way < EVAL_CACHE_WAYS; way++){
+        uint64_t data = __atomic_load_n(&slots[way].data, __ATOMIC_RELAXED);
+        if (data == 0){
+            if (empty < 0)
+                empty = way;
+        } else if ((__atomic_load_n(&slots[way].key_xor_data, __ATOMIC_RELAXED) ^ data) == key){
+            if ((int)((data >> 16) & 0xff) > depth)
+                return;
+            victim = way;
+            break;
+        }
+    }
+    if (victim < 0)
+        victim = empty;
+
+    // The bucket is full: sweep the clock hand, clearing referenced bits, until it reaches a slot that hasn't been hit
+    // since the hand last passed. After one full turn every bit is clear, so this always finds one.
+    if (victim < 0){
+        uint8_t hand = __atomic_load_n(&shard.hands[bucket], __ATOMIC_RELAXED);
+        for (int i = 0; i < 2 * EVAL_CACHE_WAYS && victim < 0; i++){
+            int way = hand % EVAL_CACHE_WAYS;
+            hand++;
+            if (__atomic_load_n(&shard.referenced[bucket], __ATOMIC_RELAXED) & REFERENCED(way))
+                __atomic_fetch_and(&shard.referenced[bucket], (uint8_t)~REFERENCED(way), __ATOMIC_RELAXED);
+            else
+                victim = way;
+        }
+        if (victim < 0)
+            victim = hand % EVAL_CACHE_WAYS; // the bits were set again behind the hand by other threads' hits
+        __atomic_store_n(&shard.hands[bucket], hand, __ATOMIC_RELAXED);
+        shard.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // a new entry has to be hit to earn its second chance
+    __atomic_fetch_and(&shard.referenced[bucket], (uint8_t)~REFERENCED(victim), __ATOMIC_RELAXED);
+    uint64_t data = pack_table_entry(score, depth, bound, best_move);
+    __atomic_store_n(&slots[victim].data, data, __ATOMIC_RELAXED);
+    __atomic_store_n(&slots[victim].key_xor_data, key ^ data, __ATOMIC_RELAXED);
+}
+
+static void append_histogram(std::string &out, const char *name, const long *counts){
+    char line[160];
+    long total = 0;
+    for (int b = 0; b < EVAL_CACHE_LATENCY_BUCKETS; b++){
+        total += counts[b];
+        if (b < EVAL_CACHE_LATENCY_BUCKETS - 1)
+            snprintf(line, sizeof(line), "%s_bucket{le=\"%ld\"} %ld\n", name, 2l << b, total);
+        else
+            snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %ld\n", name, total);
+        out += line;
+    }
+    snprintf(line, sizeof(line), "%s_count %ld\n", name, total);
+    out += line;
+}
+
+std::string EvalCache::format_metrics(){
+    long lookups = 0, hits = 0, inserts = 0, evictions = 0;
+    long lookup_latency[EVAL_CACHE_LATENCY_BUCKETS] = {0}, insert_latency[EVAL_CACHE_LATENCY_BUCKETS] = {0};
+    for (int i = 0; i < shard_count; i++){
+        lookups += shards[i].lookups.load(std::memory_order_relaxed);
+        hits += shards[i].hits.load(std::memory_order_relaxed);
+        inserts += shards[i].inserts.load(std::memory_order_relaxed);
+        evictions += shards[i].evictions.load(std::memory_order_relaxed);
+        for (int b = 0; b < EVAL_CACHE_LATENCY_BUCKETS; b++){
+            lookup_latency[b] += shards[i].lookup_latency[b].load(std::memory_order_relaxed);
+            insert_latency[b] += shards[i].insert_latency[b].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::string out;
+    char line[160];
+    snprintf(line, sizeof(line), "eval_cache_lookups_total %ld\neval_cache_hits_total %ld\neval_cache_hit_ratio %.4f\n",
+        lookups, hits, lookups ? (double)hits / lookups : 0.0);
+    out += line;
+    snprintf(line, sizeof(line), "eval_cache_inserts_total %ld\neval_cache_evictions_total %ld\n", inserts, evictions);
+    out += line;
+    append_histogram(out, "eval_cache_lookup_latency_ns", lookup_latency);
+    append_histogram(out, "eval_cache_insert_latency_ns", insert_latency);
+    return out;
+}
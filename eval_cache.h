@@ -0,0 +1,74 @@
+#ifndef EVAL_CACHE_H
+#define EVAL_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "transposition.h"
+
+// A cache of search results shared by every game in the process. Thousands of games reach the same openings and common
+// middlegame positions, so what one game's bot found about a position (its score, best move and how deep it was searched)
+// saves the next game's bot from searching it again. Each engine pool still has its own transposition table for the search
+// at hand; the cache is only consulted for nodes searched a few plies deep, where the lookup is cheap next to the work it saves.
+
+// The cache is split into shards by the top bits of the key, each with its own memory and counters, so threads working on
+// different positions don't contend on the same cache lines. A key maps to a bucket of four slots in its shard. Reads and
+// writes are lock free: like the transposition table, a slot keeps its key xored with its packed entry, so a slot torn by
+// two writers just misses. When a bucket is full, a new entry evicts with the CLOCK (second chance) policy: every slot has a
+// referenced bit that hits set, and the bucket's clock hand skips (and clears) referenced slots before evicting one. Memory
+// is fixed when the cache is made.
+
+#define EVAL_CACHE_WAYS 4
+#define EVAL_CACHE_LATENCY_BUCKETS 16
+
+class EvalCache {
+    public:
+        // a cache of about megabytes megabytes, split into shard_count shards (rounded down to a power of two)
+        EvalCache(size_t megabytes, int shard_count = 64);
+        ~EvalCache();
+
+        EvalCache(const EvalCache&) = delete;
+        EvalCache& operator=(const EvalCache&) = delete;
+
+        // looks the position up. Returns false if the cache doesn't have it
+        bool lookup(uint64_t key, TableEntry &entry);
+
+        // Adds or updates a position's entry. An entry for the same position is only replaced by one searched at least as
+        // deep, so a quick search never throws away a deep one.
+        void insert(uint64_t key, int score, int depth, Bound bound, const Move *best_move);
+
+        // Writes the counters in the Prometheus text format: lookups, hits, hit rate, inserts, evictions, and the latency of
+        // lookups and inserts (sampled 1 in 64) as histograms.
+        std::string format_metrics();
+
+    private:
+        struct Slot {
+            uint64_t key_xor_data;
+            uint64_t data;
+        };
+
+        // everything one shard owns, aligned so two shards' counters never share a cache line. The slots, referenced bits
+        // and hands are only read and written with atomic builtins
+        struct alignas(64) Shard {
+            Slot *slots; // bucket_count buckets of EVAL_CACHE_WAYS slots
+            uint8_t *referenced; // a bit per slot of each bucket
+            uint8_t *hands; // each bucket's clock hand
+            size_t bucket_count; // a power of two
+
+            std::atomic<long> lookups, hits, inserts, evictions;
+            std::atomic<long> lookup_latency[EVAL_CACHE_LATENCY_BUCKETS]; // counts by power of two nanoseconds
+            std::atomic<long> insert_latency[EVAL_CACHE_LATENCY_BUCKETS];
+        };
+
+        Shard &shard_for(uint64_t key);
+        bool find(Shard &shard, uint64_t key, TableEntry &entry);
+        void store(Shard &shard, uint64_t key, int score, int depth, Bound bound, const Move *best_move);
+
+        Shard *shards;
+        int shard_count;
+        int shard_shift; // 64 - log2(shard_count), to take a key's shard from its top bits
+};
+
+#endif // EVAL_CACHE_H
@@ -1,23 +1,31 @@
+#include <algorithm>
 #include <utility>
 #include <vector>
-#include <string>
 #include <cstring>
-#include <map>
+#include <cstdio>
+#include <cstdlib>
 #include <cmath>
 
 #include "game.h"
 #include "utils.h"
+#include "eval.h"
+
+// how many moves ahead make_moves starts loading a game
+#define BATCH_PREFETCH_DISTANCE 4
 
 // chess board is 8x8 tiles. White is always on bottom, and black is always on top.
-// server will keep track of entire board with a 2d vector of strings. Each of these strings will have a character
-// for the color, a character for the piece type, and a number character for the specific rook it is (needed for castle-ing),
-// (i.e. BK = black king,  WR1 = white rook one). 
+// server will keep track of entire board with a fixed 8x8 array of Pieces. Each Piece has a character for the color and a
+// character for the piece type (i.e. BK = black king, WR = white rook).
 
 // There will also be a dead list for white, and a dead list for black, keeping track of what pieces have been removed from the board.
-// These will be displayed above and below the rendered board
+// These will be displayed above and below the rendered board. A player only has 16 pieces, so each dead list is a fixed array of 16.
 
 // There will be six flags: WK_moved, BK_moved, WR1_moved, WR2_moved, BR1_moved, BR2_moved. These let us know if certain rooks or kings
-// have moved already for castle-ing.
+// have moved already for castle-ing. Rook one is the rook that starts on the a file, and rook two starts on the h file. Since a rook
+// that has left its starting tile can never castle again, the rook flags are set whenever a move starts or ends on a rook's starting tile.
+
+// Nothing in a Game lives on the heap, so a Game is trivially copyable and a few hundred bytes in size. Copying one (i.e. to try a
+// move out) is a single memcpy.
 
 // A king is the peice that initiates a castle. Simply move the king two spaces to the right or left of where it started to perform a castle.
 
@@ -48,73 +56,626 @@
 //      5f) For rooks and kings, set the appropriate flags for their first movements to prevent subsequent castleing
 //      5g) Check if a King was removed. If so, set the appriate black_won or white_won flags.
 //      5h) For pawns, if reaching the other end of the board, return ValidWithReplace, which tells server to prompt the client for a promotion piece.
+//  6) Once the move is complete (after the promotion, if there was one), the game checks whether it has ended in a draw:
+//      6a) Every position is hashed (a zobrist hash of the pieces, the side to move, and the castle-ing flags), and the hashes of the positions
+//          since the last capture, pawn move or castle-ing flag change are kept in a history. None of the positions before such a move
+//          can ever come back, so only that history has to be scanned for a threefold repetition.
+//      6b) A count of the half moves since the last capture or pawn move is kept for the fifty move rule.
+//      6c) The remaining pieces are checked for insufficient material (lone kings, a single minor piece, or bishops all on one color).
+//      6d) If the player to move isn't in check but has no legal moves, the game is a stalemate.
+
+// Random keys for the zobrist hash. Each (piece, tile) pair has a key, and the hash of a position is the xor of the keys of every
+// piece on the table, so moving a piece only takes two xors. The keys are generated once with a fixed seed so hashes are the
+// same from run to run.
+struct ZobristKeys {
+    uint64_t pieces[12][8][8]; // indexed by piece_kind(), row and col
+    uint64_t black_to_move;
+    uint64_t castle_flags[6];
+
+    ZobristKeys(){
+        uint64_t seed = 0x2545F4914F6CDD1DULL;
+        for (int kind = 0; kind < 12; kind++)
+            for (int row = 0; row < 8; row++)
+                for (int col = 0; col < 8; col++)
+                    pieces[kind][row][col] = next(seed);
+        black_to_move = next(seed);
+        for (int i = 0; i < 6; i++)
+            castle_flags[i] = next(seed);
+    }
+
+    // splitmix64
+    static uint64_t next(uint64_t &state){
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+
+static const ZobristKeys zobrist;
 
-Game::Game() : WR1_moved(false), WR2_moved(false), WK_moved(false), BR1_moved(false), BR2_moved(false), BK_moved(false),
-    white_won(false), black_won(false), replace_coordinates({0,0}), white_dead_list_idx(0), black_dead_list_idx(0){
+// all the valid movement vectors for a knight, as (row, col)
+static const int knight_move_vectors[8][2] = {
+    {2,1},{1,2},{-1,2},{-2,1},{-2,-1},{-1,-2},{1,-2},{2,-1}
+};
+
+// what format_table_to_print writes, before the pieces are filled in: two rows of white's dead list, the table with its rank
+// numbers and file letters, and two rows of black's dead list
+static const char PRINTED_BOARD_TEMPLATE[] =
+    "                                           \n"
+    "                                           \n"
+    "  +----+----+----+----+----+----+----+----+\n"
+    "8 |    |    |    |    |    |    |    |    |\n"
+    "  +----+----+----+----+----+----+----+----+\n"
+    "7 |    |    |    |    |    |    |    |    |\n"
+    "  +----+----+----+----+----+----+----+----+\n"
+    "6 |    |    |    |    |    |    |    |    |\n"
+    "  +----+----+----+----+----+----+----+----+\n"
+    "5 |    |    |    |    |    |    |    |    |\n"
+    "  +----+----+----+----+----+----+----+----+\n"
+    "4 |    |    |    |    |    |    |    |    |\n"
+    "  +----+----+----+----+----+----+----+----+\n"
+    "3 |    |    |    |    |    |    |    |    |\n"
+    "  +----+----+----+----+----+----+----+----+\n"
+    "2 |    |    |    |    |    |    |    |    |\n"
+    "  +----+----+----+----+----+----+----+----+\n"
+    "1 |    |    |    |    |    |    |    |    |\n"
+    "  +----+----+----+----+----+----+----+----+\n"
+    "    a    b    c    d    e    f    g    h   \n"
+    "                                           \n"
+    "                                           \n";
+
+// true if (row, col) is a tile of the table
+static bool on_table(int row, int col){
+    return row >= 0 && row < 8 && col >= 0 && col < 8;
+}
+
+// maps a piece to an index from 0 to 11 (white pieces first) for the zobrist keys, or -1 for an empty tile
+static int piece_kind(Piece piece){
+    int color_offset = (piece.color == 'W') ? 0 : 6;
+    switch (piece.type){
+        case 'P': return color_offset + 0;
+        case 'N': return color_offset + 1;
+        case 'B': return color_offset + 2;
+        case 'R': return color_offset + 3;
+        case 'Q': return color_offset + 4;
+        case 'K': return color_offset + 5;
+        default: return -1;
+    }
+}
+
+template <typename Variant>
+BasicGame<Variant>::BasicGame(int start_position) : WR1_moved(false), WR2_moved(false), WK_moved(false), BR1_moved(false), BR2_moved(false), BK_moved(false),
+    white_won(false), black_won(false), replace_row(0), replace_col(0), evaluation(0), side_to_move('W'), hash(0),
+    position_history_len(0), halfmove_clock(0), draw_reason(DrawReason::NoDraw), white_dead_list_idx(0), black_dead_list_idx(0){
     // All moves on the board will be in the format (row, col)
-    table = {
-            {"BR1", "BN", "BB", "BQ", "BK", "BB", "BN", "BR2"},
-            {"BP" , "BP", "BP", "BP", "BP", "BP", "BP", "BP" },
-            {"  " , "  ", "  ", "  ", "  ", "  ", "  ", "  " },
-            {"  " , "  ", "  ", "  ", "  ", "  ", "  ", "  " },
-            {"  " , "  ", "  ", "  ", "  ", "  ", "  ", "  " },
-            {"  " , "  ", "  ", "  ", "  ", "  ", "  ", "  " },
-            {"WP" , "WP", "WP", "WP", "WP", "WP", "WP", "WP" },
-            {"WR1", "WN", "WB", "WQ", "WK", "WB", "WN", "WR2"}
-        };
-
-    knight_move_vectors = {
-        {2,1},{1,2},{-1,2},{-2,1},{-2,-1},{-1,-2},{1,-2},{2,-1}
-    };
-
-    white_dead_list.assign(16,"   ");
-    black_dead_list.assign(16,"   ");
+    char back_rank[8] = {'R', 'N', 'B', 'Q', 'K', 'B', 'N', 'R'};
+    if constexpr (Variant::shuffled_start){
+        chess960_back_rank(start_position, back_rank);
+        // both colors castle from the files their king and rooks start on
+        int rooks = 0;
+        for (int col = 0; col < 8; col++){
+            if (back_rank[col] == 'K')
+                this->king_cols[0] = this->king_cols[1] = col;
+            else if (back_rank[col] == 'R'){
+                this->rook_cols[0][rooks] = this->rook_cols[1][rooks] = col;
+                rooks++;
+            }
+        }
+    } else {
+        (void)start_position;
+    }
+    for (int col = 0; col < 8; col++){
+        table[0][col] = {'B', back_rank[col]};
+        table[1][col] = {'B', 'P'};
+        for (int row = 2; row < 6; row++)
+            table[row][col] = EMPTY_TILE;
+        table[6][col] = {'W', 'P'};
+        table[7][col] = {'W', back_rank[col]};
+    }
+
+    for (int i = 0; i < 16; i++){
+        white_dead_list[i] = EMPTY_TILE;
+        black_dead_list[i] = EMPTY_TILE;
+    }
+
+    // the evaluation and hash are only computed from scratch once. After this, set_tile keeps them up to date
+    for (int row = 0; row < 8; row++){
+        for (int col = 0; col < 8; col++){
+            evaluation += piece_square_value(table[row][col].color, table[row][col].type, row, col);
+            int kind = piece_kind(table[row][col]);
+            if (kind >= 0)
+                hash ^= zobrist.pieces[kind][row][col];
+        }
+    }
+
+    position_history[position_history_len++] = (uint32_t)(position_key() >> 32);
 };
 
-bool Game::get_black_won(){
+template <typename Variant>
+BasicGame<Variant>::BasicGame() : BasicGame(STANDARD_START_POSITION){
+}
+
+// Overwrites a tile of the table, updating the evaluation and hash incrementally by removing the piece that was
+// on the tile and adding the piece replacing it. All writes to the table after construction go through here.
+template <typename Variant>
+void BasicGame<Variant>::set_tile(int row, int col, Piece piece){
+    evaluation -= piece_square_value(table[row][col].color, table[row][col].type, row, col);
+    evaluation += piece_square_value(piece.color, piece.type, row, col);
+
+    int old_kind = piece_kind(table[row][col]);
+    int new_kind = piece_kind(piece);
+    if (old_kind >= 0)
+        hash ^= zobrist.pieces[old_kind][row][col];
+    if (new_kind >= 0)
+        hash ^= zobrist.pieces[new_kind][row][col];
+
+    table[row][col] = piece;
+}
+
+template <typename Variant>
+void BasicGame<Variant>::add_to_dead_list(Piece piece){
+    if (piece.color == 'W' && white_dead_list_idx < 16)
+        white_dead_list[white_dead_list_idx++] = piece;
+    else if (piece.color == 'B' && black_dead_list_idx < 16)
+        black_dead_list[black_dead_list_idx++] = piece;
+}
+
+template <typename Variant>
+void BasicGame<Variant>::update_castle_flags(int row, int col){
+    // the starting files are constants outside of Chess960
+    if (row == 7 && col == this->rook_col('W', 0))
+        WR1_moved = true;
+    else if (row == 7 && col == this->rook_col('W', 1))
+        WR2_moved = true;
+    else if (row == 7 && col == this->king_col('W'))
+        WK_moved = true;
+    else if (row == 0 && col == this->rook_col('B', 0))
+        BR1_moved = true;
+    else if (row == 0 && col == this->rook_col('B', 1))
+        BR2_moved = true;
+    else if (row == 0 && col == this->king_col('B'))
+        BK_moved = true;
+}
+
+template <typename Variant>
+int BasicGame<Variant>::castle_flags(){
+    return (WR1_moved << 0) | (WR2_moved << 1) | (WK_moved << 2) | (BR1_moved << 3) | (BR2_moved << 4) | (BK_moved << 5);
+}
+
+template <typename Variant>
+uint64_t BasicGame<Variant>::position_key(){
+    uint64_t key = hash;
+    if (side_to_move == 'B')
+        key ^= zobrist.black_to_move;
+    int flags = castle_flags();
+    for (int i = 0; i < 6; i++)
+        if (flags & (1 << i))
+            key ^= zobrist.castle_flags[i];
+    return key;
+}
+
+template <typename Variant>
+bool BasicGame<Variant>::get_black_won(){
     return black_won;
 }
 
-bool Game::get_white_won(){
+template <typename Variant>
+bool BasicGame<Variant>::get_white_won(){
     return white_won;
 }
 
-// Takes the table structure and the dead lists and compiles them into a pretty chess table inside the buffer passed in
-void Game::format_table_to_print(char buf[DEFAULT_BUFLEN]){
-    std::vector<std::vector<char>> pretty_table = {
-        {' ',' ',white_dead_list[10].at(0),white_dead_list[10].at(1),' ',' ',white_dead_list[11].at(0),white_dead_list[11].at(1),' ',' ',white_dead_list[12].at(0),white_dead_list[12].at(1),' ',' ',white_dead_list[13].at(0),white_dead_list[13].at(1),' ',' ',white_dead_list[14].at(0),white_dead_list[14].at(1),' ',' ',white_dead_list[15].at(0),white_dead_list[15].at(1),' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ','\n'},
-        {' ',' ',white_dead_list[0].at(0),white_dead_list[0].at(1),' ',' ',white_dead_list[1].at(0),white_dead_list[1].at(1),' ',' ',white_dead_list[2].at(0),white_dead_list[2].at(1),' ',' ',white_dead_list[3].at(0),white_dead_list[3].at(1),' ',' ',white_dead_list[4].at(0),white_dead_list[4].at(1),' ',' ',white_dead_list[5].at(0),white_dead_list[5].at(1),' ',' ',white_dead_list[6].at(0),white_dead_list[6].at(1),' ',' ',white_dead_list[7].at(0),white_dead_list[7].at(1),' ',' ',white_dead_list[8].at(0),white_dead_list[8].at(1),' ',' ',white_dead_list[9].at(0),white_dead_list[9].at(1),' ',' ',' ','\n'},
-        {' ',' ','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','\n'},
-        {'8',' ','|',' ',table[0][0].at(0),table[0][0].at(1),' ','|',' ',table[0][1].at(0),table[0][1].at(1),' ','|',' ',table[0][2].at(0),table[0][2].at(1),' ','|',' ',table[0][3].at(0),table[0][3].at(1),' ','|',' ',table[0][4].at(0),table[0][4].at(1),' ','|',' ',table[0][5].at(0),table[0][5].at(1),' ','|',' ',table[0][6].at(0),table[0][6].at(1),' ','|',' ',table[0][7].at(0),table[0][7].at(1),' ','|','\n'},
-        {' ',' ','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','\n'},
-        {'7',' ','|',' ',table[1][0].at(0),table[1][0].at(1),' ','|',' ',table[1][1].at(0),table[1][1].at(1),' ','|',' ',table[1][2].at(0),table[1][2].at(1),' ','|',' ',table[1][3].at(0),table[1][3].at(1),' ','|',' ',table[1][4].at(0),table[1][4].at(1),' ','|',' ',table[1][5].at(0),table[1][5].at(1),' ','|',' ',table[1][6].at(0),table[1][6].at(1),' ','|',' ',table[1][7].at(0),table[1][7].at(1),' ','|','\n'},
-        {' ',' ','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','\n'},
-        {'6',' ','|',' ',table[2][0].at(0),table[2][0].at(1),' ','|',' ',table[2][1].at(0),table[2][1].at(1),' ','|',' ',table[2][2].at(0),table[2][2].at(1),' ','|',' ',table[2][3].at(0),table[2][3].at(1),' ','|',' ',table[2][4].at(0),table[2][4].at(1),' ','|',' ',table[2][5].at(0),table[2][5].at(1),' ','|',' ',table[2][6].at(0),table[2][6].at(1),' ','|',' ',table[2][7].at(0),table[2][7].at(1),' ','|','\n'},
-        {' ',' ','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','\n'},
-        {'5',' ','|',' ',table[3][0].at(0),table[3][0].at(1),' ','|',' ',table[3][1].at(0),table[3][1].at(1),' ','|',' ',table[3][2].at(0),table[3][2].at(1),' ','|',' ',table[3][3].at(0),table[3][3].at(1),' ','|',' ',table[3][4].at(0),table[3][4].at(1),' ','|',' ',table[3][5].at(0),table[3][5].at(1),' ','|',' ',table[3][6].at(0),table[3][6].at(1),' ','|',' ',table[3][7].at(0),table[3][7].at(1),' ','|','\n'},
-        {' ',' ','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','\n'},
-        {'4',' ','|',' ',table[4][0].at(0),table[4][0].at(1),' ','|',' ',table[4][1].at(0),table[4][1].at(1),' ','|',' ',table[4][2].at(0),table[4][2].at(1),' ','|',' ',table[4][3].at(0),table[4][3].at(1),' ','|',' ',table[4][4].at(0),table[4][4].at(1),' ','|',' ',table[4][5].at(0),table[4][5].at(1),' ','|',' ',table[4][6].at(0),table[4][6].at(1),' ','|',' ',table[4][7].at(0),table[4][7].at(1),' ','|','\n'},
-        {' ',' ','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','\n'},
-        {'3',' ','|',' ',table[5][0].at(0),table[5][0].at(1),' ','|',' ',table[5][1].at(0),table[5][1].at(1),' ','|',' ',table[5][2].at(0),table[5][2].at(1),' ','|',' ',table[5][3].at(0),table[5][3].at(1),' ','|',' ',table[5][4].at(0),table[5][4].at(1),' ','|',' ',table[5][5].at(0),table[5][5].at(1),' ','|',' ',table[5][6].at(0),table[5][6].at(1),' ','|',' ',table[5][7].at(0),table[5][7].at(1),' ','|','\n'},
-        {' ',' ','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','\n'},
-        {'2',' ','|',' ',table[6][0].at(0),table[6][0].at(1),' ','|',' ',table[6][1].at(0),table[6][1].at(1),' ','|',' ',table[6][2].at(0),table[6][2].at(1),' ','|',' ',table[6][3].at(0),table[6][3].at(1),' ','|',' ',table[6][4].at(0),table[6][4].at(1),' ','|',' ',table[6][5].at(0),table[6][5].at(1),' ','|',' ',table[6][6].at(0),table[6][6].at(1),' ','|',' ',table[6][7].at(0),table[6][7].at(1),' ','|','\n'},
-        {' ',' ','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','\n'},
-        {'1',' ','|',' ',table[7][0].at(0),table[7][0].at(1),' ','|',' ',table[7][1].at(0),table[7][1].at(1),' ','|',' ',table[7][2].at(0),table[7][2].at(1),' ','|',' ',table[7][3].at(0),table[7][3].at(1),' ','|',' ',table[7][4].at(0),table[7][4].at(1),' ','|',' ',table[7][5].at(0),table[7][5].at(1),' ','|',' ',table[7][6].at(0),table[7][6].at(1),' ','|',' ',table[7][7].at(0),table[7][7].at(1),' ','|','\n'},
-        {' ',' ','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','-','-','-','-','+','\n'},
-        {' ',' ',' ',' ','a',' ',' ',' ',' ','b',' ',' ',' ',' ','c',' ',' ',' ',' ','d',' ',' ',' ',' ','e',' ',' ',' ',' ','f',' ',' ',' ',' ','g',' ',' ',' ',' ','h',' ',' ',' ','\n'},
-        {' ',' ',black_dead_list[0].at(0),black_dead_list[0].at(1),' ',' ',black_dead_list[1].at(0),black_dead_list[1].at(1),' ',' ',black_dead_list[2].at(0),black_dead_list[2].at(1),' ',' ',black_dead_list[3].at(0),black_dead_list[3].at(1),' ',' ',black_dead_list[4].at(0),black_dead_list[4].at(1),' ',' ',black_dead_list[5].at(0),black_dead_list[5].at(1),' ',' ',black_dead_list[6].at(0),black_dead_list[6].at(1),' ',' ',black_dead_list[7].at(0),black_dead_list[7].at(1),' ',' ',black_dead_list[8].at(0),black_dead_list[8].at(1),' ',' ',black_dead_list[9].at(0),black_dead_list[9].at(1),' ',' ',' ','\n'},
-        {' ',' ',black_dead_list[10].at(0),black_dead_list[10].at(1),' ',' ',black_dead_list[11].at(0),black_dead_list[11].at(1),' ',' ',black_dead_list[12].at(0),black_dead_list[12].at(1),' ',' ',black_dead_list[13].at(0),black_dead_list[13].at(1),' ',' ',black_dead_list[14].at(0),black_dead_list[14].at(1),' ',' ',black_dead_list[15].at(0),black_dead_list[15].at(1),' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' ','\n'}
-    };
-
-    for (int i = 0; i < PRINTED_BOARD_ROWS; i++){
-        for (int j = 0; j < PRINTED_BOARD_COLS; j++){
-            buf[i*PRINTED_BOARD_COLS+j] = pretty_table[i][j];
+template <typename Variant>
+int BasicGame<Variant>::get_evaluation(){
+    return evaluation;
+}
+
+template <typename Variant>
+DrawReason BasicGame<Variant>::get_draw_reason(){
+    return draw_reason;
+}
+
+template <typename Variant>
+char BasicGame<Variant>::get_side_to_move(){
+    return side_to_move;
+}
+
+template <typename Variant>
+Piece BasicGame<Variant>::get_piece(int row, int col){
+    return table[row][col];
+}
+
+template <typename Variant>
+void BasicGame<Variant>::resign(char player_color){
+    if (player_color == 'W')
+        black_won = true;
+    else
+        white_won = true;
+}
+
+template <typename Variant>
+bool BasicGame<Variant>::in_check(char player_color){
+    char opponent = (player_color == 'W') ? 'B' : 'W';
+    for (int row = 0; row < 8; row++){
+        for (int col = 0; col < 8; col++){
+            if (table[row][col].color == player_color && table[row][col].type == 'K')
+                return is_attacked(row, col, opponent);
+        }
+    }
+    return false;
+}
+
+// Returns true if neither player has enough pieces left to ever capture the other's king: lone kings, a king and a single
+// knight or bishop against a lone king, or kings and bishops where every bishop stands on the same color of tile.
+template <typename Variant>
+bool BasicGame<Variant>::insufficient_material(){
+    int minor_pieces = 0;
+    int knights = 0;
+    bool bishop_on_light = false, bishop_on_dark = false;
+    for (int row = 0; row < 8; row++){
+        for (int col = 0; col < 8; col++){
+            char type = table[row][col].type;
+            if (type == 'P' || type == 'R' || type == 'Q')
+                return false;
+            if (type == 'N'){
+                knights++;
+                minor_pieces++;
+            } else if (type == 'B'){
+                minor_pieces++;
+                if ((row + col) % 2 == 0)
+                    bishop_on_light = true;
+                else
+                    bishop_on_dark = true;
+            }
+        }
+    }
+    if (minor_pieces <= 1)
+        return true;
+    // any number of bishops is a draw as long as they all move on the same color
+    return knights == 0 && !(bishop_on_light && bishop_on_dark);
+}
+
+template <typename Variant>
+void BasicGame<Variant>::update_draw_state(){
+    // a draw stands whatever is played after it, which is also what keeps the history from having to grow past 100
+    // reversible half moves
+    if (draw_reason != DrawReason::NoDraw)
+        return;
+
+    // threefold repetition. The history only goes back to the last irreversible move, and only every other entry has the
+    // same player to move as the current position, so this is O(reversible half moves) rather than comparing whole tables.
+    uint32_t key = position_history[position_history_len - 1];
+    int repetitions = 0;
+    for (int i = position_history_len - 1; i >= 0; i -= 2){
+        if (position_history[i] == key)
+            repetitions++;
+    }
+    if (repetitions >= 3){
+        draw_reason = DrawReason::ThreefoldRepetition;
+        return;
+    }
+
+    if (halfmove_clock >= 100){
+        draw_reason = DrawReason::FiftyMoveRule;
+        return;
+    }
+
+    // in King of the Hill a lone king can still win by walking to the center
+    if (!Variant::king_of_the_hill && insufficient_material()){
+        draw_reason = DrawReason::InsufficientMaterial;
+        return;
+    }
+
+    // stalemate: the player to move isn't in check but can't make a move that keeps their king out of check
+    if (!has_legal_move(side_to_move) && !in_check(side_to_move))
+        draw_reason = DrawReason::Stalemate;
+}
+
+// returns true if the tile at (row, col) is attacked by any of the given player's pieces
+template <typename Variant>
+bool BasicGame<Variant>::is_attacked(int row, int col, char by_color){
+    // pawns. White pawns move up the table (towards row 0), so they attack from the row below
+    int pawn_row = (by_color == 'W') ? row + 1 : row - 1;
+    if (pawn_row >= 0 && pawn_row < 8){
+        for (int dc = -1; dc <= 1; dc += 2){
+            int c = col + dc;
+            if (c >= 0 && c < 8 && table[pawn_row][c].color == by_color && table[pawn_row][c].type == 'P')
+                return true;
+        }
+    }
+
+    // knights
+    for (const int *v : knight_move_vectors){
+        int r = row + v[0], c = col + v[1];
+        if (r >= 0 && r < 8 && c >= 0 && c < 8 && table[r][c].color == by_color && table[r][c].type == 'N')
+            return true;
+    }
+
+    // kings
+    for (int dr = -1; dr <= 1; dr++){
+        for (int dc = -1; dc <= 1; dc++){
+            int r = row + dr, c = col + dc;
+            if ((dr != 0 || dc != 0) && r >= 0 && r < 8 && c >= 0 && c < 8 && table[r][c].color == by_color && table[r][c].type == 'K')
+                return true;
+        }
+    }
+
+    // sliding pieces. Walk outwards in each of the 8 directions until hitting a piece
+    for (int dr = -1; dr <= 1; dr++){
+        for (int dc = -1; dc <= 1; dc++){
+            if (dr == 0 && dc == 0)
+                continue;
+            bool diagonal = (dr != 0 && dc != 0);
+            int r = row + dr, c = col + dc;
+            while (r >= 0 && r < 8 && c >= 0 && c < 8){
+                Piece piece = table[r][c];
+                if (!piece.empty()){
+                    if (piece.color == by_color && (piece.type == 'Q' || piece.type == (diagonal ? 'B' : 'R')))
+                        return true;
+                    break;
+                }
+                r += dr;
+                c += dc;
+            }
+        }
+    }
+
+    return false;
+}
+
+template <typename Variant>
+bool BasicGame<Variant>::leaves_king_safe(const Move &move, char player_color){
+    Piece moving = table[move.from_row][move.from_col];
+    Piece captured = table[move.to_row][move.to_col];
+    table[move.to_row][move.to_col] = moving;
+    table[move.from_row][move.from_col] = EMPTY_TILE;
+
+    char opponent = (player_color == 'W') ? 'B' : 'W';
+    bool safe = true;
+    for (int row = 0; row < 8; row++){
+        for (int col = 0; col < 8; col++){
+            if (table[row][col].color == player_color && table[row][col].type == 'K')
+                safe = !is_attacked(row, col, opponent);
+        }
+    }
+
+    table[move.from_row][move.from_col] = moving;
+    table[move.to_row][move.to_col] = captured;
+    return safe;
+}
+
+// Every move the rules make_move enforces allow (so no en passant), before checking whether it leaves the mover's king in
+// check. Castle-ing also isn't allowed out of or through check.
+template <typename Variant>
+template <typename Visit>
+bool BasicGame<Variant>::visit_candidates(char player_color, Visit visit){
+    char opponent = (player_color == 'W') ? 'B' : 'W';
+
+    for (int row = 0; row < 8; row++){
+        for (int col = 0; col < 8; col++){
+            Piece piece = table[row][col];
+            if (piece.color != player_color)
+                continue;
+            char type = piece.type;
+
+            if (type == 'P'){
+                int dir = (player_color == 'W') ? -1 : 1;
+                int start_row = (player_color == 'W') ? 6 : 1;
+                int last_row = (player_color == 'W') ? 0 : 7;
+                Move pawn_moves[4];
+                int pawn_move_count = 0;
+                int r = row + dir;
+                if (r >= 0 && r < 8){
+                    if (table[r][col].empty()){
+                        pawn_moves[pawn_move_count++] = {row, col, r, col, 0};
+                        if (row == start_row && table[r+dir][col].empty())
+                            pawn_moves[pawn_move_count++] = {row, col, r+dir, col, 0};
+                    }
+                    for (int dc = -1; dc <= 1; dc += 2){
+                        int c = col + dc;
+                        if (c >= 0 && c < 8 && table[r][c].color == opponent)
+                            pawn_moves[pawn_move_count++] = {row, col, r, c, 0};
+                    }
+                }
+                for (int i = 0; i < pawn_move_count; i++){
+                    Move m = pawn_moves[i];
+                    if (m.to_row == last_row){
+                        const char promotions[4] = {'Q', 'R', 'B', 'N'};
+                        for (char p : promotions){
+                            m.promotion = p;
+                            if (visit(m))
+                                return true;
+                        }
+                    } else if (visit(m)){
+                        return true;
+                    }
+                }
+            } else if (type == 'N'){
+                for (const int *v : knight_move_vectors){
+                    int r = row + v[0], c = col + v[1];
+                    if (r >= 0 && r < 8 && c >= 0 && c < 8 && table[r][c].color != player_color && visit({row, col, r, c, 0}))
+                        return true;
+                }
+            } else if (type == 'K'){
+                for (int dr = -1; dr <= 1; dr++){
+                    for (int dc = -1; dc <= 1; dc++){
+                        int r = row + dr, c = col + dc;
+                        if ((dr != 0 || dc != 0) && r >= 0 && r < 8 && c >= 0 && c < 8 && table[r][c].color != player_color
+                            && visit({row, col, r, c, 0}))
+                            return true;
+                    }
+                }
+                // castle-ing, with the same flag and collision checks as make_move, plus the king can't castle out of or through check.
+                // Chess960 castles are checked by can_castle_shuffled instead
+                if constexpr (Variant::shuffled_start)
+                    continue;
+                int home_row = (player_color == 'W') ? 7 : 0;
+                bool king_moved = (player_color == 'W') ? WK_moved : BK_moved;
+                bool left_rook_moved = (player_color == 'W') ? WR1_moved : BR1_moved;
+                bool right_rook_moved = (player_color == 'W') ? WR2_moved : BR2_moved;
+                if (row == home_row && col == 4 && !king_moved && !is_attacked(row, 4, opponent)){
+                    if (!left_rook_moved && table[row][3].empty() && table[row][2].empty() && table[row][1].empty()
+                        && !is_attacked(row, 3, opponent) && !is_attacked(row, 2, opponent) && visit({row, 4, row, 2, 0}))
+                        return true;
+                    if (!right_rook_moved && table[row][5].empty() && table[row][6].empty()
+                        && !is_attacked(row, 5, opponent) && !is_attacked(row, 6, opponent) && visit({row, 4, row, 6, 0}))
+                        return true;
+                }
+            } else { // rooks, bishops and queens slide until they hit a piece
+                for (int dr = -1; dr <= 1; dr++){
+                    for (int dc = -1; dc <= 1; dc++){
+                        if (dr == 0 && dc == 0)
+                            continue;
+                        bool diagonal = (dr != 0 && dc != 0);
+                        if ((type == 'R' && diagonal) || (type == 'B' && !diagonal))
+                            continue;
+                        int r = row + dr, c = col + dc;
+                        while (r >= 0 && r < 8 && c >= 0 && c < 8 && table[r][c].color != player_color){
+                            if (visit({row, col, r, c, 0}))
+                                return true;
+                            if (!table[r][c].empty())
+                                break;
+                            r += dr;
+                            c += dc;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Throws out any candidate that leaves the mover's king in check
+template <typename Variant>
+void BasicGame<Variant>::generate_moves(char player_color, std::vector<Move> &moves){
+    // every candidate goes straight into moves, and the ones that leave the king in check are filtered out at the end, so
+    // nothing is allocated once moves has grown to fit
+    moves.clear();
+    visit_candidates(player_color, [&moves](const Move &m){
+        moves.push_back(m);
+        return false;
+    });
+
+    size_t kept = 0;
+    for (size_t i = 0; i < moves.size(); i++){
+        if (leaves_king_safe(moves[i], player_color))
+            moves[kept++] = moves[i];
+    }
+    moves.resize(kept);
+    if constexpr (Variant::shuffled_start){
+        int row = (player_color == 'W') ? 7 : 0;
+        for (int side = 0; side < 2; side++){
+            if (can_castle_shuffled(player_color, side))
+                moves.push_back({row, this->king_col(player_color), row, this->rook_col(player_color, side), 0});
+        }
+    }
+}
+
+// Stops at the first candidate that keeps the king safe, which in most positions is one of the first few looked at
+template <typename Variant>
+bool BasicGame<Variant>::has_legal_move(char player_color){
+    if (visit_candidates(player_color, [this, player_color](const Move &m){ return leaves_king_safe(m, player_color); }))
+        return true;
+    if constexpr (Variant::shuffled_start)
+        return can_castle_shuffled(player_color, 0) || can_castle_shuffled(player_color, 1);
+    return false;
+}
+
+template <typename Variant>
+bool BasicGame<Variant>::can_castle_shuffled(char player_color, int side){
+    char opponent = (player_color == 'W') ? 'B' : 'W';
+    int row = (player_color == 'W') ? 7 : 0;
+    int king_col = this->king_col(player_color);
+    bool king_moved = (player_color == 'W') ? WK_moved : BK_moved;
+    Piece king = table[row][king_col];
+    if (king_moved || king.color != player_color || king.type != 'K')
+        return false;
+    bool rook_moved = (player_color == 'W') ? (side == 0 ? WR1_moved : WR2_moved) : (side == 0 ? BR1_moved : BR2_moved);
+    int rook_col = this->rook_col(player_color, side);
+    Piece rook = table[row][rook_col];
+    if (rook_moved || rook.color != player_color || rook.type != 'R')
+        return false;
+
+    // every tile the king or rook crosses or lands on has to be empty, other than the ones they're on
+    int king_to = (side == 0) ? 2 : 6, rook_to = (side == 0) ? 3 : 5;
+    int lo = std::min(std::min(king_col, rook_col), std::min(king_to, rook_to));
+    int hi = std::max(std::max(king_col, rook_col), std::max(king_to, rook_to));
+    for (int col = lo; col <= hi; col++)
+        if (col != king_col && col != rook_col && !table[row][col].empty())
+            return false;
+
+    // and the king can't castle out of, through or into check. Both pieces are lifted off the table for this, since
+    // neither of them can shield a tile it's leaving
+    table[row][king_col] = EMPTY_TILE;
+    table[row][rook_col] = EMPTY_TILE;
+    bool safe = true;
+    for (int col = std::min(king_col, king_to); col <= std::max(king_col, king_to) && safe; col++)
+        safe = !is_attacked(row, col, opponent);
+    table[row][king_col] = king;
+    table[row][rook_col] = rook;
+    return safe;
+}
+
+template <typename Variant>
+MoveResult BasicGame<Variant>::castle_shuffled(int row, int king_col, int rook_col, char player_color){
+    int side = (rook_col < king_col) ? 0 : 1;
+    bool king_moved = (player_color == 'W') ? WK_moved : BK_moved;
+    bool rook_moved = (player_color == 'W') ? (side == 0 ? WR1_moved : WR2_moved) : (side == 0 ? BR1_moved : BR2_moved);
+    int home_row = (player_color == 'W') ? 7 : 0;
+    if (king_moved || rook_moved || row != home_row || king_col != this->king_col(player_color)
+        || rook_col != this->rook_col(player_color, side))
+        return MoveResult::Invalid;
+
+    int king_to = (side == 0) ? 2 : 6, rook_to = (side == 0) ? 3 : 5;
+    int lo = std::min(std::min(king_col, rook_col), std::min(king_to, rook_to));
+    int hi = std::max(std::max(king_col, rook_col), std::max(king_to, rook_to));
+    for (int col = lo; col <= hi; col++)
+        if (col != king_col && col != rook_col && !table[row][col].empty())
+            return MoveResult::Invalid;
+
+    // both are lifted before either is put down, since the king may land where the rook was or the other way around
+    set_tile(row, king_col, EMPTY_TILE);
+    set_tile(row, rook_col, EMPTY_TILE);
+    set_tile(row, king_to, {player_color, 'K'});
+    set_tile(row, rook_to, {player_color, 'R'});
+    if (player_color == 'W')
+        WK_moved = true;
+    else
+        BK_moved = true;
+    return MoveResult::Valid;
+}
+
+// Takes the table structure and the dead lists and compiles them into a pretty chess table inside the buffer passed in. The
+// lines of the table are copied from PRINTED_BOARD_TEMPLATE and the pieces written over the blank tiles, so nothing is
+// allocated.
+template <typename Variant>
+void BasicGame<Variant>::format_table_to_print(char buf[DEFAULT_BUFLEN]){
+    memcpy(buf, PRINTED_BOARD_TEMPLATE, PRINTED_BOARD_SIZE);
+
+    // the dead lists fill the row next to the board first, ten to a row, and then the outer row
+    for (int i = 0; i < 16; i++){
+        int col = 2 + 4 * (i % 10);
+        char *white_dead = buf + ((i < 10) ? 1 : 0) * PRINTED_BOARD_COLS + col;
+        char *black_dead = buf + ((i < 10) ? PRINTED_BOARD_ROWS - 2 : PRINTED_BOARD_ROWS - 1) * PRINTED_BOARD_COLS + col;
+        white_dead[0] = white_dead_list[i].color;
+        white_dead[1] = white_dead_list[i].type;
+        black_dead[0] = black_dead_list[i].color;
+        black_dead[1] = black_dead_list[i].type;
+    }
+
+    for (int row = 0; row < 8; row++){
+        char *line = buf + (3 + 2 * row) * PRINTED_BOARD_COLS;
+        for (int col = 0; col < 8; col++){
+            line[4 + 5 * col] = table[row][col].color;
+            line[5 + 5 * col] = table[row][col].type;
         }
     }
 }
 
 // quick helper function to validate user input for a pawn promotion
-bool Game::validate_promotion_input(char buf[DEFAULT_BUFLEN]){
+template <typename Variant>
+bool BasicGame<Variant>::validate_promotion_input(char buf[DEFAULT_BUFLEN]){
     if ((buf[0]=='R' || buf[0]=='N' || buf[0]=='B' || buf[0]=='Q') && buf[1]=='\n' && buf[2]=='\0')
         return true;
     else 
@@ -122,38 +683,416 @@ bool Game::validate_promotion_input(char buf[DEFAULT_BUFLEN]){
 }
 
 // Promotes pawn when it reaches the other side of the board
-void Game::promote_pawn(char new_piece){
-    std::string replacement = "  ";
-    if (replace_coordinates.first == 0) // if promoting a white pawn
-        replacement[0] = 'W';
+template <typename Variant>
+void BasicGame<Variant>::promote_pawn(char new_piece){
+    Piece replacement;
+    if (replace_row == 0) // if promoting a white pawn
+        replacement.color = 'W';
     else 
-        replacement[0] = 'B';
-    replacement[1] = new_piece;
-    table[replace_coordinates.first][replace_coordinates.second] = replacement;
+        replacement.color = 'B';
+    replacement.type = new_piece;
+    set_tile(replace_row, replace_col, replacement);
+
+    // make_move already recorded the position with the pawn still on the table, so swap in the promoted one and finish the turn
+    position_history[position_history_len - 1] = (uint32_t)(position_key() >> 32);
+    update_draw_state();
 }
 
 // makes a move and returns whether it was invalid, valid, or if a pawn was moved to the other side and needs to be promoted
-MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
+template <typename Variant>
+MoveResult BasicGame<Variant>::make_move(char buf[DEFAULT_BUFLEN], char player_color){
+    Move move;
+    if (!parse_move(buf, move))
+        return MoveResult::Invalid;
+    return apply_move(move, player_color);
+}
+
+template <typename Variant>
+MoveResult BasicGame<Variant>::make_move(const Move &move, char player_color){
+    MoveResult result = apply_move(move, player_color);
+    // a move to the last row that didn't say what to promote to
+    if (result == MoveResult::ValidWithReplace){
+        promote_pawn('Q');
+        result = MoveResult::Valid;
+    }
+    return result;
+}
+
+template <typename Variant>
+MoveResult BasicGame<Variant>::apply_move(const Move &move, char player_color){
+    if (!on_table(move.from_row, move.from_col) || !on_table(move.to_row, move.to_col))
+        return MoveResult::Invalid;
+
+    // remember what the move is about to change so we can tell afterwards whether it was irreversible
+    bool pawn_move = table[move.from_row][move.from_col].type == 'P';
+    int dead_before = white_dead_list_idx + black_dead_list_idx;
+    int flags_before = castle_flags();
+
+    // a promotion piece can only be given for a pawn moving to the other side
+    int last_row = (player_color == 'W') ? 0 : 7;
+    if (move.promotion != 0 && (!pawn_move || move.to_row != last_row))
+        return MoveResult::Invalid;
+
+    MoveResult result = try_move(move, player_color);
+    if (result == MoveResult::Invalid)
+        return result;
+
+    update_castle_flags(move.from_row, move.from_col);
+    update_castle_flags(move.to_row, move.to_col);
+
+    bool capture = (white_dead_list_idx + black_dead_list_idx) != dead_before;
+    if (pawn_move || capture)
+        halfmove_clock = 0;
+    else
+        halfmove_clock++;
+
+    // no position from before a capture, pawn move or lost castle-ing right can be repeated, so the history can be dropped
+    if (pawn_move || capture || castle_flags() != flags_before)
+        position_history_len = 0;
+
+    side_to_move = (player_color == 'W') ? 'B' : 'W';
+    if (position_history_len < POSITION_HISTORY_SIZE)
+        position_history[position_history_len++] = (uint32_t)(position_key() >> 32);
+
+    // a promotion finishes the turn in promote_pawn, once the new piece is on the table
+    if (result == MoveResult::ValidWithReplace && move.promotion != 0){
+        promote_pawn(move.promotion);
+        result = MoveResult::Valid;
+    } else if (result == MoveResult::Valid){
+        update_draw_state();
+    }
+
+    return result;
+}
+
+// Only the cheap checks that rule a move out are made up front. A move that passes them is tried straight on the table by
+// leaves_king_safe, which is far cheaper than generating every legal move the player has and looking for it among them.
+template <typename Variant>
+MoveResult BasicGame<Variant>::make_legal_move(const Move &move, char player_color){
+    if (player_color != side_to_move || white_won || black_won || draw_reason != DrawReason::NoDraw)
+        return MoveResult::Invalid;
+    if (!on_table(move.from_row, move.from_col) || !on_table(move.to_row, move.to_col))
+        return MoveResult::Invalid;
+
+    Piece piece = table[move.from_row][move.from_col];
+    Piece end_piece = table[move.to_row][move.to_col];
+    if (piece.color != player_color)
+        return MoveResult::Invalid;
+
+    // a pawn reaching the other side has to say what it's promoted to, and no other move can
+    int last_row = (player_color == 'W') ? 0 : 7;
+    bool promoting = piece.type == 'P' && move.to_row == last_row;
+    if (promoting != (move.promotion != 0))
+        return MoveResult::Invalid;
+
+    // A castle moves the rook as well and can't pass through check, which leaves_king_safe can't try out, so castles are
+    // checked the way generate_moves checks them instead: among the candidates, or by can_castle_shuffled in Chess960
+    bool castle = piece.type == 'K' && move.from_row == move.to_row;
+    if constexpr (Variant::shuffled_start)
+        castle = castle && end_piece.color == player_color && end_piece.type == 'R';
+    else
+        castle = castle && std::abs(move.to_col - move.from_col) == 2;
+    if (castle){
+        bool legal;
+        if constexpr (Variant::shuffled_start){
+            int side = (move.to_col < move.from_col) ? 0 : 1;
+            legal = move.from_row == ((player_color == 'W') ? 7 : 0) && move.from_col == this->king_col(player_color)
+                && move.to_col == this->rook_col(player_color, side) && can_castle_shuffled(player_color, side);
+        } else {
+            legal = visit_candidates(player_color, [&move](const Move &m){
+                return m.from_row == move.from_row && m.from_col == move.from_col && m.to_row == move.to_row && m.to_col == move.to_col;
+            });
+        }
+        if (!legal)
+            return MoveResult::Invalid;
+    } else if (!leaves_king_safe(move, player_color)){
+        return MoveResult::Invalid;
+    }
+
+    // apply_move checks the rest of the rules, and leaves the game as it was if the move breaks them
+    return apply_move(move, player_color);
+}
+
+template <typename Variant>
+void BasicGame<Variant>::make_moves(BatchMove *moves, size_t count){
+    for (size_t i = 0; i < count; i++){
+        // The games are scattered across the heap and a batch rarely finds them in cache, so the game a few moves ahead is
+        // loaded while this one is made: the line with the flags and side to move, and the table
+        if (i + BATCH_PREFETCH_DISTANCE < count){
+            const BasicGame *ahead = moves[i + BATCH_PREFETCH_DISTANCE].game;
+            __builtin_prefetch(ahead);
+            __builtin_prefetch(&ahead->table[0][0]);
+            __builtin_prefetch(&ahead->table[4][0]);
+        }
+        BatchMove &batch_move = moves[i];
+        batch_move.result = batch_move.game->make_legal_move(batch_move.move, batch_move.player_color);
+    }
+}
+
+template <typename Variant>
+void BasicGame<Variant>::format_move(const Move &move, char buf[DEFAULT_BUFLEN]){
+    int len = 0;
+    buf[len++] = 'a' + move.from_col;
+    buf[len++] = '1' + (7 - move.from_row);
+    buf[len++] = 'a' + move.to_col;
+    buf[len++] = '1' + (7 - move.to_row);
+    if (move.promotion != 0)
+        buf[len++] = move.promotion - 'A' + 'a';
+    buf[len++] = '\n';
+    buf[len] = '\0';
+}
+
+template <typename Variant>
+bool BasicGame<Variant>::parse_move(const char buf[DEFAULT_BUFLEN], Move &move){
+    if (buf[0] < 'a' || buf[0] > 'h' || buf[1] < '1' || buf[1] > '8' || buf[2] < 'a' || buf[2] > 'h' || buf[3] < '1' || buf[3] > '8')
+        return false;
+    move.from_row = 7 - (buf[1] - '1');
+    move.from_col = buf[0] - 'a';
+    move.to_row = 7 - (buf[3] - '1');
+    move.to_col = buf[2] - 'a';
+    move.promotion = 0;
+
+    int len = 4;
+    if (buf[len] != '\0' && strchr("QRBNqrbn", buf[len]) != NULL){
+        move.promotion = (buf[len] >= 'a') ? buf[len] - 'a' + 'A' : buf[len];
+        len++;
+    }
+    return buf[len] == '\n' || buf[len] == '\0';
+}
+
+template <typename Variant>
+bool BasicGame<Variant>::load_fen(const char *fen){
+    BasicGame loaded;
+    for (int row = 0; row < 8; row++)
+        for (int col = 0; col < 8; col++)
+            loaded.set_tile(row, col, EMPTY_TILE);
+
+    // the pieces, rank 8 first
+    int row = 0, col = 0;
+    const char *p = fen;
+    for (; *p != '\0' && *p != ' '; p++){
+        if (*p == '/'){
+            if (col != 8)
+                return false;
+            row++;
+            col = 0;
+        } else if (*p >= '1' && *p <= '8'){
+            col += *p - '0';
+        } else {
+            char type = (*p >= 'a') ? *p - 'a' + 'A' : *p;
+            if (strchr("PNBRQK", type) == NULL || row > 7 || col > 7)
+                return false;
+            loaded.set_tile(row, col, {(*p >= 'a') ? 'B' : 'W', type});
+            col++;
+        }
+        if (col > 8)
+            return false;
+    }
+    if (row != 7 || col != 8)
+        return false;
+
+    // the player to move
+    while (*p == ' ')
+        p++;
+    if (*p != 'w' && *p != 'b')
+        return false;
+    loaded.side_to_move = (*p == 'w') ? 'W' : 'B';
+    p++;
+
+    // castle-ing rights. A right only counts if the king and rook are still on their starting tiles
+    while (*p == ' ')
+        p++;
+    if constexpr (Variant::shuffled_start){
+        if (!loaded.load_shuffled_castle_rights(p))
+            return false;
+    } else {
+        bool rights[4] = {false, false, false, false}; // K, Q, k, q
+        for (; *p != '\0' && *p != ' '; p++){
+            const char *right = strchr("KQkq", *p);
+            if (right != NULL)
+                rights[right - "KQkq"] = true;
+            else if (*p != '-')
+                return false;
+        }
+        Piece white_king = loaded.table[7][4], black_king = loaded.table[0][4];
+        bool white_home = white_king.color == 'W' && white_king.type == 'K';
+        bool black_home = black_king.color == 'B' && black_king.type == 'K';
+        loaded.WR2_moved = !(rights[0] && white_home && loaded.table[7][7].color == 'W' && loaded.table[7][7].type == 'R');
+        loaded.WR1_moved = !(rights[1] && white_home && loaded.table[7][0].color == 'W' && loaded.table[7][0].type == 'R');
+        loaded.BR2_moved = !(rights[2] && black_home && loaded.table[0][7].color == 'B' && loaded.table[0][7].type == 'R');
+        loaded.BR1_moved = !(rights[3] && black_home && loaded.table[0][0].color == 'B' && loaded.table[0][0].type == 'R');
+    }
+    loaded.WK_moved = loaded.WR1_moved && loaded.WR2_moved;
+    loaded.BK_moved = loaded.BR1_moved && loaded.BR2_moved;
+
+    // the en passant tile is skipped, and the halfmove clock is optional (EPD lines put operations here instead)
+    while (*p == ' ')
+        p++;
+    while (*p != '\0' && *p != ' ')
+        p++;
+    while (*p == ' ')
+        p++;
+    loaded.halfmove_clock = 0;
+    if (*p >= '0' && *p <= '9')
+        loaded.halfmove_clock = atoi(p);
+
+    // one king each, and whatever else is missing from the starting pieces goes on the dead lists
+    const char types[6] = {'P', 'N', 'B', 'R', 'Q', 'K'};
+    const int starting_counts[6] = {8, 2, 2, 2, 1, 1};
+    const char colors[2] = {'W', 'B'};
+    for (char color : colors){
+        int counts[6] = {0, 0, 0, 0, 0, 0};
+        for (int r = 0; r < 8; r++)
+            for (int c = 0; c < 8; c++)
+                if (loaded.table[r][c].color == color)
+                    counts[strchr(types, loaded.table[r][c].type) - types]++;
+        if (counts[5] != 1)
+            return false;
+        for (int t = 0; t < 5; t++)
+            for (int i = counts[t]; i < starting_counts[t]; i++)
+                loaded.add_to_dead_list({color, types[t]});
+    }
+
+    loaded.position_history_len = 0;
+    loaded.position_history[loaded.position_history_len++] = (uint32_t)(loaded.position_key() >> 32);
+    loaded.update_draw_state();
+    *this = loaded;
+    return true;
+}
+
+// Chess960 castle-ing rights are either Shredder-FEN's files of the rooks that can castle (i.e. "HAha"), or X-FEN's KQkq
+// for the outermost rook on each side of the king. Advances p past them
+template <typename Variant>
+bool BasicGame<Variant>::load_shuffled_castle_rights(const char *&p){
+    // only Chess960 has files to read, and only Chess960 calls this
+    if constexpr (!Variant::shuffled_start){
+        (void)p;
+        return false;
+    } else {
+        const char colors[2] = {'W', 'B'};
+        bool rights[2][2] = {{false, false}, {false, false}}; // by color, then side
+        for (int color = 0; color < 2; color++){
+            int row = (color == 0) ? 7 : 0;
+            this->king_cols[color] = 4;
+            this->rook_cols[color][0] = 0;
+            this->rook_cols[color][1] = 7;
+            for (int col = 0; col < 8; col++)
+                if (table[row][col].color == colors[color] && table[row][col].type == 'K')
+                    this->king_cols[color] = col;
+        }
+
+        for (; *p != '\0' && *p != ' '; p++){
+            if (*p == '-')
+                continue;
+            char c = *p;
+            int color = (c >= 'a') ? 1 : 0;
+            char upper = (c >= 'a') ? c - 'a' + 'A' : c;
+            int row = (color == 0) ? 7 : 0;
+            int king_col = this->king_cols[color];
+            int rook_col = -1;
+            if (upper == 'K' || upper == 'Q'){
+                // the outermost rook on that side
+                int step = (upper == 'K') ? -1 : 1;
+                for (int col = (upper == 'K') ? 7 : 0; col != king_col; col += step){
+                    if (table[row][col].color == colors[color] && table[row][col].type == 'R'){
+                        rook_col = col;
+                        break;
+                    }
+                }
+            } else if (upper >= 'A' && upper <= 'H'){
+                rook_col = upper - 'A';
+            } else {
+                return false;
+            }
+            if (rook_col < 0 || rook_col == king_col)
+                continue;
+            int side = (rook_col < king_col) ? 0 : 1;
+            rights[color][side] = true;
+            this->rook_cols[color][side] = rook_col;
+        }
+
+        for (int color = 0; color < 2; color++){
+            int row = (color == 0) ? 7 : 0;
+            Piece king = table[row][this->king_cols[color]];
+            bool king_home = king.color == colors[color] && king.type == 'K';
+            bool can_castle[2];
+            for (int side = 0; side < 2; side++){
+                Piece rook = table[row][this->rook_cols[color][side]];
+                can_castle[side] = rights[color][side] && king_home && rook.color == colors[color] && rook.type == 'R';
+            }
+            if (color == 0){
+                WR1_moved = !can_castle[0];
+                WR2_moved = !can_castle[1];
+            } else {
+                BR1_moved = !can_castle[0];
+                BR2_moved = !can_castle[1];
+            }
+        }
+        return true;
+    }
+}
+
+template <typename Variant>
+void BasicGame<Variant>::format_fen(char buf[DEFAULT_BUFLEN]){
+    int len = 0;
+    for (int row = 0; row < 8; row++){
+        int empty = 0;
+        for (int col = 0; col < 8; col++){
+            Piece piece = table[row][col];
+            if (piece.empty()){
+                empty++;
+                continue;
+            }
+            if (empty > 0)
+                buf[len++] = '0' + empty;
+            empty = 0;
+            buf[len++] = (piece.color == 'W') ? piece.type : piece.type - 'A' + 'a';
+        }
+        if (empty > 0)
+            buf[len++] = '0' + empty;
+        if (row < 7)
+            buf[len++] = '/';
+    }
+
+    buf[len++] = ' ';
+    buf[len++] = (side_to_move == 'W') ? 'w' : 'b';
+    buf[len++] = ' ';
+    int rights_start = len;
+    if constexpr (Variant::shuffled_start){
+        // Shredder-FEN: the files of the rooks that can still castle
+        if (!WK_moved && !WR2_moved)
+            buf[len++] = 'A' + this->rook_col('W', 1);
+        if (!WK_moved && !WR1_moved)
+            buf[len++] = 'A' + this->rook_col('W', 0);
+        if (!BK_moved && !BR2_moved)
+            buf[len++] = 'a' + this->rook_col('B', 1);
+        if (!BK_moved && !BR1_moved)
+            buf[len++] = 'a' + this->rook_col('B', 0);
+    } else {
+        if (!WK_moved && !WR2_moved)
+            buf[len++] = 'K';
+        if (!WK_moved && !WR1_moved)
+            buf[len++] = 'Q';
+        if (!BK_moved && !BR2_moved)
+            buf[len++] = 'k';
+        if (!BK_moved && !BR1_moved)
+            buf[len++] = 'q';
+    }
+    if (len == rights_start)
+        buf[len++] = '-';
+    snprintf(buf + len, DEFAULT_BUFLEN - len, " - %d 1", halfmove_clock);
+}
+
+template <typename Variant>
+MoveResult BasicGame<Variant>::try_move(const Move &move, char player_color){
     bool attempting_left_castle; // this will refer to castles on the left side of the board, i.e. BK and BR1, or WK and WR1
     bool attempting_right_castle; // this will refer to castles on the right side of the board, i.e. BK and BR2, or WK and WR2
-    std::string piece; // the piece being moved
-    std::string end_piece; // the piece (or blank space) at the end coordinate
+    Piece piece; // the piece being moved
+    Piece end_piece; // the piece (or blank space) at the end coordinate
 
-    //////////////////////////////////////
-    //// Checking input /////
-    //////////////////////////////////////
-    if (buf[0] < 'a' || buf[0] > 'h') return MoveResult::Invalid;
-    if (buf[1] < '1' || buf[1] > '8') return MoveResult::Invalid;
-    if (buf[2] < 'a' || buf[2] > 'h') return MoveResult::Invalid;
-    if (buf[3] < '1' || buf[3] > '8') return MoveResult::Invalid;
-    if (buf[4] != '\n' && buf[5] != '\0') return MoveResult::Invalid;
-
-    //////////////////////////////////////
-    //// Reformatting /////
-    //////////////////////////////////////
-    // Turn starting and ending coordiantes into integer coordinates that are swapped for (row,col) table indexing i.e. (a,5) -> (5,1)
-    std::pair<int,int> start_coord(7 - ((int)buf[1] - (int)('1')),((int)buf[0] - (int)('a')));
-    std::pair<int,int> end_coord(7 - ((int)buf[3] - (int)('1')),((int)buf[2] - (int)('a')));
+    // (apply_move has already checked both tiles are on the table)
+    std::pair<int,int> start_coord(move.from_row, move.from_col);
+    std::pair<int,int> end_coord(move.to_row, move.to_col);
 
 
     //////////////////////////////////////
@@ -163,7 +1102,7 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
     end_piece = table[end_coord.first][end_coord.second];
 
     // sanity check: piece being moved is the same as the current player's piece
-    if (player_color != piece.at(0))
+    if (player_color != piece.color)
         return MoveResult::Invalid;
 
 
@@ -176,14 +1115,20 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
     if (move_vector.first == 0 && move_vector.second == 0) 
         return MoveResult::Invalid;
 
+    // a Chess960 castle is the king moving onto its own rook
+    if constexpr (Variant::shuffled_start){
+        if (piece.type == 'K' && end_piece.color == piece.color && end_piece.type == 'R' && move_vector.first == 0)
+            return castle_shuffled(start_coord.first, start_coord.second, end_coord.second, player_color);
+    }
+
     // sanity check: if friendly piece at endcoord, return MoveResult::Invalid
-    if (piece.at(0) == end_piece.at(0))
+    if (piece.color == end_piece.color)
         return MoveResult::Invalid;
     
     //////////////////////////////////////
     //// Handling rook movement /////
     //////////////////////////////////////
-    if (piece.at(1) == 'R'){
+    if (piece.type == 'R'){
         if (move_vector.first != 0 && move_vector.second != 0) // either row-movement or col-movement must be 0 for a rook
             return MoveResult::Invalid;
 
@@ -200,37 +1145,22 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
             else if (move_vector.second < 0)
                 iterative_coord.second--;
             // if a piece is in the way
-            if (iterative_coord != end_coord && table[iterative_coord.first][iterative_coord.second] != "  ")
+            if (iterative_coord != end_coord && !table[iterative_coord.first][iterative_coord.second].empty())
                 return MoveResult::Invalid;
         } while (iterative_coord != end_coord);
 
         // check if we're removing a piece
-        if (end_piece.at(0) == 'W'){
-            white_dead_list.insert(white_dead_list.begin()+white_dead_list_idx,end_piece);
-            white_dead_list_idx++;
-        } else if (end_piece.at(0) == 'B'){
-            black_dead_list.insert(black_dead_list.begin()+black_dead_list_idx,end_piece);
-            black_dead_list_idx++;
-        }
+        if (!end_piece.empty())
+            add_to_dead_list(end_piece);
 
         // make move
-        table[start_coord.first][start_coord.second] = "  ";
-        table[end_coord.first][end_coord.second] = piece;
-
-        // set rook moved flag
-        if (piece == "WR1")
-            WR1_moved = true;
-        else if (piece == "WR2")
-            WR2_moved = true;
-        else if (piece == "BR1")
-            BR1_moved = true;
-        else if (piece == "BR2")
-            BR2_moved = true;
+        set_tile(start_coord.first, start_coord.second, EMPTY_TILE);
+        set_tile(end_coord.first, end_coord.second, piece);
 
         // check if game ends
-        if (end_piece == "WK")
+        if (end_piece.color == 'W' && end_piece.type == 'K')
             black_won = true;
-        else if (end_piece == "BK")
+        else if (end_piece.color == 'B' && end_piece.type == 'K')
             white_won = true;
 
         return MoveResult::Valid;
@@ -239,10 +1169,10 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
     //////////////////////////////////////
     //// Handling knight movement /////
     //////////////////////////////////////
-    if (piece.at(1) == 'N'){
+    if (piece.type == 'N'){
         bool valid_flag = false;
-        for (std::pair<int,int> p : knight_move_vectors){ // loop through all the possible knight movement vectors
-            if (p == move_vector){ // if we get a match with the requested move vector
+        for (const int *v : knight_move_vectors){ // loop through all the possible knight movement vectors
+            if (v[0] == move_vector.first && v[1] == move_vector.second){ // if we get a match with the requested move vector
                 valid_flag = true;
                 break;
             }
@@ -251,22 +1181,17 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
             return MoveResult::Invalid;
 
         // check if we're removing a piece
-        if (end_piece.at(0) == 'W'){
-            white_dead_list.insert(white_dead_list.begin()+white_dead_list_idx,end_piece);
-            white_dead_list_idx++;
-        } else if (end_piece.at(0) == 'B'){
-            black_dead_list.insert(black_dead_list.begin()+black_dead_list_idx,end_piece);
-            black_dead_list_idx++;
-        }
+        if (!end_piece.empty())
+            add_to_dead_list(end_piece);
 
         // make move
-        table[start_coord.first][start_coord.second] = "  ";
-        table[end_coord.first][end_coord.second] = piece;
+        set_tile(start_coord.first, start_coord.second, EMPTY_TILE);
+        set_tile(end_coord.first, end_coord.second, piece);
         
         // check if game ends
-        if (end_piece == "WK")
+        if (end_piece.color == 'W' && end_piece.type == 'K')
             black_won = true;
-        else if (end_piece == "BK")
+        else if (end_piece.color == 'B' && end_piece.type == 'K')
             white_won = true;
 
         return MoveResult::Valid;
@@ -275,7 +1200,7 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
     //////////////////////////////////////
     //// Handling bishop movement /////
     //////////////////////////////////////
-    if (piece.at(1) == 'B'){
+    if (piece.type == 'B'){
         if (std::abs(move_vector.first) != std::abs(move_vector.second)) // for diagonal movement, row-movement and col-movement must be equal
             return MoveResult::Invalid;
         
@@ -294,27 +1219,22 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
                 iterative_coord.second--;
 
             // if a piece is in the way
-            if (iterative_coord != end_coord && table[iterative_coord.first][iterative_coord.second] != "  ")
+            if (iterative_coord != end_coord && !table[iterative_coord.first][iterative_coord.second].empty())
                 return MoveResult::Invalid;
         } while (iterative_coord != end_coord);
 
         // check if we're removing a piece
-        if (end_piece.at(0) == 'W'){
-            white_dead_list.insert(white_dead_list.begin()+white_dead_list_idx,end_piece);
-            white_dead_list_idx++;
-        } else if (end_piece.at(0) == 'B'){
-            black_dead_list.insert(black_dead_list.begin()+black_dead_list_idx,end_piece);
-            black_dead_list_idx++;
-        }
+        if (!end_piece.empty())
+            add_to_dead_list(end_piece);
 
         // make move
-        table[start_coord.first][start_coord.second] = "  ";
-        table[end_coord.first][end_coord.second] = piece;
+        set_tile(start_coord.first, start_coord.second, EMPTY_TILE);
+        set_tile(end_coord.first, end_coord.second, piece);
 
         // check if game ends
-        if (end_piece == "WK")
+        if (end_piece.color == 'W' && end_piece.type == 'K')
             black_won = true;
-        else if (end_piece == "BK")
+        else if (end_piece.color == 'B' && end_piece.type == 'K')
             white_won = true;
 
         return MoveResult::Valid;
@@ -323,7 +1243,7 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
     //////////////////////////////////////
     //// Handling queen movement /////
     //////////////////////////////////////
-    if (piece.at(1) == 'Q'){
+    if (piece.type == 'Q'){
         if (move_vector.first != 0 && move_vector.second != 0){ // if not straight line movement
             if (std::abs(move_vector.first) != std::abs(move_vector.second)) // if not diagonal movement
                 return MoveResult::Invalid;
@@ -344,27 +1264,22 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
                 iterative_coord.second--;
 
             // if a piece is in the way
-            if (iterative_coord != end_coord && table[iterative_coord.first][iterative_coord.second] != "  ")
+            if (iterative_coord != end_coord && !table[iterative_coord.first][iterative_coord.second].empty())
                 return MoveResult::Invalid;
         } while (iterative_coord != end_coord);
 
         // check if we're removing a piece
-        if (end_piece.at(0) == 'W'){
-            white_dead_list.insert(white_dead_list.begin()+white_dead_list_idx,end_piece);
-            white_dead_list_idx++;
-        } else if (end_piece.at(0) == 'B'){
-            black_dead_list.insert(black_dead_list.begin()+black_dead_list_idx,end_piece);
-            black_dead_list_idx++;
-        }
+        if (!end_piece.empty())
+            add_to_dead_list(end_piece);
 
         // make move
-        table[start_coord.first][start_coord.second] = "  ";
-        table[end_coord.first][end_coord.second] = piece;
+        set_tile(start_coord.first, start_coord.second, EMPTY_TILE);
+        set_tile(end_coord.first, end_coord.second, piece);
 
         // check if game ends
-        if (end_piece == "WK")
+        if (end_piece.color == 'W' && end_piece.type == 'K')
             black_won = true;
-        else if (end_piece == "BK")
+        else if (end_piece.color == 'B' && end_piece.type == 'K')
             white_won = true;
 
         return MoveResult::Valid;
@@ -373,86 +1288,94 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
     //////////////////////////////////////
     //// Handling king movement /////
     //////////////////////////////////////
-    if (piece.at(1) == 'K'){
-        if (move_vector.second==-2 && move_vector.first==0){ // first we check for left castleing
-            if (piece.at(0)=='W' && !WK_moved  && !WR1_moved){ // attempting white left castle
+    if (piece.type == 'K'){
+        // (in Chess960 the king castles onto its rook instead, which is handled above)
+        if (!Variant::shuffled_start && move_vector.second==-2 && move_vector.first==0){ // first we check for left castleing
+            if (piece.color=='W' && !WK_moved  && !WR1_moved){ // attempting white left castle
                 // check for collisions between the white king and the left rook
-                if (table[7][3] != "  " || table[7][2] != "  " || table[7][1] != "  ")
+                if (!table[7][3].empty() || !table[7][2].empty() || !table[7][1].empty())
                     return MoveResult::Invalid;
                 // make move
-                table[7][2] = "WK";
-                table[7][3] = "WR1";
-                table[7][4] = "  ";
-                table[7][0] = "  ";
+                set_tile(7, 2, {'W', 'K'});
+                set_tile(7, 3, {'W', 'R'});
+                set_tile(7, 4, EMPTY_TILE);
+                set_tile(7, 0, EMPTY_TILE);
                 WK_moved = true;
                 return MoveResult::Valid;
-            } else if (piece.at(0)=='B' && !BK_moved  && !BR1_moved){ // attempting black left castle
+            } else if (piece.color=='B' && !BK_moved  && !BR1_moved){ // attempting black left castle
                 // check for collisions between the black king and the left rook
-                if (table[0][3] != "  " || table[0][2] != "  " || table[0][1] != "  ")
+                if (!table[0][3].empty() || !table[0][2].empty() || !table[0][1].empty())
                     return MoveResult::Invalid;
                 // make move
-                table[0][2] = "BK";
-                table[0][3] = "BR1";
-                table[0][4] = "  ";
-                table[0][0] = "  ";
+                set_tile(0, 2, {'B', 'K'});
+                set_tile(0, 3, {'B', 'R'});
+                set_tile(0, 4, EMPTY_TILE);
+                set_tile(0, 0, EMPTY_TILE);
                 BK_moved = true;
                 return MoveResult::Valid;
             }
-        } else if (move_vector.second==2 && move_vector.first==0){ // then we check for right castleing
-            if (piece.at(0)=='W' && !WK_moved  && !WR2_moved){ // attempting white right castle
+            return MoveResult::Invalid; // the king or rook has already moved
+        } else if (!Variant::shuffled_start && move_vector.second==2 && move_vector.first==0){ // then we check for right castleing
+            if (piece.color=='W' && !WK_moved  && !WR2_moved){ // attempting white right castle
                 // check for collisions between the white king and the right rook
-                if (table[7][5] != "  " || table[7][6] != "  ")
+                if (!table[7][5].empty() || !table[7][6].empty())
                     return MoveResult::Invalid;
                 // make move
-                table[7][6] = "WK";
-                table[7][5] = "WR2";
-                table[7][4] = "  ";
-                table[7][7] = "  ";
+                set_tile(7, 6, {'W', 'K'});
+                set_tile(7, 5, {'W', 'R'});
+                set_tile(7, 4, EMPTY_TILE);
+                set_tile(7, 7, EMPTY_TILE);
                 WK_moved = true;
                 return MoveResult::Valid;
-            } else if (piece.at(0)=='B' && !BK_moved  && !BR2_moved){ // attempting black right castle
+            } else if (piece.color=='B' && !BK_moved  && !BR2_moved){ // attempting black right castle
                 // check for collisions between the black king and the right rook
-                if (table[0][5] != "  " || table[0][6] != "  ")
+                if (!table[0][5].empty() || !table[0][6].empty())
                     return MoveResult::Invalid;
                 // make move
-                table[0][5] = "BK";
-                table[0][6] = "BR2";
-                table[0][4] = "  ";
-                table[0][7] = "  ";
+                set_tile(0, 6, {'B', 'K'});
+                set_tile(0, 5, {'B', 'R'});
+                set_tile(0, 4, EMPTY_TILE);
+                set_tile(0, 7, EMPTY_TILE);
                 BK_moved = true;
                 return MoveResult::Valid;
             }
+            return MoveResult::Invalid; // the king or rook has already moved
         } else if (std::abs(move_vector.first) > 1 || std::abs(move_vector.second) > 1){ // If not castleing, we check
 // that king is only moving 1 tile away
             return MoveResult::Invalid;
         }
 
         // if removing a piece, add it to dead list
-        if (end_piece.at(0) == 'W'){
-            white_dead_list.insert(white_dead_list.begin()+white_dead_list_idx,end_piece);
-            white_dead_list_idx++;
-        } else if (end_piece.at(0) == 'B'){
-            black_dead_list.insert(black_dead_list.begin()+black_dead_list_idx,end_piece);
-            black_dead_list_idx++;
-        }
+        if (!end_piece.empty())
+            add_to_dead_list(end_piece);
         
 
         // set king moved flag
-        if (piece.at(0) == 'W')
+        if (piece.color == 'W')
             WK_moved = true;
-        else if (piece.at(0) == 'B')
+        else if (piece.color == 'B')
             BK_moved = true;
 
 
         // check if game ends
-        if (end_piece == "WK")
+        if (end_piece.color == 'W' && end_piece.type == 'K')
             black_won = true;
-        else if (end_piece == "BK")
+        else if (end_piece.color == 'B' && end_piece.type == 'K')
             white_won = true;
 
         // make move
-        table[start_coord.first][start_coord.second] = "  ";
-        table[end_coord.first][end_coord.second] = piece;
+        set_tile(start_coord.first, start_coord.second, EMPTY_TILE);
+        set_tile(end_coord.first, end_coord.second, piece);
+
+        // in King of the Hill, reaching one of d4, e4, d5 or e5 wins
+        if constexpr (Variant::king_of_the_hill){
+            if (end_coord.first >= 3 && end_coord.first <= 4 && end_coord.second >= 3 && end_coord.second <= 4){
+                if (piece.color == 'W')
+                    white_won = true;
+                else
+                    black_won = true;
+            }
+        }
 
         return MoveResult::Valid;
     } 
@@ -460,103 +1383,100 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
     //////////////////////////////////////
     //// Handling pawn movement /////
     //////////////////////////////////////
-    if (piece.at(1) == 'P'){
+    if (piece.type == 'P'){
         // if player wants to move pawn two spaces
         if (move_vector.first == 2 && move_vector.second == 0){ // 2 is movement towards white side
             // check that pawn is of color and position to perform such a move
-            if (!(piece.at(0) == 'B' && start_coord.first == 1))
+            if (!(piece.color == 'B' && start_coord.first == 1))
                 return MoveResult::Invalid;
 
-            // check if there's a collision
-            if (table[start_coord.first+1][start_coord.second] != "  ")
+            // check if there's a collision. Pawns can't capture straight ahead, so the end tile has to be empty too
+            if (!table[start_coord.first+1][start_coord.second].empty() || !end_piece.empty())
                 return MoveResult::Invalid;
         } else if (move_vector.first == -2  && move_vector.second == 0){ // -2 is movement towards black side
             // check that pawn is of color and position to perform such a move
-            if (!(piece.at(0) == 'W' && start_coord.first == 6))
+            if (!(piece.color == 'W' && start_coord.first == 6))
                 return MoveResult::Invalid;
 
-            // check if there's a collision
-            if (table[start_coord.first-1][start_coord.second] != "  ")
+            // check if there's a collision. Pawns can't capture straight ahead, so the end tile has to be empty too
+            if (!table[start_coord.first-1][start_coord.second].empty() || !end_piece.empty())
                 return MoveResult::Invalid;
         } else if (move_vector.first == 1 && move_vector.second == 1){ // movement down and right
             // check that pawn is black
-            if (piece.at(0) != 'B')
+            if (piece.color != 'B')
                 return MoveResult::Invalid;
 
             // piece at end_coordinate must be white
-            if (end_piece.at(0) == 'W'){
-                white_dead_list.insert(white_dead_list.begin()+white_dead_list_idx,end_piece);
-                white_dead_list_idx++;
+            if (end_piece.color == 'W'){
+                add_to_dead_list(end_piece);
             } else 
                 return MoveResult::Invalid;
 
         } else if (move_vector.first == 1 && move_vector.second == -1){ // movement down and left
             // check that pawn is black
-            if (piece.at(0) != 'B')
+            if (piece.color != 'B')
                 return MoveResult::Invalid;
 
             // piece at end_coordinate must be white
-            if (end_piece.at(0) == 'W'){
-                white_dead_list.insert(white_dead_list.begin()+white_dead_list_idx,end_piece);
-                white_dead_list_idx++;
+            if (end_piece.color == 'W'){
+                add_to_dead_list(end_piece);
             } else 
                 return MoveResult::Invalid;
 
         } else if (move_vector.first == -1 && move_vector.second == 1){ // movement up and right
             // check that pawn is white
-            if (piece.at(0) != 'W')
+            if (piece.color != 'W')
                 return MoveResult::Invalid;
 
             // piece at end_coordinate must be black
-            if (end_piece.at(0) == 'B'){
-                black_dead_list.insert(black_dead_list.begin()+black_dead_list_idx,end_piece);
-                black_dead_list_idx++;
+            if (end_piece.color == 'B'){
+                add_to_dead_list(end_piece);
             } else 
                 return MoveResult::Invalid;
 
         } else if (move_vector.first == -1 && move_vector.second == -1){ // movement up and left
             // check that pawn is white
-            if (piece.at(0) != 'W')
+            if (piece.color != 'W')
                 return MoveResult::Invalid;
 
             // piece at end_coordinate must be black
-            if (end_piece.at(0) == 'B'){
-                black_dead_list.insert(black_dead_list.begin()+black_dead_list_idx,end_piece);
-                black_dead_list_idx++;
+            if (end_piece.color == 'B'){
+                add_to_dead_list(end_piece);
             } else 
                 return MoveResult::Invalid;
         } else if (move_vector.first == 1 && move_vector.second == 0){ // movement down
             // check that pawn is black
-            if (piece.at(0) != 'B')
+            if (piece.color != 'B')
                 return MoveResult::Invalid;
 
             // check that end piece is empty
-            if (end_piece != "  ")
+            if (!end_piece.empty())
                 return MoveResult::Invalid;
         } else if (move_vector.first == -1 && move_vector.second == 0){ // movement up
             // check that pawn is white
-            if (piece.at(0) != 'W')
+            if (piece.color != 'W')
                 return MoveResult::Invalid;
 
             // check that end piece is empty
-            if (end_piece != "  ")
+            if (!end_piece.empty())
                 return MoveResult::Invalid;
         } else {
             // all possible pawn moves are enumerated above, so return MoveResult::Invalid;
             return MoveResult::Invalid;
         }
 
-        table[start_coord.first][start_coord.second] = "  ";
-        table[end_coord.first][end_coord.second] = piece;
+        set_tile(start_coord.first, start_coord.second, EMPTY_TILE);
+        set_tile(end_coord.first, end_coord.second, piece);
 
         // check if game ends
-        if (end_piece == "WK")
+        if (end_piece.color == 'W' && end_piece.type == 'K')
             black_won = true;
-        else if (end_piece == "BK")
+        else if (end_piece.color == 'B' && end_piece.type == 'K')
             white_won = true;
 
         if (end_coord.first == 7 || end_coord.first == 0){ // if at the top or bottom of board, player will get to replace pawn
-            replace_coordinates = end_coord;
+            replace_row = end_coord.first;
+            replace_col = end_coord.second;
             return MoveResult::ValidWithReplace;
         }
 
@@ -566,3 +1486,7 @@ MoveResult Game::make_move(char buf[DEFAULT_BUFLEN], char player_color){
 
     return MoveResult::Invalid;
 };
+
+template class BasicGame<StandardChess>;
+template class BasicGame<Chess960>;
+template class BasicGame<KingOfTheHill>;
@@ -1,26 +1,39 @@
+#ifndef GAME_H
+#define GAME_H
+
 #include <vector>
-#include <string>
-#include <map>
-#include <utility>
+#include <cstddef>
+#include <cstdint>
 #include "utils.h"
+#include "variant.h"
 
 
 #define PRINTED_BOARD_ROWS 22
 #define PRINTED_BOARD_COLS 44
 #define PRINTED_BOARD_SIZE PRINTED_BOARD_ROWS * PRINTED_BOARD_COLS
 
+// the most positions a game's repetition history holds: the one after an irreversible move and 100 reversible half moves
+#define POSITION_HISTORY_SIZE 101
+
 
 
 // chess board is 8x8 tiles. White is always on bottom, and black is always on top.
-// server will keep track of entire board with a 2d vector of strings. Each of these strings will have a character
-// for the color, a character for the piece type, and a number character for the specific rook it is (needed for castle-ing),
-// (i.e. BK = black king,  WR1 = white rook one). 
+// server will keep track of entire board with a fixed 8x8 array of Pieces. Each Piece has a character for the color and a
+// character for the piece type (i.e. BK = black king, WR = white rook).
 
 // There will also be a dead list for white, and a dead list for black, keeping track of what pieces have been removed from the board.
-// These will be displayed above and below the rendered board
+// These will be displayed above and below the rendered board. A player only has 16 pieces, so each dead list is a fixed array of 16.
 
 // There will be six flags: WK_moved, BK_moved, WR1_moved, WR2_moved, BR1_moved, BR2_moved. These let us know if certain rooks or kings
-// have moved already for castle-ing.
+// have moved already for castle-ing. Rook one is the rook that starts on the a file, and rook two starts on the h file. Since a rook
+// that has left its starting tile can never castle again, the rook flags are set whenever a move starts or ends on a rook's starting tile.
+
+// The rules are a template over a variant policy (see variant.h), so Chess960 and King of the Hill get their own compiled
+// copy of the move generation and castle-ing code rather than runtime checks in the standard one. Game is standard chess.
+// In Chess960, rook one is the rook on the a side of the king and rook two the one on the h side, wherever they start.
+
+// Nothing in a Game lives on the heap, so a Game is trivially copyable and a few hundred bytes in size. Copying one (i.e. to try a
+// move out) is a single memcpy.
 
 // A king is the peice that initiates a castle. Simply move the king two spaces to the right or left of where it started to perform a castle.
 
@@ -30,8 +43,10 @@
 
 //  1) When a client takes a turn, they will type the starting position coordinate and the ending position coordinate
 //      (i.e. "a2", "d5") which get sent to the server. Then the rest of the steps are in a function called "make_move" which will check that the
-//      requested move is valid. If it's valid, the move will be made and the function returns Valid. If a pawn needs to be promoted, it 
-//      returns ValidWithReplace. Otherwise it returns Invalid, and the server will prompt the user to make different move.
+//      requested move is valid. If it's valid, the move will be made and the function returns Valid. A pawn move to the other side can
+//      name the piece it promotes to with a fifth character (i.e. "e7e8q"), in which case it's promoted straight away. Without one,
+//      make_move returns ValidWithReplace and the pawn is promoted by promote_pawn. Otherwise it returns Invalid, and the server will
+//      prompt the user to make different move.
 //  2) These coordinates are then converted to integer coordiantes (i.e. "a2" -> 12, "d5" -> 45).Then the game will convert these integers 
 //      into pair<int,int> where the row and column from the user input are swapped as (col,row)->(row,col) to match the layout of the 2d board vector. 
 //  3) The function will perform some sanity checks: is the piece being moved the same color as the current player, is there movement at all, and is
@@ -51,15 +66,110 @@
 //      5f) For rooks and kings, set the appropriate flags for their first movements to prevent subsequent castleing
 //      5g) Check if a King was removed. If so, set the appriate black_won or white_won flags.
 //      5h) For pawns, if reaching the other end of the board, return ValidWithReplace, which tells server to prompt the client for a promotion piece.
+//  6) Once the move is complete (after the promotion, if there was one), the game checks whether it has ended in a draw:
+//      6a) Every position is hashed (a zobrist hash of the pieces, the side to move, and the castle-ing flags), and the hashes of the positions
+//          since the last capture, pawn move or castle-ing flag change are kept in a history. None of the positions before such a move
+//          can ever come back, so only that history has to be scanned for a threefold repetition.
+//      6b) A count of the half moves since the last capture or pawn move is kept for the fifty move rule.
+//      6c) The remaining pieces are checked for insufficient material (lone kings, a single minor piece, or bishops all on one color).
+//      6d) If the player to move isn't in check but has no legal moves, the game is a stalemate.
+
+// A piece on the table, or an empty tile when both characters are spaces
+struct Piece {
+    char color; // 'W' or 'B'
+    char type;  // 'P', 'N', 'B', 'R', 'Q' or 'K'
+
+    bool empty() const { return type == ' '; }
+};
 
-class Game {
+const Piece EMPTY_TILE = {' ', ' '};
+
+// A move from one tile to another in (row, col) table coordinates. promotion is the piece a pawn is promoted to ('Q', 'R', 'B' or 'N')
+// when it reaches the other side of the board, or 0 for every other move.
+struct Move {
+    int from_row, from_col;
+    int to_row, to_col;
+    char promotion;
+};
+
+template <typename Variant>
+class BasicGame : private Variant::CastleSquares {
     public:
-        Game();
+        // the variant's start position, which for Chess960 is the standard one
+        BasicGame();
+
+        // Chess960 start position start_position (0 to 959). The other variants have only the one start position
+        explicit BasicGame(int start_position);
+
         bool get_white_won();
         bool get_black_won();
 
-        // makes a move and returns whether it was invalid, valid, or if a pawn was moved to the other side and needs to be promoted
-        MoveResult make_move(char buf[DEFAULT_BUFLEN], char player_color); 
+        // static evaluation of the current position in centipawns, positive when white is ahead (see eval.h)
+        int get_evaluation();
+
+        // returns why the game ended in a draw, or NoDraw if it hasn't
+        DrawReason get_draw_reason();
+
+        // the player ('W' or 'B') whose turn it is
+        char get_side_to_move();
+
+        // the piece on the tile at (row, col)
+        Piece get_piece(int row, int col);
+
+        // hash of the full position: the pieces, the side to move and the castle-ing flags
+        uint64_t position_key();
+
+        // ends the game with a win for the other player
+        void resign(char player_color);
+
+        // returns true if the given player's king is attacked
+        bool in_check(char player_color);
+
+        // fills moves with every legal move the given player ('W' or 'B') can make. Unlike make_move, this won't let a player leave
+        // their own king in check
+        void generate_moves(char player_color, std::vector<Move> &moves);
+
+        // returns true if the tile at (row, col) is attacked by any of the given player's pieces
+        bool is_attacked(int row, int col, char by_color);
+
+        // makes a move and returns whether it was invalid, valid, or if a pawn was moved to the other side and needs to be promoted.
+        // A promotion piece after the move (i.e. "e7e8q\n") promotes the pawn straight away, and is invalid on any other move
+        MoveResult make_move(char buf[DEFAULT_BUFLEN], char player_color);
+
+        // makes a move given in table coordinates (i.e. one from generate_moves). A pawn reaching the other side is promoted
+        // to move.promotion straight away, so this never returns ValidWithReplace
+        MoveResult make_move(const Move &move, char player_color);
+
+        // One move of a batch for make_moves: the game it's made in, the move in table coordinates (parsed beforehand, so no
+        // text is handled in the batch) and the player making it. make_moves fills in result.
+        struct BatchMove {
+            BasicGame *game;
+            Move move;
+            char player_color;
+            MoveResult result;
+        };
+
+        // Validates and makes a batch of moves, each in its own game, and fills in their results. Unlike make_move, a move is
+        // only made if it's legal in full: it's the player's turn, the game isn't over, the move doesn't leave their king in
+        // check, and it says what to promote to exactly when a pawn reaches the other side (so no result is ValidWithReplace).
+        // An invalid move leaves its game as it was. Moves in the same game are made in the order they're given.
+        static void make_moves(BatchMove *moves, size_t count);
+
+        // writes a move the way a client would type it (i.e. "e2e4\n", or "e7e8q\n" for a promotion) into buf, ready for make_move
+        void static format_move(const Move &move, char buf[DEFAULT_BUFLEN]);
+
+        // Reads a move typed the way format_move writes it into move. The promotion piece may be upper or lower case, and is 0 if
+        // there isn't one. Returns false if buf doesn't hold a move, without checking whether the move is legal.
+        bool static parse_move(const char buf[DEFAULT_BUFLEN], Move &move);
+
+        // Sets up the position in a FEN, or in the first four fields of an EPD line: the pieces, the player to move, the castle-ing
+        // rights and, if it's there, the halfmove clock. The en passant field is ignored, since en passant isn't played. Pieces
+        // missing from a player's starting set are put on their dead list. Returns false, and leaves the game as it was, if
+        // fen doesn't hold a position with one king of each color.
+        bool load_fen(const char *fen);
+
+        // writes the position as a FEN into buf. Move numbers aren't kept, so the full move number is always 1
+        void format_fen(char buf[DEFAULT_BUFLEN]);
 
         // Takes the table structure and the dead lists and compiles them into a pretty chess table inside the buffer passed in
         void format_table_to_print(char buf[DEFAULT_BUFLEN]);
@@ -75,13 +185,86 @@ class Game {
 
         bool white_won, black_won; // flags for if white won or if black one
 
-        std::pair<int,int> replace_coordinates; // coordinates of the pawn to be promoted
+        int8_t replace_row, replace_col; // coordinates of the pawn to be promoted
+
+        int evaluation; // running evaluation of the position, updated by set_tile every time a tile changes
+
+        char side_to_move; // 'W' or 'B', the player whose turn it is
+
+        uint64_t hash; // zobrist hash of the pieces on the table, updated by set_tile every time a tile changes
+
+        // hashes of every position since the last irreversible move (capture, pawn move or castle-ing flag change), including
+        // the current one. Used to check for threefold repetition. Once 100 reversible half moves have piled up the fifty
+        // move rule has drawn the game, and a drawn game stays drawn, so the history stops growing there: make_move still
+        // takes moves past a draw (a PGN or a GUI's move list can play on past one nobody claimed), but they aren't recorded.
+        // Only the top 32 bits of each hash are kept to keep the Game small.
+        uint32_t position_history[POSITION_HISTORY_SIZE];
+        int position_history_len;
+
+        int halfmove_clock; // half moves since the last capture or pawn move, for the fifty move rule
+
+        DrawReason draw_reason;
+
+        // overwrites a tile of the table and updates the evaluation and hash
+        void set_tile(int row, int col, Piece piece);
+
+        // adds a captured piece to its owner's dead list
+        void add_to_dead_list(Piece piece);
+
+        // sets the castle-ing flags for a move that starts or ends on a king or rook's starting tile
+        void update_castle_flags(int row, int col);
+
+        // Chess960: castles the king on (row, king_col) with its rook on (row, rook_col), if the flags and the tiles in
+        // between allow it
+        MoveResult castle_shuffled(int row, int king_col, int rook_col, char player_color);
 
-        std::vector<std::vector<std::string>> table; // The 8x8 table used by the code
+        // Chess960: reads the castle-ing rights field of a FEN into the castle-ing flags and the rooks' files
+        bool load_shuffled_castle_rights(const char *&p);
 
-        std::vector<std::pair<int,int>> knight_move_vectors; // a map of all the valid movement vectors for a knight
+        // Chess960: whether the given player can castle with the rook on side 0 (the a file side) or 1 (the h file side).
+        // It's checked in full here, since leaves_king_safe can't try out a king landing on its own rook
+        bool can_castle_shuffled(char player_color, int side);
 
-        std::vector<std::string> white_dead_list, black_dead_list;
-        int white_dead_list_idx, black_dead_list_idx; // Dead lists will be initialized to a fixed size of 16, so we need to keep track of the
+        // Calls visit with every move the given player could make before checking whether it leaves their king in check,
+        // standard castles included but not Chess960 ones, and stops as soon as visit returns true. Returns whether it did
+        template <typename Visit>
+        bool visit_candidates(char player_color, Visit visit);
+
+        // whether the given player has any legal move. Unlike generate_moves it stops at the first one and allocates nothing
+        bool has_legal_move(char player_color);
+
+        // validates and makes a move without any of the end of turn bookkeeping done by make_move
+        MoveResult try_move(const Move &move, char player_color);
+
+        // make_move for a move already in table coordinates, leaving a pawn that reaches the other side without a promotion
+        // piece for promote_pawn
+        MoveResult apply_move(const Move &move, char player_color);
+
+        // makes one move of a batch for make_moves
+        MoveResult make_legal_move(const Move &move, char player_color);
+
+        // bitmask of the six castle-ing flags
+        int castle_flags();
+
+        // checks the position for a draw and sets draw_reason
+        void update_draw_state();
+
+        bool insufficient_material();
+
+        // tries a move by writing it straight into the table and returns true if it doesn't leave the mover's king in check. The
+        // table is restored before returning
+        bool leaves_king_safe(const Move &move, char player_color);
+
+        Piece table[8][8]; // The 8x8 table used by the code
+
+        Piece white_dead_list[16], black_dead_list[16];
+        int white_dead_list_idx, black_dead_list_idx; // Dead lists are a fixed size of 16, so we need to keep track of the
         // insertion index since we cant just push_back().
-};
\ No newline at end of file
+};
+
+// standard chess, which the server and the bot play
+typedef BasicGame<StandardChess> Game;
+typedef BasicGame<Chess960> Chess960Game;
+typedef BasicGame<KingOfTheHill> KingOfTheHillGame;
+
+#endif // GAME_H
\ No newline at end of file
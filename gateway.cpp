@@ -0,0 +1,599 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "net.h"
+#include "utils.h"
+#include "pool.h"
+#include "hash_ring.h"
+
+// A gateway in front of any number of game servers ("nodes"), for more players than one machine can serve. Clients connect
+// to the gateway as they would to a server, and the gateway pairs them up the way a server does, each with the next player
+// to connect (to the same gateway thread). It gives each game a random 64-bit key, and the game is played on the node the
+// key belongs to on a consistent hash ring of the nodes (see hash_ring.h), on the shard the key picks there. Each player
+// gets their own connection to that shard's port (the node's --resume-port plus the shard's index, which nodes started with
+// --gateway listen on), which starts with a "join <key>" frame so the shard seats both players of the game together,
+// whatever else connects in between (see Shard::join). After that the gateway copies bytes both ways without looking at
+// them.
+
+// The nodes are listed in a file, one "host:port" or "host:port/shards" per line, where port is the node's --resume-port
+// and shards is its --shards (1 by default). Lines starting with # are skipped. On SIGHUP the gateway reads the file again:
+// games in progress stay where they are, and new games go by the new ring, so a node that's been added takes its share of
+// new games (1/N of them, with N nodes) from the others, which keep all the rest.
+
+// Each thread has its own listening socket on the same port (SO_REUSEPORT) and its own epoll loop. When the gateway stops,
+// each thread prints how many frames it relayed, and the syscalls and CPU time it spent per frame.
+
+// Usage: gateway --nodes FILE [--port P] [--threads N] [--max-players N]
+
+#define MAX_EVENTS 256
+#define RELAY_CHUNK 65536
+// keys used to tell how many new games a reload moves to a different node
+#define RELOAD_SAMPLE_KEYS 100000
+
+struct Node {
+    std::string name; // as listed, "host:port", which is also its name on the ring
+    struct sockaddr_storage addr; // shard 0's port
+    socklen_t addr_len;
+    int port;
+    int shards;
+};
+
+struct NodeTable {
+    std::vector<Node> nodes;
+    HashRing ring;
+
+    NodeTable(const std::vector<Node> &nodes, const std::vector<std::string> &names) : nodes(nodes), ring(names){}
+};
+
+// read by every thread for each new game, and replaced whole on a reload
+static std::shared_ptr<const NodeTable> node_table;
+static std::atomic<bool> stopping(false);
+
+struct Link;
+
+// One end of a player's relay: the client's socket or the node's
+struct Side {
+    socket_t fd; // INVALID_SOCKET once closed
+    Link *link;
+    std::string outbuf; // bytes from the other end that this socket hasn't taken yet
+    size_t out_offset;
+    uint32_t events; // what epoll is watching the socket for
+};
+
+// A player: their connection to the gateway, and the gateway's connection to the node on their behalf
+struct Link {
+    Side client, node;
+    bool connecting; // the connection to the node is still being made
+    bool node_gone; // the node closed its end, so the client's is closed once what the node sent has been flushed
+    bool dead; // both ends are closed, and the link is released at the end of the batch
+};
+
+struct GatewayLoop {
+    int index;
+    int epfd;
+    int wake_fd;
+    socket_t listen_fd;
+    SlabPool<Link> links;
+    std::vector<Link*> dead;
+    std::mt19937_64 rng;
+
+    // the first player of the game waiting for a second one (or NULL), the game's key and where it's played
+    Link *waiting;
+    uint64_t waiting_key;
+    struct sockaddr_storage waiting_addr;
+    socklen_t waiting_addr_len;
+
+    long players, unreachable;
+    long bytes_relayed;
+    long syscalls; // every epoll_wait(), accept4(), recv(), send() and epoll_ctl() made
+
+    GatewayLoop(int max_players) : links(max_players){}
+};
+
+// epoll_data for the fds that aren't relay sockets. Those use their Side pointer
+static char LISTEN_TAG, WAKE_TAG;
+
+static Side &other_side(Side &side){
+    return (&side == &side.link->client) ? side.link->node : side.link->client;
+}
+
+static bool has_output(const Side &side){
+    return side.out_offset < side.outbuf.size();
+}
+
+// A side is read from only while the other side has taken everything sent its way, so a slow reader slows down the
+// writer instead of piling up in the gateway. It's watched for writing while it has output waiting, or is connecting
+static void watch(GatewayLoop &loop, Side &side){
+    if (side.fd == INVALID_SOCKET)
+        return;
+    bool connecting = (&side == &side.link->node) && side.link->connecting;
+    uint32_t events = (has_output(other_side(side)) ? 0 : (uint32_t)(EPOLLIN | EPOLLRDHUP))
+        | ((has_output(side) || connecting) ? (uint32_t)EPOLLOUT : 0);
+    if (events == side.events)
+        return;
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = &side;
+    epoll_ctl(loop.epfd, EPOLL_CTL_MOD, side.fd, &ev);
+    loop.syscalls++;
+    side.events = events;
+}
+
+static void add_side(GatewayLoop &loop, Side &side, uint32_t events){
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = &side;
+    epoll_ctl(loop.epfd, EPOLL_CTL_ADD, side.fd, &ev);
+    loop.syscalls++;
+    side.events = events;
+}
+
+static void close_side(GatewayLoop &loop, Side &side){
+    if (side.fd == INVALID_SOCKET)
+        return;
+    epoll_ctl(loop.epfd, EPOLL_CTL_DEL, side.fd, NULL);
+    net_close(side.fd);
+    loop.syscalls += 2;
+    side.fd = INVALID_SOCKET;
+}
+
+static void close_link(GatewayLoop &loop, Link *link){
+    if (link->dead)
+        return;
+    close_side(loop, link->client);
+    close_side(loop, link->node);
+    link->dead = true;
+    loop.dead.push_back(link);
+    if (loop.waiting == link)
+        loop.waiting = NULL;
+}
+
+// Sends as much of a side's output as its socket will take
+static void flush_side(GatewayLoop &loop, Side &side){
+    while (has_output(side)){
+        ssize_t n = send(side.fd, side.outbuf.data() + side.out_offset, side.outbuf.size() - side.out_offset, MSG_NOSIGNAL);
+        loop.syscalls++;
+        if (n < 0){
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            close_link(loop, side.link);
+            return;
+        }
+        side.out_offset += n;
+    }
+    if (!has_output(side)){
+        side.outbuf.clear();
+        side.out_offset = 0;
+        if (&side == &side.link->client && side.link->node_gone){
+            close_link(loop, side.link);
+            return;
+        }
+    }
+    watch(loop, side);
+    watch(loop, other_side(side));
+}
+
+// Tells a client the gateway can't get them a game, and closes their connection once they've been told
+static void refuse(GatewayLoop &loop, Link *link, const char *msg){
+    if (loop.waiting == link)
+        loop.waiting = NULL;
+    close_side(loop, link->node);
+    link->connecting = false;
+    link->node_gone = true;
+    size_t len = strlen(msg);
+    link->client.outbuf.append(msg, len);
+    link->client.outbuf.append(DEFAULT_BUFLEN - len, '\0');
+    flush_side(loop, link->client);
+}
+
+// Copies what one side's socket has to the other side, straight through when the other socket takes it all
+static void relay(GatewayLoop &loop, Side &from){
+    Side &to = other_side(from);
+    char buf[RELAY_CHUNK];
+    ssize_t n = recv(from.fd, buf, sizeof(buf), 0);
+    loop.syscalls++;
+    if (n <= 0){
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        // a client that leaves takes its connection to the node with it, which tells the node the player left. A node
+        // that closes has said its last (i.e. "game over"), which still has to reach the client
+        if (&from == &from.link->node && has_output(to)){
+            close_side(loop, from);
+            from.link->node_gone = true;
+            return;
+        }
+        close_link(loop, from.link);
+        return;
+    }
+    loop.bytes_relayed += n;
+    // the node's gone, and has nothing more to say to a client that's still talking
+    if (to.fd == INVALID_SOCKET)
+        return;
+    size_t sent = 0;
+    if (!has_output(to) && !(&to == &to.link->node && to.link->connecting)){
+        ssize_t s = send(to.fd, buf, n, MSG_NOSIGNAL);
+        loop.syscalls++;
+        if (s < 0 && errno != EAGAIN && errno != EWOULDBLOCK){
+            close_link(loop, from.link);
+            return;
+        }
+        sent = (s > 0) ? (size_t)s : 0;
+    }
+    if (sent < (size_t)n){
+        to.outbuf.append(buf + sent, n - sent);
+        watch(loop, to);
+        watch(loop, from);
+    }
+}
+
+static void set_port(struct sockaddr_storage &addr, int port){
+    if (addr.ss_family == AF_INET6)
+        ((struct sockaddr_in6*)&addr)->sin6_port = htons((uint16_t)port);
+    else
+        ((struct sockaddr_in*)&addr)->sin_port = htons((uint16_t)port);
+}
+
+// Starts connecting a player to the shard at addr, with the join frame for the game queued up for when it's connected
+static void connect_node(GatewayLoop &loop, Link *link, const struct sockaddr_storage &addr, socklen_t addr_len,
+        uint64_t key){
+    link->node.fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (link->node.fd < 0){
+        perror("socket() error");
+        refuse(loop, link, "The gateway couldn't reach a game server. Try again later.\n$E");
+        return;
+    }
+    int one = 1;
+    setsockopt(link->node.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(link->node.fd, (const struct sockaddr*)&addr, addr_len) != 0 && errno != EINPROGRESS){
+        net_close(link->node.fd);
+        link->node.fd = INVALID_SOCKET;
+        loop.unreachable++;
+        refuse(loop, link, "The gateway couldn't reach a game server. Try again later.\n$E");
+        return;
+    }
+    char frame[DEFAULT_BUFLEN] = {0};
+    snprintf(frame, sizeof(frame), "join %llu\n", (unsigned long long)key);
+    link->node.outbuf.assign(frame, sizeof(frame));
+    link->connecting = true;
+    add_side(loop, link->node, EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+    watch(loop, link->client);
+}
+
+// the node's socket is writable for the first time: connected, or failed to
+static void finish_connecting(GatewayLoop &loop, Link *link){
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(link->node.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error != 0){
+        loop.unreachable++;
+        refuse(loop, link, "The gateway couldn't reach a game server. Try again later.\n$E");
+        return;
+    }
+    link->connecting = false;
+    flush_side(loop, link->node);
+}
+
+// Puts a new player in the game waiting for a second player, or in a new game on the node the game's key belongs to
+static void start_player(GatewayLoop &loop, Link *link){
+    if (loop.waiting != NULL){
+        loop.waiting = NULL;
+        connect_node(loop, link, loop.waiting_addr, loop.waiting_addr_len, loop.waiting_key);
+        return;
+    }
+    std::shared_ptr<const NodeTable> table = std::atomic_load(&node_table);
+    uint64_t key;
+    do {
+        key = loop.rng();
+    } while (key == 0);
+    int n = table->ring.node_for(key);
+    if (n < 0){
+        refuse(loop, link, "There are no game servers to play on right now. Try again later.\n$E");
+        return;
+    }
+    const Node &node = table->nodes[n];
+    loop.waiting = link;
+    loop.waiting_key = key;
+    loop.waiting_addr = node.addr;
+    loop.waiting_addr_len = node.addr_len;
+    // the ring picked the node by the key's hash, so the key itself is free to pick the shard
+    set_port(loop.waiting_addr, node.port + (int)(key % (uint64_t)node.shards));
+    connect_node(loop, link, loop.waiting_addr, loop.waiting_addr_len, key);
+}
+
+static void accept_players(GatewayLoop &loop){
+    while (true){
+        socket_t fd = accept4(loop.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        loop.syscalls++;
+        if (fd < 0){
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("accept() error");
+            return;
+        }
+        Link *link = loop.links.acquire();
+        if (link == NULL){
+            net_close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        link->client.fd = fd;
+        link->client.link = link;
+        link->client.out_offset = 0;
+        link->node.fd = INVALID_SOCKET;
+        link->node.link = link;
+        link->node.out_offset = 0;
+        link->connecting = false;
+        link->node_gone = false;
+        link->dead = false;
+        add_side(loop, link->client, EPOLLIN | EPOLLRDHUP);
+        loop.players++;
+        start_player(loop, link);
+    }
+}
+
+static double thread_cpu_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_gateway_thread(GatewayLoop *loop_ptr, const char *port){
+    GatewayLoop &loop = *loop_ptr;
+    loop.listen_fd = net_listen(port, true);
+    if (loop.listen_fd == INVALID_SOCKET || !net_set_nonblocking(loop.listen_fd)){
+        printf("[thread %d] Couldn't listen on port %s.\n", loop.index, port);
+        exit(1);
+    }
+    loop.epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &LISTEN_TAG;
+    epoll_ctl(loop.epfd, EPOLL_CTL_ADD, loop.listen_fd, &ev);
+    ev.data.ptr = &WAKE_TAG;
+    epoll_ctl(loop.epfd, EPOLL_CTL_ADD, loop.wake_fd, &ev);
+    double cpu_start = thread_cpu_seconds();
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopping){
+        int n = epoll_wait(loop.epfd, events, MAX_EVENTS, -1);
+        loop.syscalls++;
+        if (n < 0){
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait() error");
+            break;
+        }
+        for (int i = 0; i < n; i++){
+            void *tag = events[i].data.ptr;
+            if (tag == &LISTEN_TAG){
+                accept_players(loop);
+                continue;
+            }
+            if (tag == &WAKE_TAG)
+                continue;
+            Side &side = *(Side*)tag;
+            // an earlier event in the batch may have closed it
+            if (side.fd == INVALID_SOCKET)
+                continue;
+            uint32_t e = events[i].events;
+            if (&side == &side.link->node && side.link->connecting){
+                if (e & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                    finish_connecting(loop, side.link);
+                continue;
+            }
+            if (e & EPOLLOUT)
+                flush_side(loop, side);
+            if (side.fd != INVALID_SOCKET && (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                relay(loop, side);
+        }
+        for (Link *link : loop.dead)
+            loop.links.release(link);
+        loop.dead.clear();
+    }
+
+    double cpu = thread_cpu_seconds() - cpu_start;
+    long frames = loop.bytes_relayed / DEFAULT_BUFLEN;
+    printf("[thread %d] Relayed %ld frame(s) for %ld player(s), with %.2f syscalls and %.2f us of CPU per frame.", loop.index,
+        frames, loop.players, frames > 0 ? (double)loop.syscalls / frames : 0.0, frames > 0 ? cpu * 1e6 / frames : 0.0);
+    if (loop.unreachable > 0)
+        printf(" %ld player(s) couldn't be connected to a node.", loop.unreachable);
+    printf("\n");
+
+    loop.links.for_each([&](Link *link){
+        if (!link->dead){
+            close_side(loop, link->client);
+            close_side(loop, link->node);
+        }
+    });
+    close(loop.epfd);
+    net_close(loop.listen_fd);
+}
+
+// Reads the node list. Returns NULL (having said why) if a line can't be used
+static std::shared_ptr<const NodeTable> load_nodes(const char *path){
+    std::ifstream file(path);
+    if (!file){
+        printf("Couldn't open %s.\n", path);
+        return NULL;
+    }
+    std::vector<Node> nodes;
+    std::vector<std::string> names;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)){
+        line_number++;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+        line = line.substr(start, line.find_last_not_of(" \t\r") + 1 - start);
+        Node node;
+        node.shards = 1;
+        size_t slash = line.find('/');
+        if (slash != std::string::npos){
+            node.shards = atoi(line.c_str() + slash + 1);
+            line.resize(slash);
+        }
+        size_t colon = line.rfind(':');
+        node.port = (colon != std::string::npos) ? atoi(line.c_str() + colon + 1) : 0;
+        if (colon == std::string::npos || colon == 0 || node.port < 1 || node.shards < 1
+            || node.port + node.shards > 65536){
+            printf("%s:%d: expected host:port or host:port/shards.\n", path, line_number);
+            return NULL;
+        }
+        std::string host = line.substr(0, colon);
+        struct addrinfo hints, *result;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        int err = getaddrinfo(host.c_str(), NULL, &hints, &result);
+        if (err != 0){
+            printf("%s:%d: couldn't resolve %s: %s\n", path, line_number, host.c_str(), gai_strerror(err));
+            return NULL;
+        }
+        memset(&node.addr, 0, sizeof(node.addr));
+        memcpy(&node.addr, result->ai_addr, result->ai_addrlen);
+        node.addr_len = result->ai_addrlen;
+        freeaddrinfo(result);
+        set_port(node.addr, node.port);
+        node.name = line;
+        nodes.push_back(node);
+        names.push_back(line);
+    }
+    return std::make_shared<const NodeTable>(nodes, names);
+}
+
+static void print_nodes(const NodeTable &table){
+    for (const Node &node : table.nodes)
+        printf("  %s, %d shard(s)\n", node.name.c_str(), node.shards);
+}
+
+// Rereads the node list. Games already going stay where they are, and new ones go by the new ring
+static void reload_nodes(const char *path){
+    std::shared_ptr<const NodeTable> table = load_nodes(path);
+    if (table == NULL){
+        printf("Keeping the nodes the gateway had.\n");
+        return;
+    }
+    std::shared_ptr<const NodeTable> old_table = std::atomic_load(&node_table);
+    long moved = 0;
+    for (uint64_t key = 1; key <= RELOAD_SAMPLE_KEYS; key++){
+        int a = old_table->ring.node_for(key), b = table->ring.node_for(key);
+        if (a < 0 || b < 0 || old_table->nodes[a].name != table->nodes[b].name)
+            moved++;
+    }
+    std::atomic_store(&node_table, table);
+    printf("Reloaded %s, with %zu node(s). %.1f%% of new games go to a different node than before.\n", path,
+        table->nodes.size(), 100.0 * moved / RELOAD_SAMPLE_KEYS);
+    print_nodes(*table);
+}
+
+static void print_usage(){
+    printf("Usage: gateway --nodes FILE [--port P] [--threads N] [--max-players N]\n");
+}
+
+int main(int argc, char* argv[]){
+    const char *nodes_path = NULL;
+    const char *port = DEFAULT_PORT;
+    int threads = 1;
+    int max_players = 20000;
+    for (int i = 1; i < argc; i++){
+        if (i + 1 < argc && strcmp(argv[i], "--nodes") == 0){
+            nodes_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--port") == 0){
+            port = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--threads") == 0){
+            threads = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--max-players") == 0){
+            max_players = atoi(argv[++i]);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (nodes_path == NULL || threads < 1 || max_players < 1){
+        print_usage();
+        return 1;
+    }
+
+    std::shared_ptr<const NodeTable> table = load_nodes(nodes_path);
+    if (table == NULL)
+        return 1;
+    std::atomic_store(&node_table, table);
+
+    if (!net_startup())
+        return 1;
+    net_raise_fd_limit();
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    // SIGINT, SIGTERM and SIGHUP are only taken by this thread (the others inherit the mask)
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    std::random_device seed;
+    std::vector<std::unique_ptr<GatewayLoop>> loops;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++){
+        GatewayLoop *loop = new GatewayLoop(max_players);
+        loop->index = i;
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loop->rng.seed(((uint64_t)seed() << 32) | seed());
+        loop->waiting = NULL;
+        loop->waiting_key = 0;
+        loop->players = 0;
+        loop->unreachable = 0;
+        loop->bytes_relayed = 0;
+        loop->syscalls = 0;
+        loops.emplace_back(loop);
+        workers.emplace_back(run_gateway_thread, loop, port);
+    }
+    printf("Gateway listening on port %s with %d thread(s), in front of %zu node(s):\n", port, threads, table->nodes.size());
+    print_nodes(*table);
+
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    while (true){
+        struct signalfd_siginfo info;
+        ssize_t n = read(signal_fd, &info, sizeof(info));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n != sizeof(info) || info.ssi_signo != SIGHUP)
+            break;
+        reload_nodes(nodes_path);
+    }
+    close(signal_fd);
+
+    printf("Shutting down.\n");
+    stopping = true;
+    for (auto &loop : loops){
+        uint64_t one = 1;
+        if (write(loop->wake_fd, &one, sizeof(one)) != sizeof(one))
+            perror("eventfd write() error");
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+    for (auto &loop : loops)
+        close(loop->wake_fd);
+    net_cleanup();
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+
+#include "handoff.h"
+
+// Each message on the socket is a HandoffChunk header, up to HANDOFF_CHUNK bytes of data, and up to HANDOFF_CHUNK_FDS fds
+// (the most one SCM_RIGHTS message can carry). A whole handoff starts with a message giving its total bytes and fds, and
+// then as many chunks as it takes
+#define HANDOFF_CHUNK 65536
+#define HANDOFF_CHUNK_FDS 253
+
+struct HandoffChunk {
+    uint32_t bytes;
+    uint32_t fds;
+};
+
+struct HandoffTotals {
+    uint64_t bytes;
+    uint64_t fds;
+};
+
+uint64_t handoff_clock_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool make_address(const char *path, struct sockaddr_un &addr){
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)){
+        printf("The handoff socket path %s is too long.\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    return true;
+}
+
+int handoff_listen(const char *path){
+    struct sockaddr_un addr;
+    if (!make_address(path, addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0){
+        perror("socket() error");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0){
+        perror("handoff socket error");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_connect(const char *path){
+    struct sockaddr_un addr;
+    if (!make_address(path, addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0){
+        perror("socket() error");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+        perror("handoff connect() error");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_chunk(int sock, const char *data, uint32_t bytes, const int *fds, uint32_t nfds){
+    HandoffChunk chunk = {bytes, nfds};
+    struct iovec iov[2];
+    iov[0].iov_base = &chunk;
+    iov[0].iov_len = sizeof(chunk);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = bytes;
+    char control[CMSG_SPACE(HANDOFF_CHUNK_FDS * sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (nfds > 0){
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+    while (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0){
+        if (errno != EINTR){
+            perror("handoff sendmsg() error");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sends len bytes and nfds fds as one handoff
+static bool send_all(int sock, const char *data, size_t len, const int *fds, size_t nfds){
+    HandoffTotals totals = {len, nfds};
+    if (!send_chunk(sock, (const char*)&totals, sizeof(totals), NULL, 0))
+        return false;
+    size_t sent = 0, fds_sent = 0;
+    while (sent < len || fds_sent < nfds){
+        uint32_t bytes = (uint32_t)std::min<size_t>(len - sent, HANDOFF_CHUNK);
+        uint32_t n = (uint32_t)std::min<size_t>(nfds - fds_sent, HANDOFF_CHUNK_FDS);
+        if (!send_chunk(sock, data + sent, bytes, fds + fds_sent, n))
+            return false;
+        sent += bytes;
+        fds_sent += n;
+    }
+    return true;
+}
+
+// Receives one message into buf, and appends the fds that came with it. Returns the data bytes, or -1
+static ssize_t recv_chunk(int sock, char *buf, size_t size, std::vector<int> &fds){
+    HandoffChunk chunk;
+    struct iovec iov[2];
+    iov[0].iov_base = &chunk;
+    iov[0].iov_len = sizeof(chunk);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = size;
+    char control[CMSG_SPACE(HANDOFF_CHUNK_FDS * sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0){
+        if (errno != EINTR){
+            perror("handoff recvmsg() error");
+            return -1;
+        }
+    }
+    size_t received = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int *data = (const int*)CMSG_DATA(cmsg);
+        fds.insert(fds.end(), data, data + count);
+        received += count;
+    }
+    // the connection went away, the message was cut short, or its fds don't match what it says it carries
+    if (n < (ssize_t)sizeof(chunk) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || n - sizeof(chunk) != chunk.bytes
+        || received != chunk.fds)
+        return -1;
+    return n - sizeof(chunk);
+}
+
+static void close_fds(std::vector<int> &fds){
+    for (int fd : fds)
+        close(fd);
+    fds.clear();
+}
+
+// Receives one handoff into data and fds
+static bool recv_all(int sock, std::string &data, std::vector<int> &fds){
+    HandoffTotals totals;
+    fds.clear();
+    if (recv_chunk(sock, (char*)&totals, sizeof(totals), fds) != (ssize_t)sizeof(totals) || !fds.empty()){
+        close_fds(fds);
+        return false;
+    }
+    data.resize(totals.bytes);
+    fds.reserve(totals.fds);
+    size_t received = 0;
+    while (received < totals.bytes || fds.size() < totals.fds){
+        ssize_t n = recv_chunk(sock, &data[received], std::min<size_t>(totals.bytes - received, HANDOFF_CHUNK), fds);
+        if (n < 0 || fds.size() > totals.fds){
+            close_fds(fds);
+            return false;
+        }
+        received += n;
+    }
+    return true;
+}
+
+bool handoff_send_message(int sock, const void *msg, size_t len){
+    return send_chunk(sock, (const char*)msg, (uint32_t)len, NULL, 0);
+}
+
+bool handoff_recv_message(int sock, void *msg, size_t len){
+    std::vector<int> fds;
+    bool ok = recv_chunk(sock, (char*)msg, len, fds) == (ssize_t)len && fds.empty();
+    close_fds(fds);
+    return ok;
+}
+
+bool send_shard_handoff(int sock, const ShardHandoff &handoff){
+    std::string data;
+    data.reserve(sizeof(handoff.header) + handoff.connections.size() * sizeof(ConnectionHandoff)
+        + handoff.sessions.size() * sizeof(SessionHandoff) + handoff.live_sessions.size() * sizeof(int32_t)
+        + handoff.buffered.size());
+    data.append((const char*)&handoff.header, sizeof(handoff.header));
+    data.append((const char*)handoff.connections.data(), handoff.connections.size() * sizeof(ConnectionHandoff));
+    data.append((const char*)handoff.sessions.data(), handoff.sessions.size() * sizeof(SessionHandoff));
+    data.append((const char*)handoff.live_sessions.data(), handoff.live_sessions.size() * sizeof(int32_t));
+    data.append(handoff.buffered);
+    return send_all(sock, data.data(), data.size(), handoff.fds.data(), handoff.fds.size());
+}
+
+bool recv_shard_handoff(int sock, ShardHandoff &handoff){
+    std::string data;
+    if (!recv_all(sock, data, handoff.fds))
+        return false;
+    if (data.size() < sizeof(handoff.header)){
+        close_fds(handoff.fds);
+        return false;
+    }
+    memcpy(&handoff.header, data.data(), sizeof(handoff.header));
+    const ShardHandoffHeader &header = handoff.header;
+    size_t connections_size = (size_t)header.connections * sizeof(ConnectionHandoff);
+    size_t sessions_size = (size_t)header.sessions * sizeof(SessionHandoff);
+    size_t live_size = (size_t)header.live_sessions * sizeof(int32_t);
+    if (data.size() < sizeof(header) + connections_size + sessions_size + live_size
+        || handoff.fds.size() < header.listen_fds || handoff.fds.size() > (size_t)header.listen_fds + header.connections){
+        close_fds(handoff.fds);
+        return false;
+    }
+    const char *p = data.data() + sizeof(header);
+    handoff.connections.resize(header.connections);
+    memcpy(handoff.connections.data(), p, connections_size);
+    p += connections_size;
+    handoff.sessions.resize(header.sessions);
+    memcpy((void*)handoff.sessions.data(), p, sessions_size);
+    p += sessions_size;
+    handoff.live_sessions.resize(header.live_sessions);
+    memcpy(handoff.live_sessions.data(), p, live_size);
+    p += live_size;
+    handoff.buffered.assign(p, data.data() + data.size() - p);
+
+    // Lengths have to add up before the shard trusts any of it. Indexes are checked against what the new shard has when it
+    // looks them up, since references in the final handoff can be to connections and games from the copy
+    size_t buffered = 0;
+    bool ok = header.waiting >= -1;
+    for (const ConnectionHandoff &c : handoff.connections){
+        ok = ok && c.index >= 0 && c.session >= -1 && c.inbuf_len < DEFAULT_BUFLEN;
+        buffered += (size_t)c.inbuf_len + c.outbuf_len;
+    }
+    for (const SessionHandoff &s : handoff.sessions)
+        ok = ok && s.index >= 0 && s.white >= -1 && s.black >= -1;
+    for (int32_t index : handoff.live_sessions)
+        ok = ok && index >= 0;
+    if (!ok || buffered != handoff.buffered.size()){
+        close_fds(handoff.fds);
+        return false;
+    }
+    return true;
+}
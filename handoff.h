@@ -0,0 +1,126 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "game.h"
+
+// Hands a running server's sockets and games over to a new server process, so a new build can be deployed without ending
+// a single game. The running server listens on a Unix domain socket (--handoff-socket). A new server started with
+// --take-over connects to it, and:
+// 1. The old server checks that the new one can take its games: same number of shards, same Game layout, same bot mode, and
+//    a state directory only if it had one.
+// 2. Each old shard copies its listening sockets, its connections and its games while it carries on serving them, a chunk
+//    of games per batch of events, and the old server sends the copies over. The sockets themselves go as SCM_RIGHTS
+//    ancillary data.
+// 3. The new server's shards set everything copied up (connections, games, and the sockets on their epoll sets) without
+//    touching the sockets yet, and the new server says it's ready.
+// 4. Each old shard stops between two batches of events and exports what's changed since its copy: every connection still
+//    open (with any partial frame received and any output not sent yet), the sockets of connections opened since the copy,
+//    the games that changed or started since the copy, and the indexes of every game still going.
+// 5. The new shards bring their copies up to date and start serving, and the new server says it's running. The old server
+//    closes its copies of the sockets and exits.
+// Only steps 4 and 5 hold games up, and what they move grows with the games that were played in the meantime rather than
+// with every game the shard has, so the pause stays short however many sessions there are. The sockets stay open
+// throughout, so players only see the replies to their moves held up for the length of the pause, which both servers log.
+// If the new server goes away before saying it's running, the old server's shards just carry on. Bot searches in progress
+// are started over by the new server, and pondering is dropped.
+
+// With a state directory, the new server carries on journaling into the same directory, starting a new journal file, so
+// the last snapshot and journals still restore every game if it crashes before its first checkpoint.
+
+// Connections and games keep the index they were given in the copy. Ones opened or started after it get the next free
+// indexes when the final handoff is exported, and every reference between them (a connection's session, a game's players)
+// is by index.
+
+#define HANDOFF_MAGIC "CHHAND1"
+#define HANDOFF_VERSION 2
+
+// The new server's request, and the old server's reply with its own values and whether it accepted
+struct HandoffHello {
+    char magic[8];
+    uint32_t version;
+    uint32_t shards;
+    uint32_t game_size; // sizeof(Game), so builds with a different Game layout don't exchange games
+    uint8_t bot_mode;
+    uint8_t state_dir;
+    uint8_t accepted; // in the reply
+    uint8_t padding;
+};
+
+// The single byte the new server sends when its shards are ready for the final handoffs, and when they're running
+#define HANDOFF_READY 'R'
+#define HANDOFF_RUNNING 'G'
+
+struct ShardHandoffHeader {
+    uint32_t index;
+    uint32_t listen_fds; // the copy's first fds: the listening socket, and the shard's own port's if it has one
+    uint32_t connections; // in the copy, followed by one fd each. In the final handoff, only new connections have fds
+    uint32_t sessions;
+    uint32_t live_sessions; // final handoff: the indexes of every game still going
+    int32_t waiting; // the session waiting for an opponent, or -1
+    uint32_t max_connections, max_sessions; // the old shard's pool sizes, so the new shard has room for all it hands over
+    uint64_t next_game_id;
+    uint64_t journal_seq; // the journal file the old shard was writing, or 0 without a state directory
+    int64_t resume_ms_left; // how long the players of restored games still have to come back, or -1
+    uint64_t stopped_ns; // CLOCK_MONOTONIC time the old shard stopped at, to measure the pause from
+};
+
+struct ConnectionHandoff {
+    int32_t index;
+    int32_t session; // index of the connection's session, or -1
+    char color;
+    uint8_t close_after_flush;
+    uint8_t resuming;
+    uint8_t padding;
+    uint32_t inbuf_len; // bytes of a partly received frame
+    uint32_t outbuf_len; // bytes queued and not sent yet
+};
+
+struct SessionHandoff {
+    int32_t index;
+    int32_t white, black; // indexes of the players' connections, or -1
+    uint32_t plies;
+    uint64_t id;
+    uint64_t gateway_key;
+    uint32_t resume_codes[2];
+    char last_move[8];
+    uint8_t state; // a SessionState
+    uint8_t bot_game;
+    char to_move;
+    uint8_t padding[5];
+    Game game;
+};
+
+// Everything a shard hands over in one step
+struct ShardHandoff {
+    ShardHandoffHeader header;
+    std::vector<int> fds; // header.listen_fds listening sockets, then one per connection that's new to the new server
+    std::vector<ConnectionHandoff> connections;
+    std::vector<SessionHandoff> sessions;
+    std::vector<int32_t> live_sessions;
+    std::string buffered; // each connection's partial frame and unsent output, one connection after another
+};
+
+// The old server's end: listens on a Unix socket at path, replacing any socket file already there. Returns -1 on failure
+int handoff_listen(const char *path);
+
+// The new server's end. Returns -1 on failure
+int handoff_connect(const char *path);
+
+// Sends or receives a small fixed size message, like a HandoffHello. Both return false if the socket fails (or, receiving,
+// if the message isn't len bytes)
+bool handoff_send_message(int sock, const void *msg, size_t len);
+bool handoff_recv_message(int sock, void *msg, size_t len);
+
+// Sends a shard's handoff, or receives one. Both return false if the socket fails or the data doesn't add up
+bool send_shard_handoff(int sock, const ShardHandoff &handoff);
+bool recv_shard_handoff(int sock, ShardHandoff &handoff);
+
+// nanoseconds on CLOCK_MONOTONIC, which both servers share
+uint64_t handoff_clock_ns();
+
+#endif // HANDOFF_H
@@ -0,0 +1,45 @@
+#include <algorithm>
+
+#include "hash_ring.h"
+
+uint64_t HashRing::hash_key(uint64_t key){
+    // splitmix64's finalizer
+    key += 0x9e3779b97f4a7c15ull;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+    return key ^ (key >> 31);
+}
+
+// FNV-1a
+static uint64_t hash_name(const std::string &name){
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char ch : name){
+        h ^= ch;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+HashRing::HashRing(const std::vector<std::string> &nodes){
+    points.reserve(nodes.size() * HASH_RING_POINTS);
+    for (size_t i = 0; i < nodes.size(); i++){
+        uint64_t base = hash_name(nodes[i]);
+        for (int p = 0; p < HASH_RING_POINTS; p++)
+            points.push_back({hash_key(base + p), (int)i});
+    }
+    std::sort(points.begin(), points.end(), [](const Point &a, const Point &b){
+        return a.hash < b.hash;
+    });
+}
+
+int HashRing::node_for(uint64_t key) const{
+    if (points.empty())
+        return -1;
+    uint64_t h = hash_key(key);
+    auto it = std::lower_bound(points.begin(), points.end(), h, [](const Point &point, uint64_t hash){
+        return point.hash < hash;
+    });
+    if (it == points.end())
+        it = points.begin();
+    return it->node;
+}
@@ -0,0 +1,36 @@
+#ifndef HASH_RING_H
+#define HASH_RING_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A consistent hash ring, for the gateway to spread games over game server nodes (see gateway.cpp). Every node is put at
+// HASH_RING_POINTS pseudo-random points around a ring of 64-bit hashes, which depend only on the node's name, and a key
+// belongs to the node at the first point at or after the key's hash. Adding a node to N others only moves the keys that
+// land just before its points, about 1/(N+1) of them, and every one of those moves to the new node; removing a node only
+// moves its own keys. The points even out how many keys each node gets, to within a few percent.
+
+#define HASH_RING_POINTS 160
+
+class HashRing {
+    public:
+        // a ring over nodes, by name. Rings made with the same name put that node at the same points
+        HashRing(const std::vector<std::string> &nodes);
+
+        // the index in nodes of the node a key belongs to, or -1 if there are no nodes
+        int node_for(uint64_t key) const;
+
+        // mixes the bits of a key, so keys that count up still land all around the ring
+        static uint64_t hash_key(uint64_t key);
+
+    private:
+        struct Point {
+            uint64_t hash;
+            int node;
+        };
+
+        std::vector<Point> points; // sorted by hash
+};
+
+#endif // HASH_RING_H
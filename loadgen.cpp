@@ -0,0 +1,474 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "net.h"
+#include "utils.h"
+#include "game.h"
+
+// A load generator for the server. It opens a number of connections and has every one of them play random legal moves
+// as fast as the server answers (or after a fixed think time), starting a new game on a fresh connection whenever one ends.
+// Each connection keeps its own copy of its game, following the opponent's moves from the "just moved" messages, so it
+// only ever sends legal moves and any "Invalid move" reply means the two copies disagree.
+
+// Reports moves per second and the latency of a move, measured from sending it to receiving the server's first reply, over
+// the whole run and over each fifth of it, which shows whether latency holds steady or keeps growing.
+
+// A player the server turns away for being busy (see admission.h) connects again as many seconds later as the server said.
+// With --arrival-rate, players arrive at that many a second instead, on top of the --connections there are at the start,
+// and every player leaves after one game or after being turned away. That's load that doesn't slow down when the server
+// does, as real players arriving don't, so past the server's capacity the games in progress pile up unless it sheds new ones.
+
+// Usage: loadgen [--host H] [--port P] [--connections N] [--duration S] [--think-ms MS] [--arrival-rate N] [--seed N]
+
+#define MAX_EVENTS 256
+// the latency percentiles are also reported over each of this many equal parts of the run
+#define LATENCY_SLICES 5
+
+typedef std::chrono::steady_clock Clock;
+
+struct Player {
+    socket_t fd;
+    int generation; // bumped on every reconnect, so stale think timers can be told apart
+    Game game;
+    char color; // ' ' until the welcome message says which side this is
+
+    char inbuf[DEFAULT_BUFLEN];
+    int inbuf_len;
+    std::string outbuf;
+    size_t out_offset;
+    bool want_write;
+
+    bool awaiting_reply;
+    Clock::time_point sent_at;
+    int retry_after_s; // set when the server turns the player away
+};
+
+struct Timer {
+    Clock::time_point due;
+    Player *player;
+    int generation;
+};
+
+struct LoadStats {
+    long moves;
+    long games_finished;
+    long turned_away;
+    long errors;
+    std::vector<uint32_t> latencies_us;
+    std::vector<uint32_t> slice_latencies_us[LATENCY_SLICES];
+};
+
+struct LoadGen {
+    const char *host;
+    const char *port;
+    int think_ms;
+    int epfd;
+    uint64_t rng;
+    std::deque<Timer> timers; // think time is the same for every move, so timers come due in the order they're added
+    std::deque<Timer> reconnects; // players turned away, to connect again. The server tells every one to wait as long
+    Clock::time_point start;
+    double duration;
+    LoadStats stats;
+};
+
+static uint64_t next_random(LoadGen &lg){
+    // xorshift64
+    lg.rng ^= lg.rng << 13;
+    lg.rng ^= lg.rng >> 7;
+    lg.rng ^= lg.rng << 17;
+    return lg.rng;
+}
+
+static void flush_player(LoadGen &lg, Player *p){
+    while (p->out_offset < p->outbuf.size()){
+        ssize_t n = send(p->fd, p->outbuf.data() + p->out_offset, p->outbuf.size() - p->out_offset, MSG_NOSIGNAL);
+        if (n < 0){
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && !p->want_write){
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLOUT;
+                ev.data.ptr = p;
+                epoll_ctl(lg.epfd, EPOLL_CTL_MOD, p->fd, &ev);
+                p->want_write = true;
+            }
+            return;
+        }
+        p->out_offset += n;
+    }
+    p->outbuf.clear();
+    p->out_offset = 0;
+    if (p->want_write){
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = p;
+        epoll_ctl(lg.epfd, EPOLL_CTL_MOD, p->fd, &ev);
+        p->want_write = false;
+    }
+}
+
+static void send_line(LoadGen &lg, Player *p, const char *line){
+    size_t len = strlen(line);
+    p->outbuf.append(line, len);
+    p->outbuf.append(DEFAULT_BUFLEN - len, '\0');
+    flush_player(lg, p);
+}
+
+// (Re)connects a player and starts it on a new game. Returns false if the server couldn't be reached
+static bool connect_player(LoadGen &lg, Player *p){
+    p->fd = net_connect(lg.host, lg.port);
+    if (p->fd == INVALID_SOCKET)
+        return false;
+    net_set_nonblocking(p->fd);
+    p->generation++;
+    p->game = Game();
+    p->color = ' ';
+    p->inbuf_len = 0;
+    p->outbuf.clear();
+    p->out_offset = 0;
+    p->want_write = false;
+    p->awaiting_reply = false;
+    p->retry_after_s = 0;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = p;
+    epoll_ctl(lg.epfd, EPOLL_CTL_ADD, p->fd, &ev);
+    return true;
+}
+
+static void disconnect_player(LoadGen &lg, Player *p){
+    epoll_ctl(lg.epfd, EPOLL_CTL_DEL, p->fd, NULL);
+    net_close(p->fd);
+    p->fd = INVALID_SOCKET;
+    p->generation++;
+}
+
+// picks a random legal move, plays it on the local copy and sends it. Promotions are always to a queen
+static void play_move(LoadGen &lg, Player *p){
+    std::vector<Move> moves;
+    p->game.generate_moves(p->color, moves);
+    if (moves.empty()){
+        send_line(lg, p, "resign\n");
+        return;
+    }
+    Move m = moves[next_random(lg) % moves.size()];
+    if (m.promotion != 0)
+        m.promotion = 'Q';
+    char buf[DEFAULT_BUFLEN];
+    Game::format_move(m, buf);
+    p->game.make_move(m, p->color);
+
+    p->awaiting_reply = true;
+    p->sent_at = Clock::now();
+    send_line(lg, p, buf);
+}
+
+// Handles one whole frame from the server. Returns false if the connection should be dropped
+static bool handle_frame(LoadGen &lg, Player *p){
+    p->inbuf[DEFAULT_BUFLEN - 1] = '\0';
+    char *delimiter = strchr(p->inbuf, '$');
+    if (delimiter == NULL){
+        lg.stats.errors++;
+        return false;
+    }
+    *delimiter = '\0';
+    const char *text = p->inbuf;
+    char next_step = delimiter[1];
+
+    if (p->awaiting_reply){
+        p->awaiting_reply = false;
+        lg.stats.moves++;
+        Clock::time_point now = Clock::now();
+        uint32_t us = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now - p->sent_at).count();
+        lg.stats.latencies_us.push_back(us);
+        int slice = (int)(std::chrono::duration<double>(now - lg.start).count() / lg.duration * LATENCY_SLICES);
+        lg.stats.slice_latencies_us[std::min(slice, LATENCY_SLICES - 1)].push_back(us);
+    }
+
+    const char *busy = strstr(text, "Try again in ");
+    if (busy != NULL && next_step == 'E'){
+        lg.stats.turned_away++;
+        p->retry_after_s = std::max(1, atoi(busy + strlen("Try again in ")));
+        return false;
+    }
+
+    if (p->color == ' '){
+        if (strstr(text, "Player 1!") != NULL)
+            p->color = 'W';
+        else if (strstr(text, "Player 2!") != NULL)
+            p->color = 'B';
+    }
+
+    // follow the opponent's move on the local copy of the game
+    const char *moved = strstr(text, " just moved: ");
+    if (moved != NULL){
+        char buf[DEFAULT_BUFLEN] = {0};
+        const char *move_text = moved + strlen(" just moved: ");
+        const char *end = strchr(move_text, '\n');
+        size_t len = (end != NULL) ? (size_t)(end - move_text + 1) : strlen(move_text);
+        memcpy(buf, move_text, std::min(len, (size_t)16));
+        char opponent = (p->color == 'W') ? 'B' : 'W';
+        if (p->game.make_move(buf, opponent) != MoveResult::Valid)
+            lg.stats.errors++;
+    }
+
+    if (strstr(text, "Invalid") != NULL){
+        // the local copy has gone out of step with the server's
+        lg.stats.errors++;
+        if (next_step == 'S')
+            send_line(lg, p, "resign\n");
+        return true;
+    }
+
+    if (next_step == 'E'){
+        // every game has a White here (in bot games, the bot is Black), so count games from White's side
+        if (p->color == 'W')
+            lg.stats.games_finished++;
+        return false;
+    }
+    if (next_step == 'S'){
+        if (lg.think_ms > 0){
+            Timer t;
+            t.due = Clock::now() + std::chrono::milliseconds(lg.think_ms);
+            t.player = p;
+            t.generation = p->generation;
+            lg.timers.push_back(t);
+        } else {
+            play_move(lg, p);
+        }
+    }
+    return true;
+}
+
+// Reads everything available from a player's socket. Returns false if the connection should be dropped
+static bool read_player(LoadGen &lg, Player *p){
+    while (1){
+        ssize_t n = recv(p->fd, p->inbuf + p->inbuf_len, DEFAULT_BUFLEN - p->inbuf_len, 0);
+        if (n > 0){
+            p->inbuf_len += (int)n;
+            if (p->inbuf_len == DEFAULT_BUFLEN){
+                p->inbuf_len = 0;
+                if (!handle_frame(lg, p))
+                    return false;
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            lg.stats.errors++;
+        return false;
+    }
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double p){
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t)(p * (sorted.size() - 1));
+    return sorted[i];
+}
+
+static void usage(){
+    printf("Usage: loadgen [--host H] [--port P] [--connections N] [--duration S] [--think-ms MS] [--arrival-rate N] [--seed N]\n");
+}
+
+// a player that isn't connected, to connect next
+static Player *idle_player(std::vector<Player*> &players, std::vector<Player*> &idle){
+    if (!idle.empty()){
+        Player *p = idle.back();
+        idle.pop_back();
+        return p;
+    }
+    Player *p = new Player();
+    p->fd = INVALID_SOCKET;
+    p->generation = 0;
+    players.push_back(p);
+    return p;
+}
+
+int main(int argc, char* argv[]){
+    LoadGen lg;
+    lg.host = NULL;
+    lg.port = DEFAULT_PORT;
+    lg.think_ms = 0;
+    lg.rng = 0x9E3779B97F4A7C15ULL;
+    lg.stats.moves = 0;
+    lg.stats.games_finished = 0;
+    lg.stats.turned_away = 0;
+    lg.stats.errors = 0;
+    int connections = 100;
+    double duration = 10;
+    double arrival_rate = 0;
+
+    for (int i = 1; i < argc; i++){
+        if (i + 1 >= argc){
+            usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "--host") == 0)
+            lg.host = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0)
+            lg.port = argv[++i];
+        else if (strcmp(argv[i], "--connections") == 0)
+            connections = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--duration") == 0)
+            duration = atof(argv[++i]);
+        else if (strcmp(argv[i], "--think-ms") == 0)
+            lg.think_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--arrival-rate") == 0)
+            arrival_rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0)
+            lg.rng = strtoull(argv[++i], NULL, 10) | 1;
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (connections < 0 || (connections == 0 && arrival_rate <= 0) || duration <= 0 || arrival_rate < 0){
+        usage();
+        return 1;
+    }
+
+    if (!net_startup())
+        return 1;
+    net_raise_fd_limit();
+    lg.epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    std::vector<Player*> players, idle;
+    for (int i = 0; i < connections; i++){
+        Player *p = idle_player(players, idle);
+        if (!connect_player(lg, p)){
+            printf("Couldn't open connection %d.\n", i);
+            return 1;
+        }
+    }
+    printf("Opened %d connections.\n", connections);
+
+    lg.start = Clock::now();
+    lg.duration = duration;
+    Clock::time_point end = lg.start + std::chrono::microseconds((long)(duration * 1e6));
+    Clock::time_point next_arrival = lg.start;
+    long arrivals = 0;
+    int open = connections, peak_open = connections;
+    struct epoll_event events[MAX_EVENTS];
+    while (1){
+        Clock::time_point now = Clock::now();
+        if (now >= end)
+            break;
+
+        // play the moves whose think time is up
+        while (!lg.timers.empty() && lg.timers.front().due <= now){
+            Timer t = lg.timers.front();
+            lg.timers.pop_front();
+            if (t.generation == t.player->generation)
+                play_move(lg, t.player);
+        }
+        // connect the players that were turned away and have waited, and the players that have arrived
+        while (!lg.reconnects.empty() && lg.reconnects.front().due <= now){
+            Player *p = lg.reconnects.front().player;
+            lg.reconnects.pop_front();
+            if (connect_player(lg, p))
+                open++;
+            else
+                lg.stats.errors++;
+        }
+        while (arrival_rate > 0 && next_arrival <= now){
+            Player *p = idle_player(players, idle);
+            if (connect_player(lg, p)){
+                open++;
+            } else {
+                lg.stats.errors++;
+                idle.push_back(p);
+            }
+            arrivals++;
+            next_arrival = lg.start + std::chrono::microseconds((long)(arrivals * 1e6 / arrival_rate));
+        }
+        peak_open = std::max(peak_open, open);
+
+        Clock::time_point wake = end;
+        if (!lg.timers.empty() && lg.timers.front().due < wake)
+            wake = lg.timers.front().due;
+        if (!lg.reconnects.empty() && lg.reconnects.front().due < wake)
+            wake = lg.reconnects.front().due;
+        if (arrival_rate > 0 && next_arrival < wake)
+            wake = next_arrival;
+        int timeout_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1;
+
+        int n = epoll_wait(lg.epfd, events, MAX_EVENTS, timeout_ms);
+        if (n < 0 && errno != EINTR){
+            printf("epoll_wait() error: %d\n", errno);
+            break;
+        }
+        for (int i = 0; i < n; i++){
+            Player *p = (Player*)events[i].data.ptr;
+            if (p->fd == INVALID_SOCKET)
+                continue;
+            bool keep = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                keep = read_player(lg, p);
+            if (keep && (events[i].events & EPOLLOUT))
+                flush_player(lg, p);
+            if (!keep){
+                // The game is over, so start another one on a fresh connection, later if the server was too busy for this
+                // one, or with players arriving, leave
+                disconnect_player(lg, p);
+                open--;
+                if (arrival_rate > 0){
+                    idle.push_back(p);
+                } else if (p->retry_after_s > 0){
+                    Timer t;
+                    t.due = Clock::now() + std::chrono::seconds(p->retry_after_s);
+                    t.player = p;
+                    t.generation = p->generation;
+                    lg.reconnects.push_back(t);
+                } else if (connect_player(lg, p)){
+                    open++;
+                } else {
+                    lg.stats.errors++;
+                }
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - lg.start).count();
+
+    for (Player *p : players){
+        if (p->fd != INVALID_SOCKET)
+            net_close(p->fd);
+        delete p;
+    }
+    close(lg.epfd);
+    net_cleanup();
+
+    std::vector<uint32_t> &lat = lg.stats.latencies_us;
+    std::sort(lat.begin(), lat.end());
+    if (arrival_rate > 0)
+        printf("Connections: %d at the start, %ld arrived (%.0f a second), at most %d at once\n", connections, arrivals,
+            arrival_rate, peak_open);
+    else
+        printf("Connections: %d\n", connections);
+    printf("Duration: %.1f s\n", seconds);
+    printf("Moves: %ld (%.0f moves/sec)\n", lg.stats.moves, lg.stats.moves / seconds);
+    printf("Games finished: %ld\n", lg.stats.games_finished);
+    printf("Turned away by the server: %ld\n", lg.stats.turned_away);
+    printf("Move latency (us): p50 %u, p90 %u, p99 %u, max %u\n", percentile(lat, 0.50), percentile(lat, 0.90),
+        percentile(lat, 0.99), lat.empty() ? 0 : lat.back());
+    printf("Move latency p99 (us) by fifth of the run:");
+    for (int i = 0; i < LATENCY_SLICES; i++){
+        std::vector<uint32_t> &slice = lg.stats.slice_latencies_us[i];
+        std::sort(slice.begin(), slice.end());
+        printf(" %u", percentile(slice, 0.99));
+    }
+    printf("\n");
+    printf("Errors: %ld\n", lg.stats.errors);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include "mate.h"
+
+// deepest the search goes: every attacker move and defender reply of the longest mate, and the defender's final position
+#define MAX_MATE_PLIES (2 * MAX_MATE_MOVES + 1)
+
+class MateSolver {
+    public:
+        MateSolver(char attacker, long max_nodes)
+            : attacker(attacker), defender((attacker == 'W') ? 'B' : 'W'), max_nodes(max_nodes), nodes(0), aborted(false){
+        }
+
+        // true if the attacker, to move, can mate in at most moves_left moves
+        bool attacker_mates(Game &game, int moves_left, int ply){
+            if (!count_node())
+                return false;
+            std::vector<Move> &moves = move_lists[ply];
+            game.generate_moves(attacker, moves);
+            for (size_t i = 0; i < moves.size(); i++){
+                Game child = game;
+                child.make_move(moves[i], attacker);
+                if (defender_loses(child, moves_left - 1, ply + 1))
+                    return true;
+                if (aborted)
+                    return false;
+            }
+            return false;
+        }
+
+        // true if the defender, to move, is mated now, or is mated in at most moves_left more attacker moves whatever
+        // they reply
+        bool defender_loses(Game &game, int moves_left, int ply){
+            if (!count_node())
+                return false;
+            if (game.get_draw_reason() != DrawReason::NoDraw)
+                return false;
+            // with no attacker moves left only mate itself will do, and that needs the king in check, which is far cheaper
+            // to find out than the defender's moves
+            if (moves_left == 0 && !game.in_check(defender))
+                return false;
+            std::vector<Move> &moves = move_lists[ply];
+            game.generate_moves(defender, moves);
+            if (moves.empty())
+                return game.in_check(defender);
+            if (moves_left == 0)
+                return false;
+            for (size_t i = 0; i < moves.size(); i++){
+                Game child = game;
+                child.make_move(moves[i], defender);
+                if (!attacker_mates(child, moves_left, ply + 1))
+                    return false;
+            }
+            return true;
+        }
+
+        // the fewest attacker moves the attacker, to move, mates in, up to max_moves, or 0
+        int shortest_mate(Game &game, int max_moves, int ply){
+            for (int n = 1; n <= max_moves && !aborted; n++){
+                if (attacker_mates(game, n, ply))
+                    return n;
+            }
+            return 0;
+        }
+
+        char attacker, defender;
+        long max_nodes, nodes;
+        bool aborted;
+
+    private:
+        // one list per ply, so generating moves deeper in the tree doesn't overwrite the ones being tried
+        std::vector<Move> move_lists[MAX_MATE_PLIES + 1];
+
+        bool count_node(){
+            nodes++;
+            if (max_nodes > 0 && nodes > max_nodes)
+                aborted = true;
+            return !aborted;
+        }
+};
+
+MateResult solve_mate(const Game &game, int max_moves, long max_nodes){
+    MateResult result;
+    result.mate_in = 0;
+    result.solutions = 0;
+    result.nodes = 0;
+    result.aborted = false;
+    if (max_moves > MAX_MATE_MOVES)
+        max_moves = MAX_MATE_MOVES;
+
+    Game position = game;
+    MateSolver solver(position.get_side_to_move(), max_nodes);
+    int mate_in = solver.shortest_mate(position, max_moves, 0);
+    if (mate_in > 0){
+        // every first move that mates that quickly. No move mates any quicker, or a shorter mate would have been found
+        std::vector<Move> first_moves;
+        position.generate_moves(solver.attacker, first_moves);
+        for (const Move &move : first_moves){
+            Game child = position;
+            child.make_move(move, solver.attacker);
+            if (solver.defender_loses(child, mate_in - 1, 1)){
+                if (result.solutions++ == 0)
+                    result.line.push_back(move);
+                if (result.solutions == 2)
+                    break;
+            }
+        }
+
+        // Play out the rest of the line: the reply that puts mate off longest, and then the move that mates quickest
+        // after it
+        Game line = position;
+        line.make_move(result.line[0], solver.attacker);
+        int left = mate_in - 1;
+        std::vector<Move> replies, moves;
+        while (left > 0 && !solver.aborted){
+            line.generate_moves(solver.defender, replies);
+            Move longest = replies[0];
+            int longest_left = -1;
+            for (const Move &reply : replies){
+                Game child = line;
+                child.make_move(reply, solver.defender);
+                int n = solver.shortest_mate(child, left, 0);
+                if (n > longest_left){
+                    longest = reply;
+                    longest_left = n;
+                }
+                if (n == left)
+                    break;
+            }
+            if (longest_left <= 0)
+                break;
+            line.make_move(longest, solver.defender);
+            result.line.push_back(longest);
+
+            line.generate_moves(solver.attacker, moves);
+            for (const Move &move : moves){
+                Game child = line;
+                child.make_move(move, solver.attacker);
+                if (solver.defender_loses(child, longest_left - 1, 1)){
+                    line.make_move(move, solver.attacker);
+                    result.line.push_back(move);
+                    break;
+                }
+            }
+            left = longest_left - 1;
+        }
+        // the defender's last reply, into mate, isn't part of the line
+    }
+    result.mate_in = mate_in;
+    result.nodes = solver.nodes;
+    result.aborted = solver.aborted;
+    return result;
+}
@@ -0,0 +1,30 @@
+#ifndef MATE_H
+#define MATE_H
+
+#include <cstddef>
+#include <vector>
+
+#include "game.h"
+
+// A dedicated solver for forced mates, separate from the bot's search. It doesn't score positions at all: it's a depth
+// first search of an AND/OR tree built straight on Game's rules, where the attacker needs one move that mates (OR) and
+// every reply of the defender has to lose (AND). Mates are looked for one move longer at a time, so the first mate found
+// is the shortest. Checkmate is the defender having no legal move while in check; stalemate and Game's draw rules end the
+// line without a mate.
+
+// the longest mate solve_mate looks for, in the attacker's moves
+#define MAX_MATE_MOVES 8
+
+struct MateResult {
+    int mate_in; // the attacker's moves to the shortest forced mate, or 0 if none was found
+    int solutions; // how many first moves mate in mate_in: 1 for a unique solution. Counting stops at 2
+    std::vector<Move> line; // the solution, with the defender putting off mate as long as they can at each reply
+    long nodes; // positions searched
+    bool aborted; // ran out of nodes, so a mate (or a second solution, or the rest of the line) may have been missed
+};
+
+// Looks for a forced mate by the player to move in at most max_moves of their moves (up to MAX_MATE_MOVES), searching no
+// more than max_nodes positions (0 for no limit). The game passed in is left untouched.
+MateResult solve_mate(const Game &game, int max_moves, long max_nodes = 0);
+
+#endif // MATE_H
@@ -0,0 +1,751 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <regex.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "game.h"
+#include "eval.h"
+#include "session.h"
+
+// Microbenchmarks for the hot paths of the game and the server's protocol: making each kind of move, evaluating a position,
+// printing the board, generating legal moves, reading and writing moves, a shard setting up and tearing down sessions, and recording a timeline
+// event (see timeline.h). Every benchmark reports the wall and CPU time per operation, heap allocations per operation, and
+// (where the kernel lets us read the hardware counters) instructions per operation.
+
+// It's modelled on Google Benchmark, whose flags it takes: each benchmark body loops "for (auto _ : state)", and runs
+// enough iterations to fill --benchmark_min_time. --benchmark_out writes the results as JSON (one benchmark per line), and
+// --compare reads such a file back and shows how much each benchmark changed, so a change can be checked against a run
+// from before it.
+
+// Usage: microbench [--benchmark_filter=REGEX] [--benchmark_min_time=S] [--benchmark_out=FILE] [--benchmark_format=console|json] [--compare=FILE]
+
+// Every allocation through operator new is counted, which covers the containers and strings the server uses. The counter
+// isn't atomic: the only threads running while a benchmark is measured are the benchmark's own.
+static long allocations;
+
+void *operator new(size_t size){
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size){
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept {
+    allocations++;
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+// keeps the compiler from optimizing away a value the benchmark never looks at
+template <typename T>
+static void keep(T &value){
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+// Counts the instructions this thread runs in user space. Unavailable in most containers and VMs, and when
+// perf_event_paranoid forbids it, in which case instructions aren't reported
+class InstructionCounter {
+    public:
+        InstructionCounter(){
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+
+        ~InstructionCounter(){
+            if (fd >= 0)
+                close(fd);
+        }
+
+        bool available(){
+            return fd >= 0;
+        }
+
+        void start(){
+            if (fd >= 0){
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+
+        long stop(){
+            long count = 0;
+            if (fd >= 0){
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd, &count, sizeof(count)) != sizeof(count))
+                    count = 0;
+            }
+            return count;
+        }
+
+    private:
+        int fd;
+};
+
+static InstructionCounter *instruction_counter;
+
+static double thread_cpu_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What a benchmark body is handed. Looping over it runs the timed part: the counters start when the loop does, and stop
+// when it ends, so setup before the loop isn't measured
+class State {
+    public:
+        explicit State(long iterations) : iterations(iterations){
+        }
+
+        struct Iterator {
+            State *state;
+            long left;
+
+            bool operator!=(const Iterator&){
+                if (left != 0)
+                    return true;
+                state->stop();
+                return false;
+            }
+
+            void operator++(){
+                left--;
+            }
+
+            int operator*() const {
+                return 0;
+            }
+        };
+
+        Iterator begin(){
+            start();
+            return Iterator{this, iterations};
+        }
+
+        Iterator end(){
+            return Iterator{this, 0};
+        }
+
+        long iterations;
+        double real_seconds, cpu_seconds;
+        long allocations_made, instructions;
+
+    private:
+        void start(){
+            allocations_made = allocations;
+            cpu_seconds = thread_cpu_seconds();
+            instruction_counter->start();
+            start_time = std::chrono::steady_clock::now();
+        }
+
+        void stop(){
+            real_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            instructions = instruction_counter->stop();
+            cpu_seconds = thread_cpu_seconds() - cpu_seconds;
+            allocations_made = allocations - allocations_made;
+        }
+
+        std::chrono::steady_clock::time_point start_time;
+};
+
+// a middlegame position (an Italian game) where every white piece has a quiet move, and a knight can capture
+static const char *MIDDLEGAME_FEN = "r1bqk2r/pppp1ppp/2n2n2/2b1p3/2B1P3/5N2/PPPPQPPP/RNB1K2R w KQkq - 4 5";
+static const char *PROMOTION_FEN = "4k3/1P6/8/8/8/8/8/4K3 w - - 0 1";
+
+static Game middlegame, promotion_position;
+
+static Move parse(const char *text){
+    Move move;
+    if (!Game::parse_move(text, move)){
+        printf("Bad benchmark move: %s", text);
+        exit(1);
+    }
+    return move;
+}
+
+// Each make_move benchmark copies the position and makes one move on the copy, since moves can't be taken back. The cost
+// of the copy alone is game/copy
+static void make_move_from(State &state, const Game &position, const char *text){
+    Move move = parse(text);
+    Game check = position;
+    if (check.make_move(move, 'W') != MoveResult::Valid){
+        printf("Benchmark move isn't legal: %s", text);
+        exit(1);
+    }
+    for (auto _ : state){
+        Game game = position;
+        game.make_move(move, 'W');
+        keep(game);
+    }
+}
+
+static void bench_copy(State &state){
+    for (auto _ : state){
+        Game game = middlegame;
+        keep(game);
+    }
+}
+
+static void bench_pawn(State &state){
+    make_move_from(state, middlegame, "a2a3\n");
+}
+
+static void bench_knight(State &state){
+    make_move_from(state, middlegame, "f3g5\n");
+}
+
+static void bench_bishop(State &state){
+    make_move_from(state, middlegame, "c4b5\n");
+}
+
+static void bench_rook(State &state){
+    make_move_from(state, middlegame, "h1g1\n");
+}
+
+static void bench_queen(State &state){
+    make_move_from(state, middlegame, "e2e3\n");
+}
+
+static void bench_king(State &state){
+    make_move_from(state, middlegame, "e1f1\n");
+}
+
+static void bench_castle(State &state){
+    make_move_from(state, middlegame, "e1g1\n");
+}
+
+static void bench_capture(State &state){
+    make_move_from(state, middlegame, "f3e5\n");
+}
+
+static void bench_promote_queen(State &state){
+    make_move_from(state, promotion_position, "b7b8q\n");
+}
+
+static void bench_promote_knight(State &state){
+    make_move_from(state, promotion_position, "b7b8n\n");
+}
+
+static void bench_generate_moves(State &state){
+    std::vector<Move> moves;
+    for (auto _ : state){
+        middlegame.generate_moves('W', moves);
+        keep(moves);
+    }
+}
+
+// The validate_moves benchmarks make one move in each of many games, the way a shard does for the moves that arrive in a
+// batch of events: either checking each against the player's legal moves before making it, as the server used to, or all
+// at once with Game::make_moves. The games are allocated one by one and visited in a shuffled order, so they're scattered
+// across the heap as sessions are. Each iteration is VALIDATE_BATCH moves. Once every game has had its move, they're all
+// copied back from where they started, which adds a game/copy to each move of both benchmarks.
+#define VALIDATE_GAMES 16384
+#define VALIDATE_BATCH 256
+
+struct ValidateGames {
+    std::vector<Game> positions; // each game as it starts
+    std::vector<Game*> games; // the games the moves are made in
+    std::vector<Move> moves;
+    std::vector<char> colors;
+
+    ValidateGames(){
+        srand(1);
+        for (int i = 0; i < VALIDATE_GAMES; i++){
+            // a position from a few random moves into a game, and a legal move in it
+            Game game;
+            std::vector<Move> legal;
+            int plies = 4 + rand() % 30;
+            for (int ply = 0; ; ply++){
+                game.generate_moves(game.get_side_to_move(), legal);
+                bool over = game.get_white_won() || game.get_black_won() || game.get_draw_reason() != DrawReason::NoDraw;
+                if (over || legal.empty()){
+                    game = Game();
+                    ply = 0;
+                    continue;
+                }
+                if (ply == plies)
+                    break;
+                game.make_move(legal[rand() % legal.size()], game.get_side_to_move());
+            }
+            positions.push_back(game);
+            moves.push_back(legal[rand() % legal.size()]);
+            colors.push_back(game.get_side_to_move());
+            games.push_back(new Game(game));
+        }
+        for (int i = VALIDATE_GAMES - 1; i > 0; i--){
+            int j = rand() % (i + 1);
+            std::swap(positions[i], positions[j]);
+            std::swap(games[i], games[j]);
+            std::swap(moves[i], moves[j]);
+            std::swap(colors[i], colors[j]);
+        }
+    }
+
+    ~ValidateGames(){
+        for (Game *game : games)
+            delete game;
+    }
+
+    void reset(){
+        for (int i = 0; i < VALIDATE_GAMES; i++)
+            *games[i] = positions[i];
+    }
+};
+
+static void bench_validate_per_call(State &state){
+    ValidateGames set;
+    std::vector<Move> legal;
+    int next = 0;
+    for (auto _ : state){
+        if (next == VALIDATE_GAMES){
+            set.reset();
+            next = 0;
+        }
+        for (int i = next; i < next + VALIDATE_BATCH; i++){
+            Game *game = set.games[i];
+            const Move &move = set.moves[i];
+            game->generate_moves(set.colors[i], legal);
+            bool found = false;
+            for (const Move &m : legal){
+                if (m.from_row == move.from_row && m.from_col == move.from_col && m.to_row == move.to_row && m.to_col == move.to_col
+                    && m.promotion == move.promotion)
+                    found = true;
+            }
+            MoveResult result = found ? game->make_move(move, set.colors[i]) : MoveResult::Invalid;
+            keep(result);
+        }
+        next += VALIDATE_BATCH;
+    }
+}
+
+static void bench_validate_batch(State &state){
+    ValidateGames set;
+    std::vector<Game::BatchMove> batch(VALIDATE_BATCH);
+    int next = 0;
+    for (auto _ : state){
+        if (next == VALIDATE_GAMES){
+            set.reset();
+            next = 0;
+        }
+        for (int i = 0; i < VALIDATE_BATCH; i++)
+            batch[i] = {set.games[next + i], set.moves[next + i], set.colors[next + i], MoveResult::Invalid};
+        Game::make_moves(batch.data(), batch.size());
+        keep(batch);
+        next += VALIDATE_BATCH;
+    }
+}
+
+static void bench_format_table(State &state){
+    char buf[DEFAULT_BUFLEN];
+    for (auto _ : state){
+        middlegame.format_table_to_print(buf);
+        keep(buf);
+    }
+}
+
+// The bot's evaluation of the middlegame position added up from scratch, tile by tile, the way a Game is scored when it's
+// made. Games never do this again (see eval.h), so it's what the running evaluation saves at every node of a search.
+// Evaluations a second are 1e9 over the nanoseconds
+static void bench_evaluate(State &state){
+    for (auto _ : state){
+        keep(middlegame);
+        int score = 0;
+        for (int row = 0; row < 8; row++){
+            for (int col = 0; col < 8; col++){
+                Piece piece = middlegame.get_piece(row, col);
+                score += piece_square_value(piece.color, piece.type, row, col);
+            }
+        }
+        keep(score);
+    }
+}
+
+// what keeping the evaluation up to date costs a quiet move (the knight from f3 to g5): its old tile's value out and its new
+// one's in
+static void bench_evaluate_update(State &state){
+    Piece knight = middlegame.get_piece(5, 5);
+    int score = middlegame.get_evaluation();
+    for (auto _ : state){
+        keep(knight);
+        score -= piece_square_value(knight.color, knight.type, 5, 5);
+        score += piece_square_value(knight.color, knight.type, 3, 6);
+        keep(score);
+    }
+}
+
+// reading a move out of a received frame
+static void bench_parse_move(State &state){
+    char frame[DEFAULT_BUFLEN] = "e7e8q\n";
+    Move move;
+    for (auto _ : state){
+        keep(frame);
+        bool ok = Game::parse_move(frame, move);
+        keep(ok);
+        keep(move);
+    }
+}
+
+// writing a move into a frame, as the server does for every move it tells a player about
+static void bench_format_move(State &state){
+    Move move = parse("e7e8q\n");
+    char frame[DEFAULT_BUFLEN];
+    for (auto _ : state){
+        keep(move);
+        Game::format_move(move, frame);
+        keep(frame);
+    }
+}
+
+static ShardConfig shard_config(){
+    ShardConfig config;
+    config.bot_mode = false;
+    config.bot_think_ms = 0;
+    config.engine_threads = 0;
+    config.hash_mb = 0;
+    config.ponder_budget = NULL;
+    config.eval_cache = NULL;
+    config.max_sessions = 16;
+    config.verbose = false;
+    config.state_dir = NULL;
+    config.checkpoint_interval_s = 10;
+    config.record_path = NULL;
+    config.admission = AdmissionLimits();
+    config.memory_budget = NULL;
+    return config;
+}
+
+// what a backend does at the end of a batch, except the frames are dropped rather than sent
+static void drain(Shard &shard){
+    shard.end_batch();
+    for (Connection *c : shard.pending_writes){
+        c->write_pending = false;
+        shard.output_sent(c);
+    }
+    shard.pending_writes.clear();
+}
+
+// Two players connect (and are sent their welcome, board and legal moves), then both disconnect, and the shard releases
+// their connections at the end of the batch. No sockets are involved
+static void bench_session(State &state){
+    Shard shard(0, shard_config());
+    for (auto _ : state){
+        Connection *white = shard.open_connection(-1);
+        Connection *black = shard.open_connection(-1);
+        drain(shard);
+        shard.close_connection(white);
+        shard.close_connection(black);
+        drain(shard);
+        shard.release_closed();
+    }
+}
+
+// A game set up as above, four moves received as frames (each read, then checked and played at the end of its batch, and answered
+// with the board and the opponent's legal moves), and torn down. Less bench_session, this is the cost of four move frames
+static void bench_four_moves(State &state){
+    Shard shard(0, shard_config());
+    const char *moves[4] = {"e2e4\n", "e7e5\n", "g1f3\n", "b8c6\n"};
+    std::vector<std::string> frames;
+    for (const char *move : moves){
+        std::string frame(move);
+        frame.resize(DEFAULT_BUFLEN, '\0');
+        frames.push_back(frame);
+    }
+    for (auto _ : state){
+        Connection *players[2];
+        players[0] = shard.open_connection(-1);
+        players[1] = shard.open_connection(-1);
+        drain(shard);
+        for (int i = 0; i < 4; i++){
+            shard.receive(players[i % 2], frames[i].data(), DEFAULT_BUFLEN);
+            drain(shard);
+        }
+        shard.close_connection(players[0]);
+        shard.close_connection(players[1]);
+        drain(shard);
+        shard.release_closed();
+    }
+}
+
+// One timeline event, the way the server records each recv, parse, render, encode and send: with the timeline off (all
+// that's left in the server normally) and on
+static void bench_timeline(State &state, bool on){
+    timeline_set_enabled(on);
+    uint64_t id = 0;
+    for (auto _ : state){
+        TimelineSpan span(TimelineEncode, id++, DEFAULT_BUFLEN);
+    }
+    timeline_set_enabled(false);
+}
+
+static void bench_timeline_off(State &state){
+    bench_timeline(state, false);
+}
+
+static void bench_timeline_on(State &state){
+    bench_timeline(state, true);
+}
+
+// the four move game with the timeline on, against session/four_move_game
+static void bench_four_moves_timeline(State &state){
+    timeline_set_enabled(true);
+    bench_four_moves(state);
+    timeline_set_enabled(false);
+}
+
+struct Benchmark {
+    const char *name;
+    void (*run)(State&);
+};
+
+static const Benchmark BENCHMARKS[] = {
+    {"game/copy", bench_copy},
+    {"game/make_move/pawn", bench_pawn},
+    {"game/make_move/knight", bench_knight},
+    {"game/make_move/bishop", bench_bishop},
+    {"game/make_move/rook", bench_rook},
+    {"game/make_move/queen", bench_queen},
+    {"game/make_move/king", bench_king},
+    {"game/make_move/castle", bench_castle},
+    {"game/make_move/capture", bench_capture},
+    {"game/make_move/promote_queen", bench_promote_queen},
+    {"game/make_move/promote_knight", bench_promote_knight},
+    {"game/generate_moves", bench_generate_moves},
+    {"game/validate_moves/per_call", bench_validate_per_call},
+    {"game/validate_moves/batch", bench_validate_batch},
+    {"game/format_table_to_print", bench_format_table},
+    {"eval/evaluate", bench_evaluate},
+    {"eval/update", bench_evaluate_update},
+    {"protocol/parse_move", bench_parse_move},
+    {"protocol/format_move", bench_format_move},
+    {"session/setup_teardown", bench_session},
+    {"session/four_move_game", bench_four_moves},
+    {"session/four_move_game/timeline", bench_four_moves_timeline},
+    {"timeline/event/off", bench_timeline_off},
+    {"timeline/event/on", bench_timeline_on},
+};
+
+struct Result {
+    std::string name;
+    long iterations;
+    double real_ns, cpu_ns; // per iteration
+    double allocations, instructions; // per iteration. instructions is negative if it couldn't be counted
+};
+
+// Runs a benchmark with more and more iterations until a run takes at least min_time, like Google Benchmark does
+static Result run_benchmark(const Benchmark &benchmark, double min_time){
+    long iterations = 1;
+    while (1){
+        State state(iterations);
+        benchmark.run(state);
+        if (state.real_seconds >= min_time || iterations >= 1000000000L){
+            Result result;
+            result.name = benchmark.name;
+            result.iterations = iterations;
+            result.real_ns = state.real_seconds * 1e9 / iterations;
+            result.cpu_ns = state.cpu_seconds * 1e9 / iterations;
+            result.allocations = (double)state.allocations_made / iterations;
+            result.instructions = instruction_counter->available() ? (double)state.instructions / iterations : -1;
+            return result;
+        }
+        // aim a little past min_time, but never grow by more than ten times on a run too short to time well
+        double factor = (state.real_seconds > 0) ? min_time * 1.4 / state.real_seconds : 10;
+        if (factor > 10 || state.real_seconds < min_time / 10)
+            factor = 10;
+        long next = (long)(iterations * factor);
+        iterations = (next > iterations) ? next : iterations + 1;
+    }
+}
+
+static std::string format_json(const std::vector<Result> &results){
+    char line[512];
+    time_t now = time(NULL);
+    char date[64];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    std::string json = "{\n";
+    snprintf(line, sizeof(line), "  \"context\": {\"date\": \"%s\", \"host_name\": \"%s\", \"num_cpus\": %ld, \"instructions_counted\": %s},\n",
+        date, host, sysconf(_SC_NPROCESSORS_ONLN), instruction_counter->available() ? "true" : "false");
+    json += line;
+    json += "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++){
+        const Result &r = results[i];
+        char instructions[32] = "null";
+        if (r.instructions >= 0)
+            snprintf(instructions, sizeof(instructions), "%.1f", r.instructions);
+        snprintf(line, sizeof(line), "    {\"name\": \"%s\", \"iterations\": %ld, \"real_time\": %.2f, \"cpu_time\": %.2f, "
+            "\"time_unit\": \"ns\", \"allocs_per_iter\": %.2f, \"instructions_per_iter\": %s}%s\n", r.name.c_str(),
+            r.iterations, r.real_ns, r.cpu_ns, r.allocations, instructions, (i + 1 < results.size()) ? "," : "");
+        json += line;
+    }
+    json += "  ]\n}\n";
+    return json;
+}
+
+// reads the name and real time of each benchmark from a file format_json wrote
+static bool read_json(const char *path, std::vector<Result> &results){
+    FILE *file = fopen(path, "r");
+    if (file == NULL){
+        perror("fopen() error");
+        return false;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL){
+        char name[256];
+        Result r;
+        if (sscanf(line, " {\"name\": \"%255[^\"]\", \"iterations\": %ld, \"real_time\": %lf, \"cpu_time\": %lf", name,
+            &r.iterations, &r.real_ns, &r.cpu_ns) == 4){
+            r.name = name;
+            results.push_back(r);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+static void print_header(){
+    printf("%-32s %12s %12s %12s %10s %10s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations", "Allocs/op", "Instr/op");
+    printf("%s\n", std::string(93, '-').c_str());
+}
+
+static void print_row(const Result &r){
+    char instructions[32] = "-";
+    if (r.instructions >= 0)
+        snprintf(instructions, sizeof(instructions), "%.0f", r.instructions);
+    printf("%-32s %12.1f %12.1f %12ld %10.2f %10s\n", r.name.c_str(), r.real_ns, r.cpu_ns, r.iterations, r.allocations,
+        instructions);
+}
+
+static void print_comparison(const std::vector<Result> &before, const std::vector<Result> &after){
+    printf("\n%-32s %12s %12s %9s\n", "Benchmark", "Before (ns)", "After (ns)", "Change");
+    printf("%s\n", std::string(68, '-').c_str());
+    for (const Result &r : after){
+        for (const Result &old : before){
+            if (old.name == r.name){
+                printf("%-32s %12.1f %12.1f %+8.1f%%\n", r.name.c_str(), old.real_ns, r.real_ns,
+                    (r.real_ns - old.real_ns) * 100 / old.real_ns);
+                break;
+            }
+        }
+    }
+}
+
+static void usage(){
+    printf("Usage: microbench [--benchmark_filter=REGEX] [--benchmark_min_time=S] [--benchmark_out=FILE] [--benchmark_format=console|json] [--compare=FILE]\n");
+}
+
+int main(int argc, char* argv[]){
+    const char *filter = NULL;
+    const char *out_path = NULL;
+    const char *compare_path = NULL;
+    double min_time = 0.5;
+    bool json = false;
+    for (int i = 1; i < argc; i++){
+        if (strncmp(argv[i], "--benchmark_filter=", 19) == 0){
+            filter = argv[i] + 19;
+        } else if (strncmp(argv[i], "--benchmark_min_time=", 21) == 0){
+            min_time = atof(argv[i] + 21);
+        } else if (strncmp(argv[i], "--benchmark_out=", 16) == 0){
+            out_path = argv[i] + 16;
+        } else if (strcmp(argv[i], "--benchmark_format=json") == 0){
+            json = true;
+        } else if (strcmp(argv[i], "--benchmark_format=console") == 0){
+            json = false;
+        } else if (strncmp(argv[i], "--compare=", 10) == 0){
+            compare_path = argv[i] + 10;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (min_time <= 0){
+        usage();
+        return 1;
+    }
+
+    regex_t filter_regex;
+    if (filter != NULL && regcomp(&filter_regex, filter, REG_EXTENDED | REG_NOSUB) != 0){
+        printf("Bad --benchmark_filter: %s\n", filter);
+        return 1;
+    }
+    std::vector<Result> before;
+    if (compare_path != NULL && !read_json(compare_path, before))
+        return 1;
+
+    middlegame.load_fen(MIDDLEGAME_FEN);
+    promotion_position.load_fen(PROMOTION_FEN);
+    instruction_counter = new InstructionCounter();
+    if (!json && !instruction_counter->available())
+        printf("Hardware counters aren't available here (see /proc/sys/kernel/perf_event_paranoid), so instructions aren't counted.\n\n");
+
+    std::vector<Result> results;
+    if (!json)
+        print_header();
+    for (const Benchmark &benchmark : BENCHMARKS){
+        if (filter != NULL && regexec(&filter_regex, benchmark.name, 0, NULL, 0) != 0)
+            continue;
+        results.push_back(run_benchmark(benchmark, min_time));
+        // print each one as it finishes, the way Google Benchmark does
+        if (!json)
+            print_row(results.back());
+    }
+    if (filter != NULL)
+        regfree(&filter_regex);
+
+    std::string output = format_json(results);
+    if (json)
+        fputs(output.c_str(), stdout);
+    if (out_path != NULL){
+        FILE *file = fopen(out_path, "w");
+        if (file == NULL){
+            perror("fopen() error");
+            return 1;
+        }
+        fputs(output.c_str(), file);
+        fclose(file);
+    }
+    if (compare_path != NULL)
+        print_comparison(before, results);
+    delete instruction_counter;
+    return 0;
+}
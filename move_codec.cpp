@@ -0,0 +1,358 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "move_codec.h"
+#include "eval.h"
+
+// the range coder keeps its range above this, so a byte can be shifted out whenever it drops below
+#define RANGE_TOP (1u << 24)
+
+// How often the move played is the first, second, third... in the order rank_moves puts them, out of about 60000. Counted
+// over the bot's games against itself (searching two plies deep, from a few random opening moves) and smoothed, with every
+// place past the end of the table given RANK_TAIL_FREQ. No position has more than 218 legal moves, so the total stays
+// under 16 bits, which the range coder needs.
+static const uint16_t RANK_FREQ[] = {
+    27884, 5670, 3775, 2242, 2128, 1395, 1370, 1160, 995, 843, 839, 836, 770, 757, 742, 700,
+    685, 679, 620, 571, 523, 474, 422, 388, 360, 332, 304, 277, 253, 236, 217, 203,
+    172, 150, 132, 114, 102, 90, 77, 67, 54, 47, 43, 35, 28, 26, 23, 21,
+    20, 19, 16, 15, 12, 11, 11, 10, 9, 8, 7, 7, 7, 6, 6, 6,
+};
+#define RANK_TAIL_FREQ 4
+#define MAX_LEGAL_MOVES 256
+
+struct RankTable {
+    uint32_t cum[MAX_LEGAL_MOVES + 1]; // cum[n] is the total of the first n places' frequencies
+
+    RankTable(){
+        cum[0] = 0;
+        size_t listed = sizeof(RANK_FREQ) / sizeof(RANK_FREQ[0]);
+        for (int i = 0; i < MAX_LEGAL_MOVES; i++)
+            cum[i + 1] = cum[i] + (((size_t)i < listed) ? RANK_FREQ[i] : RANK_TAIL_FREQ);
+    }
+};
+
+static const RankTable rank_table;
+
+// The static guess at how likely each move is, used to order them for Ranked: what the move gains in material and
+// piece-square value, less the moving piece if it lands on a tile the opponent attacks. Both the encoder and the decoder
+// order the moves this way, so it only has to be deterministic, not right. Ties keep generate_moves' order.
+static void rank_moves(Game &game, char color, const std::vector<Move> &legal, std::vector<int64_t> &sort_keys,
+    std::vector<int> &order){
+    char opponent = (color == 'W') ? 'B' : 'W';
+    int sign = (color == 'W') ? 1 : -1;
+    order.resize(legal.size());
+    sort_keys.resize(legal.size());
+    for (size_t i = 0; i < legal.size(); i++){
+        const Move &move = legal[i];
+        Piece piece = game.get_piece(move.from_row, move.from_col);
+        Piece captured = game.get_piece(move.to_row, move.to_col);
+        char type_after = (move.promotion != 0) ? move.promotion : piece.type;
+        int landed = sign * piece_square_value(color, type_after, move.to_row, move.to_col);
+        int score = landed - sign * piece_square_value(color, piece.type, move.from_row, move.from_col)
+            - sign * piece_square_value(captured.color, captured.type, move.to_row, move.to_col);
+        if (piece.type != 'K' && game.is_attacked(move.to_row, move.to_col, opponent))
+            score -= landed;
+        // the index breaks ties, earlier first, and makes every key different
+        sort_keys[i] = (int64_t)score * MAX_LEGAL_MOVES + (MAX_LEGAL_MOVES - 1 - (int64_t)i);
+        order[i] = (int)i;
+    }
+    std::sort(order.begin(), order.end(), [&sort_keys](int a, int b){
+        return sort_keys[a] > sort_keys[b];
+    });
+}
+
+// a game has no moves after it's been won or drawn
+static bool game_over(Game &game){
+    return game.get_white_won() || game.get_black_won() || game.get_draw_reason() != DrawReason::NoDraw;
+}
+
+static bool same_move(const Move &a, const Move &b){
+    return a.from_row == b.from_row && a.from_col == b.from_col && a.to_row == b.to_row && a.to_col == b.to_col
+        && a.promotion == b.promotion;
+}
+
+MoveEncoder::MoveEncoder(const Game &start, MoveCoding coding)
+    : game(start), coding(coding), count(0), low(0), range(0xFFFFFFFFu), cache(0), cache_size(1), first_byte(true){
+}
+
+bool MoveEncoder::add(const Move &move){
+    if (game_over(game))
+        return false;
+    char color = game.get_side_to_move();
+    game.generate_moves(color, legal);
+    int index = -1;
+    for (size_t i = 0; i < legal.size(); i++){
+        if (same_move(legal[i], move)){
+            index = (int)i;
+            break;
+        }
+    }
+    if (index < 0)
+        return false;
+
+    if (coding == MoveCoding::Index){
+        payload.push_back((char)index);
+    } else {
+        rank_moves(game, color, legal, sort_keys, order);
+        int rank = (int)(std::find(order.begin(), order.end(), index) - order.begin());
+        encode_rank(rank, (int)legal.size());
+    }
+    game.make_move(move, color);
+    count++;
+    return true;
+}
+
+void MoveEncoder::encode_rank(int rank, int move_count){
+    uint32_t r = range / rank_table.cum[move_count];
+    low += (uint64_t)r * rank_table.cum[rank];
+    range = r * (rank_table.cum[rank + 1] - rank_table.cum[rank]);
+    while (range < RANGE_TOP){
+        range <<= 8;
+        shift_low();
+    }
+}
+
+// Moves the top byte of low out, holding back a run of 0xFF bytes until it's known whether a carry will ripple into them.
+// The very first byte is always 0, so it's left out, and the decoder starts a byte later
+void MoveEncoder::shift_low(){
+    if ((uint32_t)low < 0xFF000000u || (low >> 32) != 0){
+        uint8_t carry = (uint8_t)(low >> 32);
+        uint8_t byte = cache;
+        do {
+            if (first_byte)
+                first_byte = false;
+            else
+                payload.push_back((char)(uint8_t)(byte + carry));
+            byte = 0xFF;
+        } while (--cache_size != 0);
+        cache = (uint8_t)(low >> 24);
+    }
+    cache_size++;
+    low = (low & 0x00FFFFFFu) << 8;
+}
+
+void MoveEncoder::finish(std::string &out){
+    if (coding == MoveCoding::Ranked && count > 0){
+        // Any value in [low, low + range) decodes the same, so pick the one ending in the most zero bytes, and leave those
+        // off: the decoder reads zeros past the end
+        for (int bits = 32; bits >= 0; bits -= 8){
+            uint64_t mask = (1ull << bits) - 1;
+            uint64_t value = (low + mask) & ~mask;
+            if (value < low + range){
+                low = value;
+                break;
+            }
+        }
+        for (int i = 0; i < 5; i++)
+            shift_low();
+        while (!payload.empty() && payload.back() == '\0')
+            payload.pop_back();
+    }
+
+    out.push_back((char)coding);
+    uint32_t n = count;
+    while (n >= 0x80){
+        out.push_back((char)(n | 0x80));
+        n >>= 7;
+    }
+    out.push_back((char)n);
+    out += payload;
+}
+
+MoveDecoder::MoveDecoder(const Game &start, const char *data, size_t len)
+    : game(start), coding(MoveCoding::Index), left(0), header_ok(false), data((const uint8_t*)data), len(len), pos(0),
+      range(0xFFFFFFFFu), code(0){
+    if (len == 0 || (data[0] != (char)MoveCoding::Index && data[0] != (char)MoveCoding::Ranked))
+        return;
+    coding = (MoveCoding)data[0];
+    pos = 1;
+    uint32_t n = 0;
+    for (int shift = 0; ; shift += 7){
+        if (pos == len || shift > 28)
+            return;
+        uint8_t byte = this->data[pos++];
+        n |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    left = n;
+    header_ok = true;
+    if (coding == MoveCoding::Ranked){
+        for (int i = 0; i < 4; i++)
+            code = (code << 8) | next_byte();
+    }
+}
+
+uint8_t MoveDecoder::next_byte(){
+    return (pos < len) ? data[pos++] : 0;
+}
+
+// returns the next place in the order, or -1 if the data is corrupt
+int MoveDecoder::decode_rank(int move_count){
+    uint32_t total = rank_table.cum[move_count];
+    uint32_t r = range / total;
+    uint32_t value = code / r;
+    if (value >= total)
+        return -1;
+    int rank = 0;
+    while (rank_table.cum[rank + 1] <= value)
+        rank++;
+    code -= r * rank_table.cum[rank];
+    range = r * (rank_table.cum[rank + 1] - rank_table.cum[rank]);
+    while (range < RANGE_TOP){
+        range <<= 8;
+        code = (code << 8) | next_byte();
+    }
+    return rank;
+}
+
+bool MoveDecoder::next(Move &move){
+    if (!header_ok || left == 0 || game_over(game))
+        return false;
+    char color = game.get_side_to_move();
+    game.generate_moves(color, legal);
+    if (legal.empty())
+        return false;
+
+    int index;
+    if (coding == MoveCoding::Index){
+        if (pos == len)
+            return false;
+        index = data[pos++];
+    } else {
+        rank_moves(game, color, legal, sort_keys, order);
+        int rank = decode_rank((int)legal.size());
+        if (rank < 0 || rank >= (int)legal.size())
+            return false;
+        index = order[rank];
+    }
+    if (index >= (int)legal.size())
+        return false;
+
+    move = legal[index];
+    game.make_move(move, color);
+    left--;
+    return true;
+}
+
+std::string format_san(Game &game, const Move &move){
+    Piece piece = game.get_piece(move.from_row, move.from_col);
+    std::string san;
+    if (piece.type == 'K' && abs(move.to_col - move.from_col) == 2){
+        san = (move.to_col == 6) ? "O-O" : "O-O-O";
+    } else {
+        bool capture = !game.get_piece(move.to_row, move.to_col).empty();
+        if (piece.type == 'P'){
+            if (capture)
+                san += (char)('a' + move.from_col);
+        } else {
+            san += piece.type;
+            // name the file, rank or both of the starting tile if another piece of the same type could also move there
+            std::vector<Move> moves;
+            game.generate_moves(piece.color, moves);
+            bool ambiguous = false, same_file = false, same_rank = false;
+            for (const Move &m : moves){
+                if (m.to_row != move.to_row || m.to_col != move.to_col || (m.from_row == move.from_row && m.from_col == move.from_col))
+                    continue;
+                if (game.get_piece(m.from_row, m.from_col).type != piece.type)
+                    continue;
+                ambiguous = true;
+                if (m.from_col == move.from_col)
+                    same_file = true;
+                if (m.from_row == move.from_row)
+                    same_rank = true;
+            }
+            if (ambiguous && (!same_file || same_rank))
+                san += (char)('a' + move.from_col);
+            if (ambiguous && same_file)
+                san += (char)('1' + (7 - move.from_row));
+        }
+        if (capture)
+            san += 'x';
+        san += (char)('a' + move.to_col);
+        san += (char)('1' + (7 - move.to_row));
+        if (move.promotion != 0){
+            san += '=';
+            san += move.promotion;
+        }
+    }
+
+    Game after = game;
+    after.make_move(move, piece.color);
+    char opponent = (piece.color == 'W') ? 'B' : 'W';
+    if (after.in_check(opponent)){
+        std::vector<Move> replies;
+        after.generate_moves(opponent, replies);
+        san += replies.empty() ? '#' : '+';
+    }
+    return san;
+}
+
+bool parse_san(Game &game, const char *san, Move &move){
+    char color = game.get_side_to_move();
+    std::vector<Move> moves;
+    game.generate_moves(color, moves);
+
+    // castle-ing is the king moving two tiles
+    if (strncmp(san, "O-O", 3) == 0){
+        int row = (color == 'W') ? 7 : 0;
+        int to_col = (strncmp(san, "O-O-O", 5) == 0) ? 2 : 6;
+        for (const Move &m : moves){
+            if (m.from_row == row && m.from_col == 4 && m.to_row == row && m.to_col == to_col
+                && game.get_piece(row, 4).type == 'K'){
+                move = m;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // keep only the letters and digits that say which move it is: "Nbxd7+" becomes "Nbd7", "exd8=Q" becomes "ed8Q"
+    char text[8];
+    int len = 0;
+    for (const char *p = san; *p != '\0' && *p != ' ' && *p != '\n'; p++){
+        if (strchr("x=+#!?", *p) != NULL)
+            continue;
+        if (len == (int)sizeof(text) - 1)
+            return false;
+        text[len++] = *p;
+    }
+    text[len] = '\0';
+
+    int start = 0;
+    char type = 'P';
+    if (len > 0 && strchr("NBRQK", text[0]) != NULL)
+        type = text[start++];
+    char promotion = 0;
+    if (type == 'P' && len > start && strchr("NBRQ", text[len - 1]) != NULL)
+        promotion = text[--len];
+    if (len - start < 2 || len - start > 4)
+        return false;
+    int to_col = text[len - 2] - 'a', to_row = 7 - (text[len - 1] - '1');
+    if (to_col < 0 || to_col > 7 || to_row < 0 || to_row > 7)
+        return false;
+    // whatever is left between the piece and the destination is the starting file, rank or both
+    int from_col = -1, from_row = -1;
+    for (int i = start; i < len - 2; i++){
+        if (text[i] >= 'a' && text[i] <= 'h')
+            from_col = text[i] - 'a';
+        else if (text[i] >= '1' && text[i] <= '8')
+            from_row = 7 - (text[i] - '1');
+        else
+            return false;
+    }
+
+    int found = 0;
+    for (const Move &m : moves){
+        if (m.to_row != to_row || m.to_col != to_col || m.promotion != promotion)
+            continue;
+        if ((from_col >= 0 && m.from_col != from_col) || (from_row >= 0 && m.from_row != from_row))
+            continue;
+        if (game.get_piece(m.from_row, m.from_col).type != type)
+            continue;
+        move = m;
+        found++;
+    }
+    return found == 1;
+}
@@ -0,0 +1,114 @@
+#ifndef MOVE_CODEC_H
+#define MOVE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "game.h"
+
+// A compact encoding for the moves of a stored game. Given the position a move is played from, the move generator already
+// knows every move that could come next, so a move only has to be stored as which of them it was. Decoding replays the game
+// through the move generator, a move at a time.
+
+// An encoded game is a coding byte, the number of moves as a varint, and then the moves:
+// - Index: each move is one byte, its index in the list generate_moves makes
+// - Ranked: the legal moves are ordered by a static guess at how likely each is to be played (captures of more than the
+//   capturing piece is worth, moves onto better tiles, not leaving the piece where the opponent attacks it), and each move's
+//   place in that order is range coded with a fixed table of how often each place is the move played. The move played is
+//   usually among the first few, which take a bit or two.
+// The start position isn't part of the encoding. Like a PGN's FEN tag, it's stored alongside the moves when it isn't the
+// standard one.
+
+enum class MoveCoding : uint8_t {
+    Index = 1,
+    Ranked
+};
+
+// Encodes a game a move at a time, as it's played
+class MoveEncoder {
+    public:
+        MoveEncoder(const Game &start, MoveCoding coding);
+
+        // Adds the next move. Returns false, and adds nothing, if it isn't a legal move for the player to move or the game is
+        // already over. A pawn reaching the other side has to say what it's promoted to.
+        bool add(const Move &move);
+
+        // appends the encoded game to out
+        void finish(std::string &out);
+
+    private:
+        Game game;
+        MoveCoding coding;
+        uint32_t count;
+        std::vector<Move> legal;
+        std::vector<int64_t> sort_keys;
+        std::vector<int> order;
+
+        std::string payload;
+
+        // the range coder's state, for Ranked
+        uint64_t low;
+        uint32_t range;
+        uint8_t cache;
+        uint64_t cache_size;
+        bool first_byte;
+
+        void encode_rank(int rank, int move_count);
+        void shift_low();
+};
+
+// Decodes an encoded game a move at a time, playing each move on its own copy of the start position
+class MoveDecoder {
+    public:
+        // len bytes of an encoded game at data, which has to stay valid while the decoder is used
+        MoveDecoder(const Game &start, const char *data, size_t len);
+
+        // false if data doesn't start with an encoded game's coding byte and move count
+        bool ok(){
+            return header_ok;
+        }
+
+        // moves left to decode
+        uint32_t remaining(){
+            return left;
+        }
+
+        // Decodes the next move into move and plays it. Returns false once every move has been decoded, or if the data is
+        // corrupt.
+        bool next(Move &move);
+
+        // the position after the moves decoded so far
+        const Game &position(){
+            return game;
+        }
+
+    private:
+        Game game;
+        MoveCoding coding;
+        uint32_t left;
+        bool header_ok;
+        std::vector<Move> legal;
+        std::vector<int64_t> sort_keys;
+        std::vector<int> order;
+
+        const uint8_t *data;
+        size_t len, pos;
+
+        // the range decoder's state, for Ranked
+        uint32_t range, code;
+
+        uint8_t next_byte();
+        int decode_rank(int move_count);
+};
+
+// Writes a move in standard algebraic notation (i.e. "Nf3", "exd5", "O-O", "e8=Q+"), as a PGN stores it. The move hasn't
+// been played yet.
+std::string format_san(Game &game, const Move &move);
+
+// Reads a move in standard algebraic notation for the player to move, as format_san writes it. The check and mate marks
+// are optional. Returns false if it isn't one of their legal moves.
+bool parse_san(Game &game, const char *san, Move &move);
+
+#endif // MOVE_CODEC_H
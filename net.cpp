@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include "net.h"
+
+bool net_startup(){
+#ifdef _WIN32
+    WSADATA wsaData;
+    int result = WSAStartup(MAKEWORD(2,2), &wsaData);
+    if (result != 0){
+        printf("WSAStartup error: %d\n", result);
+        return false;
+    }
+#else
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    return true;
+}
+
+void net_cleanup(){
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void net_close(socket_t s){
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+int net_last_error(){
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+bool net_set_nonblocking(socket_t s){
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags != -1 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+socket_t net_listen(const char *port, bool reuse_port){
+    struct addrinfo *result = NULL, hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_PASSIVE;
+
+    int iResult = getaddrinfo(NULL, port, &hints, &result);
+    if (iResult != 0){
+        printf("getaddrinfo error: %d\n", iResult);
+        return INVALID_SOCKET;
+    }
+
+    socket_t listenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (listenSocket == INVALID_SOCKET){
+        printf("socket() error: %d\n", net_last_error());
+        freeaddrinfo(result);
+        return INVALID_SOCKET;
+    }
+
+    // lets a restarted server bind straight away instead of waiting out TIME_WAIT
+    int one = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+#ifdef SO_REUSEPORT
+    if (reuse_port)
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, (const char*)&one, sizeof(one));
+#else
+    (void)reuse_port;
+#endif
+
+    if (bind(listenSocket, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR){
+        printf("bind() error: %d\n", net_last_error());
+        freeaddrinfo(result);
+        net_close(listenSocket);
+        return INVALID_SOCKET;
+    }
+    freeaddrinfo(result);
+
+    if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR){
+        printf("listen() error: %d\n", net_last_error());
+        net_close(listenSocket);
+        return INVALID_SOCKET;
+    }
+    return listenSocket;
+}
+
+socket_t net_connect(const char *host, const char *port){
+    struct addrinfo *result = NULL, *ptr = NULL, hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    int iResult = getaddrinfo(host, port, &hints, &result);
+    if (iResult != 0){
+        printf("getaddrinfo() error: %d\n", iResult);
+        return INVALID_SOCKET;
+    }
+
+    socket_t connectSocket = INVALID_SOCKET;
+    for (ptr = result; ptr != NULL; ptr = ptr->ai_next){
+        connectSocket = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+        if (connectSocket == INVALID_SOCKET){
+            printf("socket() error: %d\n", net_last_error());
+            break;
+        }
+        if (connect(connectSocket, ptr->ai_addr, (int)ptr->ai_addrlen) == 0)
+            break;
+        net_close(connectSocket);
+        connectSocket = INVALID_SOCKET;
+    }
+    freeaddrinfo(result);
+
+    // frames are small and every one of them is waited on, so don't let Nagle hold them back
+    if (connectSocket != INVALID_SOCKET){
+        int one = 1;
+        setsockopt(connectSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+    }
+    return connectSocket;
+}
+
+void net_raise_fd_limit(){
+#ifndef _WIN32
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max){
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
+
+int net_send_all(socket_t s, const char *buf, int len){
+    int sent = 0;
+    while (sent < len){
+        int n = send(s, buf + sent, len - sent, 0);
+        if (n == SOCKET_ERROR)
+            return SOCKET_ERROR;
+        sent += n;
+    }
+    return len;
+}
+
+int net_recv_all(socket_t s, char *buf, int len){
+    int received = 0;
+    while (received < len){
+        int n = recv(s, buf + received, len - received, 0);
+        if (n == 0)
+            return 0;
+        if (n == SOCKET_ERROR)
+            return SOCKET_ERROR;
+        received += n;
+    }
+    return len;
+}
@@ -0,0 +1,55 @@
+#ifndef NET_H
+#define NET_H
+
+// A thin layer over the socket API so the same code builds against Winsock on Windows and BSD sockets on Linux and other
+// POSIX systems. Only the calls that differ between the two are wrapped; send(), recv(), accept() and friends are used as is.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#endif
+
+// Starts up the socket library (WSAStartup on Windows). On POSIX systems it makes writes to a closed socket fail with an
+// error instead of killing the process with SIGPIPE. Returns false on failure.
+bool net_startup();
+
+// Shuts down the socket library (WSACleanup on Windows)
+void net_cleanup();
+
+// closesocket() on Windows, close() elsewhere
+void net_close(socket_t s);
+
+// The error code of the last failed socket call (WSAGetLastError() on Windows, errno elsewhere)
+int net_last_error();
+
+// Puts a socket in non-blocking mode. Returns false on failure.
+bool net_set_nonblocking(socket_t s);
+
+// Creates a TCP socket listening on the given port on all interfaces. With reuse_port set, several sockets can listen on the
+// same port and the kernel spreads incoming connections between them (SO_REUSEPORT, where supported).
+// Returns INVALID_SOCKET on failure.
+socket_t net_listen(const char *port, bool reuse_port);
+
+// Connects a TCP socket to host:port, trying every address host resolves to. host can be NULL for localhost.
+// Returns INVALID_SOCKET on failure.
+socket_t net_connect(const char *host, const char *port);
+
+// Raises the limit on open files as far as it will go, for servers and load generators holding thousands of sockets.
+// Does nothing on Windows.
+void net_raise_fd_limit();
+
+// Blocking helpers that keep calling send()/recv() until exactly len bytes have gone through. Messages between the server
+// and clients are fixed size frames of DEFAULT_BUFLEN bytes, and TCP is free to split them up.
+// Both return len on success, 0 if the connection was closed, and SOCKET_ERROR on error.
+int net_send_all(socket_t s, const char *buf, int len);
+int net_recv_all(socket_t s, char *buf, int len);
+
+#endif // NET_H
@@ -0,0 +1,88 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <new>
+#include <cstdlib>
+#include <vector>
+
+// A fixed capacity slab of objects. All the memory is allocated in one block when the pool is made, and after that acquiring
+// and releasing objects just pops and pushes slots on a free list, so creating and tearing down games never touches the
+// global heap. Freed slots are handed out again most recently used first, which keeps them warm in the cache. Slots that
+// have never been used aren't on the free list, but are handed out in order once it's empty, so making a large pool doesn't
+// touch (and fault in) all of its memory up front.
+
+// A pool isn't thread safe. Each shard (event loop thread) of the server owns its own pool and is the only one to use it.
+template <typename T>
+class SlabPool {
+    public:
+        SlabPool(int capacity) : free_list(NULL), capacity(capacity), used(0), never_used(0){
+            slots = static_cast<Slot*>(std::malloc(sizeof(Slot) * capacity));
+            if (slots == NULL)
+                throw std::bad_alloc();
+        }
+
+        ~SlabPool(){
+            std::free(slots);
+        }
+
+        SlabPool(const SlabPool&) = delete;
+        SlabPool& operator=(const SlabPool&) = delete;
+
+        // constructs a new object in a free slot, or returns NULL if the pool is full
+        T *acquire(){
+            Slot *slot = free_list;
+            if (slot != NULL)
+                free_list = slot->next;
+            else if (never_used < capacity)
+                slot = &slots[never_used++];
+            else
+                return NULL;
+            used++;
+            return new (slot->storage) T();
+        }
+
+        // destroys an object and gives its slot back to the pool. obj must have come from this pool's acquire()
+        void release(T *obj){
+            obj->~T();
+            Slot *slot = reinterpret_cast<Slot*>(obj);
+            slot->next = free_list;
+            free_list = slot;
+            used--;
+        }
+
+        // Calls f on every object in use, in slot order. It has to walk the free list to know which slots are free, so it's
+        // for rare jobs like handing the whole pool's contents over to another process
+        template <typename F>
+        void for_each(F f){
+            std::vector<bool> free_slot(never_used, false);
+            for (Slot *slot = free_list; slot != NULL; slot = slot->next)
+                free_slot[slot - slots] = true;
+            for (int i = 0; i < never_used; i++){
+                if (!free_slot[i])
+                    f(reinterpret_cast<T*>(slots[i].storage));
+            }
+        }
+
+        int in_use(){
+            return used;
+        }
+
+        int get_capacity(){
+            return capacity;
+        }
+
+    private:
+        // a slot either holds a live object or, while it's free, a pointer to the next free slot
+        union Slot {
+            Slot *next;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        Slot *slots;
+        Slot *free_list;
+        int capacity, used;
+        int never_used; // slots from here on have never been handed out
+
+};
+
+#endif // POOL_H
@@ -0,0 +1,445 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "utils.h"
+#include "game.h"
+#include "engine.h"
+#include "transposition.h"
+#include "mate.h"
+#include "move_codec.h"
+
+// Mines tactics puzzles from finished games, like the PGN files tournament writes. Every position of every game is searched
+// a few plies deep, and a position is a candidate when the player to move has just been handed a decisive advantage: their
+// side scores at least PUZZLE_WIN, where before the opponent's last move it scored no more than PUZZLE_EVEN. Each candidate
+// is then checked:
+// - for a forced mate, with the mate solver (see mate.h). It's a puzzle if exactly one first move mates that quickly
+// - failing that, for a unique winning move: every legal move is searched, and it's a puzzle if the best one keeps the
+//   advantage and none of the others does
+// Games are read on as many threads as there are cores, and the puzzles are written out once all of them have been, in
+// the order of the games they came from, with any position that's already been written left out.
+
+// Puzzles are written as EPD lines, which tournament's --openings and load_fen read: the position, then "bm" with the move
+// to find in SAN, and either "dm" with the moves to mate and "pv" with the whole mating line, or "ce" with the best move's
+// score in centipawns. "id" says which game and move the puzzle came from.
+
+// Usage: puzzles [--threads N] [--out FILE] [--scan-depth D] [--verify-depth D] [--mate-moves N] [--mate-nodes N] PGN...
+
+// the side to move scores at least this after the opponent's mistake, in centipawns
+#define PUZZLE_WIN 300
+// and no more than this before it. Every move but the solution must leave the side to move no better than this either
+#define PUZZLE_EVEN 100
+
+// each worker's transposition table, in megabytes
+#define PUZZLE_TABLE_MB 16
+
+// longest PGN line read in one go. Longer move text lines are read in pieces
+#define MAX_LINE 1024
+
+// the first few moves of a game from the start position are book moves more often than they're tactics
+#define PUZZLE_MIN_PLY 6
+
+struct PuzzleOptions {
+    int threads;
+    const char *out_path;
+    int scan_depth; // plies searched for every position of every game
+    int verify_depth; // plies searched for every move of a candidate position
+    int mate_moves; // the longest mate looked for
+    long mate_nodes; // positions the mate solver may search for each candidate
+};
+
+// a game from a PGN file, not yet played through
+struct ArchivedGame {
+    std::string source; // "file, game N"
+    std::string fen; // the FEN tag, or empty for the standard start position
+    std::string movetext;
+};
+
+struct Puzzle {
+    size_t game; // index of the game it came from, to write puzzles in order
+    int ply;
+    uint64_t key; // the position's hash, to leave out positions found more than once
+    std::string epd;
+    bool mate;
+};
+
+struct WorkerStats {
+    double busy_seconds;
+    int games;
+};
+
+struct Miner {
+    PuzzleOptions options;
+    std::vector<ArchivedGame> games;
+
+    std::atomic<size_t> next_game;
+    std::atomic<int> workers_running;
+    std::atomic<long> positions, candidates, mate_nodes, unreadable;
+
+    std::mutex mutex; // guards everything below
+    std::vector<Puzzle> puzzles;
+    std::vector<WorkerStats> workers;
+};
+
+// Splits a PGN file into its games. A game is its tags and then its move text, and the next tag after move text starts
+// another game
+static bool read_pgn_file(const char *path, std::vector<ArchivedGame> &games){
+    FILE *f = fopen(path, "r");
+    if (f == NULL){
+        printf("Couldn't open %s.\n", path);
+        return false;
+    }
+    char line[MAX_LINE];
+    ArchivedGame game;
+    bool in_movetext = false;
+    bool in_movetext_line = false; // the last piece read was the start of a line that goes on
+    int count = 0;
+    auto finish_game = [&](){
+        if (!game.movetext.empty()){
+            game.source = std::string(path) + ", game " + std::to_string(++count);
+            games.push_back(game);
+        }
+        game = ArchivedGame();
+        in_movetext = false;
+    };
+    while (fgets(line, sizeof(line), f) != NULL){
+        // a line too long for the buffer goes on in the next piece, so its move text mustn't be split there
+        bool whole_line = strchr(line, '\n') != NULL || feof(f);
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '[' && !in_movetext_line){
+            if (in_movetext)
+                finish_game();
+            char name[32], value[MAX_LINE];
+            if (sscanf(line, "[%31s \"%[^\"]\"]", name, value) == 2 && strcmp(name, "FEN") == 0)
+                game.fen = value;
+        } else if (line[strspn(line, " \t")] != '\0'){
+            in_movetext = true;
+            game.movetext += line;
+            if (whole_line)
+                game.movetext += ' ';
+        }
+        in_movetext_line = !whole_line;
+    }
+    finish_game();
+    fclose(f);
+    return true;
+}
+
+// Plays a game's move text through from its start position, collecting the moves. Comments, variations, annotation
+// glyphs, move numbers and the result are skipped. Returns false if a move isn't legal
+static bool parse_movetext(const ArchivedGame &archived, Game &start, std::vector<Move> &moves){
+    if (!archived.fen.empty() && !start.load_fen(archived.fen.c_str()))
+        return false;
+    Game game = start;
+    const char *p = archived.movetext.c_str();
+    int variation_depth = 0;
+    while (*p != '\0'){
+        if (*p == ' ' || *p == '\t'){
+            p++;
+            continue;
+        }
+        if (*p == '{'){
+            const char *end = strchr(p, '}');
+            p = (end == NULL) ? p + strlen(p) : end + 1;
+            continue;
+        }
+        if (*p == '(' || *p == ')'){
+            variation_depth += (*p == '(') ? 1 : -1;
+            p++;
+            continue;
+        }
+        size_t len = strcspn(p, " \t{}()");
+        std::string token(p, len);
+        p += len;
+        if (variation_depth > 0 || token[0] == '$' || token == "*" || token == "1-0" || token == "0-1" || token == "1/2-1/2")
+            continue;
+        // "12." and "12..." are move numbers, and "12.e4" a move number stuck to its move
+        size_t digits = strspn(token.c_str(), "0123456789");
+        if (digits > 0 && digits < token.size() && token[digits] == '.'){
+            token.erase(0, token.find_first_not_of('.', digits));
+            if (token.empty())
+                continue;
+        }
+        Move move;
+        if (!parse_san(game, token.c_str(), move))
+            return false;
+        game.make_move(move, game.get_side_to_move());
+        moves.push_back(move);
+    }
+    return true;
+}
+
+// the position as an EPD: the first four fields of its FEN
+static std::string format_epd(Game &game){
+    char fen[DEFAULT_BUFLEN];
+    game.format_fen(fen);
+    std::string epd = fen;
+    size_t end = 0;
+    for (int field = 0; field < 4 && end != std::string::npos; field++)
+        end = epd.find(' ', end + 1);
+    if (end != std::string::npos)
+        epd.erase(end);
+    return epd;
+}
+
+// the search's score from the point of view of the player to move, or 0 if they have no move
+static int search_score(const Game &game, int depth, TranspositionTable &table){
+    std::atomic<bool> stop(false);
+    SearchLimits limits = {};
+    limits.max_depth = depth;
+    limits.table = &table;
+    table.new_search();
+    Game position = game;
+    SearchResult result = search_position(position, position.get_side_to_move(), limits, stop);
+    return result.found_move ? result.score : 0;
+}
+
+// Checks a candidate position for a puzzle, and writes its EPD line into puzzle. Returns false if it isn't one
+static bool verify_candidate(Miner &m, Game &game, const std::string &source, int ply, Puzzle &puzzle,
+    TranspositionTable &table){
+    char side = game.get_side_to_move();
+    MateResult mate = solve_mate(game, m.options.mate_moves, m.options.mate_nodes);
+    m.mate_nodes += mate.nodes;
+    std::string id = "; id \"" + source + ", ply " + std::to_string(ply + 1) + "\";";
+    if (mate.mate_in > 0){
+        // a second way to mate as quickly, or one the solver couldn't rule out, makes the puzzle unfair
+        if (mate.solutions != 1 || mate.aborted)
+            return false;
+        Game line = game;
+        std::string pv;
+        for (const Move &move : mate.line){
+            pv += ' ' + format_san(line, move);
+            line.make_move(move, line.get_side_to_move());
+        }
+        puzzle.epd = format_epd(game) + " bm " + format_san(game, mate.line[0]) + "; dm " + std::to_string(mate.mate_in)
+            + "; pv" + pv + id;
+        puzzle.mate = true;
+        return true;
+    }
+
+    // the best move has to keep the advantage, and the second best has to give it up
+    std::vector<Move> moves;
+    game.generate_moves(side, moves);
+    int best = -2 * MATE_SCORE, second = -2 * MATE_SCORE;
+    Move best_move = moves.empty() ? Move{0, 0, 0, 0, 0} : moves[0];
+    for (const Move &move : moves){
+        Game child = game;
+        child.make_move(move, side);
+        int score;
+        if (child.get_draw_reason() != DrawReason::NoDraw)
+            score = 0;
+        else
+            score = -search_score(child, m.options.verify_depth - 1, table);
+        if (score > best){
+            second = best;
+            best = score;
+            best_move = move;
+        } else if (score > second){
+            second = score;
+        }
+        // a second move that keeps the advantage is enough to throw the position out
+        if (second > PUZZLE_EVEN)
+            return false;
+    }
+    if (best < PUZZLE_WIN)
+        return false;
+    puzzle.epd = format_epd(game) + " bm " + format_san(game, best_move) + "; ce " + std::to_string(best) + id;
+    puzzle.mate = false;
+    return true;
+}
+
+// Plays through one game, looking for puzzles in it
+static void mine_game(Miner &m, size_t index, std::vector<Puzzle> &found, TranspositionTable &table){
+    const ArchivedGame &archived = m.games[index];
+    Game game;
+    std::vector<Move> moves;
+    if (!parse_movetext(archived, game, moves)){
+        m.unreadable++;
+        return;
+    }
+
+    // score before each move, from the point of view of the player making it
+    int previous = 0;
+    for (size_t ply = 0; ply <= moves.size(); ply++){
+        if (game.get_white_won() || game.get_black_won() || game.get_draw_reason() != DrawReason::NoDraw)
+            break;
+        int score = search_score(game, m.options.scan_depth, table);
+        m.positions++;
+        if ((!archived.fen.empty() || (int)ply >= PUZZLE_MIN_PLY) && score >= PUZZLE_WIN && -previous <= PUZZLE_EVEN){
+            m.candidates++;
+            Puzzle puzzle;
+            if (verify_candidate(m, game, archived.source, (int)ply, puzzle, table)){
+                puzzle.game = index;
+                puzzle.ply = (int)ply;
+                puzzle.key = game.position_key();
+                found.push_back(puzzle);
+            }
+        }
+        if (ply == moves.size())
+            break;
+        game.make_move(moves[ply], game.get_side_to_move());
+        previous = score;
+    }
+}
+
+static void worker(Miner &m, int id){
+    double busy = 0;
+    int games = 0;
+    std::vector<Puzzle> found;
+    // Each worker has a table of its own. Positions next to each other in a game share most of their search trees, so
+    // the table carries over from one position to the next. It's cleared between games, so what's found in a game doesn't
+    // depend on which games the worker mined before it
+    TranspositionTable table;
+    table.resize(PUZZLE_TABLE_MB);
+    while (1){
+        size_t index = m.next_game++;
+        if (index >= m.games.size())
+            break;
+        auto start = std::chrono::steady_clock::now();
+        table.clear();
+        mine_game(m, index, found, table);
+        busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        games++;
+    }
+
+    std::lock_guard<std::mutex> lock(m.mutex);
+    m.puzzles.insert(m.puzzles.end(), found.begin(), found.end());
+    m.workers[id].busy_seconds = busy;
+    m.workers[id].games = games;
+    m.workers_running--;
+}
+
+static void print_progress(Miner &m, double seconds){
+    size_t games = std::min(m.next_game.load(), m.games.size());
+    long positions = m.positions.load();
+    printf("Games %zu/%zu, %ld positions (%.0f/sec), %ld candidates, %.0f mate solver nodes/sec\n", games, m.games.size(),
+        positions, seconds > 0 ? positions / seconds : 0.0, m.candidates.load(), seconds > 0 ? m.mate_nodes.load() / seconds : 0.0);
+}
+
+static void usage(){
+    printf("Usage: puzzles [--threads N] [--out FILE] [--scan-depth D] [--verify-depth D] [--mate-moves N] [--mate-nodes N] PGN...\n");
+}
+
+int main(int argc, char* argv[]){
+    Miner m;
+    m.options.threads = (int)std::thread::hardware_concurrency();
+    if (m.options.threads < 1)
+        m.options.threads = 1;
+    m.options.out_path = "puzzles.epd";
+    m.options.scan_depth = 3;
+    m.options.verify_depth = 4;
+    m.options.mate_moves = 3;
+    m.options.mate_nodes = 1000000;
+
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++){
+        if (strncmp(argv[i], "--", 2) != 0){
+            paths.push_back(argv[i]);
+            continue;
+        }
+        if (i + 1 >= argc){
+            usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "--threads") == 0)
+            m.options.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0)
+            m.options.out_path = argv[++i];
+        else if (strcmp(argv[i], "--scan-depth") == 0)
+            m.options.scan_depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--verify-depth") == 0)
+            m.options.verify_depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--mate-moves") == 0)
+            m.options.mate_moves = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--mate-nodes") == 0)
+            m.options.mate_nodes = atol(argv[++i]);
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (paths.empty() || m.options.threads < 1 || m.options.scan_depth < 1 || m.options.verify_depth < 2
+        || m.options.mate_moves < 1 || m.options.mate_moves > MAX_MATE_MOVES || m.options.mate_nodes < 0){
+        usage();
+        return 1;
+    }
+
+    for (const char *path : paths){
+        if (!read_pgn_file(path, m.games))
+            return 1;
+    }
+    FILE *out = fopen(m.options.out_path, "w");
+    if (out == NULL){
+        printf("Couldn't open %s.\n", m.options.out_path);
+        return 1;
+    }
+
+    m.next_game = 0;
+    m.workers_running = m.options.threads;
+    m.positions = 0;
+    m.candidates = 0;
+    m.mate_nodes = 0;
+    m.unreadable = 0;
+    m.workers.assign(m.options.threads, {0.0, 0});
+    printf("Mining %zu games on %d threads: every position searched %d plies deep, mates of up to %d moves, other "
+        "candidates searched %d plies deep.\n", m.games.size(), m.options.threads, m.options.scan_depth, m.options.mate_moves,
+        m.options.verify_depth);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < m.options.threads; i++)
+        threads.emplace_back(worker, std::ref(m), i);
+
+    // report progress every few seconds until every worker is done
+    auto next_report = start + std::chrono::seconds(5);
+    while (m.workers_running.load() > 0){
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_report){
+            print_progress(m, std::chrono::duration<double>(now - start).count());
+            next_report = now + std::chrono::seconds(5);
+        }
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // in the order of the games, so the output doesn't depend on which thread got to which game first
+    std::sort(m.puzzles.begin(), m.puzzles.end(), [](const Puzzle &a, const Puzzle &b){
+        return (a.game != b.game) ? a.game < b.game : a.ply < b.ply;
+    });
+    std::unordered_set<uint64_t> written;
+    int mates = 0, others = 0, duplicates = 0;
+    for (const Puzzle &puzzle : m.puzzles){
+        if (!written.insert(puzzle.key).second){
+            duplicates++;
+            continue;
+        }
+        fprintf(out, "%s\n", puzzle.epd.c_str());
+        if (puzzle.mate)
+            mates++;
+        else
+            others++;
+    }
+    fclose(out);
+
+    printf("\n");
+    print_progress(m, seconds);
+    printf("%.2f games/sec. %d puzzles (%d mates, %d winning moves) written to %s, %d duplicates left out.\n",
+        seconds > 0 ? m.games.size() / seconds : 0.0, mates + others, mates, others, m.options.out_path, duplicates);
+    if (m.unreadable.load() > 0)
+        printf("%ld games had a move that isn't legal, and were skipped.\n", m.unreadable.load());
+    printf("Worker utilization:");
+    for (int i = 0; i < m.options.threads; i++)
+        printf(" %d: %.1f%% (%d games)%s", i, seconds > 0 ? 100.0 * m.workers[i].busy_seconds / seconds : 0.0, m.workers[i].games,
+            (i + 1 < m.options.threads) ? "," : "\n");
+    return 0;
+}
@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <chrono>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "net.h"
+#include "utils.h"
+#include "trace.h"
+
+// Plays a trace recorded by "server --record" (see trace.h) back against a server: it opens a connection for every one in
+// the trace and sends the frames they sent, either at the pace they were recorded (--speed 1, the default, or faster with
+// a bigger factor) or as fast as the server answers (--speed 0).
+
+// However fast it goes, each frame is sent only once the connection has received as many frames as the recording server
+// had sent it, so every frame arrives at the same point in its game that it did when it was recorded. Pairing players up
+// depends on the order connections open and close in, so a connection is only opened once every connection before it has
+// been welcomed and every close before it has been seen through by the server, and a close waits in the same way on the
+// opens before it.
+
+// A trace is one shard's traffic, so it should be played back against a server with one shard. With the server started the
+// same way as the recording one (other than --record, --state-dir and the shard count), it should send every connection
+// exactly what it did when the trace was recorded, which is checked against the digests in the trace. Traces recorded with
+// the bot, or with a state directory, can't be checked, since the bot's moves and the resume codes aren't reproducible.
+
+// Reports how long the replay took, frames sent per second, and the latency of a frame, measured from sending it to
+// receiving the server's first reply. Exits with 1 if any connection's output didn't match, so it can gate a change.
+
+// Usage: replay TRACE [--host H] [--port P] [--speed X] [--no-check]
+
+#define MAX_EVENTS 256
+// a replay that's had nothing from the server for this long has gone out of step with the trace and is given up on
+#define STALL_TIMEOUT_MS 5000
+// connections whose output didn't match that are listed individually
+#define MISMATCHES_SHOWN 10
+
+typedef std::chrono::steady_clock Clock;
+
+// an event, with how many of the trace's opens and closes came before it
+struct Step {
+    const TraceEvent *event;
+    uint32_t opens_before;
+    uint32_t closes_before;
+    uint32_t close_index; // Close only: its place among the trace's closes
+};
+
+struct ReplayConn {
+    socket_t fd; // INVALID_SOCKET until opened and once done
+    Step open_step;
+    std::vector<Step> steps; // its frames and close, in order
+    size_t next_step;
+    const TraceEvent *digest; // NULL if the recording server never closed it
+
+    char inbuf[DEFAULT_BUFLEN];
+    int inbuf_len;
+    std::string outbuf;
+    size_t out_offset;
+    bool want_write;
+
+    uint32_t frames_received;
+    uint64_t hash;
+    bool shut; // the trace's close has been played, and the server's close is awaited
+    bool eof; // the server closed it
+    bool waiting_on_opens; // on the closes_waiting list
+    bool timer_armed;
+
+    bool awaiting_reply;
+    Clock::time_point sent_at;
+};
+
+struct Replay {
+    const char *host;
+    const char *port;
+    double speed; // 0 for as fast as possible
+    int epfd;
+    Clock::time_point start;
+
+    std::vector<ReplayConn*> conns; // by trace connection number
+    std::vector<ReplayConn*> opens; // in the order the trace opened them
+    size_t next_open;
+    bool open_timer_armed;
+
+    // the first how many opens have been welcomed, and closes seen through
+    std::vector<bool> welcomed, close_confirmed;
+    size_t welcomed_prefix, confirmed_prefix;
+    std::vector<ReplayConn*> closes_waiting; // closes held back until earlier opens are welcomed
+
+    // when steps come due at 1x, soonest first. A NULL connection is the next open
+    typedef std::pair<Clock::time_point, ReplayConn*> Timer;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+    long frames_sent, steps_skipped, errors;
+    std::vector<uint32_t> latencies_us;
+};
+
+static void try_open(Replay &rp);
+static void try_advance(Replay &rp, ReplayConn *c);
+
+static Clock::time_point due_at(Replay &rp, const TraceEvent *event){
+    return rp.start + std::chrono::microseconds((long long)(event->time_us / rp.speed));
+}
+
+// true if the event can go now. If it's not due yet, a timer is set to come back to it
+static bool is_due(Replay &rp, const TraceEvent *event, ReplayConn *c, bool &armed){
+    if (rp.speed == 0)
+        return true;
+    Clock::time_point due = due_at(rp, event);
+    if (Clock::now() >= due)
+        return true;
+    if (!armed){
+        armed = true;
+        rp.timers.push(Replay::Timer(due, c));
+    }
+    return false;
+}
+
+static void set_events(Replay &rp, ReplayConn *c, bool want_write){
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(rp.epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_write = want_write;
+}
+
+static void flush_conn(Replay &rp, ReplayConn *c){
+    while (c->out_offset < c->outbuf.size()){
+        ssize_t n = send(c->fd, c->outbuf.data() + c->out_offset, c->outbuf.size() - c->out_offset, MSG_NOSIGNAL);
+        if (n < 0){
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && !c->want_write)
+                set_events(rp, c, true);
+            return;
+        }
+        c->out_offset += n;
+    }
+    c->outbuf.clear();
+    c->out_offset = 0;
+    if (c->want_write)
+        set_events(rp, c, false);
+    // a close waits for the frames before it to have gone out
+    if (c->shut)
+        shutdown(c->fd, SHUT_WR);
+}
+
+static void advance_prefix(std::vector<bool> &done, size_t &prefix){
+    while (prefix < done.size() && done[prefix])
+        prefix++;
+}
+
+static void confirm_close(Replay &rp, ReplayConn *c){
+    const Step &step = c->steps[c->next_step - 1];
+    rp.close_confirmed[step.close_index] = true;
+    advance_prefix(rp.close_confirmed, rp.confirmed_prefix);
+    try_open(rp);
+}
+
+// the server has closed the connection, so nothing more will come of it
+static void finish_conn(Replay &rp, ReplayConn *c){
+    c->eof = true;
+    epoll_ctl(rp.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    net_close(c->fd);
+    c->fd = INVALID_SOCKET;
+    if (c->shut){
+        confirm_close(rp, c);
+        return;
+    }
+    // whatever the trace still had for it can't be played now, though a close can count as seen through
+    try_advance(rp, c);
+}
+
+// Plays as many of a connection's steps as are ready
+static void try_advance(Replay &rp, ReplayConn *c){
+    while (c->next_step < c->steps.size() && !c->shut){
+        const Step &step = c->steps[c->next_step];
+        const TraceEvent *event = step.event;
+        if (c->eof){
+            if (event->type == TraceClose){
+                c->next_step++;
+                c->shut = true;
+                confirm_close(rp, c);
+                return;
+            }
+            rp.steps_skipped++;
+            c->next_step++;
+            continue;
+        }
+        if (c->frames_received < event->frames_sent)
+            return;
+        if (!is_due(rp, event, c, c->timer_armed))
+            return;
+        if (event->type == TraceFrame){
+            c->outbuf.append(event->text);
+            c->outbuf.append(DEFAULT_BUFLEN - event->text.size(), '\0');
+            c->awaiting_reply = true;
+            c->sent_at = Clock::now();
+            rp.frames_sent++;
+            c->next_step++;
+            flush_conn(rp, c);
+            if (c->fd == INVALID_SOCKET)
+                return;
+            continue;
+        }
+        // a close, once every open before it has been welcomed
+        if (rp.welcomed_prefix < step.opens_before){
+            if (!c->waiting_on_opens){
+                c->waiting_on_opens = true;
+                rp.closes_waiting.push_back(c);
+            }
+            return;
+        }
+        c->next_step++;
+        c->shut = true;
+        flush_conn(rp, c);
+        return;
+    }
+}
+
+// Opens the next connections in the trace, as far as their turn has come
+static void try_open(Replay &rp){
+    while (rp.next_open < rp.opens.size()){
+        ReplayConn *c = rp.opens[rp.next_open];
+        const Step &step = c->open_step;
+        // the connection before it has to have been welcomed, and the closes before it seen through
+        if (rp.welcomed_prefix < rp.next_open || rp.confirmed_prefix < step.closes_before)
+            return;
+        if (!is_due(rp, step.event, NULL, rp.open_timer_armed))
+            return;
+        rp.next_open++;
+        c->fd = net_connect(rp.host, rp.port);
+        if (c->fd == INVALID_SOCKET){
+            // it can't be played, but the connections after it can still go
+            rp.errors++;
+            c->eof = true;
+            rp.welcomed[rp.next_open - 1] = true;
+            advance_prefix(rp.welcomed, rp.welcomed_prefix);
+            try_advance(rp, c);
+            continue;
+        }
+        net_set_nonblocking(c->fd);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(rp.epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    }
+}
+
+// the server has sent the connection its first frame, so it's been paired up (or not) with the connections before it
+static void welcome(Replay &rp, ReplayConn *c){
+    rp.welcomed[c->open_step.opens_before] = true;
+    advance_prefix(rp.welcomed, rp.welcomed_prefix);
+    std::vector<ReplayConn*> waiting;
+    waiting.swap(rp.closes_waiting);
+    for (ReplayConn *w : waiting){
+        w->waiting_on_opens = false;
+        try_advance(rp, w);
+    }
+    try_open(rp);
+}
+
+// Reads everything available from a connection's socket
+static void read_conn(Replay &rp, ReplayConn *c){
+    while (1){
+        ssize_t n = recv(c->fd, c->inbuf + c->inbuf_len, DEFAULT_BUFLEN - c->inbuf_len, 0);
+        if (n > 0){
+            c->inbuf_len += (int)n;
+            if (c->inbuf_len < DEFAULT_BUFLEN)
+                continue;
+            c->inbuf_len = 0;
+            if (c->awaiting_reply){
+                c->awaiting_reply = false;
+                rp.latencies_us.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - c->sent_at).count());
+            }
+            c->hash = trace_hash(c->hash, c->inbuf, strnlen(c->inbuf, DEFAULT_BUFLEN));
+            if (c->frames_received++ == 0)
+                welcome(rp, c);
+            try_advance(rp, c);
+            if (c->fd == INVALID_SOCKET)
+                return;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno != ECONNRESET)
+            rp.errors++;
+        finish_conn(rp, c);
+        return;
+    }
+}
+
+// done once every step has been played and every connection the recording server closed has been closed again
+static bool finished(Replay &rp){
+    if (rp.next_open < rp.opens.size())
+        return false;
+    for (ReplayConn *c : rp.opens){
+        if (c->next_step < c->steps.size() || (c->shut && !c->eof) || (c->digest != NULL && !c->eof))
+            return false;
+    }
+    return true;
+}
+
+// Sorts a trace's events out by connection, counting the opens and closes before each one
+static void load_steps(Replay &rp, const std::vector<TraceEvent> &events){
+    uint32_t opens = 0, closes = 0;
+    for (const TraceEvent &event : events){
+        if (event.conn >= rp.conns.size())
+            rp.conns.resize(event.conn + 1, NULL);
+        ReplayConn *&c = rp.conns[event.conn];
+        Step step;
+        step.event = &event;
+        step.opens_before = opens;
+        step.closes_before = closes;
+        step.close_index = 0;
+        if (event.type == TraceOpen){
+            if (c != NULL)
+                continue;
+            c = new ReplayConn();
+            c->fd = INVALID_SOCKET;
+            c->open_step = step;
+            c->next_step = 0;
+            c->digest = NULL;
+            c->inbuf_len = 0;
+            c->out_offset = 0;
+            c->want_write = false;
+            c->frames_received = 0;
+            c->hash = TRACE_HASH_START;
+            c->shut = false;
+            c->eof = false;
+            c->waiting_on_opens = false;
+            c->timer_armed = false;
+            c->awaiting_reply = false;
+            rp.opens.push_back(c);
+            opens++;
+            continue;
+        }
+        if (c == NULL || c->digest != NULL)
+            continue; // the trace started recording after it opened
+        if (event.type == TraceDigest){
+            c->digest = &event;
+            continue;
+        }
+        if (event.type == TraceClose)
+            step.close_index = closes++;
+        c->steps.push_back(step);
+    }
+    rp.welcomed.assign(opens, false);
+    rp.close_confirmed.assign(closes, false);
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double p){
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t)(p * (sorted.size() - 1));
+    return sorted[i];
+}
+
+static void usage(){
+    printf("Usage: replay TRACE [--host H] [--port P] [--speed X] [--no-check]\n");
+}
+
+int main(int argc, char* argv[]){
+    Replay rp;
+    rp.host = NULL;
+    rp.port = DEFAULT_PORT;
+    rp.speed = 1;
+    const char *path = NULL;
+    bool check = true;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--no-check") == 0)
+            check = false;
+        else if (i + 1 < argc && strcmp(argv[i], "--host") == 0)
+            rp.host = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--port") == 0)
+            rp.port = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--speed") == 0)
+            rp.speed = atof(argv[++i]);
+        else if (path == NULL && argv[i][0] != '-')
+            path = argv[i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (path == NULL || rp.speed < 0){
+        usage();
+        return 1;
+    }
+
+    TraceHeader header;
+    std::vector<TraceEvent> events;
+    if (!read_trace(path, header, events))
+        return 1;
+    if (check && (header.flags & (TRACE_BOT_MODE | TRACE_STATE_DIR))){
+        printf("The trace was recorded %s, so the server's output won't be checked.\n",
+            (header.flags & TRACE_BOT_MODE) ? "against the bot" : "with a state directory");
+        check = false;
+    }
+    load_steps(rp, events);
+    long trace_frames = 0;
+    for (const TraceEvent &event : events)
+        trace_frames += (event.type == TraceFrame);
+    double recorded_s = events.empty() ? 0 : events.back().time_us / 1e6;
+    printf("Trace: %zu connections, %ld frames, recorded over %.1f s\n", rp.opens.size(), trace_frames, recorded_s);
+
+    if (!net_startup())
+        return 1;
+    net_raise_fd_limit();
+    rp.epfd = epoll_create1(EPOLL_CLOEXEC);
+    rp.next_open = 0;
+    rp.open_timer_armed = false;
+    rp.welcomed_prefix = 0;
+    rp.confirmed_prefix = 0;
+    rp.frames_sent = 0;
+    rp.steps_skipped = 0;
+    rp.errors = 0;
+
+    rp.start = Clock::now();
+    try_open(rp);
+    Clock::time_point last_progress = rp.start;
+    bool stalled = false;
+    struct epoll_event ev[MAX_EVENTS];
+    while (!finished(rp)){
+        Clock::time_point now = Clock::now();
+        while (!rp.timers.empty() && rp.timers.top().first <= now){
+            ReplayConn *c = rp.timers.top().second;
+            rp.timers.pop();
+            if (c == NULL){
+                rp.open_timer_armed = false;
+                try_open(rp);
+            } else {
+                c->timer_armed = false;
+                try_advance(rp, c);
+            }
+        }
+
+        int timeout_ms = STALL_TIMEOUT_MS;
+        if (!rp.timers.empty())
+            timeout_ms = std::min(timeout_ms, (int)std::chrono::duration_cast<std::chrono::milliseconds>(rp.timers.top().first - now).count() + 1);
+        int n = epoll_wait(rp.epfd, ev, MAX_EVENTS, timeout_ms);
+        if (n < 0 && errno != EINTR){
+            printf("epoll_wait() error: %d\n", errno);
+            break;
+        }
+        now = Clock::now();
+        if (n > 0 || !rp.timers.empty()){
+            last_progress = now;
+        } else if (now - last_progress >= std::chrono::milliseconds(STALL_TIMEOUT_MS)){
+            stalled = true;
+            break;
+        }
+        for (int i = 0; i < n; i++){
+            ReplayConn *c = (ReplayConn*)ev[i].data.ptr;
+            if (c->fd == INVALID_SOCKET)
+                continue;
+            if (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                read_conn(rp, c);
+            if (c->fd != INVALID_SOCKET && (ev[i].events & EPOLLOUT))
+                flush_conn(rp, c);
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - rp.start).count();
+
+    // compare what every connection the recording server closed was sent, both times
+    long matched = 0, mismatched = 0;
+    for (ReplayConn *c : rp.opens){
+        if (c->fd != INVALID_SOCKET)
+            net_close(c->fd);
+        if (!check || c->digest == NULL)
+            continue;
+        if (c->eof && c->frames_received == c->digest->frames_sent && c->hash == c->digest->hash){
+            matched++;
+            continue;
+        }
+        if (mismatched++ < MISMATCHES_SHOWN){
+            printf("Connection %u: recorded %u frames (hash %016llx), replay got %u (hash %016llx)%s\n", c->digest->conn,
+                c->digest->frames_sent, (unsigned long long)c->digest->hash, c->frames_received, (unsigned long long)c->hash,
+                c->eof ? "" : " and was still open");
+        }
+    }
+    close(rp.epfd);
+    net_cleanup();
+
+    std::vector<uint32_t> &lat = rp.latencies_us;
+    std::sort(lat.begin(), lat.end());
+    if (rp.speed == 0)
+        printf("Replayed as fast as possible in %.2f s\n", seconds);
+    else
+        printf("Replayed at %gx in %.2f s\n", rp.speed, seconds);
+    printf("Frames sent: %ld (%.0f frames/sec)\n", rp.frames_sent, rp.frames_sent / seconds);
+    printf("Reply latency (us): p50 %u, p90 %u, p99 %u, max %u\n", percentile(lat, 0.50), percentile(lat, 0.90),
+        percentile(lat, 0.99), lat.empty() ? 0 : lat.back());
+    if (rp.steps_skipped > 0)
+        printf("Frames and closes that couldn't be played (the server had closed the connection): %ld\n", rp.steps_skipped);
+    if (stalled)
+        printf("Stalled: nothing was heard from the server for %d s, with the trace not finished.\n", STALL_TIMEOUT_MS / 1000);
+    printf("Errors: %ld\n", rp.errors);
+    if (check)
+        printf("Output: %ld of %ld connections matched the recording\n", matched, matched + mismatched);
+
+    for (ReplayConn *c : rp.opens)
+        delete c;
+    return (stalled || mismatched > 0) ? 1 : 0;
+}
@@ -1,423 +1,505 @@
-#include <winsock2.h>
-#include <ws2tcpip.h>
 #include <stdio.h>
-#include <cstring>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <algorithm>
 #include <string>
-#pragma comment(lib, "ws2_32.lib") 
+#include <thread>
+#include <vector>
 
+#include "net.h"
 #include "utils.h"
-#include "game.h"
-
-// The game logic itself is located in game.cpp
-
-// This simply closes the sockets passed as arguments and calls WSACleanup.
-void cleanup(SOCKET s1, SOCKET s2) {
-    closesocket(s1);
-    if (s2 != INVALID_SOCKET){
-        closesocket(s2);
+#include "backend.h"
+#include "handoff.h"
+#include "timeline.h"
+
+// The game logic itself is located in game.cpp, the bot's search in engine.cpp, the per-session protocol in session.cpp,
+// and the event loops that move bytes between sockets and sessions in epoll_backend.cpp and uring_backend.cpp.
+
+// Each shard is a thread with its own listening socket on the same port (SO_REUSEPORT), its own event loop and its own
+// session pool, so shards share no game state (only the bot's ponder budget and eval cache). Players are paired with the
+// next connection that lands on the same shard.
+
+// Usage: server [bot] [--port P] [--shards N] [--backend epoll|uring] [--engine-threads N] [--max-sessions N] [--think-ms MS] [--hash MB] [--ponder-budget PCT] [--eval-cache MB] [--metrics-file PATH] [--state-dir DIR] [--checkpoint-interval S] [--resume-port P] [--gateway] [--record FILE] [--handoff-socket PATH] [--take-over PATH] [--timeline FILE] [--latency-slo-ms MS] [--memory-budget MB] [--max-queued-frames N] [--accept-rate N] [--retry-after S] [--quiet]
+// Run "server bot" to have every client play the bot instead of another client. The bot plays Black, and thinks on White's
+// time with up to --ponder-budget percent of the engine threads (50 by default, 0 to turn pondering off). Every shard's bot
+// shares one eval cache of --eval-cache megabytes (64 by default, 0 for none). With --metrics-file, the cache's metrics are
+// written to the file in the Prometheus text format every few seconds (i.e. for node_exporter's textfile collector).
+// With --state-dir, games survive the server restarting: every shard journals its games to the directory and checkpoints
+// them every --checkpoint-interval seconds (10 by default), and a server started on the same directory (with the same
+// number of shards) restores them. Players get back to their game by connecting to port --resume-port (27016 by default)
+// plus their shard's index, which "client --resume" does for them.
+// With --gateway, shards listen on --resume-port plus their index even without a state directory, for a gateway to connect
+// its players to (see gateway.cpp).
+// With --record, every shard records the connections it accepts and the frames they send to FILE.<shard>, which replay
+// plays back against another server (see replay.cpp).
+// With --handoff-socket, a new server started with --take-over on the same path takes over every connection and game
+// without a single one being dropped, and this server exits (see handoff.h). The new server then listens on the path
+// itself, ready for the next upgrade.
+// With --timeline, SIGUSR1 turns the timeline (see timeline.h) on and off, and SIGUSR2 writes what it's recorded to FILE, for
+// chrome://tracing or ui.perfetto.dev to show where each turn's time went. It's written once more on the way out if it's on.
+// Under overload (see admission.h), a shard turns new games away, telling their players to come back in --retry-after seconds
+// (5 by default), while its p99 turn latency is over --latency-slo-ms (no objective by default) or the output queued across
+// every shard is over --memory-budget megabytes (1024 by default, 0 for no budget). The server takes at most --accept-rate
+// new connections a second (no limit by default), and drops a connection with more than --max-queued-frames frames (256 by
+// default, 0 for no bound) waiting to be sent.
+
+#define METRICS_INTERVAL_S 5
+// how long the old server waits on the new one at each step of a handoff before carrying on by itself
+#define HANDOFF_TIMEOUT_S 10
+
+// Writes the metrics to a temporary file and renames it over the old one, so whatever reads the file never sees half of it
+static void write_metrics(const char *path, EvalCache *eval_cache){
+    std::string temp_path = std::string(path) + ".tmp";
+    FILE *file = fopen(temp_path.c_str(), "w");
+    if (file == NULL){
+        perror("fopen() error");
+        return;
     }
-    WSACleanup();
-    return;
+    std::string metrics = eval_cache->format_metrics();
+    fwrite(metrics.data(), 1, metrics.size(), file);
+    fclose(file);
+    if (rename(temp_path.c_str(), path) != 0)
+        perror("rename() error");
 }
 
-int main(){
-    // WSA startup
-    WSADATA wsaData;
-
-    int startupResult = WSAStartup(MAKEWORD(2,2), &wsaData);
-    if (startupResult != 0){
-        printf("WSAStartup error: %d\n", startupResult);
-    }
-
-    // getting addresses and ports to be used
+static void usage(){
+    printf("Usage: server [bot] [--port P] [--shards N] [--backend epoll|uring] [--engine-threads N] [--max-sessions N] [--think-ms MS] [--hash MB] [--ponder-budget PCT] [--eval-cache MB] [--metrics-file PATH] [--state-dir DIR] [--checkpoint-interval S] [--resume-port P] [--gateway] [--record FILE] [--handoff-socket PATH] [--take-over PATH] [--timeline FILE] [--latency-slo-ms MS] [--memory-budget MB] [--max-queued-frames N] [--accept-rate N] [--retry-after S] [--quiet]\n");
+}
 
-    struct addrinfo *result = NULL, *ptr = NULL, hints;
+static std::thread start_shard(int index, const ServerOptions &options, ShardControl &control){
+    if (options.backend == IOBackend::UringBackend)
+        return std::thread(run_uring_shard, index, std::cref(options), std::ref(control));
+    return std::thread(run_epoll_shard, index, std::cref(options), std::ref(control));
+}
 
-    ZeroMemory(&hints, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-    hints.ai_flags = AI_PASSIVE;
+static void make_hello(const ServerOptions &options, HandoffHello &hello){
+    memset(&hello, 0, sizeof(hello));
+    memcpy(hello.magic, HANDOFF_MAGIC, sizeof(hello.magic));
+    hello.version = HANDOFF_VERSION;
+    hello.shards = options.shards;
+    hello.game_size = sizeof(Game);
+    hello.bot_mode = options.shard_config.bot_mode;
+    hello.state_dir = options.shard_config.state_dir != NULL;
+}
 
-    int iResult = getaddrinfo(NULL, DEFAULT_PORT, &hints, &result);
-    if (iResult != 0){
-        printf("getaddrinfo error: %d\n", iResult);
-        WSACleanup();
-        return 1;
+// The new server's side of a handoff, up to having every shard's copy. Returns the socket to carry on with, or -1 if there
+// was nothing to take over
+static int start_take_over(const char *path, const ServerOptions &options, std::vector<ShardHandoff> &copies){
+    int sock = handoff_connect(path);
+    if (sock < 0)
+        return -1;
+    HandoffHello hello, reply;
+    make_hello(options, hello);
+    if (!handoff_send_message(sock, &hello, sizeof(hello)) || !handoff_recv_message(sock, &reply, sizeof(reply))){
+        printf("The running server didn't answer the handoff request.\n");
+        close(sock);
+        return -1;
     }
-
-    // creating socket
-
-    SOCKET listenSocket = INVALID_SOCKET;
-    listenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-    if (listenSocket == INVALID_SOCKET){
-        printf("socket() error: %d\n", WSAGetLastError());
-        freeaddrinfo(result);
-        WSACleanup();
-        return 1;
+    if (!reply.accepted){
+        printf("The running server refused the handoff. It has %u shard(s)%s%s, and this server has to match.\n", reply.shards,
+            reply.bot_mode ? ", bot mode" : "", reply.state_dir ? ", a state directory" : "");
+        close(sock);
+        return -1;
     }
-
-    // binding socket
-    iResult = bind(listenSocket, result->ai_addr, (int)result->ai_addrlen);
-    if (iResult == SOCKET_ERROR){
-        printf("bind() error: %d\n", WSAGetLastError());
-        freeaddrinfo(result);
-        WSACleanup();
-        return 1;
+    for (int i = 0; i < options.shards; i++){
+        if (!recv_shard_handoff(sock, copies[i]) || copies[i].header.index != (uint32_t)i){
+            printf("The running server's copy of shard %d didn't come through.\n", i);
+            close(sock);
+            return -1;
+        }
     }
+    return sock;
+}
 
-    // result is no longer needed so it must be freed
-    freeaddrinfo(result);
-
-    printf("Waiting to receive connection from client.\n");
-
-    // listening on socket
-    if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR){
-        printf("listen() error: %d\n", WSAGetLastError());
-        cleanup(listenSocket, INVALID_SOCKET);
-        return 1;
+// The rest of it, once the shards have been started from the copies: waits for them to be ready, has the old server stop
+// its shards, and hands the final handoffs to the shards. Returns false if the old server went away
+static bool finish_take_over(int sock, const ServerOptions &options, std::vector<ShardControl> &controls,
+    std::vector<ShardHandoff> &finals){
+    for (int i = 0; i < options.shards; i++)
+        controls[i].wait_done();
+    char ready = HANDOFF_READY;
+    if (!handoff_send_message(sock, &ready, sizeof(ready)))
+        return false;
+    for (int i = 0; i < options.shards; i++){
+        if (!recv_shard_handoff(sock, finals[i]) || finals[i].header.index != (uint32_t)i){
+            printf("The running server's handoff of shard %d didn't come through.\n", i);
+            return false;
+        }
+        controls[i].adopt_final = &finals[i];
+        controls[i].give_answer(true);
     }
-
-    // Accepting a connection
-    SOCKET clientSocketOne = INVALID_SOCKET;
-    clientSocketOne = accept(listenSocket, NULL, NULL);
-    if (clientSocketOne == INVALID_SOCKET){
-        printf("accept() first client error: %d\n", WSAGetLastError());
-        cleanup(listenSocket, INVALID_SOCKET);
-        return 1;
+    // the pause runs from the first old shard stopping to the last new one running
+    uint64_t stopped = UINT64_MAX, running = 0;
+    size_t connections = 0, games = 0, changed = 0;
+    for (int i = 0; i < options.shards; i++){
+        controls[i].wait_done();
+        stopped = std::min(stopped, finals[i].header.stopped_ns);
+        running = std::max(running, controls[i].started_ns);
+        connections += finals[i].connections.size();
+        games += finals[i].live_sessions.size();
+        changed += finals[i].sessions.size();
     }
-    printf("Client one connected, waiting for client two.\n");
+    char started = HANDOFF_RUNNING;
+    handoff_send_message(sock, &started, sizeof(started));
+    printf("Took over %zu connection(s) and %zu game(s), %zu of them changed since the copy. Games were paused for %.1f ms.\n",
+        connections, games, changed, (running - stopped) / 1e6);
+    return true;
+}
 
-    const char *sendbuf;
+// A copy's connection fds are duplicates, so its shard could carry on closing connections while the copy was sent. The
+// rest of the copy is kept, for the shard to tell what's changed since
+static void close_copied_fds(ShardHandoff &copy){
+    for (size_t i = copy.header.listen_fds; i < copy.fds.size(); i++)
+        close(copy.fds[i]);
+    copy.fds.clear();
+}
 
-    // $ is the delimiter for the end of the message. $R tells client to wait to receive another message.
-    // $S tells client to send a message.
-    sendbuf = "Welcome to Chess Online, Player 1! Server is waiting for player 2 to connect.\n\n\
-Controls: input the tile of the piece you would like to move first, followed directly by the destination tile. \
-Example: c1e3 would attempt to move the piece at c1 to position e3. \nIf you want to castle, move the king two spaces the right or left.\n$R";
-    if (send(clientSocketOne, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-        printf("Welcome message to client one error: %d", WSAGetLastError());
-        cleanup(clientSocketOne, listenSocket);
-        return 1;
+// Hands every shard over to a new server connecting on the handoff socket. Returns true once the new server has taken
+// over and the shards have exited, or false if it refused or went away, in which case the shards carry on
+static bool hand_off(int listen_fd, const ServerOptions &options, std::vector<ShardControl> &controls,
+    std::vector<std::thread> &shards){
+    int sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0)
+        return false;
+    struct timeval timeout = {HANDOFF_TIMEOUT_S, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    HandoffHello hello, reply;
+    make_hello(options, reply);
+    if (!handoff_recv_message(sock, &hello, sizeof(hello))){
+        close(sock);
+        return false;
     }
-
-    // Accepting another connection
-    SOCKET clientSocketTwo = INVALID_SOCKET;
-    clientSocketTwo = accept(listenSocket, NULL, NULL);
-    if (clientSocketTwo == INVALID_SOCKET){
-        printf("accept() second client error: %d\n", WSAGetLastError());
-        cleanup(listenSocket, INVALID_SOCKET);
-        return 1;
+    reply.accepted = memcmp(hello.magic, reply.magic, sizeof(hello.magic)) == 0 && hello.version == reply.version
+        && hello.shards == reply.shards && hello.game_size == reply.game_size && hello.bot_mode == reply.bot_mode
+        && hello.state_dir == reply.state_dir;
+    if (!handoff_send_message(sock, &reply, sizeof(reply)) || !reply.accepted){
+        printf("Refused to hand off to a server with different settings.\n");
+        close(sock);
+        return false;
     }
-    printf("Client two connected.");
-
-    // Don't need server socket once two connections are accepted
-    closesocket(listenSocket); 
 
-    sendbuf = "Welcome to Chess Online, Player 2! Player 1 will start as White.\n\n\
-Controls: input the tile of the piece you would like to move first, followed directly by the destination tile. \
-Example: c1e3 would attempt to move the piece at c1 to position e3. \nIf you want to castle, move the king two spaces the right or left.\n$R";
-    if (send(clientSocketTwo, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-        printf("Welcome message to client two error: %d", WSAGetLastError());
-        cleanup(clientSocketOne, clientSocketTwo);
-        return 1;
+    // the shards carry on while they copy everything, and while the new server sets the copies up
+    printf("Handing off to a new server.\n");
+    uint64_t start = handoff_clock_ns();
+    for (int i = 0; i < options.shards; i++){
+        controls[i].copy = ShardHandoff();
+        controls[i].final = ShardHandoff();
+        controls[i].post(ShardRequest::CopyShard);
     }
-
-    Game game; // Instatiate the game
-
-
-    // receive and send data on socket
-    char recvbuf[DEFAULT_BUFLEN];
-    // recvbuf[DEFAULT_BUFLEN] = '\0'; // end with null for printing purposes. when calling recv function, effective buffer size is DEFAULT_BUFLEN
-    int iSendResult;
-
-    // setting up buffer that holds the printed table. This table is of fixed size and will have it's contents replaced after every move.
-    char tablebuf[DEFAULT_BUFLEN];
-    tablebuf[PRINTED_BOARD_SIZE] = '$';
-    tablebuf[PRINTED_BOARD_SIZE+1] = 'R';
-    tablebuf[PRINTED_BOARD_SIZE+2] = '\0';
-
-    // Sending table to client 1
-    game.format_table_to_print(tablebuf); // update the contents of the printed table buffer
-    tablebuf[PRINTED_BOARD_SIZE+1] = 'R'; // tell client 1 to recieve a message from server after recieving table
-
-    // Send the printed table
-    if (send(clientSocketOne, tablebuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-        printf("Sending table to client 1 error: %d", WSAGetLastError());
-        cleanup(clientSocketOne, clientSocketTwo);
-        return 1;
+    for (int i = 0; i < options.shards; i++)
+        controls[i].wait_done();
+    uint64_t copied = handoff_clock_ns();
+    bool ok = true;
+    for (int i = 0; i < options.shards && ok; i++)
+        ok = send_shard_handoff(sock, controls[i].copy);
+    for (int i = 0; i < options.shards; i++)
+        close_copied_fds(controls[i].copy);
+    char ready = 0;
+    ok = ok && handoff_recv_message(sock, &ready, sizeof(ready)) && ready == HANDOFF_READY;
+    if (!ok){
+        printf("The new server went away before taking over. Carrying on.\n");
+        close(sock);
+        for (int i = 0; i < options.shards; i++)
+            controls[i].copy = ShardHandoff();
+        return false;
     }
 
-    sendbuf = "Player two has connected. It's your turn to make the first move as White.\
-$S";
-    if (send(clientSocketOne, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-        printf("Third welcome message to client one error: %d", WSAGetLastError());
-        cleanup(clientSocketOne, clientSocketTwo);
-        return 1;
+    // from here until the answer, games are paused
+    uint64_t ready_ns = handoff_clock_ns();
+    for (int i = 0; i < options.shards; i++)
+        controls[i].post(ShardRequest::HandOffShard);
+    for (int i = 0; i < options.shards; i++)
+        controls[i].wait_done();
+    uint64_t exported = handoff_clock_ns();
+    for (int i = 0; i < options.shards && ok; i++)
+        ok = send_shard_handoff(sock, controls[i].final);
+    uint64_t sent = handoff_clock_ns();
+    char running = 0;
+    bool taken = ok && handoff_recv_message(sock, &running, sizeof(running)) && running == HANDOFF_RUNNING;
+    close(sock);
+    for (int i = 0; i < options.shards; i++)
+        controls[i].give_answer(taken);
+
+    size_t connections = 0, games = 0, changed = 0;
+    for (int i = 0; i < options.shards; i++){
+        connections += controls[i].final.connections.size();
+        games += controls[i].final.live_sessions.size();
+        changed += controls[i].final.sessions.size();
+        controls[i].copy = ShardHandoff();
+        controls[i].final = ShardHandoff();
     }
+    if (!taken){
+        printf("The new server didn't take over. Carrying on with %zu connection(s) and %zu game(s).\n", connections, games);
+        return false;
+    }
+    for (int i = 0; i < options.shards; i++)
+        shards[i].join();
+    printf("Handed %zu connection(s) and %zu game(s) over, %zu of them changed since the copy. Copying took %.1f ms and "
+        "the new server %.1f ms to set it up while games went on. Stopping the shards took %.1f ms and sending what "
+        "changed %.1f ms.\n", connections, games, changed, (copied - start) / 1e6, (ready_ns - copied) / 1e6,
+        (exported - ready_ns) / 1e6, (sent - exported) / 1e6);
+    return true;
+}
 
-    enum MoveResult move_result;
-
-    do {
-        
-        ///////////////////////////////
-        /// Client 1 (White) move ////
-        /////////////////////////////
-        
-        // recieve client 1's move
-        printf("Waiting for client 1 to make move.\n");
-        if (recv(clientSocketOne,recvbuf,DEFAULT_BUFLEN,0) == SOCKET_ERROR){
-            printf("Client 1 receive error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
-        printf("client 1's move: %s", recvbuf);
-
-        // check that move is valid. if not, keep recieving moves until it is
-        while((move_result = game.make_move(recvbuf, 'W')) == MoveResult::Invalid){ // if condition is false, move was invalid and server requests another
-            sendbuf = "Invalid move. Try again:$S";
-            if (send(clientSocketOne, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-                printf("client 1 send error: %d\n", WSAGetLastError());
-                cleanup(clientSocketOne, clientSocketTwo);
-                return 1;
-            }
-            printf("Waiting for client 1 to make move.\n");
-            if (recv(clientSocketOne,recvbuf,DEFAULT_BUFLEN,0) == SOCKET_ERROR){
-                printf("Client 1 receive error: %d\n", WSAGetLastError());
-                cleanup(clientSocketOne, clientSocketTwo);
+int main(int argc, char* argv[]){
+    ServerOptions options;
+    options.port = DEFAULT_PORT;
+    options.shards = 1;
+    options.backend = IOBackend::EpollBackend;
+    options.shard_config.bot_mode = false;
+    options.shard_config.bot_think_ms = 2000;
+    options.shard_config.engine_threads = 1;
+    options.shard_config.hash_mb = 16;
+    options.shard_config.ponder_budget = NULL;
+    options.shard_config.eval_cache = NULL;
+    int ponder_percent = 50;
+    int eval_cache_mb = 64;
+    const char *metrics_path = NULL;
+    options.shard_config.max_sessions = 16384;
+    options.shard_config.verbose = true;
+    options.shard_config.state_dir = NULL;
+    options.shard_config.checkpoint_interval_s = 10;
+    options.shard_config.record_path = NULL;
+    options.shard_config.admission.latency_slo_ms = 0;
+    options.shard_config.admission.max_queued_frames = 256;
+    options.shard_config.admission.accept_rate = 0;
+    options.shard_config.admission.retry_after_s = 5;
+    options.shard_config.memory_budget = NULL;
+    int memory_budget_mb = 1024;
+    options.resume_port = DEFAULT_RESUME_PORT;
+    options.gateway = false;
+    const char *handoff_path = NULL;
+    const char *take_over_path = NULL;
+    const char *timeline_path = NULL;
+
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "bot") == 0){
+            options.shard_config.bot_mode = true;
+        } else if (strcmp(argv[i], "--quiet") == 0){
+            options.shard_config.verbose = false;
+        } else if (i + 1 < argc && strcmp(argv[i], "--port") == 0){
+            options.port = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--backend") == 0){
+            i++;
+            if (strcmp(argv[i], "epoll") == 0){
+                options.backend = IOBackend::EpollBackend;
+            } else if (strcmp(argv[i], "uring") == 0){
+                options.backend = IOBackend::UringBackend;
+            } else {
+                usage();
                 return 1;
             }
-            printf("client 1's move: %s", recvbuf);
-        } 
-
-        // check if move results in a pawn promotion
-        if (move_result == MoveResult::ValidWithReplace){
-            printf("Client 1 must promote pawn.");
-            while (1){ // loop to take input from client until it's a valid replacement piece
-                sendbuf = "What piece will you promote your pawn to? Type one uppercase letter; \n\
-R = Rook, N = Knight, B = Bishop, and Q = Queen.\n$S";
-                if (send(clientSocketOne, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-                    printf("Promotion send error: %d", WSAGetLastError());
-                    cleanup(clientSocketOne, clientSocketTwo);
-                    return 1;
-                }
-                if (recv(clientSocketOne, recvbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-                    printf("Promotion recieve error: %d", WSAGetLastError());
-                    cleanup(clientSocketOne, clientSocketTwo);
-                    return 1;
-                }
-                if (Game::validate_promotion_input(recvbuf)){
-                    // if recvbuf is valid
-                    break;
-                } else {
-                    sendbuf = "Invalid input. Try again.\n$R";
-                    if (send(clientSocketOne, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-                        printf("Promotion invalid send error: %d", WSAGetLastError());
-                        cleanup(clientSocketOne, clientSocketTwo);
-                        return 1;
-                    }
-                }
-            }
-            game.promote_pawn(recvbuf[0]);
-        }
-
-
-        // Send table again to show client 1 where they moved
-        game.format_table_to_print(tablebuf); // update the contents of the printed table buffer
-        tablebuf[PRINTED_BOARD_SIZE+1] = 'R'; // tell client 1 to wait for message from server after recieving table
-        if (send(clientSocketOne, tablebuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Sending table pt.2 to client 1 error: %d", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
+        } else if (i + 1 < argc && strcmp(argv[i], "--shards") == 0){
+            options.shards = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--engine-threads") == 0){
+            options.shard_config.engine_threads = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--max-sessions") == 0){
+            options.shard_config.max_sessions = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--think-ms") == 0){
+            options.shard_config.bot_think_ms = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--hash") == 0){
+            options.shard_config.hash_mb = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--ponder-budget") == 0){
+            ponder_percent = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--eval-cache") == 0){
+            eval_cache_mb = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--metrics-file") == 0){
+            metrics_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--state-dir") == 0){
+            options.shard_config.state_dir = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--checkpoint-interval") == 0){
+            options.shard_config.checkpoint_interval_s = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--resume-port") == 0){
+            options.resume_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--gateway") == 0){
+            options.gateway = true;
+        } else if (i + 1 < argc && strcmp(argv[i], "--record") == 0){
+            options.shard_config.record_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--handoff-socket") == 0){
+            handoff_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--take-over") == 0){
+            take_over_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--timeline") == 0){
+            timeline_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--latency-slo-ms") == 0){
+            options.shard_config.admission.latency_slo_ms = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--memory-budget") == 0){
+            memory_budget_mb = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--max-queued-frames") == 0){
+            options.shard_config.admission.max_queued_frames = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--accept-rate") == 0){
+            options.shard_config.admission.accept_rate = atof(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--retry-after") == 0){
+            options.shard_config.admission.retry_after_s = atoi(argv[++i]);
+        } else {
+            usage();
             return 1;
         }
+    }
+    if (options.shards < 1 || options.shard_config.max_sessions < 1 || options.shard_config.engine_threads < 1
+        || options.shard_config.hash_mb < 0 || ponder_percent < 0 || ponder_percent > 100 || eval_cache_mb < 0
+        || options.shard_config.checkpoint_interval_s < 1 || options.resume_port < 1 || options.resume_port + options.shards > 65536
+        || options.shard_config.admission.latency_slo_ms < 0 || memory_budget_mb < 0
+        || options.shard_config.admission.max_queued_frames < 0 || options.shard_config.admission.accept_rate < 0
+        || options.shard_config.admission.retry_after_s < 1){
+        usage();
+        return 1;
+    }
 
-        // if black king was just taken, break from the game loop
-        if (game.get_white_won())
-            break;
-
-        // Now sending confirmation to client 1 and telling them to wait for another message.
-        sendbuf = "Nice move. Now waiting for Black's move.$R";
-        if (send(clientSocketOne, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("client 1 send error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
+    // one budget for every shard, so pondering in all the games together gets at most its share of the engine threads. The
+    // bot needs its transposition table to know what reply to expect, so there's no pondering without one
+    PonderBudget *ponder_budget = NULL;
+    if (options.shard_config.bot_mode && ponder_percent > 0 && options.shard_config.hash_mb > 0){
+        ponder_budget = new PonderBudget(options.shards * options.shard_config.engine_threads, ponder_percent);
+        options.shard_config.ponder_budget = ponder_budget;
+    }
+    EvalCache *eval_cache = NULL;
+    if (options.shard_config.bot_mode && eval_cache_mb > 0){
+        eval_cache = new EvalCache(eval_cache_mb);
+        options.shard_config.eval_cache = eval_cache;
+    }
 
-        // sending updated table to client 2
-        tablebuf[PRINTED_BOARD_SIZE+1] = 'R'; // tell client 2 to wait for message from server after recieving table
-        if (send(clientSocketTwo, tablebuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Sending table pt.1 to client 2 error: %d", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
+    // the accept rate is the whole server's, shared evenly by the shards (SO_REUSEPORT spreads connections evenly over them)
+    options.shard_config.admission.accept_rate /= options.shards;
+    MemoryBudget *memory_budget = NULL;
+    if (memory_budget_mb > 0){
+        memory_budget = new MemoryBudget((long)memory_budget_mb << 20);
+        options.shard_config.memory_budget = memory_budget;
+    }
 
-        // Telling client 2 of the move client 1 just made, and telling it to send a message
-        std::string c1move(recvbuf);
-        std::string msg("White just moved: ");
-        msg = msg+c1move+"Your turn now: $S";
-        if (send(clientSocketTwo, msg.c_str(),(int)msg.length(),0) == SOCKET_ERROR){
-            printf("Client 2 send error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
+    if (options.shard_config.state_dir != NULL && mkdir(options.shard_config.state_dir, 0755) != 0 && errno != EEXIST){
+        perror("mkdir() error");
+        return 1;
+    }
 
-        //////////////////////////////
-        /// Client 2 (Black) move ////
-        //////////////////////////////
+    if (options.backend == IOBackend::UringBackend && !uring_supported()){
+        printf("This kernel doesn't support the io_uring backend (Linux 6.0 or newer is needed). Using epoll.\n");
+        options.backend = IOBackend::EpollBackend;
+    }
 
-        // recieve client 2's move
-        printf("Waiting for client 2 to make move.\n");
-        if (recv(clientSocketTwo,recvbuf,DEFAULT_BUFLEN,0) == SOCKET_ERROR){
-            printf("Client 2 receive error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
+    if (!net_startup())
+        return 1;
+    net_raise_fd_limit();
+    setvbuf(stdout, NULL, _IOLBF, 0); // the shards log from several threads, so keep lines whole even when piped to a file
+
+    // SIGINT and SIGTERM are only taken by this thread (the shards inherit the mask), which then wakes every shard up to exit.
+    // So are the timeline's signals, with --timeline
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (timeline_path != NULL){
+        sigaddset(&signals, SIGUSR1);
+        sigaddset(&signals, SIGUSR2);
+    }
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // Taking over from a running server, every shard gets ready from its copy of the old server's shard, and takes over
+    // once the old shard has stopped
+    std::vector<ShardHandoff> copies(options.shards), finals(options.shards);
+    int take_over_sock = -1;
+    if (take_over_path != NULL){
+        take_over_sock = start_take_over(take_over_path, options, copies);
+        if (take_over_sock < 0)
             return 1;
-        }
-        printf("client 2's move: %s", recvbuf);
-
-        // check that move is valid. if not, keep recieving moves until it is
-        while((move_result = game.make_move(recvbuf, 'B')) == MoveResult::Invalid){ // if condition is false, move was invalid and server requests another
-            sendbuf = "Invalid move. Try again:$S";
-            if (send(clientSocketTwo, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-                printf("client 2 send error: %d\n", WSAGetLastError());
-                cleanup(clientSocketOne, clientSocketTwo);
-                return 1;
-            }
-            printf("Waiting for client 2 to make move.\n");
-            if (recv(clientSocketTwo,recvbuf,DEFAULT_BUFLEN,0) == SOCKET_ERROR){
-                printf("Client 1 receive error: %d\n", WSAGetLastError());
-                cleanup(clientSocketOne, clientSocketTwo);
-                return 1;
-            }
-            printf("client 2's move: %s", recvbuf);
-        } 
-
-        // check if move results in a pawn promotion
-        if (move_result == MoveResult::ValidWithReplace){
-            printf("Client 2 must promote pawn.");
-            while (1){ // loop to take input from client until it's a valid replacement piece
-                sendbuf = "What piece will you promote your pawn to? Type one uppercase letter; \n\
-R = Rook, N = Knight, B = Bishop, and Q = Queen.\n$S";
-                if (send(clientSocketTwo, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-                    printf("Promotion send error: %d", WSAGetLastError());
-                    cleanup(clientSocketOne, clientSocketTwo);
-                    return 1;
-                }
-                if (recv(clientSocketTwo, recvbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-                    printf("Promotion recieve error: %d", WSAGetLastError());
-                    cleanup(clientSocketOne, clientSocketTwo);
-                    return 1;
-                }
-                if (Game::validate_promotion_input(recvbuf)){
-                    // if recvbuf is valid
-                    break;
-                } else {
-                    sendbuf = "Invalid input. Try again.\n$R";
-                    if (send(clientSocketTwo, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-                        printf("Promotion invalid send error: %d", WSAGetLastError());
-                        cleanup(clientSocketOne, clientSocketTwo);
-                        return 1;
-                    }
-                }
-            }
-            game.promote_pawn(recvbuf[0]);
-        }
+    }
 
-        // Send table again to show client 2 where they moved
-        game.format_table_to_print(tablebuf); // update the contents of the printed table buffer
-        tablebuf[PRINTED_BOARD_SIZE+1] = 'R'; // tell client 2 to wait for message from server after recieving table
-        if (send(clientSocketTwo, tablebuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Sending table pt.2 to client 2 error: %d", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
+    std::vector<ShardControl> controls(options.shards);
+    std::vector<std::thread> shards;
+    for (int i = 0; i < options.shards; i++){
+        controls[i].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        controls[i].adopt = (take_over_sock >= 0) ? &copies[i] : NULL;
+        shards.push_back(start_shard(i, options, controls[i]));
+    }
+    if (take_over_sock >= 0){
+        // the shards are waiting on the old server, and can't be stopped cleanly without it
+        if (!finish_take_over(take_over_sock, options, controls, finals)){
+            printf("The running server went away during the handoff.\n");
+            exit(1);
         }
+        close(take_over_sock);
+        copies.clear();
+        finals.clear();
+    }
+    printf("Listening on port %s with %d %s shard(s)%s.\n", options.port, options.shards,
+        (options.backend == IOBackend::UringBackend) ? "io_uring" : "epoll",
+        options.shard_config.bot_mode ? ", every client plays the bot" : "");
+
+    int handoff_fd = -1;
+    if (handoff_path != NULL){
+        handoff_fd = handoff_listen(handoff_path);
+        if (handoff_fd < 0)
+            printf("Couldn't listen for handoffs on %s.\n", handoff_path);
+    }
 
-        // if white king was just taken, break from the game loop
-        if (game.get_black_won())
+    // wait for a signal or a new server to hand off to, writing out the metrics every few seconds meanwhile
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    bool handed_off = false;
+    int timeout_ms = (metrics_path != NULL && eval_cache != NULL) ? METRICS_INTERVAL_S * 1000 : -1;
+    while (!handed_off){
+        struct pollfd fds[2] = {{signal_fd, POLLIN, 0}, {handoff_fd, POLLIN, 0}};
+        int n = poll(fds, (handoff_fd >= 0) ? 2 : 1, timeout_ms);
+        if (n < 0 && errno != EINTR){
+            perror("poll() error");
             break;
-
-        // Now sending confirmation to client 2 and telling them to wait for another message.
-        sendbuf = "Nice move. Now waiting for White's move.$R";
-        if (send(clientSocketTwo, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("client 2 send error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
-
-        // Sending updated table to client 1
-        game.format_table_to_print(tablebuf); // update the contents of the printed table buffer
-        tablebuf[PRINTED_BOARD_SIZE+1] = 'R'; // tell client 1 to send a move to server after recieving table
-        // Send the printed table
-        if (send(clientSocketOne, tablebuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Sending table pt.1 to client 1 error: %d", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
-
-        // Telling client 1 of the move client 2 just made
-        std::string c2move(recvbuf);
-        std::string msg2("Black just moved: ");
-        msg2 = msg2+c2move+"Your turn now: $S";
-        if (send(clientSocketOne, msg2.c_str(),(int)msg2.length(),0) == SOCKET_ERROR){
-            printf("Client 1 send error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
         }
-
-    } while (1);
-
-    // handle cases when the game has been won.
-    if (game.get_white_won()){
-        sendbuf = "White has won the game!!!!!!!!!!!!!!$E";
-        if (send(clientSocketOne, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Client 1 game finish send to client 1 error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
-        tablebuf[PRINTED_BOARD_SIZE+1] = 'R'; // tell client 2 to wait for message from server after recieving table
-        if (send(clientSocketTwo, tablebuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Sending victory table to client 2 error: %d", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
-        if (send(clientSocketTwo, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Client 1 game finish send to client 2 error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
-    } else if (game.get_black_won()){
-        sendbuf = "Black has won the game!!!!!!!!!!!!!!$E";
-        if (send(clientSocketTwo, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Client 2 game finish send to client 2 error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
-        tablebuf[PRINTED_BOARD_SIZE+1] = 'R'; // tell client 2 to wait for message from server after recieving table
-        if (send(clientSocketOne, tablebuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Sending victory table to client 1 error: %d", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
-        }
-        if (send(clientSocketOne, sendbuf, DEFAULT_BUFLEN, 0) == SOCKET_ERROR){
-            printf("Client 2 game finish send to client 1 error: %d\n", WSAGetLastError());
-            cleanup(clientSocketOne, clientSocketTwo);
-            return 1;
+        if (n == 0)
+            write_metrics(metrics_path, eval_cache);
+        if (n <= 0)
+            continue;
+        if (fds[0].revents & POLLIN){
+            struct signalfd_siginfo info;
+            if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
+                break;
+            if (info.ssi_signo == SIGUSR1){
+                timeline_set_enabled(!timeline_enabled);
+                printf("The timeline is %s.\n", timeline_enabled ? "on" : "off");
+            } else if (info.ssi_signo == SIGUSR2){
+                timeline_dump(timeline_path);
+            } else {
+                break;
+            }
         }
+        if (handoff_fd >= 0 && (fds[1].revents & POLLIN))
+            handed_off = hand_off(handoff_fd, options, controls, shards);
+    }
+    close(signal_fd);
+    // after a handoff the socket file is the new server's
+    if (handoff_fd >= 0){
+        close(handoff_fd);
+        if (!handed_off)
+            unlink(handoff_path);
     }
 
-    // connection closed (iResult == 0)
-    iResult = shutdown(clientSocketOne, SD_SEND);
-    if (iResult == SOCKET_ERROR){
-        printf("shutdown() client one error: %d\n", WSAGetLastError());
-        // closesocket(clientSocketOne);
-        // closesocket(clientSocketTwo);
-        // WSACleanup();
+    if (!handed_off){
+        printf("Shutting down.\n");
+        for (int i = 0; i < options.shards; i++)
+            controls[i].post(ShardRequest::StopShard);
+        for (int i = 0; i < options.shards; i++)
+            shards[i].join();
     }
-    iResult = shutdown(clientSocketTwo, SD_SEND);
-    if (iResult == SOCKET_ERROR){
-        printf("shutdown() client two error: %d\n", WSAGetLastError());
+    for (int i = 0; i < options.shards; i++)
+        close(controls[i].wake_fd);
+
+    if (eval_cache != NULL){
+        if (metrics_path != NULL)
+            write_metrics(metrics_path, eval_cache);
+        std::string metrics = eval_cache->format_metrics();
+        printf("Eval cache:\n%.*s", (int)metrics.find("eval_cache_lookup_latency"), metrics.c_str());
     }
-
-    cleanup(clientSocketOne, clientSocketTwo);
-
+    if (timeline_path != NULL && timeline_enabled)
+        timeline_dump(timeline_path);
+    delete eval_cache;
+    delete ponder_budget;
+    delete memory_budget;
+    net_cleanup();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1277 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+
+#include "session.h"
+
+// $ is the delimiter for the end of the message. $R tells client to wait to receive another message.
+// $S tells client to send a message. $E tells the client the game is over.
+static const char *WELCOME_ONE = "Welcome to Chess Online, Player 1! Server is waiting for player 2 to connect.\n\n\
+Controls: input the tile of the piece you would like to move first, followed directly by the destination tile. \
+Example: c1e3 would attempt to move the piece at c1 to position e3. \nIf you want to castle, move the king two spaces the right or left. \
+To promote a pawn, add the piece you want to the move, i.e. e7e8q for a queen (q, r, b or n). Type resign to resign.\n$R";
+
+static const char *WELCOME_ONE_BOT = "Welcome to Chess Online, Player 1! You will play White against the bot.\n\n\
+Controls: input the tile of the piece you would like to move first, followed directly by the destination tile. \
+Example: c1e3 would attempt to move the piece at c1 to position e3. \nIf you want to castle, move the king two spaces the right or left. \
+To promote a pawn, add the piece you want to the move, i.e. e7e8q for a queen (q, r, b or n). Type resign to resign.\n$R";
+
+static const char *WELCOME_TWO = "Welcome to Chess Online, Player 2! Player 1 will start as White.\n\n\
+Controls: input the tile of the piece you would like to move first, followed directly by the destination tile. \
+Example: c1e3 would attempt to move the piece at c1 to position e3. \nIf you want to castle, move the king two spaces the right or left. \
+To promote a pawn, add the piece you want to the move, i.e. e7e8q for a queen (q, r, b or n). Type resign to resign.\n$R";
+
+// Frames asking a player for a move start with a line listing every legal move, i.e. "Legal moves: e2e3 e2e4 ...\n", with
+// promotions written with their piece (i.e. "e7e8q"). The client checks what's typed against the list, so an illegal move or
+// a promotion never costs the player an extra round trip. The longest possible list (218 moves) still fits in a frame.
+static const char *LEGAL_MOVES_PREFIX = "Legal moves:";
+
+// a ponder search may take up to this many times the bot's thinking time out of the ponder budget
+#define MAX_PONDER_FACTOR 4
+
+// how often a shard with a state directory wakes up to carry on with its checkpoints
+#define CHECKPOINT_TICK_MS 100
+// games copied per batch of events for a checkpoint, which keeps each batch's share of the copying well under a millisecond
+#define CHECKPOINT_CHUNK 4096
+// how long players have to come back to their restored games before the games are given up on
+#define RESUME_WINDOW_S 300
+// Closed connections' output buffers are kept for the next connections to open, so a new game's frames go into a buffer
+// that's already grown. Only this many are kept, and none that grew past SPARE_OUTBUF_BYTES behind a slow reader
+#define MAX_SPARE_OUTBUFS 256
+#define SPARE_OUTBUF_BYTES (8 * DEFAULT_BUFLEN)
+
+// a player can type "resign" instead of a move on their turn
+static bool is_resignation(const char *buf){
+    return strncmp(buf, "resign\n", 7) == 0;
+}
+
+static char opponent_of(char color){
+    return (color == 'W') ? 'B' : 'W';
+}
+
+// writes the legal move line for moves into buf and returns its length
+static int format_legal_moves(const std::vector<Move> &moves, char buf[DEFAULT_BUFLEN]){
+    int len = (int)strlen(LEGAL_MOVES_PREFIX);
+    memcpy(buf, LEGAL_MOVES_PREFIX, len);
+    char move_text[DEFAULT_BUFLEN];
+    for (const Move &m : moves){
+        Game::format_move(m, move_text);
+        int n = (int)strlen(move_text) - 1; // without the newline
+        buf[len++] = ' ';
+        memcpy(buf + len, move_text, n);
+        len += n;
+    }
+    buf[len++] = '\n';
+    buf[len] = '\0';
+    return len;
+}
+
+// An adopting shard makes its pools at least as big as the old shard's, so there's room for whatever it hands over
+Shard::Shard(int index, const ShardConfig &config, const ShardHandoff *adopt)
+    : frames_received(0), frames_queued(0), ponder_hits(0), ponder_misses(0),
+      admission(index, config.admission, config.memory_budget), index(index), config(config),
+      sessions(std::max<int>(config.max_sessions, adopt != NULL ? (int)adopt->header.max_sessions : 0)),
+      connections(std::max<int>(config.max_sessions * 2, adopt != NULL ? (int)adopt->header.max_connections : 0)), waiting(NULL),
+      engine_pool(config.bot_mode ? config.engine_threads : 0, config.hash_mb, config.ponder_budget, config.eval_cache),
+      queued_bytes(0), batch_frames(0), next_game_id(1), resume_code_rng(std::random_device()()), journal(NULL), snapshot_writer(NULL), timer(-1),
+      trace(NULL), next_trace_id(1),
+      checkpointing(false), checkpoint_copied(0), checkpoint_journal_seq(0), awaiting_resumes(false), copy_target(NULL),
+      copied_connections(0), copied_sessions(0), handed_off(false){
+    spare_outbufs.reserve(MAX_SPARE_OUTBUFS);
+    tablebuf[PRINTED_BOARD_SIZE] = '$';
+    tablebuf[PRINTED_BOARD_SIZE+1] = 'R';
+    tablebuf[PRINTED_BOARD_SIZE+2] = '\0';
+
+    if (config.record_path != NULL){
+        uint32_t flags = (config.bot_mode ? TRACE_BOT_MODE : 0) | (config.state_dir != NULL ? TRACE_STATE_DIR : 0);
+        trace = new TraceWriter(std::string(config.record_path) + "." + std::to_string(index), flags);
+    }
+
+    if (config.state_dir != NULL){
+        journal = new Journal(config.state_dir, index);
+        snapshot_writer = new SnapshotWriter(config.state_dir, index);
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct itimerspec tick;
+        tick.it_interval.tv_sec = 0;
+        tick.it_interval.tv_nsec = CHECKPOINT_TICK_MS * 1000000L;
+        tick.it_value = tick.it_interval;
+        if (timer < 0 || timerfd_settime(timer, 0, &tick, NULL) != 0)
+            perror("timerfd error");
+        // an adopting shard opens its journal once the old shard has stopped writing (see adopt_final)
+        if (adopt == NULL)
+            restore();
+        next_checkpoint = std::chrono::steady_clock::now() + std::chrono::seconds(config.checkpoint_interval_s);
+    }
+    if (adopt != NULL)
+        adopt_copy(*adopt);
+}
+
+Shard::~Shard(){
+    release_closed();
+    if (journal != NULL){
+        // a last checkpoint of every game, so the next start has no journal to replay. It's written before the writer's
+        // thread exits. A shard that was handed off leaves that to the server that has its games now
+        if (!handed_off)
+            continue_checkpoint(true);
+        delete snapshot_writer;
+        delete journal;
+        if (timer >= 0)
+            close(timer);
+    }
+    delete trace;
+    if (config.bot_mode && config.ponder_budget != NULL)
+        printf("[shard %d] ponder: %ld hits, %ld misses\n", index, ponder_hits, ponder_misses);
+    if (admission.connections_refused + admission.games_shed + admission.connections_dropped > 0)
+        printf("[shard %d] admission: %ld connection(s) over the accept rate, %ld new game(s) shed, %ld slow connection(s) "
+            "dropped\n", index, admission.connections_refused, admission.games_shed, admission.connections_dropped);
+}
+
+int Shard::engine_fd(){
+    return config.bot_mode ? engine_pool.notify_fd() : -1;
+}
+
+int Shard::timer_fd(){
+    return timer;
+}
+
+void Shard::handle_timer(){
+    uint64_t ticks;
+    if (read(timer, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN)
+        perror("timerfd read error");
+}
+
+// Copies a message into a DEFAULT_BUFLEN frame on the connection's output queue. Messages to NULL (the bot's side of a
+// bot game, or a player who has already gone) are simply dropped. A connection whose queue is full isn't reading what it's
+// sent, and gets nothing more: it's left for the backend to close.
+void Shard::queue_frame(Connection *c, const char *msg){
+    if (c == NULL || c->closed || c->too_slow)
+        return;
+    if (admission.queue_full(c->outbuf.size() - c->out_offset)){
+        c->too_slow = true;
+        admission.connections_dropped++;
+        if (!c->write_pending){
+            c->write_pending = true;
+            pending_writes.push_back(c);
+        }
+        return;
+    }
+    TimelineSpan span(TimelineEncode, c->fd, DEFAULT_BUFLEN);
+    size_t len = strnlen(msg, DEFAULT_BUFLEN);
+    c->outbuf.append(msg, len);
+    c->outbuf.append(DEFAULT_BUFLEN - len, '\0');
+    queued_bytes += DEFAULT_BUFLEN;
+    frames_queued++;
+    if (c->trace_id != 0){
+        c->frames_sent++;
+        c->out_hash = trace_hash(c->out_hash, msg, len);
+    }
+    if (!c->write_pending){
+        c->write_pending = true;
+        pending_writes.push_back(c);
+    }
+}
+
+// Prints a game's board into tablebuf, for c (which only says who it's for on the timeline, and can be NULL)
+void Shard::render_table(Session *s, Connection *c){
+    TimelineSpan span(TimelineRender, (c != NULL) ? c->fd : 0);
+    s->game.format_table_to_print(tablebuf);
+}
+
+Connection *Shard::player(Session *s, char color){
+    return (color == 'W') ? s->white : s->black;
+}
+
+// A new connection with nothing received or queued yet, or NULL if the pool is full
+Connection *Shard::acquire_connection(socket_t fd, bool resuming){
+    Connection *c = connections.acquire();
+    if (c == NULL)
+        return NULL;
+    c->fd = fd;
+    c->session = NULL;
+    c->color = ' ';
+    c->inbuf_len = 0;
+    c->out_offset = 0;
+    c->write_pending = false;
+    c->close_after_flush = false;
+    c->too_slow = false;
+    c->closed = false;
+    c->want_write = false;
+    c->ops_in_flight = 0;
+    c->send_in_flight = false;
+    c->shutting_down = false;
+    c->resuming = resuming;
+    c->handoff_index = -1;
+    c->trace_id = 0;
+    if (!spare_outbufs.empty()){
+        c->outbuf.swap(spare_outbufs.back());
+        spare_outbufs.pop_back();
+    }
+    return c;
+}
+
+Connection *Shard::open_connection(socket_t fd, bool resuming){
+    Connection *c = acquire_connection(fd, resuming);
+    if (c == NULL)
+        return NULL;
+    // resumed games can't be played back, since they depend on the state the server was restored from
+    if (trace != NULL && !resuming){
+        c->trace_id = next_trace_id++;
+        c->frames_sent = 0;
+        c->out_hash = TRACE_HASH_START;
+        trace->open(c->trace_id);
+    }
+    if (resuming)
+        return c;
+    if (!admission.admit_connection())
+        turn_away(c);
+    else
+        seat(c, waiting, 0);
+    return c;
+}
+
+// Seats a connection as Black in the game waiting_slot holds, if there is one, or else as White in a new game that waits
+// in waiting_slot for an opponent (unless it's a bot game). gateway_key is the key the game was joined with, or 0
+void Shard::seat(Connection *c, Session *&waiting_slot, uint64_t gateway_key){
+    // join the game that's waiting for a second player, if there is one
+    if (!config.bot_mode && waiting_slot != NULL){
+        Session *s = waiting_slot;
+        waiting_slot = NULL;
+        s->black = c;
+        c->session = s;
+        c->color = 'B';
+        queue_frame(c, WELCOME_TWO);
+        start_game(s);
+        return;
+    }
+
+    if (!admission.admit_game(sessions.in_use())){
+        turn_away(c);
+        return;
+    }
+    Session *s = sessions.acquire();
+    if (s == NULL){
+        queue_frame(c, "The server is full. Try again later.\n$E");
+        c->close_after_flush = true;
+        return;
+    }
+    s->id = 0;
+    s->gateway_key = gateway_key;
+    s->bot_game = config.bot_mode;
+    s->white = c;
+    s->black = NULL;
+    s->bot_job = 0;
+    s->ponder_job = 0;
+    s->last_move[0] = '\0';
+    s->handoff_index = -1;
+    c->session = s;
+    c->color = 'W';
+
+    if (config.bot_mode){
+        queue_frame(c, WELCOME_ONE_BOT);
+        start_game(s);
+    } else {
+        queue_frame(c, WELCOME_ONE);
+        s->state = SessionState::WaitingForOpponent;
+        waiting_slot = s;
+    }
+    if (config.verbose)
+        printf("[shard %d] Client connected, %d game(s) in progress.\n", index, sessions.in_use());
+}
+
+// Both sides are here (or White is playing the bot), so show White the board and ask for the first move
+void Shard::start_game(Session *s){
+    char msg[DEFAULT_BUFLEN];
+    s->plies = 0;
+    if (journal != NULL){
+        s->id = ((uint64_t)index << GAME_SHARD_SHIFT) | next_game_id++;
+        s->resume_codes[0] = (uint32_t)resume_code_rng();
+        s->resume_codes[1] = (uint32_t)resume_code_rng();
+        sessions_by_id[s->id] = s;
+
+        JournalRecord record;
+        memset(&record, 0, sizeof(record));
+        record.game_id = s->id;
+        record.type = JournalType::GameStarted;
+        record.bot_game = s->bot_game;
+        record.resume_codes[0] = s->resume_codes[0];
+        record.resume_codes[1] = s->resume_codes[1];
+        journal->append(record);
+
+        Connection *players[2] = {s->white, s->black};
+        for (int i = 0; i < 2; i++){
+            snprintf(msg, sizeof(msg), "This is game %llu. If the server restarts, come back to it with: client [host] --resume %llu %08x\n$R",
+                (unsigned long long)s->id, (unsigned long long)s->id, s->resume_codes[i]);
+            queue_frame(players[i], msg);
+        }
+    }
+
+    render_table(s, s->white);
+    queue_frame(s->white, tablebuf);
+    s->game.generate_moves('W', legal_moves);
+    int len = format_legal_moves(legal_moves, msg);
+    snprintf(msg + len, sizeof(msg) - len, "Player two has connected. It's your turn to make the first move as White.$S");
+    queue_frame(s->white, msg);
+    s->state = SessionState::WaitingForMove;
+    s->to_move = 'W';
+}
+
+void Shard::receive(Connection *c, const char *data, int len){
+    while (len > 0 && !c->closed){
+        int n = DEFAULT_BUFLEN - c->inbuf_len;
+        if (n > len)
+            n = len;
+        memcpy(c->inbuf + c->inbuf_len, data, n);
+        c->inbuf_len += n;
+        data += n;
+        len -= n;
+        if (c->inbuf_len == DEFAULT_BUFLEN){
+            c->inbuf_len = 0;
+            c->inbuf[DEFAULT_BUFLEN - 1] = '\0'; // don't trust the client to have terminated its input
+            frames_received++;
+            if (c->trace_id != 0)
+                trace->frame(c->trace_id, c->frames_sent, c->inbuf, strlen(c->inbuf));
+            handle_frame(c, c->inbuf);
+        }
+    }
+}
+
+void Shard::handle_frame(Connection *c, char frame[DEFAULT_BUFLEN]){
+    if (c->resuming){
+        if (strncmp(frame, "join ", 5) == 0)
+            join(c, frame);
+        else
+            resume(c, frame);
+        return;
+    }
+    Session *s = c->session;
+    // input is only expected from the player whose turn it is. Anything else is ignored
+    if (s == NULL || s->to_move != c->color || s->state != SessionState::WaitingForMove)
+        return;
+
+    if (config.verbose)
+        printf("[shard %d] %s's move: %s", index, (c->color == 'W') ? "White" : "Black", frame);
+
+    if (is_resignation(frame)){
+        s->game.resign(c->color);
+        end_game(s, c->color);
+        return;
+    }
+
+    // The move is parsed now and made at the end of the batch along with every other move the batch brought in (see
+    // make_queued_moves). Until then anything else the player sends is ignored
+    Move move;
+    bool parsed;
+    {
+        TimelineSpan span(TimelineParse, c->fd);
+        parsed = Game::parse_move(frame, move);
+    }
+    if (!parsed){
+        queue_frame(c, "Invalid move. Try again:$S");
+        return;
+    }
+    queued_moves.push_back({&s->game, move, c->color, MoveResult::Invalid});
+    queued_movers.push_back(c);
+    s->state = SessionState::MoveQueued;
+}
+
+// Only a legal move is played: one from the list the player was sent. The client won't send anything else, so an invalid move
+// only costs a round trip with clients that don't check their input. A promotion without its piece isn't legal either
+void Shard::make_queued_moves(){
+    // a game that ended after its move arrived (i.e. the opponent disconnected) has been released, and its move is dropped
+    size_t kept = 0;
+    for (size_t i = 0; i < queued_moves.size(); i++){
+        if (queued_movers[i]->session != NULL){
+            queued_moves[kept] = queued_moves[i];
+            queued_movers[kept] = queued_movers[i];
+            kept++;
+        }
+    }
+    queued_moves.resize(kept);
+    queued_movers.resize(kept);
+
+    {
+        TimelineSpan span(TimelineMakeMove, queued_moves.size());
+        Game::make_moves(queued_moves.data(), queued_moves.size());
+    }
+
+    for (size_t i = 0; i < queued_moves.size(); i++){
+        Connection *c = queued_movers[i];
+        Session *s = c->session;
+        const Move &move = queued_moves[i].move;
+        if (queued_moves[i].result != MoveResult::Valid){
+            s->state = SessionState::WaitingForMove;
+            queue_frame(c, "Invalid move. Try again:$S");
+            continue;
+        }
+        // remember the move, to tell the other player about
+        Game::format_move(move, s->last_move);
+        played_move(s, move, c->color);
+        finish_turn(s, c->color);
+    }
+    queued_moves.clear();
+    queued_movers.clear();
+}
+
+// Counts the move, and journals it with a state directory
+void Shard::played_move(Session *s, const Move &move, char mover){
+    if (journal != NULL){
+        JournalRecord record;
+        memset(&record, 0, sizeof(record));
+        record.game_id = s->id;
+        record.type = JournalType::MovePlayed;
+        record.color = mover;
+        record.from_row = move.from_row;
+        record.from_col = move.from_col;
+        record.to_row = move.to_row;
+        record.to_col = move.to_col;
+        record.promotion = move.promotion;
+        record.ply = s->plies;
+        journal->append(record);
+    }
+    s->plies++;
+}
+
+// The mover's move has been played. Show both players the board, and either end the game or hand the turn over
+void Shard::finish_turn(Session *s, char mover){
+    Connection *mover_conn = player(s, mover);
+    Connection *other_conn = player(s, opponent_of(mover));
+
+    // Send table again to show the mover where they moved
+    render_table(s, mover_conn);
+    queue_frame(mover_conn, tablebuf);
+
+    // if a king was just taken, or the game is drawn, the game is over
+    if (s->game.get_white_won() || s->game.get_black_won() || s->game.get_draw_reason() != DrawReason::NoDraw){
+        end_game(s, mover);
+        return;
+    }
+
+    // With no legal move left, and no stalemate (which was checked for above), the other player is checkmated. Checkmate
+    // ends the game here, since players can't make a move that leaves their king to be taken
+    char other = opponent_of(mover);
+    s->game.generate_moves(other, legal_moves);
+    if (legal_moves.empty()){
+        s->game.resign(other);
+        end_game(s, mover);
+        return;
+    }
+
+    queue_frame(mover_conn, (mover == 'W') ? "Nice move. Now waiting for Black's move.$R" : "Nice move. Now waiting for White's move.$R");
+
+    // sending updated table to the other player, and telling them of the move that was just made
+    queue_frame(other_conn, tablebuf);
+    if (other_conn != NULL){
+        char msg[DEFAULT_BUFLEN];
+        int len = format_legal_moves(legal_moves, msg);
+        snprintf(msg + len, sizeof(msg) - len, "%s just moved: %sYour turn now: $S", (mover == 'W') ? "White" : "Black", s->last_move);
+        queue_frame(other_conn, msg);
+    }
+
+    s->to_move = other;
+    s->state = SessionState::WaitingForMove;
+
+    if (s->bot_game){
+        if (s->to_move == 'B')
+            start_bot_search(s);
+        else
+            start_pondering(s);
+    }
+}
+
+// While White thinks, the bot searches the position after the reply it expects, on whatever engine time the ponder budget
+// allows
+void Shard::start_pondering(Session *s){
+    Move reply;
+    if (config.ponder_budget == NULL || !engine_pool.expected_reply(s->game, 'W', reply))
+        return;
+    Game pondered = s->game;
+    pondered.make_move(reply, 'W');
+    Game::format_move(reply, s->expected_reply);
+    s->ponder_job = engine_pool.submit_ponder(pondered, 'B', config.bot_think_ms, config.bot_think_ms * MAX_PONDER_FACTOR);
+    bot_jobs[s->ponder_job] = s;
+}
+
+// The bot's search runs on the engine pool, and its move is played when the completion comes back. If White played the
+// reply the bot was pondering on, the ponder job just carries on as this search
+void Shard::start_bot_search(Session *s){
+    s->state = SessionState::BotThinking;
+    if (s->ponder_job != 0){
+        if (strcmp(s->last_move, s->expected_reply) == 0 && engine_pool.ponderhit(s->ponder_job)){
+            ponder_hits++;
+            s->bot_job = s->ponder_job;
+            s->ponder_job = 0;
+            return;
+        }
+        ponder_misses++;
+        stop_pondering(s);
+    }
+    s->bot_job = engine_pool.submit(s->game, 'B', config.bot_think_ms);
+    bot_jobs[s->bot_job] = s;
+}
+
+void Shard::stop_pondering(Session *s){
+    if (s->ponder_job == 0)
+        return;
+    engine_pool.cancel(s->ponder_job);
+    bot_jobs.erase(s->ponder_job);
+    s->ponder_job = 0;
+}
+
+void Shard::handle_engine_completions(){
+    EngineCompletion completion;
+    while (engine_pool.poll_completion(completion)){
+        auto it = bot_jobs.find(completion.job_id);
+        if (it == bot_jobs.end())
+            continue; // cancelled when its session ended
+        Session *s = it->second;
+        bot_jobs.erase(it);
+        // a ponder job that ended before White moved (out of budget, stopped for a normal search, or done) has left what
+        // it found in the table, which is all it's there for
+        if (completion.job_id == s->ponder_job){
+            s->ponder_job = 0;
+            continue;
+        }
+        if (completion.cancelled)
+            continue;
+
+        // with no legal moves left, the bot resigns rather than hand over its king
+        if (!completion.result.found_move){
+            s->game.resign('B');
+            end_game(s, 'B');
+            continue;
+        }
+        Game::format_move(completion.result.best_move, s->last_move);
+        if (config.verbose)
+            printf("[shard %d] bot's move: %s", index, s->last_move);
+        s->game.make_move(completion.result.best_move, 'B');
+        played_move(s, completion.result.best_move, 'B');
+        finish_turn(s, 'B');
+    }
+}
+
+// Tells both players how the game ended. The winner (or, in a draw, the player who made the last move) already has the
+// final board, so only the other player is sent it. Both connections are closed once the frames have gone out.
+void Shard::end_game(Session *s, char last_mover){
+    const char *msg;
+    char recipient = last_mover;
+    if (s->game.get_white_won()){
+        msg = "White has won the game!!!!!!!!!!!!!!$E";
+        recipient = 'W';
+    } else if (s->game.get_black_won()){
+        msg = "Black has won the game!!!!!!!!!!!!!!$E";
+        recipient = 'B';
+    } else {
+        switch (s->game.get_draw_reason()){
+            case DrawReason::Stalemate:
+                msg = "The game is a draw by stalemate.$E";
+                break;
+            case DrawReason::ThreefoldRepetition:
+                msg = "The game is a draw by threefold repetition.$E";
+                break;
+            case DrawReason::FiftyMoveRule:
+                msg = "The game is a draw by the fifty move rule.$E";
+                break;
+            default:
+                msg = "The game is a draw by insufficient material.$E";
+                break;
+        }
+    }
+    Connection *recipient_conn = player(s, recipient);
+    Connection *other_conn = player(s, opponent_of(recipient));
+    queue_frame(recipient_conn, msg);
+    render_table(s, other_conn);
+    queue_frame(other_conn, tablebuf);
+    queue_frame(other_conn, msg);
+
+    if (config.verbose)
+        printf("[shard %d] Game over: %.*s\n", index, (int)(strchr(msg, '$') - msg), msg);
+    release_session(s);
+}
+
+// Detaches both players from a finished (or abandoned) game and gives its slot back to the pool
+void Shard::release_session(Session *s){
+    if (s->state == SessionState::BotThinking){
+        engine_pool.cancel(s->bot_job);
+        bot_jobs.erase(s->bot_job);
+    }
+    stop_pondering(s);
+    if (waiting == s)
+        waiting = NULL;
+    if (s->state == SessionState::WaitingForOpponent && s->gateway_key != 0){
+        auto it = gateway_waiting.find(s->gateway_key);
+        if (it != gateway_waiting.end() && it->second == s)
+            gateway_waiting.erase(it);
+    }
+    if (s->id != 0){
+        sessions_by_id.erase(s->id);
+        JournalRecord record;
+        memset(&record, 0, sizeof(record));
+        record.game_id = s->id;
+        record.type = JournalType::GameEnded;
+        journal->append(record);
+    }
+    Connection *players[2] = {s->white, s->black};
+    for (Connection *c : players){
+        if (c != NULL){
+            c->session = NULL;
+            c->close_after_flush = true;
+            // a connection with nothing left to send is closed by the backend on its next flush
+            if (!c->write_pending){
+                c->write_pending = true;
+                pending_writes.push_back(c);
+            }
+        }
+    }
+    // a game that ends before it's been copied is left out of the copy
+    if (copy_target != NULL && s->handoff_index >= (int32_t)copied_sessions)
+        copy_sessions[s->handoff_index] = NULL;
+    sessions.release(s);
+}
+
+void Shard::close_connection(Connection *c){
+    if (c->closed)
+        return;
+    c->closed = true;
+    closed.push_back(c);
+    if (c->trace_id != 0){
+        // a connection the server wasn't about to close was closed by the client (or went away)
+        if (!c->close_after_flush)
+            trace->close(c->trace_id, c->frames_sent);
+        trace->digest(c->trace_id, c->frames_sent, c->out_hash);
+    }
+
+    Session *s = c->session;
+    if (s == NULL)
+        return;
+    c->session = NULL;
+    if (config.verbose)
+        printf("[shard %d] Client disconnected.\n", index);
+    if (s->state == SessionState::WaitingForOpponent){
+        s->white = NULL;
+        release_session(s);
+        return;
+    }
+    // the other player can't go on alone
+    if (c == s->white)
+        s->white = NULL;
+    else
+        s->black = NULL;
+    queue_frame(player(s, opponent_of(c->color)), "Your opponent has disconnected.\n$E");
+    release_session(s);
+}
+
+void Shard::release_closed(){
+    for (Connection *c : closed){
+        // a connection that closes before it's been copied is left out of the copy
+        if (copy_target != NULL && c->handoff_index >= (int32_t)copied_connections)
+            copy_connections[c->handoff_index] = NULL;
+        queued_bytes -= c->outbuf.size();
+        if (spare_outbufs.size() < MAX_SPARE_OUTBUFS && c->outbuf.capacity() <= SPARE_OUTBUF_BYTES){
+            c->outbuf.clear();
+            spare_outbufs.push_back(std::move(c->outbuf));
+        }
+        connections.release(c);
+    }
+    closed.clear();
+}
+
+void Shard::output_sent(Connection *c){
+    queued_bytes -= c->outbuf.size();
+    c->outbuf.clear();
+    c->out_offset = 0;
+}
+
+void Shard::begin_batch(bool more_waiting){
+    admission.begin_batch(more_waiting);
+}
+
+void Shard::end_batch(){
+    if (!queued_moves.empty())
+        make_queued_moves();
+    if (copy_target != NULL)
+        continue_copy();
+    admission.end_batch(frames_received - batch_frames, queued_bytes, sessions.in_use());
+    batch_frames = frames_received;
+    if (journal == NULL)
+        return;
+    journal->flush();
+    if (awaiting_resumes && std::chrono::steady_clock::now() >= resume_deadline)
+        release_unclaimed();
+    continue_checkpoint(false);
+}
+
+// Starts a checkpoint when one is due, and copies the next chunk of games for the one in progress. With everything, a
+// checkpoint is started whether or not one is due, and all its games are copied at once. Once every game has been copied,
+// the snapshot is handed to the writer's thread
+void Shard::continue_checkpoint(bool everything){
+    auto now = std::chrono::steady_clock::now();
+    if (!checkpointing){
+        if (!everything && (now < next_checkpoint || snapshot_writer->busy()))
+            return;
+        // nothing has changed since the last checkpoint (or since the games were restored), so what's on disk will do
+        if (!everything && journal->appended() == 0){
+            next_checkpoint = now + std::chrono::seconds(config.checkpoint_interval_s);
+            return;
+        }
+        // Moving the journal on first means every change from here on is in the new journal file. A game copied later
+        // in the checkpoint may already include some of those changes, which restoring skips by the game's ply count
+        checkpoint_journal_seq = journal->rotate();
+        checkpoint_ids.clear();
+        for (auto &entry : sessions_by_id)
+            checkpoint_ids.push_back(entry.first);
+        checkpoint_copied = 0;
+        checkpoint_records.clear();
+        checkpoint_records.reserve(checkpoint_ids.size());
+        checkpointing = true;
+    }
+
+    size_t end = everything ? checkpoint_ids.size() : std::min(checkpoint_copied + CHECKPOINT_CHUNK, checkpoint_ids.size());
+    for (; checkpoint_copied < end; checkpoint_copied++){
+        // a game that ended since the checkpoint started is left out, and its end is in the new journal anyway
+        auto it = sessions_by_id.find(checkpoint_ids[checkpoint_copied]);
+        if (it == sessions_by_id.end())
+            continue;
+        Session *s = it->second;
+        checkpoint_records.emplace_back();
+        SessionRecord &record = checkpoint_records.back();
+        record.id = s->id;
+        record.resume_codes[0] = s->resume_codes[0];
+        record.resume_codes[1] = s->resume_codes[1];
+        record.plies = s->plies;
+        record.to_move = s->to_move;
+        record.bot_game = s->bot_game;
+        record.game = s->game;
+    }
+    if (checkpoint_copied < checkpoint_ids.size())
+        return;
+    snapshot_writer->write(checkpoint_records, checkpoint_journal_seq);
+    checkpointing = false;
+    next_checkpoint = now + std::chrono::seconds(config.checkpoint_interval_s);
+}
+
+// Loads the games the shard had when the server last stopped. Nobody is connected to them yet, but the bot carries on
+// thinking about any move it owes
+void Shard::restore(){
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SessionRecord> records;
+    uint64_t journal_seq;
+    RestoreStats stats;
+    bool found = load_shard_state(config.state_dir, index, records, journal_seq, stats);
+    journal->open(journal_seq);
+    if (!found)
+        return;
+
+    long dropped = 0;
+    for (const SessionRecord &record : records){
+        next_game_id = std::max<uint64_t>(next_game_id, (record.id & ((1ull << GAME_SHARD_SHIFT) - 1)) + 1);
+        // a bot game can't go on if the server was restarted without the bot
+        Session *s = (record.bot_game && !config.bot_mode) ? NULL : sessions.acquire();
+        if (s == NULL){
+            dropped++;
+            continue;
+        }
+        s->game = record.game;
+        s->id = record.id;
+        s->resume_codes[0] = record.resume_codes[0];
+        s->resume_codes[1] = record.resume_codes[1];
+        s->plies = record.plies;
+        s->bot_game = record.bot_game;
+        s->white = NULL;
+        s->black = NULL;
+        s->state = SessionState::WaitingForMove;
+        s->to_move = record.to_move;
+        s->bot_job = 0;
+        s->ponder_job = 0;
+        s->last_move[0] = '\0';
+        s->handoff_index = -1;
+        s->gateway_key = 0;
+        sessions_by_id[s->id] = s;
+        if (s->bot_game && s->to_move == 'B')
+            start_bot_search(s);
+    }
+    awaiting_resumes = !sessions_by_id.empty();
+    resume_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(RESUME_WINDOW_S);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("[shard %d] Restored %zu game(s) in %.1f ms (snapshot %.1f ms, %ld journal records %.1f ms).\n", index,
+        sessions_by_id.size(), ms, stats.snapshot_ms, stats.journal_records, stats.journal_ms);
+    if (dropped > 0)
+        printf("[shard %d] Couldn't restore %ld game(s): out of sessions, or bot games without bot mode.\n", index, dropped);
+}
+
+// Gives up on the restored games that a player never came back to. A player who did come back is told why
+void Shard::release_unclaimed(){
+    awaiting_resumes = false;
+    std::vector<Session*> unclaimed;
+    for (auto &entry : sessions_by_id){
+        Session *s = entry.second;
+        if (s->white == NULL || (!s->bot_game && s->black == NULL))
+            unclaimed.push_back(s);
+    }
+    for (Session *s : unclaimed){
+        queue_frame(s->white, "Your opponent didn't come back to the game.\n$E");
+        queue_frame(s->black, "Your opponent didn't come back to the game.\n$E");
+        release_session(s);
+    }
+    if (!unclaimed.empty())
+        printf("[shard %d] Gave up on %zu restored game(s) nobody came back to.\n", index, unclaimed.size());
+}
+
+// A gateway's connection for a player, with "join <key>": both players of one of the gateway's games join with the same
+// key, on the same shard, whatever other connections arrive in between (see gateway.cpp)
+void Shard::join(Connection *c, const char *frame){
+    unsigned long long key;
+    if (sscanf(frame, "join %llu", &key) != 1 || key == 0){
+        refuse_resume(c, "That isn't a join request.\n$E");
+        return;
+    }
+    c->resuming = false;
+    auto it = gateway_waiting.find(key);
+    if (it == gateway_waiting.end()){
+        Session *s = NULL;
+        seat(c, s, key);
+        if (s != NULL)
+            gateway_waiting[key] = s;
+        return;
+    }
+    Session *s = it->second;
+    gateway_waiting.erase(it);
+    seat(c, s, key);
+}
+
+void Shard::refuse_resume(Connection *c, const char *msg){
+    queue_frame(c, msg);
+    c->close_after_flush = true;
+}
+
+// Tells a player the server is too busy to start their game, and when to try again
+void Shard::turn_away(Connection *c){
+    char msg[DEFAULT_BUFLEN];
+    snprintf(msg, sizeof(msg), "The server is busy. Try again in %d seconds.\n$E", admission.retry_after_s());
+    queue_frame(c, msg);
+    c->close_after_flush = true;
+}
+
+// A player coming back to a restored game with "resume <game> <code>". The code says which seat is theirs, and they're
+// shown the board and either asked for their move or told who they're waiting for
+void Shard::resume(Connection *c, const char *frame){
+    unsigned long long id;
+    unsigned int code;
+    if (sscanf(frame, "resume %llu %x", &id, &code) != 2){
+        refuse_resume(c, "That isn't a resume request.\n$E");
+        return;
+    }
+    auto it = sessions_by_id.find(id);
+    if (it == sessions_by_id.end()){
+        refuse_resume(c, "There's no game with that number on this server. It may have ended.\n$E");
+        return;
+    }
+    Session *s = it->second;
+    char color;
+    if (s->white == NULL && code == s->resume_codes[0]){
+        color = 'W';
+    } else if (!s->bot_game && s->black == NULL && code == s->resume_codes[1]){
+        color = 'B';
+    } else {
+        refuse_resume(c, "That resume code isn't for a free seat in the game.\n$E");
+        return;
+    }
+    c->resuming = false;
+    c->session = s;
+    c->color = color;
+    if (color == 'W')
+        s->white = c;
+    else
+        s->black = c;
+
+    render_table(s, c);
+    queue_frame(c, tablebuf);
+    char msg[DEFAULT_BUFLEN];
+    const char *name = (color == 'W') ? "White" : "Black";
+    if (s->state == SessionState::WaitingForMove && s->to_move == color){
+        s->game.generate_moves(color, legal_moves);
+        int len = format_legal_moves(legal_moves, msg);
+        snprintf(msg + len, sizeof(msg) - len, "You're back in the game as %s. Your turn now: $S", name);
+    } else if (!s->bot_game && player(s, opponent_of(color)) == NULL){
+        snprintf(msg, sizeof(msg), "You're back in the game as %s. Now waiting for your opponent to come back.$R", name);
+    } else {
+        snprintf(msg, sizeof(msg), "You're back in the game as %s. Now waiting for %s's move.$R", name,
+            (color == 'W') ? "Black" : "White");
+    }
+    queue_frame(c, msg);
+    if (config.verbose)
+        printf("[shard %d] %s came back to game %llu.\n", index, name, id);
+}
+
+// With buffered NULL, the connection's buffers are left out (for the copy, since the final handoff has them as they are by
+// then)
+void Shard::connection_record(Connection *c, ConnectionHandoff &record, std::string *buffered){
+    record.index = c->handoff_index;
+    record.session = (c->session != NULL) ? c->session->handoff_index : -1;
+    record.color = c->color;
+    record.close_after_flush = c->close_after_flush;
+    record.resuming = c->resuming;
+    record.padding = 0;
+    record.inbuf_len = 0;
+    record.outbuf_len = 0;
+    if (buffered == NULL)
+        return;
+    record.inbuf_len = c->inbuf_len;
+    record.outbuf_len = (uint32_t)(c->outbuf.size() - c->out_offset);
+    buffered->append(c->inbuf, c->inbuf_len);
+    buffered->append(c->outbuf, c->out_offset, std::string::npos);
+}
+
+// Fills in every field of record, padding included, so records can be compared byte for byte
+void Shard::session_record(Session *s, SessionHandoff &record){
+    record.index = s->handoff_index;
+    record.white = (s->white != NULL) ? s->white->handoff_index : -1;
+    record.black = (s->black != NULL) ? s->black->handoff_index : -1;
+    record.plies = s->plies;
+    record.id = s->id;
+    record.gateway_key = s->gateway_key;
+    record.resume_codes[0] = s->resume_codes[0];
+    record.resume_codes[1] = s->resume_codes[1];
+    memcpy(record.last_move, s->last_move, sizeof(record.last_move));
+    record.state = (uint8_t)s->state;
+    record.bot_game = s->bot_game;
+    record.to_move = s->to_move;
+    memset(record.padding, 0, sizeof(record.padding));
+    record.game = s->game;
+}
+
+// Connections and games are only given their indexes here, and copied by end_batch() a chunk at a time
+void Shard::start_copy(ShardHandoff &copy){
+    copy_connections.clear();
+    connections.for_each([&](Connection *c){
+        c->handoff_index = c->closed ? -1 : (int32_t)copy_connections.size();
+        if (!c->closed)
+            copy_connections.push_back(c);
+    });
+    copy_sessions.clear();
+    sessions.for_each([&](Session *s){
+        s->handoff_index = (int32_t)copy_sessions.size();
+        copy_sessions.push_back(s);
+    });
+    copied_connections = 0;
+    copied_sessions = 0;
+    copy_positions.assign(copy_sessions.size(), -1);
+    copy_target = &copy;
+    copy.connections.reserve(copy_connections.size());
+    copy.fds.reserve(copy.fds.size() + copy_connections.size());
+    copy.sessions.reserve(copy_sessions.size());
+
+    ShardHandoffHeader &header = copy.header;
+    header.index = index;
+    header.connections = 0;
+    header.sessions = 0;
+    header.live_sessions = 0;
+    header.waiting = -1;
+    header.max_connections = connections.get_capacity();
+    header.max_sessions = sessions.get_capacity();
+    header.next_game_id = next_game_id;
+    header.journal_seq = 0;
+    header.resume_ms_left = -1;
+    header.stopped_ns = 0;
+    printf("[shard %d] Copying %zu connection(s) and %zu game(s) for a handoff.\n", index, copy_connections.size(),
+        copy_sessions.size());
+}
+
+bool Shard::copying(){
+    return copy_target != NULL;
+}
+
+// Copies the next chunk of connections and games into the copy, as many as a checkpoint copies per batch. A connection
+// whose fd can't be duplicated (i.e. this process is out of fds) is left for the final handoff, as if it had opened since
+void Shard::continue_copy(){
+    size_t budget = CHECKPOINT_CHUNK;
+    for (; copied_connections < copy_connections.size() && budget > 0; copied_connections++, budget--){
+        Connection *c = copy_connections[copied_connections];
+        if (c == NULL)
+            continue;
+        int fd = fcntl(c->fd, F_DUPFD_CLOEXEC, 0);
+        if (fd < 0){
+            c->handoff_index = -1;
+            continue;
+        }
+        copy_target->connections.emplace_back();
+        connection_record(c, copy_target->connections.back(), NULL);
+        copy_target->fds.push_back(fd);
+    }
+    for (; copied_sessions < copy_sessions.size() && budget > 0; copied_sessions++, budget--){
+        Session *s = copy_sessions[copied_sessions];
+        if (s == NULL)
+            continue;
+        copy_positions[copied_sessions] = (int32_t)copy_target->sessions.size();
+        copy_target->sessions.emplace_back();
+        session_record(s, copy_target->sessions.back());
+    }
+    if (copied_sessions < copy_sessions.size() || copied_connections < copy_connections.size())
+        return;
+    copy_target->header.connections = (uint32_t)copy_target->connections.size();
+    copy_target->header.sessions = (uint32_t)copy_target->sessions.size();
+    copy_target = NULL;
+}
+
+void Shard::export_final(const ShardHandoff &copy, ShardHandoff &final){
+    if (journal != NULL)
+        journal->flush();
+
+    // connections and games new since the copy get the next indexes first, so every record can refer to them
+    int32_t next_connection = (int32_t)copy_connections.size();
+    std::vector<Connection*> open;
+    open.reserve(connections.in_use());
+    connections.for_each([&](Connection *c){
+        if (c->closed)
+            return;
+        if (c->handoff_index < 0){
+            c->handoff_index = next_connection++;
+            final.fds.push_back(c->fd);
+        }
+        open.push_back(c);
+    });
+    int32_t next_session = (int32_t)copy_sessions.size();
+    std::vector<Session*> live;
+    live.reserve(sessions.in_use());
+    sessions.for_each([&](Session *s){
+        if (s->handoff_index < 0)
+            s->handoff_index = next_session++;
+        live.push_back(s);
+    });
+
+    final.connections.resize(open.size());
+    for (size_t i = 0; i < open.size(); i++)
+        connection_record(open[i], final.connections[i], &final.buffered);
+
+    // only games that differ from their copy are sent again
+    final.live_sessions.reserve(live.size());
+    SessionHandoff record;
+    for (Session *s : live){
+        final.live_sessions.push_back(s->handoff_index);
+        session_record(s, record);
+        int32_t position = (s->handoff_index < (int32_t)copy_positions.size()) ? copy_positions[s->handoff_index] : -1;
+        if (position < 0 || memcmp((const void*)&record, (const void*)&copy.sessions[position], sizeof(record)) != 0)
+            final.sessions.push_back(record);
+    }
+
+    ShardHandoffHeader &header = final.header;
+    header.index = index;
+    header.listen_fds = 0;
+    header.connections = (uint32_t)final.connections.size();
+    header.sessions = (uint32_t)final.sessions.size();
+    header.live_sessions = (uint32_t)final.live_sessions.size();
+    header.waiting = (waiting != NULL) ? waiting->handoff_index : -1;
+    header.max_connections = connections.get_capacity();
+    header.max_sessions = sessions.get_capacity();
+    header.next_game_id = next_game_id;
+    header.journal_seq = (journal != NULL) ? journal->sequence() : 0;
+    header.resume_ms_left = -1;
+    if (awaiting_resumes){
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(resume_deadline - std::chrono::steady_clock::now());
+        header.resume_ms_left = std::max<int64_t>(0, left.count());
+    }
+}
+
+void Shard::handed_over(){
+    handed_off = true;
+}
+
+void Shard::open_connections(std::vector<Connection*> &list){
+    connections.for_each([&](Connection *c){
+        if (!c->closed)
+            list.push_back(c);
+    });
+}
+
+Connection *Shard::adopted_connection(int32_t index){
+    return (index >= 0 && (size_t)index < adopted_connections.size()) ? adopted_connections[index] : NULL;
+}
+
+Session *Shard::adopted_session(int32_t index){
+    return (index >= 0 && (size_t)index < adopted_sessions.size()) ? adopted_sessions[index] : NULL;
+}
+
+// A connection for fd at index, or NULL (having closed fd) if there's no room or index is taken already
+Connection *Shard::adopt_connection(int32_t index, socket_t fd){
+    Connection *c = (adopted_connection(index) == NULL) ? acquire_connection(fd, false) : NULL;
+    if (c == NULL){
+        net_close(fd);
+        return NULL;
+    }
+    c->handoff_index = index;
+    if (adopted_connections.size() <= (size_t)index)
+        adopted_connections.resize(index + 1, NULL);
+    adopted_connections[index] = c;
+    return c;
+}
+
+// Brings a connection up to date with its record, and data, where the record's buffers are. Its session is filled in once
+// every game has been set up
+void Shard::update_connection(Connection *c, const ConnectionHandoff &record, const char *data){
+    c->color = record.color;
+    c->close_after_flush = record.close_after_flush;
+    c->resuming = record.resuming;
+    memcpy(c->inbuf, data, record.inbuf_len);
+    c->inbuf_len = record.inbuf_len;
+    queued_bytes -= c->outbuf.size();
+    c->outbuf.assign(data + record.inbuf_len, record.outbuf_len);
+    queued_bytes += c->outbuf.size();
+}
+
+// Sets up the game at record's index, or brings it up to date. Its players have to have been adopted already
+void Shard::adopt_session(const SessionHandoff &record){
+    Session *s = adopted_session(record.index);
+    if (s == NULL){
+        // the pools are at least as big as the old shard's, so there's room for every game it had
+        s = sessions.acquire();
+        if (s == NULL)
+            return;
+        s->id = 0;
+        if (adopted_sessions.size() <= (size_t)record.index)
+            adopted_sessions.resize(record.index + 1, NULL);
+        adopted_sessions[record.index] = s;
+    }
+    s->game = record.game;
+    if (s->id != 0 && s->id != record.id)
+        sessions_by_id.erase(s->id);
+    s->id = record.id;
+    s->gateway_key = record.gateway_key;
+    s->resume_codes[0] = record.resume_codes[0];
+    s->resume_codes[1] = record.resume_codes[1];
+    s->plies = record.plies;
+    s->bot_game = record.bot_game;
+    s->white = adopted_connection(record.white);
+    s->black = adopted_connection(record.black);
+    s->state = (SessionState)record.state;
+    s->to_move = record.to_move;
+    s->bot_job = 0;
+    s->ponder_job = 0;
+    memcpy(s->last_move, record.last_move, sizeof(s->last_move));
+    s->handoff_index = record.index;
+    if (s->id != 0)
+        sessions_by_id[s->id] = s;
+}
+
+// Sets up the connections and games of an old shard's copy. Nothing is sent or received until adopt_final()
+void Shard::adopt_copy(const ShardHandoff &copy){
+    const char *buffered = copy.buffered.data();
+    for (size_t i = 0; i < copy.connections.size(); i++){
+        const ConnectionHandoff &record = copy.connections[i];
+        Connection *c = adopt_connection(record.index, copy.fds[copy.header.listen_fds + i]);
+        if (c != NULL){
+            update_connection(c, record, buffered);
+            adopted.push_back(c);
+        }
+        buffered += (size_t)record.inbuf_len + record.outbuf_len;
+    }
+    for (const SessionHandoff &record : copy.sessions)
+        adopt_session(record);
+    for (const ConnectionHandoff &record : copy.connections){
+        Connection *c = adopted_connection(record.index);
+        if (c != NULL)
+            c->session = adopted_session(record.session);
+    }
+}
+
+// Brings the copy up to date and takes over. Bot games carry on where they were, with the bot starting over on any move it
+// owed
+void Shard::adopt_final(const ShardHandoff &final, std::vector<socket_t> &dropped){
+    const ShardHandoffHeader &header = final.header;
+    adopted.clear();
+
+    // connections opened since the copy come with their fds, in order
+    size_t copied = adopted_connections.size(), next_fd = 0;
+    std::vector<bool> still_open(copied, false);
+    const char *buffered = final.buffered.data();
+    for (const ConnectionHandoff &record : final.connections){
+        const char *data = buffered;
+        buffered += (size_t)record.inbuf_len + record.outbuf_len;
+        Connection *c;
+        if ((size_t)record.index < copied){
+            c = adopted_connection(record.index);
+            if (c == NULL)
+                continue;
+            still_open[record.index] = true;
+        } else {
+            if (next_fd == final.fds.size())
+                continue;
+            c = adopt_connection(record.index, final.fds[next_fd++]);
+            if (c == NULL)
+                continue;
+            adopted.push_back(c);
+        }
+        update_connection(c, record, data);
+    }
+    // the old shard closed these, and the copies here go too
+    for (size_t i = 0; i < copied; i++){
+        Connection *c = adopted_connections[i];
+        if (c != NULL && !still_open[i]){
+            dropped.push_back(c->fd);
+            connections.release(c);
+            adopted_connections[i] = NULL;
+        }
+    }
+
+    // games that changed or started since the copy
+    for (const SessionHandoff &record : final.sessions)
+        adopt_session(record);
+    // and the ones that ended, which the old shard journaled and told the players about already
+    std::vector<bool> live(adopted_sessions.size(), false);
+    for (int32_t i : final.live_sessions){
+        if ((size_t)i < live.size())
+            live[i] = true;
+    }
+    for (size_t i = 0; i < live.size(); i++){
+        Session *s = adopted_sessions[i];
+        if (s != NULL && !live[i]){
+            if (s->id != 0)
+                sessions_by_id.erase(s->id);
+            sessions.release(s);
+            adopted_sessions[i] = NULL;
+        }
+    }
+
+    for (const ConnectionHandoff &record : final.connections){
+        Connection *c = adopted_connection(record.index);
+        if (c == NULL)
+            continue;
+        c->session = adopted_session(record.session);
+        // output the old shard hadn't sent yet, and connections it was about to close, are flushed straight away
+        if (!c->outbuf.empty() || c->close_after_flush){
+            c->write_pending = true;
+            pending_writes.push_back(c);
+        }
+    }
+    waiting = adopted_session(header.waiting);
+    next_game_id = std::max<uint64_t>(next_game_id, header.next_game_id);
+    if (header.resume_ms_left >= 0){
+        awaiting_resumes = true;
+        resume_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(header.resume_ms_left);
+    }
+    // the old shard's games are in its snapshot and journals already, so this one goes on to the next journal
+    if (journal != NULL)
+        journal->open(header.journal_seq + 1);
+
+    size_t games = 0;
+    for (Session *s : adopted_sessions){
+        if (s == NULL)
+            continue;
+        games++;
+        if (s->state == SessionState::WaitingForOpponent && s->gateway_key != 0)
+            gateway_waiting[s->gateway_key] = s;
+        if (!s->bot_game)
+            continue;
+        if (s->state == SessionState::BotThinking)
+            start_bot_search(s);
+        else if (s->state == SessionState::WaitingForMove && s->to_move == 'W')
+            start_pondering(s);
+    }
+    printf("[shard %d] Took over %d connection(s) and %zu game(s), %zu of them changed since the copy.\n", index,
+        connections.in_use(), games, final.sessions.size());
+    adopted_connections.clear();
+    adopted_sessions.clear();
+}
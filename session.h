@@ -0,0 +1,315 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "net.h"
+#include "utils.h"
+#include "game.h"
+#include "pool.h"
+#include "engine_pool.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "timeline.h"
+#include "handoff.h"
+#include "admission.h"
+
+// The server's game logic, kept apart from how bytes get on and off the wire. A Shard owns a set of connections and the
+// sessions (games) they're playing in. The I/O backend that drives it (see backend.h) tells it when a
+// connection opens, when bytes arrive and when a connection closes, and in return flushes whatever output the shard queued.
+
+// Both directions still speak the original protocol: every message is a frame of exactly DEFAULT_BUFLEN bytes. Frames from
+// the server end in $R (wait for another frame), $S (send one) or $E (game over); frames from a client hold one line of input.
+
+// Each shard is run by a single thread, and nothing in it is shared with other shards, so none of this is locked.
+
+// With a state directory, a shard journals its games and checkpoints them (see checkpoint.h), and restores them when the
+// server starts again. Restored games have no players until they connect to their shard's resume port and send
+// "resume <game> <code>" with the game number and resume code they were given when the game started.
+
+// A gateway (see gateway.cpp) connects its players to the same per-shard ports, and pairs them up into games by sending
+// "join <key>" with the same key for both players of a game.
+
+// A shard can also be handed over to another server process whole, sockets and all (see handoff.h), and start from what
+// another server's shard handed over instead of from the state directory.
+
+// Past its capacity, a shard turns new games away rather than slowing down the games it has (see admission.h).
+
+// With a record path, a shard also writes a trace of its connections and the frames they sent (see trace.h), for replay to
+// play back later.
+
+struct Session;
+
+// One client connection
+struct Connection {
+    socket_t fd;
+    Session *session; // NULL once the game is over
+    char color; // 'W' or 'B' in the session
+
+    // a frame from the client is collected here until all DEFAULT_BUFLEN bytes of it have arrived
+    char inbuf[DEFAULT_BUFLEN];
+    int inbuf_len;
+
+    // frames waiting to be sent. out_offset is how much of outbuf has been sent already
+    std::string outbuf;
+    size_t out_offset;
+
+    bool write_pending; // on the shard's pending_writes list
+    bool close_after_flush; // the game is over, so close the connection once outbuf has been sent
+    bool too_slow; // it let its output queue fill up, so the backend closes it without sending the rest
+    bool closed; // closed by the backend, to be released at the end of the current batch of events
+    bool resuming; // accepted on the resume port, and waiting for its resume (or a gateway's join) request
+    int32_t handoff_index; // the connection's index in a handoff (see handoff.h), or -1 if it opened after the copy
+
+    // recording: the connection's number in the trace (0 if it isn't in it), and the frames queued for it so far and
+    // their hash
+    uint32_t trace_id;
+    uint32_t frames_sent;
+    uint64_t out_hash;
+
+    // backend bookkeeping
+    bool want_write; // epoll: EPOLLOUT has been asked for
+    int ops_in_flight; // io_uring: operations submitted on the socket that haven't completed yet
+    bool send_in_flight; // io_uring: a send is in flight, so the next one has to wait for it
+    bool shutting_down; // io_uring: the socket has been shut down, and is closed once ops_in_flight reaches 0
+};
+
+// MoveQueued: the player to move has sent a move, which is validated and made with the rest of the batch's moves at the end
+// of the batch
+enum SessionState {WaitingForOpponent, WaitingForMove, MoveQueued, BotThinking};
+
+// One game between two connections, or between a connection and the bot
+struct Session {
+    Game game;
+    uint64_t id; // the shard's index in the top 16 bits, so a client knows which shard's resume port to come back to. 0 until
+                 // the game starts, and without a state directory
+    uint32_t resume_codes[2]; // White's and Black's, to take their seat back after a restart
+    uint32_t plies; // moves played so far
+    bool bot_game;
+    Connection *white; // NULL if White hasn't come back to a restored game yet
+    Connection *black; // NULL in bot games, where the bot plays Black, or if Black hasn't come back to a restored game yet
+    SessionState state;
+    char to_move; // whose input the session is waiting for
+    int bot_job; // the engine job searching Black's move while state is BotThinking
+    int ponder_job; // the engine job pondering while White thinks, or 0
+    char expected_reply[8]; // the move the ponder job expects from White, as Game::format_move writes it
+    char last_move[8]; // the last move as Game::format_move writes it, i.e. "e2e4\n" or "e7e8q\n", to tell the other player about
+    int32_t handoff_index; // the game's index in a handoff (see handoff.h), or -1 if it started after the copy
+    uint64_t gateway_key; // the key a gateway started the game with (see Shard::join), or 0
+};
+
+struct ShardConfig {
+    bool bot_mode; // every connection plays the bot, instead of being paired with the next connection
+    int bot_think_ms; // how long the bot gets to search each move
+    int engine_threads; // search threads per shard, in bot mode
+    int hash_mb; // size of each shard's transposition table, in bot mode
+    PonderBudget *ponder_budget; // shared by every shard. NULL if the bot doesn't ponder
+    EvalCache *eval_cache; // shared by every shard. NULL for none
+    int max_sessions; // size of the shard's session pool. Connections past this are turned away
+    bool verbose; // log every move, not just games starting and ending
+    const char *state_dir; // where games are journaled and checkpointed, or NULL to lose them when the server stops
+    int checkpoint_interval_s; // how often each shard checkpoints its games
+    const char *record_path; // each shard records a trace to this path with ".<shard>" added, or NULL to record nothing
+    AdmissionLimits admission;
+    MemoryBudget *memory_budget; // shared by every shard. NULL for no budget
+};
+
+class Shard {
+    public:
+        // With adopt (an old server's shard's copy, see handoff.h), the shard gets ready to take over from it instead of
+        // restoring games from the state directory: it sets up the copied connections and games, and leaves the connections
+        // in adopted for the backend to start watching, but the backend mustn't read or write them until adopt_final().
+        Shard(int index, const ShardConfig &config, const ShardHandoff *adopt = NULL);
+        ~Shard();
+
+        Shard(const Shard&) = delete;
+        Shard& operator=(const Shard&) = delete;
+
+        // Registers a newly accepted socket, and starts or joins a game with it, or for a socket accepted on the resume
+        // port, waits for its resume request. Returns NULL if there's no room for another connection, in which case the
+        // caller should close the socket.
+        Connection *open_connection(socket_t fd, bool resuming = false);
+
+        // hands over len bytes read from a connection
+        void receive(Connection *c, const char *data, int len);
+
+        // Called by the backend after the socket has been closed (by the peer, an error, or after close_after_flush).
+        // The Connection stays valid until release_closed().
+        void close_connection(Connection *c);
+
+        // frees every connection closed since the last call. Backends call this once they're done with a batch of events
+        void release_closed();
+
+        // Called by the backend once everything in a connection's outbuf has been sent, to empty it
+        void output_sent(Connection *c);
+
+        // Called by the backend when its event loop wakes up with a batch of events to handle, with whether there were more
+        // events ready than it took
+        void begin_batch(bool more_waiting);
+
+        // Called by the backend after handling a batch of events, before flushing what the shard queued: makes the moves
+        // received in the batch, writes out the batch's journal records and copies the next chunk of games for a checkpoint
+        // or a handoff
+        void end_batch();
+
+        // Handing the shard over to another server (see handoff.h). start_copy() starts copying every open connection and
+        // game into copy, after the listening sockets the backend put in copy.fds. The shard carries on meanwhile, and
+        // end_batch() copies the next chunk until copying() is false. copy has to stay put until then. Since the shard can
+        // close connections before the copy is sent, the fds it adds are duplicates, for the sender to close.
+        void start_copy(ShardHandoff &copy);
+        bool copying();
+
+        // Exports into final what has changed since copy: every open connection (with the fds of those opened since), and
+        // the games that changed or started. The backend must have stopped every operation on the sockets and called
+        // end_batch() first. Until handed_over() the shard can carry on as if nothing happened if the new server goes away
+        void export_final(const ShardHandoff &copy, ShardHandoff &final);
+
+        // the new server has the shard's games now, so the shard is only fit to be destroyed, and doesn't checkpoint its
+        // games on the way out
+        void handed_over();
+
+        // An adopting shard takes over with the old shard's final handoff: connections opened since the copy are left in
+        // adopted for the backend to start watching, and the fds of copied connections that have closed since are put in
+        // dropped, for the backend to stop watching and close. Output waiting to be sent is put on pending_writes.
+        void adopt_final(const ShardHandoff &final, std::vector<socket_t> &dropped);
+
+        // connections an adopting shard set up that the backend hasn't started watching yet
+        std::vector<Connection*> adopted;
+
+        // every open connection, i.e. for a backend to start receiving on them again
+        void open_connections(std::vector<Connection*> &list);
+
+        // collects finished bot searches and plays their moves
+        void handle_engine_completions();
+
+        // the engine pool's notify fd, or -1 if this shard has no bot
+        int engine_fd();
+
+        // A timerfd that ticks while the shard has a state directory, so checkpoints go on even when no clients are
+        // sending anything, or -1. The backend calls handle_timer() when it's readable
+        int timer_fd();
+        void handle_timer();
+
+        // Connections that have had frames queued since the backend last flushed. The backend empties this (and clears
+        // write_pending on each connection) after every batch of events.
+        std::vector<Connection*> pending_writes;
+
+        int get_index(){
+            return index;
+        }
+
+        // frames received from clients and queued for them, for the backends' statistics
+        long frames_received, frames_queued;
+
+        // White moves the bot pondered on that were played (hits) or not (misses)
+        long ponder_hits, ponder_misses;
+
+        AdmissionControl admission;
+
+    private:
+        void handle_frame(Connection *c, char frame[DEFAULT_BUFLEN]);
+        void resume(Connection *c, const char *frame);
+        void join(Connection *c, const char *frame);
+        void seat(Connection *c, Session *&waiting_slot, uint64_t gateway_key);
+        void refuse_resume(Connection *c, const char *msg);
+        void turn_away(Connection *c);
+        void start_game(Session *s);
+        void finish_turn(Session *s, char mover);
+        void end_game(Session *s, char last_mover);
+        void start_pondering(Session *s);
+        void start_bot_search(Session *s);
+        void stop_pondering(Session *s);
+        void release_session(Session *s);
+        void played_move(Session *s, const Move &move, char mover);
+        void make_queued_moves();
+
+        void restore();
+        void continue_copy();
+        void adopt_copy(const ShardHandoff &copy);
+        void connection_record(Connection *c, ConnectionHandoff &record, std::string *buffered);
+        void session_record(Session *s, SessionHandoff &record);
+        Connection *adopt_connection(int32_t index, socket_t fd);
+        void update_connection(Connection *c, const ConnectionHandoff &record, const char *data);
+        void adopt_session(const SessionHandoff &record);
+        Connection *adopted_connection(int32_t index);
+        Session *adopted_session(int32_t index);
+        void continue_checkpoint(bool everything);
+        void release_unclaimed();
+
+        Connection *acquire_connection(socket_t fd, bool resuming);
+        Connection *player(Session *s, char color);
+        void queue_frame(Connection *c, const char *msg);
+        void render_table(Session *s, Connection *c);
+
+        int index;
+        ShardConfig config;
+
+        SlabPool<Session> sessions;
+        SlabPool<Connection> connections;
+        std::vector<Connection*> closed;
+        std::vector<std::string> spare_outbufs; // emptied output buffers of closed connections, for new ones to take
+
+        Session *waiting; // a session whose White is still waiting for an opponent to connect
+        std::unordered_map<uint64_t, Session*> gateway_waiting; // the same for games a gateway started, by their key
+
+        EnginePool engine_pool;
+        std::unordered_map<int, Session*> bot_jobs; // engine job id -> session waiting on it
+
+        size_t queued_bytes; // in every connection's outbuf
+        long batch_frames; // frames_received when the batch started
+
+        char tablebuf[DEFAULT_BUFLEN]; // the printed board, reused for every session
+        std::vector<Move> legal_moves; // the legal moves of whoever is about to move, reused for every session
+
+        // Moves received in the current batch, parsed and waiting to be made by end_batch all at once, and the connection
+        // each came from. The moves are kept apart from the connections so Game::make_moves can run straight through them
+        std::vector<Game::BatchMove> queued_moves;
+        std::vector<Connection*> queued_movers;
+
+        uint64_t next_game_id;
+        std::unordered_map<uint64_t, Session*> sessions_by_id; // every started game, with a state directory
+        std::mt19937 resume_code_rng;
+
+        // games kept across restarts. Both NULL without a state directory
+        Journal *journal;
+        SnapshotWriter *snapshot_writer;
+        int timer;
+
+        // the trace being recorded, or NULL
+        TraceWriter *trace;
+        uint32_t next_trace_id;
+
+        // A checkpoint in progress: the games that were live when it started, how many of them have been copied so far,
+        // and the first journal file the snapshot won't cover
+        bool checkpointing;
+        std::vector<uint64_t> checkpoint_ids;
+        size_t checkpoint_copied;
+        std::vector<SessionRecord> checkpoint_records;
+        uint64_t checkpoint_journal_seq;
+        std::chrono::steady_clock::time_point next_checkpoint;
+
+        // restored games whose players haven't all come back are given up on after this
+        bool awaiting_resumes;
+        std::chrono::steady_clock::time_point resume_deadline;
+
+        // Handing over: the copy being filled in (NULL once it's complete), the connections and games that were open when
+        // the copy started (NULL once closed or ended) and how many of each have been copied so far, and where each game's
+        // record is in the copy (or -1)
+        ShardHandoff *copy_target;
+        std::vector<Connection*> copy_connections;
+        std::vector<Session*> copy_sessions;
+        size_t copied_connections, copied_sessions;
+        std::vector<int32_t> copy_positions;
+        bool handed_off; // the new server has the games now
+
+        // Taking over: the connections and games set up from the old shard's copy, by index (with NULL for games that
+        // ended before they were copied)
+        std::vector<Connection*> adopted_connections;
+        std::vector<Session*> adopted_sessions;
+};
+
+#endif // SESSION_H
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "timeline.h"
+
+// the shortest stretch of time to work out how fast the ticks go from
+#define TIMELINE_CALIBRATION_MS 50
+
+std::atomic<bool> timeline_enabled(false);
+thread_local TimelineRing *timeline_ring = NULL;
+static thread_local char thread_name[32] = "";
+
+// Every ring ever made. Rings outlive their threads, so a dump still has the events of a thread that's finished
+static std::mutex rings_mutex;
+static std::vector<TimelineRing*> rings;
+
+// when the timeline was last turned on, in ticks and in steady clock time, to put ticks on the clock from
+static uint64_t enabled_ticks = 0;
+static std::chrono::steady_clock::time_point enabled_time;
+
+static const char *EVENT_NAMES[TIMELINE_EVENT_TYPES] = {"recv", "parse", "make_move", "render", "encode", "send"};
+
+TimelineRing *timeline_new_ring(){
+    TimelineRing *ring = new TimelineRing();
+    ring->written.store(0, std::memory_order_relaxed);
+    strncpy(ring->name, thread_name, sizeof(ring->name) - 1);
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    ring->thread = (int)rings.size() + 1;
+    if (ring->name[0] == '\0')
+        snprintf(ring->name, sizeof(ring->name), "thread %d", ring->thread);
+    rings.push_back(ring);
+    timeline_ring = ring;
+    return ring;
+}
+
+void timeline_name_thread(const char *name){
+    strncpy(thread_name, name, sizeof(thread_name) - 1);
+}
+
+void timeline_set_enabled(bool on){
+    if (on && !timeline_enabled){
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        enabled_time = std::chrono::steady_clock::now();
+        enabled_ticks = timeline_ticks();
+    }
+    timeline_enabled = on;
+}
+
+// Copies the events a ring still holds, oldest first, leaving out any its thread may have written over while they were
+// being copied
+static void copy_ring(TimelineRing *ring, std::vector<TimelineEvent> &events){
+    uint64_t end = ring->written.load(std::memory_order_acquire);
+    uint64_t begin = (end > TIMELINE_RING_EVENTS) ? end - TIMELINE_RING_EVENTS : 0;
+    events.clear();
+    for (uint64_t i = begin; i < end; i++)
+        events.push_back(ring->events[i & (TIMELINE_RING_EVENTS - 1)]);
+    // the thread may be writing event `after` right now, into the slot of event after - TIMELINE_RING_EVENTS
+    uint64_t after = ring->written.load(std::memory_order_acquire);
+    if (after >= begin + TIMELINE_RING_EVENTS){
+        size_t overwritten = (size_t)std::min<uint64_t>(after - TIMELINE_RING_EVENTS - begin + 1, end - begin);
+        events.erase(events.begin(), events.begin() + overwritten);
+    }
+}
+
+bool timeline_dump(const char *path){
+    uint64_t start_ticks;
+    std::chrono::steady_clock::time_point start_time;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        start_ticks = enabled_ticks;
+        start_time = enabled_time;
+    }
+    if (start_ticks == 0){
+        printf("The timeline hasn't been turned on, so there's nothing to dump.\n");
+        return false;
+    }
+    // ticks per microsecond, from how many went by since the timeline was turned on
+    auto since = std::chrono::steady_clock::now() - start_time;
+    if (since < std::chrono::milliseconds(TIMELINE_CALIBRATION_MS))
+        std::this_thread::sleep_for(std::chrono::milliseconds(TIMELINE_CALIBRATION_MS) - since);
+    double ticks_per_us = (double)(timeline_ticks() - start_ticks)
+        / std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count();
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL){
+        perror("timeline fopen() error");
+        return false;
+    }
+    std::vector<TimelineRing*> all;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        all = rings;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    long total = 0;
+    std::vector<TimelineEvent> events;
+    for (TimelineRing *ring : all){
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", ring->thread, ring->name);
+        first = false;
+        copy_ring(ring, events);
+        for (const TimelineEvent &e : events){
+            if (e.start < start_ticks || e.type >= TIMELINE_EVENT_TYPES)
+                continue;
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"%s\":%llu",
+                EVENT_NAMES[e.type], ring->thread, (e.start - start_ticks) / ticks_per_us, e.duration / ticks_per_us,
+                (e.type == TimelineMakeMove) ? "moves" : "fd", (unsigned long long)e.id);
+            if (e.arg != 0)
+                fprintf(file, ",\"bytes\":%llu", (unsigned long long)e.arg);
+            fprintf(file, "}}");
+            total++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0){
+        perror("timeline fclose() error");
+        return false;
+    }
+    printf("Wrote %ld timeline event(s) from %zu thread(s) to %s.\n", total, all.size(), path);
+    return true;
+}
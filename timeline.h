@@ -0,0 +1,119 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// The timeline: where the time of each turn goes, event by event, for the slow turns that averages can't explain. It's
+// always compiled in and off until timeline_set_enabled() turns it on (the server does on SIGUSR1, see server.cpp), which
+// leaves one relaxed load and a branch in each place it's measured.
+
+// While it's on, every thread writes fixed-size events into a ring of its own, with nothing shared and no locks: the newest
+// TIMELINE_RING_EVENTS events of each thread are kept. timeline_dump() copies every thread's ring, while they go on
+// writing, and writes what it found in the Chrome trace event format, which chrome://tracing and ui.perfetto.dev load.
+// Times are read from the TSC where there is one, and turned into microseconds when they're dumped.
+
+// What's measured, per connection (the id is the connection's socket):
+// - recv: the backend reading from the socket (epoll), or handing what io_uring received to the shard (io_uring)
+// - parse: reading a move out of a frame
+// - make_move: checking and making a batch's moves, for all its games at once (the id is the number of moves)
+// - render: printing the board
+// - encode: copying a frame onto a connection's output queue
+// - send: the backend writing to the socket (epoll), or queuing a send with io_uring (io_uring)
+
+#define TIMELINE_RING_EVENTS 65536 // per thread, a power of two
+
+enum TimelineEventType : uint16_t {
+    TimelineRecv,
+    TimelineParse,
+    TimelineMakeMove,
+    TimelineRender,
+    TimelineEncode,
+    TimelineSend,
+    TIMELINE_EVENT_TYPES
+};
+
+struct TimelineEvent {
+    uint64_t start; // ticks
+    uint32_t duration; // ticks, cut off at 2^32 - 1
+    uint16_t type; // a TimelineEventType
+    uint16_t padding;
+    uint64_t id;
+    uint64_t arg; // bytes for recv, encode and send; 0 otherwise
+};
+
+// One thread's events. Only the thread writes to it, and written is only ever stored by that thread
+struct TimelineRing {
+    std::atomic<uint64_t> written; // events written so far. Event i is in events[i % TIMELINE_RING_EVENTS]
+    int thread; // numbered in the order threads first recorded
+    char name[32];
+    TimelineEvent events[TIMELINE_RING_EVENTS];
+};
+
+extern std::atomic<bool> timeline_enabled;
+
+inline uint64_t timeline_ticks(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// the calling thread's ring, made the first time the thread records
+TimelineRing *timeline_new_ring();
+extern thread_local TimelineRing *timeline_ring;
+
+inline void timeline_record(TimelineEventType type, uint64_t start, uint64_t end, uint64_t id, uint64_t arg){
+    TimelineRing *ring = timeline_ring;
+    if (ring == NULL)
+        ring = timeline_new_ring();
+    uint64_t i = ring->written.load(std::memory_order_relaxed);
+    TimelineEvent &e = ring->events[i & (TIMELINE_RING_EVENTS - 1)];
+    uint64_t duration = end - start;
+    e.start = start;
+    e.duration = (duration > UINT32_MAX) ? UINT32_MAX : (uint32_t)duration;
+    e.type = type;
+    e.id = id;
+    e.arg = arg;
+    ring->written.store(i + 1, std::memory_order_release);
+}
+
+// Times the scope it's declared in, as one event, if the timeline was on when the scope started
+class TimelineSpan {
+    public:
+        TimelineSpan(TimelineEventType type, uint64_t id, uint64_t arg = 0) : arg(arg), type(type), id(id),
+            start(timeline_enabled.load(std::memory_order_relaxed) ? timeline_ticks() : 0){}
+
+        ~TimelineSpan(){
+            if (start != 0)
+                timeline_record(type, start, timeline_ticks(), id, arg);
+        }
+
+        TimelineSpan(const TimelineSpan&) = delete;
+        TimelineSpan& operator=(const TimelineSpan&) = delete;
+
+        uint64_t arg; // can be filled in before the scope ends, i.e. with the bytes a recv() returned
+
+    private:
+        TimelineEventType type;
+        uint64_t id;
+        uint64_t start;
+};
+
+// Turning the timeline on (again) starts it over: a dump leaves out events from before
+void timeline_set_enabled(bool on);
+
+// names the calling thread in dumps (if it's named before it first records)
+void timeline_name_thread(const char *name);
+
+// Writes every thread's events to path as Chrome trace JSON. Returns false (having said why) if it couldn't
+bool timeline_dump(const char *path);
+
+#endif // TIMELINE_H
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+#include "game.h"
+#include "eval.h"
+#include "engine.h"
+#include "move_codec.h"
+
+// Plays the bot against itself to measure whether a change makes it stronger. Two engines, A and B, play games in pairs from
+// the same opening with colors swapped, on as many threads as there are cores. Game is the arbiter: every move goes through
+// make_move, and the game ends on checkmate, stalemate or any of Game's draw rules (or is adjudicated a draw after
+// --max-plies half moves). Both engines are this build's search, so what tells them apart is their time per move.
+
+// After every game the score is turned into an Elo difference, and a sequential probability ratio test (SPRT) checks
+// whether it's already clear that A is at least elo1 stronger than B (H1) or no more than elo0 stronger (H0). Once either
+// is accepted the tournament stops, rather than playing out every game. Every finished game is written to a PGN file.
+
+// Usage: tournament [--games N] [--threads N] [--time-a MS] [--time-b MS] [--openings FILE] [--pgn FILE] [--max-plies N]
+//                   [--elo0 E] [--elo1 E] [--alpha A] [--beta B] [--eval-weights FILE] [--no-sprt]
+// --eval-weights replaces the evaluation's weights for both engines with the ones in FILE (see load_eval_weights in eval.h),
+// to see how a set of weights does in play.
+// An openings file holds one opening per line: either a FEN or EPD position, or a list of moves from the starting position
+// the way a client types them (i.e. "e2e4 e7e5 g1f3"). Lines starting with '#' are comments.
+
+#define MAX_LINE 1024
+
+// a few common openings, used when there's no openings file
+static const char *BUILTIN_OPENINGS[] = {
+    "e2e4 e7e5 g1f3 b8c6 f1b5", // Ruy Lopez
+    "e2e4 e7e5 g1f3 b8c6 f1c4", // Italian Game
+    "e2e4 c7c5 g1f3 d7d6 d2d4", // Sicilian Defence
+    "e2e4 e7e6 d2d4 d7d5", // French Defence
+    "e2e4 c7c6 d2d4 d7d5", // Caro-Kann Defence
+    "e2e4 d7d5 e4d5 d8d5 b1c3", // Scandinavian Defence
+    "d2d4 d7d5 c2c4 e7e6", // Queen's Gambit Declined
+    "d2d4 d7d5 c2c4 c7c6", // Slav Defence
+    "d2d4 g8f6 c2c4 g7g6 b1c3 f8g7", // King's Indian Defence
+    "d2d4 g8f6 c2c4 e7e6 b1c3 f8b4", // Nimzo-Indian Defence
+    "c2c4 e7e5 b1c3 g8f6", // English Opening
+    "g1f3 d7d5 g2g3 g8f6 f1g2", // Reti Opening
+};
+
+struct Opening {
+    std::string fen; // empty for the starting position
+    std::vector<Move> moves; // played from fen before the engines take over
+};
+
+struct TournamentOptions {
+    int games;
+    int threads;
+    int time_a, time_b; // milliseconds per move
+    int max_plies;
+    bool sprt;
+    double elo0, elo1, alpha, beta;
+    const char *openings_path;
+    const char *pgn_path;
+    const char *eval_weights_path; // NULL for the built-in weights
+};
+
+// wins, draws and losses from A's point of view
+struct Score {
+    int wins, draws, losses;
+
+    int games() const { return wins + draws + losses; }
+};
+
+struct GameRecord {
+    int round;
+    bool a_is_white;
+    std::string start_fen; // empty if the game started from the starting position
+    char start_side;
+    std::vector<std::string> moves; // in SAN
+    const char *result; // "1-0", "0-1" or "1/2-1/2"
+    const char *termination; // the PGN Termination tag
+    const char *comment; // how the game ended, i.e. "White mates"
+};
+
+struct WorkerStats {
+    double busy_seconds; // time spent playing games, as opposed to waiting for the next one
+    int games;
+};
+
+struct Tournament {
+    TournamentOptions options;
+    std::vector<Opening> openings;
+
+    std::atomic<int> next_game;
+    std::atomic<bool> stop; // set once the SPRT has decided, which also aborts the searches of the games still in progress
+    std::atomic<int> workers_running;
+
+    std::mutex mutex; // guards everything below
+    Score score;
+    int sprt_result; // 1 if H1 was accepted, -1 if H0 was, 0 while undecided
+    FILE *pgn;
+    std::vector<WorkerStats> workers;
+};
+
+static double score_from_elo(double elo){
+    return 1.0 / (1.0 + pow(10.0, -elo / 400.0));
+}
+
+static double elo_from_score(double score){
+    return -400.0 * log10(1.0 / score - 1.0);
+}
+
+// average score per game and its variance, from A's point of view
+static void score_stats(const Score &score, double &mean, double &variance){
+    int n = score.games();
+    mean = (score.wins + 0.5 * score.draws) / n;
+    variance = (score.wins * (1.0 - mean) * (1.0 - mean) + score.draws * (0.5 - mean) * (0.5 - mean)
+        + score.losses * mean * mean) / n;
+}
+
+// The Elo difference between A and B, and the half width of its 95% confidence interval. Returns false if it can't be
+// estimated yet (no games, or every game won by the same engine).
+static bool elo_estimate(const Score &score, double &elo, double &margin){
+    if (score.games() == 0)
+        return false;
+    double mean, variance;
+    score_stats(score, mean, variance);
+    if (mean <= 0.0 || mean >= 1.0)
+        return false;
+    double deviation = 1.96 * sqrt(variance / score.games());
+    double low = std::max(mean - deviation, 1e-6), high = std::min(mean + deviation, 1.0 - 1e-6);
+    elo = elo_from_score(mean);
+    margin = (elo_from_score(high) - elo_from_score(low)) / 2.0;
+    return true;
+}
+
+// The log likelihood ratio of H1 (A is elo1 stronger) against H0 (A is elo0 stronger), using the normal approximation to
+// the game results. It drifts up if H1 is true and down if H0 is.
+static double sprt_llr(const Score &score, double elo0, double elo1){
+    if (score.games() == 0)
+        return 0.0;
+    double mean, variance;
+    score_stats(score, mean, variance);
+    if (variance <= 0.0)
+        return 0.0;
+    double s0 = score_from_elo(elo0), s1 = score_from_elo(elo1);
+    return (s1 - s0) * (2.0 * mean - s0 - s1) * score.games() / (2.0 * variance);
+}
+
+// Reads an opening: a FEN or EPD position if the line has a '/' in it, or else a list of moves from the starting position.
+// Returns false if the position or any of the moves isn't legal.
+static bool parse_opening(const char *line, Opening &opening){
+    Game game;
+    if (strchr(line, '/') != NULL){
+        opening.fen = line;
+        return game.load_fen(line);
+    }
+
+    char buf[DEFAULT_BUFLEN];
+    const char *p = line;
+    while (*p != '\0'){
+        while (*p == ' ' || *p == '\t')
+            p++;
+        size_t len = strcspn(p, " \t");
+        if (len == 0)
+            break;
+        if (len >= 8)
+            return false;
+        memcpy(buf, p, len);
+        buf[len] = '\0';
+        p += len;
+
+        Move move;
+        std::vector<Move> legal;
+        char side = game.get_side_to_move();
+        game.generate_moves(side, legal);
+        bool found = false;
+        if (Game::parse_move(buf, move)){
+            for (const Move &m : legal){
+                if (m.from_row == move.from_row && m.from_col == move.from_col && m.to_row == move.to_row && m.to_col == move.to_col
+                    && m.promotion == move.promotion)
+                    found = true;
+            }
+        }
+        if (!found)
+            return false;
+        game.make_move(move, side);
+        opening.moves.push_back(move);
+    }
+    return true;
+}
+
+static bool load_openings(Tournament &t){
+    if (t.options.openings_path == NULL){
+        for (const char *line : BUILTIN_OPENINGS){
+            Opening opening;
+            parse_opening(line, opening);
+            t.openings.push_back(opening);
+        }
+        return true;
+    }
+
+    FILE *f = fopen(t.options.openings_path, "r");
+    if (f == NULL){
+        printf("Couldn't open %s.\n", t.options.openings_path);
+        return false;
+    }
+    char line[MAX_LINE];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f) != NULL){
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[strspn(line, " \t")] == '\0')
+            continue;
+        Opening opening;
+        if (!parse_opening(line, opening)){
+            printf("Skipping line %d of %s, which isn't a legal opening.\n", line_number, t.options.openings_path);
+            continue;
+        }
+        t.openings.push_back(opening);
+    }
+    fclose(f);
+    if (t.openings.empty()){
+        printf("%s has no openings in it.\n", t.options.openings_path);
+        return false;
+    }
+    return true;
+}
+
+// Plays one game to the end. Returns false if the tournament was stopped before it finished.
+static bool play_game(Tournament &t, int index, GameRecord &record){
+    const Opening &opening = t.openings[(index / 2) % t.openings.size()];
+    record.round = index + 1;
+    record.a_is_white = (index % 2 == 0); // each opening is played twice, once with A as White and once with B as White
+
+    Game game;
+    if (!opening.fen.empty()){
+        game.load_fen(opening.fen.c_str());
+        char fen[DEFAULT_BUFLEN];
+        game.format_fen(fen);
+        record.start_fen = fen;
+    }
+    record.start_side = game.get_side_to_move();
+    for (const Move &m : opening.moves){
+        record.moves.push_back(format_san(game, m));
+        game.make_move(m, game.get_side_to_move());
+    }
+
+    int plies = 0;
+    while (1){
+        char side = game.get_side_to_move();
+        switch (game.get_draw_reason()){
+            case DrawReason::NoDraw:
+                break;
+            case DrawReason::Stalemate:
+                record.result = "1/2-1/2";
+                record.termination = "normal";
+                record.comment = "Draw by stalemate";
+                return true;
+            case DrawReason::ThreefoldRepetition:
+                record.result = "1/2-1/2";
+                record.termination = "normal";
+                record.comment = "Draw by threefold repetition";
+                return true;
+            case DrawReason::FiftyMoveRule:
+                record.result = "1/2-1/2";
+                record.termination = "normal";
+                record.comment = "Draw by the fifty move rule";
+                return true;
+            case DrawReason::InsufficientMaterial:
+                record.result = "1/2-1/2";
+                record.termination = "normal";
+                record.comment = "Draw by insufficient material";
+                return true;
+        }
+        if (plies >= t.options.max_plies){
+            record.result = "1/2-1/2";
+            record.termination = "adjudication";
+            record.comment = "Draw by adjudication, the game went on too long";
+            return true;
+        }
+
+        bool a_to_move = (side == 'W') == record.a_is_white;
+        SearchResult result = search_position(game, side, a_to_move ? t.options.time_a : t.options.time_b, t.stop);
+        if (t.stop.load())
+            return false;
+        if (!result.found_move){
+            // the search only finds no move at all when the player is checkmated, since stalemate was checked above
+            record.result = (side == 'W') ? "0-1" : "1-0";
+            record.termination = "normal";
+            record.comment = (side == 'W') ? "Black mates" : "White mates";
+            return true;
+        }
+        record.moves.push_back(format_san(game, result.best_move));
+        game.make_move(result.best_move, side);
+        plies++;
+    }
+}
+
+static void write_pgn(Tournament &t, const GameRecord &record){
+    if (t.pgn == NULL)
+        return;
+    char date[16];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y.%m.%d", localtime(&now));
+    char engine_a[32], engine_b[32];
+    snprintf(engine_a, sizeof(engine_a), "A (%d ms)", t.options.time_a);
+    snprintf(engine_b, sizeof(engine_b), "B (%d ms)", t.options.time_b);
+
+    fprintf(t.pgn, "[Event \"Self-play tournament\"]\n[Site \"?\"]\n[Date \"%s\"]\n[Round \"%d\"]\n", date, record.round);
+    fprintf(t.pgn, "[White \"%s\"]\n[Black \"%s\"]\n[Result \"%s\"]\n", record.a_is_white ? engine_a : engine_b,
+        record.a_is_white ? engine_b : engine_a, record.result);
+    if (!record.start_fen.empty())
+        fprintf(t.pgn, "[SetUp \"1\"]\n[FEN \"%s\"]\n", record.start_fen.c_str());
+    fprintf(t.pgn, "[PlyCount \"%zu\"]\n[Termination \"%s\"]\n\n", record.moves.size(), record.termination);
+
+    // the move text, wrapped to 80 columns
+    std::string text;
+    int line_len = 0;
+    auto add_token = [&](const std::string &token){
+        if (line_len > 0 && line_len + 1 + (int)token.size() > 80){
+            text += '\n';
+            line_len = 0;
+        } else if (line_len > 0){
+            text += ' ';
+            line_len++;
+        }
+        text += token;
+        line_len += (int)token.size();
+    };
+    bool white_to_move = (record.start_side == 'W');
+    int move_number = 1;
+    for (size_t i = 0; i < record.moves.size(); i++){
+        if (white_to_move)
+            add_token(std::to_string(move_number) + ".");
+        else if (i == 0)
+            add_token(std::to_string(move_number) + "...");
+        add_token(record.moves[i]);
+        if (!white_to_move)
+            move_number++;
+        white_to_move = !white_to_move;
+    }
+    add_token(std::string("{") + record.comment + "}");
+    add_token(record.result);
+    fprintf(t.pgn, "%s\n\n", text.c_str());
+    fflush(t.pgn);
+}
+
+// Counts a finished game, and stops the tournament if the SPRT has come to a decision
+static void record_game(Tournament &t, const GameRecord &record){
+    std::lock_guard<std::mutex> lock(t.mutex);
+    if (strcmp(record.result, "1/2-1/2") == 0)
+        t.score.draws++;
+    else if ((strcmp(record.result, "1-0") == 0) == record.a_is_white)
+        t.score.wins++;
+    else
+        t.score.losses++;
+    write_pgn(t, record);
+
+    if (t.options.sprt && t.sprt_result == 0){
+        double llr = sprt_llr(t.score, t.options.elo0, t.options.elo1);
+        if (llr >= log((1.0 - t.options.beta) / t.options.alpha))
+            t.sprt_result = 1;
+        else if (llr <= log(t.options.beta / (1.0 - t.options.alpha)))
+            t.sprt_result = -1;
+        if (t.sprt_result != 0)
+            t.stop = true;
+    }
+}
+
+static void worker(Tournament &t, int id){
+    double busy = 0;
+    int games = 0;
+    while (!t.stop.load()){
+        int index = t.next_game++;
+        if (index >= t.options.games)
+            break;
+        auto start = std::chrono::steady_clock::now();
+        GameRecord record;
+        bool finished = play_game(t, index, record);
+        busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!finished)
+            break;
+        record_game(t, record);
+        games++;
+    }
+
+    std::lock_guard<std::mutex> lock(t.mutex);
+    t.workers[id].busy_seconds = busy;
+    t.workers[id].games = games;
+    t.workers_running--;
+}
+
+static void print_progress(Tournament &t, double seconds){
+    std::lock_guard<std::mutex> lock(t.mutex);
+    const Score &s = t.score;
+    printf("Games %d: +%d =%d -%d", s.games(), s.wins, s.draws, s.losses);
+    double elo, margin;
+    if (elo_estimate(s, elo, margin))
+        printf(", Elo %.1f +/- %.1f", elo, margin);
+    if (t.options.sprt)
+        printf(", LLR %.2f [%.2f, %.2f]", sprt_llr(s, t.options.elo0, t.options.elo1),
+            log(t.options.beta / (1.0 - t.options.alpha)), log((1.0 - t.options.beta) / t.options.alpha));
+    printf(", %.2f games/sec\n", seconds > 0 ? s.games() / seconds : 0.0);
+}
+
+static void usage(){
+    printf("Usage: tournament [--games N] [--threads N] [--time-a MS] [--time-b MS] [--openings FILE] [--pgn FILE] [--max-plies N]\n"
+        "                  [--elo0 E] [--elo1 E] [--alpha A] [--beta B] [--eval-weights FILE] [--no-sprt]\n");
+}
+
+int main(int argc, char* argv[]){
+    Tournament t;
+    t.options.games = 1000;
+    t.options.threads = (int)std::thread::hardware_concurrency();
+    if (t.options.threads < 1)
+        t.options.threads = 1;
+    t.options.time_a = 20;
+    t.options.time_b = 20;
+    t.options.max_plies = 400;
+    t.options.sprt = true;
+    t.options.elo0 = 0;
+    t.options.elo1 = 10;
+    t.options.alpha = 0.05;
+    t.options.beta = 0.05;
+    t.options.openings_path = NULL;
+    t.options.pgn_path = "tournament.pgn";
+    t.options.eval_weights_path = NULL;
+
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--no-sprt") == 0){
+            t.options.sprt = false;
+            continue;
+        }
+        if (i + 1 >= argc){
+            usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "--games") == 0)
+            t.options.games = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0)
+            t.options.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--time-a") == 0)
+            t.options.time_a = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--time-b") == 0)
+            t.options.time_b = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--openings") == 0)
+            t.options.openings_path = argv[++i];
+        else if (strcmp(argv[i], "--pgn") == 0)
+            t.options.pgn_path = argv[++i];
+        else if (strcmp(argv[i], "--max-plies") == 0)
+            t.options.max_plies = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--elo0") == 0)
+            t.options.elo0 = atof(argv[++i]);
+        else if (strcmp(argv[i], "--elo1") == 0)
+            t.options.elo1 = atof(argv[++i]);
+        else if (strcmp(argv[i], "--alpha") == 0)
+            t.options.alpha = atof(argv[++i]);
+        else if (strcmp(argv[i], "--beta") == 0)
+            t.options.beta = atof(argv[++i]);
+        else if (strcmp(argv[i], "--eval-weights") == 0)
+            t.options.eval_weights_path = argv[++i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (t.options.games < 1 || t.options.threads < 1 || t.options.time_a < 1 || t.options.time_b < 1 || t.options.max_plies < 1
+        || t.options.elo1 <= t.options.elo0 || t.options.alpha <= 0 || t.options.alpha >= 1 || t.options.beta <= 0
+        || t.options.beta >= 1){
+        usage();
+        return 1;
+    }
+
+    // before the openings, since those are the first games made
+    if (t.options.eval_weights_path != NULL && !load_eval_weights(t.options.eval_weights_path))
+        return 1;
+    if (!load_openings(t))
+        return 1;
+    t.pgn = fopen(t.options.pgn_path, "w");
+    if (t.pgn == NULL)
+        printf("Couldn't open %s, so the games won't be saved.\n", t.options.pgn_path);
+
+    t.next_game = 0;
+    t.stop = false;
+    t.workers_running = t.options.threads;
+    t.score = {0, 0, 0};
+    t.sprt_result = 0;
+    t.workers.assign(t.options.threads, {0.0, 0});
+    printf("Playing up to %d games between A (%d ms per move) and B (%d ms per move) on %d threads, from %zu openings.\n",
+        t.options.games, t.options.time_a, t.options.time_b, t.options.threads, t.openings.size());
+    if (t.options.sprt)
+        printf("SPRT: H0 is elo <= %.1f, H1 is elo >= %.1f, alpha %.2f, beta %.2f.\n", t.options.elo0, t.options.elo1,
+            t.options.alpha, t.options.beta);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < t.options.threads; i++)
+        threads.emplace_back(worker, std::ref(t), i);
+
+    // report progress every few seconds until every worker is done
+    auto next_report = start + std::chrono::seconds(5);
+    while (t.workers_running.load() > 0){
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_report){
+            print_progress(t, std::chrono::duration<double>(now - start).count());
+            next_report = now + std::chrono::seconds(5);
+        }
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (t.pgn != NULL)
+        fclose(t.pgn);
+
+    printf("\n");
+    print_progress(t, seconds);
+    if (t.options.sprt){
+        if (t.sprt_result > 0)
+            printf("SPRT: H1 accepted, A is at least %.1f Elo stronger than B.\n", t.options.elo1);
+        else if (t.sprt_result < 0)
+            printf("SPRT: H0 accepted, A is no more than %.1f Elo stronger than B.\n", t.options.elo0);
+        else
+            printf("SPRT: no decision after %d games.\n", t.score.games());
+    }
+    printf("Worker utilization:");
+    for (int i = 0; i < t.options.threads; i++)
+        printf(" %d: %.1f%% (%d games)%s", i, seconds > 0 ? 100.0 * t.workers[i].busy_seconds / seconds : 0.0, t.workers[i].games,
+            (i + 1 < t.options.threads) ? "," : "\n");
+    if (t.pgn != NULL)
+        printf("Games written to %s.\n", t.options.pgn_path);
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+
+#include "trace.h"
+
+// the buffer is written out once it holds this much
+#define TRACE_BLOCK 65536
+
+static uint64_t now_us(){
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t trace_hash(uint64_t hash, const char *text, size_t len){
+    for (size_t i = 0; i < len; i++){
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+TraceWriter::TraceWriter(const std::string &path, uint32_t flags){
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0){
+        perror("trace open() error");
+        return;
+    }
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.flags = flags;
+    header.start_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    buffer.append((const char*)&header, sizeof(header));
+    last_us = now_us();
+}
+
+TraceWriter::~TraceWriter(){
+    if (fd < 0)
+        return;
+    flush();
+    ::close(fd);
+}
+
+void TraceWriter::flush(){
+    size_t done = 0;
+    while (done < buffer.size()){
+        ssize_t n = write(fd, buffer.data() + done, buffer.size() - done);
+        if (n < 0){
+            if (errno == EINTR)
+                continue;
+            perror("trace write() error");
+            break;
+        }
+        done += n;
+    }
+    buffer.clear();
+}
+
+void TraceWriter::put_varint(uint64_t value){
+    while (value >= 0x80){
+        buffer.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back((char)value);
+}
+
+void TraceWriter::begin_event(TraceEventType type, uint32_t conn){
+    if (buffer.size() >= TRACE_BLOCK)
+        flush();
+    uint64_t now = now_us();
+    buffer.push_back((char)type);
+    put_varint(now - last_us);
+    put_varint(conn);
+    last_us = now;
+}
+
+void TraceWriter::open(uint32_t conn){
+    if (fd < 0)
+        return;
+    begin_event(TraceOpen, conn);
+}
+
+void TraceWriter::frame(uint32_t conn, uint32_t frames_sent, const char *text, size_t len){
+    if (fd < 0)
+        return;
+    begin_event(TraceFrame, conn);
+    put_varint(frames_sent);
+    put_varint(len);
+    buffer.append(text, len);
+}
+
+void TraceWriter::close(uint32_t conn, uint32_t frames_sent){
+    if (fd < 0)
+        return;
+    begin_event(TraceClose, conn);
+    put_varint(frames_sent);
+}
+
+void TraceWriter::digest(uint32_t conn, uint32_t frames_sent, uint64_t hash){
+    if (fd < 0)
+        return;
+    begin_event(TraceDigest, conn);
+    put_varint(frames_sent);
+    put_varint(hash);
+}
+
+static bool get_varint(const std::string &data, size_t &pos, uint64_t &value){
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < data.size(); shift += 7){
+        unsigned char byte = (unsigned char)data[pos++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool read_trace(const char *path, TraceHeader &header, std::vector<TraceEvent> &events){
+    FILE *file = fopen(path, "rb");
+    if (file == NULL){
+        perror("fopen() error");
+        return false;
+    }
+    std::string data;
+    char chunk[TRACE_BLOCK];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.append(chunk, n);
+    fclose(file);
+
+    if (data.size() < sizeof(header) || memcmp(data.data(), TRACE_MAGIC, sizeof(header.magic)) != 0){
+        printf("%s isn't a trace.\n", path);
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.version != TRACE_VERSION){
+        printf("%s is a version %u trace, and only version %d can be read.\n", path, header.version, TRACE_VERSION);
+        return false;
+    }
+
+    // an event cut short (i.e. the server was killed mid write) ends the trace
+    size_t pos = sizeof(header);
+    uint64_t time_us = 0;
+    while (pos < data.size()){
+        TraceEvent event;
+        event.type = (TraceEventType)data[pos++];
+        uint64_t delta, conn, frames_sent = 0, hash = 0;
+        if (!get_varint(data, pos, delta) || !get_varint(data, pos, conn))
+            break;
+        if (event.type != TraceOpen && !get_varint(data, pos, frames_sent))
+            break;
+        if (event.type == TraceFrame){
+            uint64_t len;
+            if (!get_varint(data, pos, len) || pos + len > data.size())
+                break;
+            event.text.assign(data, pos, len);
+            pos += len;
+        } else if (event.type == TraceDigest){
+            if (!get_varint(data, pos, hash))
+                break;
+        } else if (event.type != TraceOpen && event.type != TraceClose){
+            printf("%s has an unknown event type %d. Stopping there.\n", path, event.type);
+            break;
+        }
+        time_us += delta;
+        event.time_us = time_us;
+        event.conn = (uint32_t)conn;
+        event.frames_sent = (uint32_t)frames_sent;
+        event.hash = hash;
+        events.push_back(event);
+    }
+    return true;
+}
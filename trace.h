@@ -0,0 +1,86 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Session traces: a shard's inbound traffic, recorded so it can be played back against a local server later (see replay.cpp).
+
+// A trace is a header followed by events, each a type byte and then varints:
+// - Open: a connection was accepted
+// - Frame: a frame arrived. Along with its text, it has how many frames the server had sent the connection by then, which
+//   is what lets a replay send it at the same point in the conversation however fast it's going
+// - Close: the client closed the connection, after it had been sent so many frames
+// - Digest: the server closed the connection (or heard it close), having sent it so many frames, with a hash of their text.
+//   A replay hashes what it's sent and checks the two match
+// Every event starts with the microseconds since the last one. Connections are numbered in the order they opened.
+
+#define TRACE_MAGIC "CHTRACE1"
+#define TRACE_VERSION 1
+
+// header flags: what the recording server was doing that a replay can't reproduce exactly
+#define TRACE_BOT_MODE 1 // the bot's moves depend on how fast it searched
+#define TRACE_STATE_DIR 2 // games were given random resume codes
+
+enum TraceEventType : uint8_t {
+    TraceOpen = 1,
+    TraceFrame,
+    TraceClose,
+    TraceDigest
+};
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t start_ms; // unix time the recording started
+};
+
+struct TraceEvent {
+    TraceEventType type;
+    uint64_t time_us; // since the recording started
+    uint32_t conn;
+    uint32_t frames_sent; // frames the server had sent the connection before this event
+    uint64_t hash; // Digest only
+    std::string text; // Frame only: the frame up to its first '\0'
+};
+
+// FNV-1a, run over the text of every frame sent to a connection
+uint64_t trace_hash(uint64_t hash, const char *text, size_t len);
+#define TRACE_HASH_START 14695981039346656037ull
+
+// Records a shard's events into a trace file, buffered and written a block at a time by the shard's own thread
+class TraceWriter {
+    public:
+        TraceWriter(const std::string &path, uint32_t flags);
+
+        // writes out whatever is still buffered
+        ~TraceWriter();
+
+        TraceWriter(const TraceWriter&) = delete;
+        TraceWriter& operator=(const TraceWriter&) = delete;
+
+        bool ok(){
+            return fd >= 0;
+        }
+
+        void open(uint32_t conn);
+        void frame(uint32_t conn, uint32_t frames_sent, const char *text, size_t len);
+        void close(uint32_t conn, uint32_t frames_sent);
+        void digest(uint32_t conn, uint32_t frames_sent, uint64_t hash);
+
+    private:
+        void begin_event(TraceEventType type, uint32_t conn);
+        void put_varint(uint64_t value);
+        void flush();
+
+        int fd;
+        std::string buffer;
+        uint64_t last_us;
+};
+
+// reads a whole trace. Returns false (saying why) if it can't be read
+bool read_trace(const char *path, TraceHeader &header, std::vector<TraceEvent> &events);
+
+#endif // TRACE_H
@@ -0,0 +1,140 @@
+#include <cstdlib>
+#include <new>
+
+#include "transposition.h"
+
+// Layout of a slot's data word, from the lowest bit:
+//  0-5   from tile (row * 8 + col)
+//  6-11  to tile
+//  12-14 promotion piece (0 none, then Q R B N)
+//  15    whether there's a best move at all
+//  16-23 depth
+//  24-25 bound, which is never 0, so an empty slot (all zeros) never decodes as an entry
+//  26-31 generation
+//  32-63 score
+#define GENERATION_MASK 63
+
+static const char PROMOTIONS[] = {0, 'Q', 'R', 'B', 'N'};
+
+static uint64_t encode_move(const Move &move){
+    uint64_t promotion = 0;
+    for (int i = 1; i < 5; i++)
+        if (move.promotion == PROMOTIONS[i])
+            promotion = i;
+    return (uint64_t)(move.from_row * 8 + move.from_col) | ((uint64_t)(move.to_row * 8 + move.to_col) << 6)
+        | (promotion << 12) | (1ull << 15);
+}
+
+static Move decode_move(uint64_t data){
+    Move move;
+    move.from_row = (data >> 3) & 7;
+    move.from_col = data & 7;
+    move.to_row = (data >> 9) & 7;
+    move.to_col = (data >> 6) & 7;
+    int promotion = (data >> 12) & 7;
+    move.promotion = promotion < 5 ? PROMOTIONS[promotion] : 0;
+    return move;
+}
+
+uint64_t pack_table_entry(int score, int depth, Bound bound, const Move *best_move){
+    return (best_move != NULL ? encode_move(*best_move) : 0) | ((uint64_t)depth << 16) | ((uint64_t)bound << 24)
+        | ((uint64_t)(uint32_t)score << 32);
+}
+
+void unpack_table_entry(uint64_t data, TableEntry &entry){
+    entry.score = (int32_t)(data >> 32);
+    entry.depth = (data >> 16) & 0xff;
+    entry.bound = (Bound)((data >> 24) & 3);
+    entry.has_move = (data >> 15) & 1;
+    if (entry.has_move)
+        entry.best_move = decode_move(data);
+}
+
+TranspositionTable::TranspositionTable() : slots(NULL), slot_count(0), wanted_slot_count(0), generation(0){
+    resize(16);
+}
+
+TranspositionTable::~TranspositionTable(){
+    std::free(slots);
+}
+
+void TranspositionTable::resize(size_t megabytes){
+    size_t count = 1;
+    while (count * 2 * sizeof(Slot) <= megabytes * 1024 * 1024)
+        count *= 2;
+    wanted_slot_count = count;
+}
+
+void TranspositionTable::clear(){
+    // freeing the slots and letting new_search() calloc them again is quicker than zeroing them, since the kernel hands out
+    // fresh zeroed pages only as they're touched
+    std::free(slots);
+    slots = NULL;
+    slot_count = 0;
+}
+
+void TranspositionTable::new_search(){
+    if (slot_count != wanted_slot_count){
+        std::free(slots);
+        slots = static_cast<Slot*>(std::calloc(wanted_slot_count, sizeof(Slot)));
+        if (slots == NULL)
+            throw std::bad_alloc();
+        slot_count = wanted_slot_count;
+    }
+    age();
+}
+
+void TranspositionTable::age(){
+    // two threads ageing at once may only move it on by one, which doesn't matter
+    uint8_t next = (__atomic_load_n(&generation, __ATOMIC_RELAXED) + 1) & GENERATION_MASK;
+    __atomic_store_n(&generation, next, __ATOMIC_RELAXED);
+}
+
+bool TranspositionTable::probe(uint64_t key, TableEntry &entry) const {
+    if (slots == NULL)
+        return false;
+    const Slot &slot = slots[key & (slot_count - 1)];
+    uint64_t data = __atomic_load_n(&slot.data, __ATOMIC_RELAXED);
+    uint64_t check = __atomic_load_n(&slot.key_xor_data, __ATOMIC_RELAXED);
+    if (data == 0 || (check ^ data) != key)
+        return false;
+
+    unpack_table_entry(data, entry);
+    return true;
+}
+
+void TranspositionTable::store(uint64_t key, int score, int depth, Bound bound, const Move *best_move){
+    if (slots == NULL)
+        return;
+    Slot &slot = slots[key & (slot_count - 1)];
+    uint64_t old_data = __atomic_load_n(&slot.data, __ATOMIC_RELAXED);
+    uint64_t old_key = __atomic_load_n(&slot.key_xor_data, __ATOMIC_RELAXED) ^ old_data;
+
+    // Keep a deeper entry for another position from this search, since it saved more work. Anything older, shallower, or
+    // for the same position is replaced.
+    uint64_t current = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+    if (old_data != 0 && old_key != key && ((old_data >> 26) & GENERATION_MASK) == current
+        && (int)((old_data >> 16) & 0xff) > depth + 2)
+        return;
+
+    // a new entry for the same position without a best move keeps the old one, which is still the best guess to try first
+    uint64_t data = pack_table_entry(score, depth, bound, best_move) | (current << 26);
+    if (best_move == NULL && old_key == key)
+        data |= old_data & 0xffff;
+    __atomic_store_n(&slot.data, data, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot.key_xor_data, key ^ data, __ATOMIC_RELAXED);
+}
+
+int TranspositionTable::hashfull() const {
+    if (slots == NULL)
+        return 0;
+    size_t sample = slot_count < 1000 ? slot_count : 1000;
+    uint64_t current = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+    int used = 0;
+    for (size_t i = 0; i < sample; i++){
+        uint64_t data = __atomic_load_n(&slots[i].data, __ATOMIC_RELAXED);
+        if (data != 0 && ((data >> 26) & GENERATION_MASK) == current)
+            used++;
+    }
+    return (int)(used * 1000 / sample);
+}
@@ -0,0 +1,82 @@
+#ifndef TRANSPOSITION_H
+#define TRANSPOSITION_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "game.h"
+
+// A transposition table remembers the score, depth and best move of positions that were already searched. A position
+// reached again by a different move order, or on the next iteration of iterative deepening, can then be cut off straight
+// away or at least have its best move searched first.
+
+// The table is shared by every thread searching the same position, and takes no locks. Each slot keeps its data word and
+// the position's key xored with that data word. A slot torn by two threads writing it at once doesn't decode back to either
+// key, so it just misses.
+
+// How a stored score relates to the real one: the search failed low (the real score is at most this), failed high (at
+// least this), or got the exact score
+enum class Bound : uint8_t {
+    Upper = 1,
+    Lower = 2,
+    Exact = 3
+};
+
+struct TableEntry {
+    int score;
+    int depth;
+    Bound bound;
+    bool has_move;
+    Move best_move;
+};
+
+// An entry packed into one 64 bit word, which is what lets tables read and write entries without locks. The word is never 0,
+// so 0 can mark an empty slot. Bits 26-31 are left 0 for the table's own use.
+uint64_t pack_table_entry(int score, int depth, Bound bound, const Move *best_move);
+void unpack_table_entry(uint64_t data, TableEntry &entry);
+
+class TranspositionTable {
+    public:
+        TranspositionTable();
+        ~TranspositionTable();
+
+        TranspositionTable(const TranspositionTable&) = delete;
+        TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+        // Sets the size of the table in megabytes. Nothing is allocated until the table is first used, so a program that
+        // sets the size and then quits (or never searches) doesn't pay for it.
+        void resize(size_t megabytes);
+
+        // forgets every entry, i.e. for a new game
+        void clear();
+
+        // Called before every search: allocates the table if it hasn't been yet, and starts a new generation so entries left
+        // from older searches are the first to be replaced. Not thread safe, so call it before starting the search threads.
+        void new_search();
+
+        // Starts a new generation without allocating, for searches that run alongside others on the same table (i.e. an
+        // engine pool's jobs). Thread safe once the table has been allocated by new_search().
+        void age();
+
+        // looks the position up. Returns false if the table doesn't have it
+        bool probe(uint64_t key, TableEntry &entry) const;
+
+        void store(uint64_t key, int score, int depth, Bound bound, const Move *best_move);
+
+        // how full the table is in permille, counting only entries from the current search. Samples the first 1000 slots,
+        // like UCI engines do for their hashfull info
+        int hashfull() const;
+
+    private:
+        struct Slot {
+            uint64_t key_xor_data;
+            uint64_t data;
+        };
+
+        Slot *slots;
+        size_t slot_count; // a power of two, so a key's slot is just its low bits
+        size_t wanted_slot_count; // what resize() asked for, allocated by the next new_search()
+        uint8_t generation;
+};
+
+#endif // TRANSPOSITION_H
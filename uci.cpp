@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+#include "game.h"
+#include "engine.h"
+#include "eval.h"
+#include "transposition.h"
+
+// A UCI (Universal Chess Interface) front end for the bot, so it can play in chess GUIs and in tournament managers like
+// cutechess-cli or fastchess. Game checks every move it's given, and the search is the same one the server's bot uses, with
+// a transposition table the size of the Hash option shared by Threads search threads (lazy SMP: every thread searches the
+// same position, and they help each other through the table).
+
+// Startup does no work beyond reading stdin: the table isn't allocated until the first go, and the kernel only hands its
+// pages out as they're touched. Tournaments that start the engine for every one of thousands of short games aren't slowed
+// down by it.
+
+// Supported: uci, isready, ucinewgame, setoption (Hash, Threads, Ponder), position (startpos or fen, then moves),
+// go (wtime, btime, winc, binc, movestogo, movetime, depth, nodes, infinite, ponder), stop, ponderhit and quit.
+
+// Usage: uci [--eval-weights FILE]
+// --eval-weights replaces the evaluation's weights with the ones in FILE (see load_eval_weights in eval.h). It's a command
+// line option rather than a UCI one, since the weights can't change once a game exists.
+
+#define DEFAULT_HASH_MB 16
+#define MAX_HASH_MB 4096
+#define MAX_THREADS 256
+#define MOVE_OVERHEAD_MS 10 // kept back from every move's time, for the time it takes the GUI to hear about the move
+
+struct GoOptions {
+    int wtime, btime, winc, binc, movestogo; // -1 if not given
+    int movetime;
+    int depth;
+    long nodes;
+    bool infinite;
+    bool ponder;
+};
+
+static std::mutex output_mutex;
+
+// writes one line to the GUI. The search thread and the main thread both write, so lines go out whole
+static void send(const char *format, ...){
+    std::lock_guard<std::mutex> lock(output_mutex);
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    putchar('\n');
+    fflush(stdout);
+}
+
+// a move the way UCI writes them, i.e. "e2e4" or "e7e8q". Castle-ing is the king's move, which is how Game takes it too
+static std::string move_to_uci(const Move &move){
+    char buf[DEFAULT_BUFLEN];
+    Game::format_move(move, buf);
+    buf[strcspn(buf, "\n")] = '\0';
+    return buf;
+}
+
+// the score the way UCI wants it: centipawns, or mate in moves (negative when the engine is the one getting mated)
+static std::string format_score(int score){
+    char buf[32];
+    if (score >= MATE_SCORE - MAX_SEARCH_DEPTH)
+        snprintf(buf, sizeof(buf), "mate %d", (MATE_SCORE - score + 1) / 2);
+    else if (score <= -MATE_SCORE + MAX_SEARCH_DEPTH)
+        snprintf(buf, sizeof(buf), "mate -%d", (MATE_SCORE + score + 1) / 2);
+    else
+        snprintf(buf, sizeof(buf), "cp %d", score);
+    return buf;
+}
+
+static bool same_move(const Move &a, const Move &b){
+    return a.from_row == b.from_row && a.from_col == b.from_col && a.to_row == b.to_row && a.to_col == b.to_col
+        && a.promotion == b.promotion;
+}
+
+// option names are case insensitive
+static bool same_name(const std::string &a, const char *b){
+    if (a.size() != strlen(b))
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+            return false;
+    return true;
+}
+
+class UciEngine {
+    public:
+        UciEngine() : hash_mb(DEFAULT_HASH_MB), threads(1), stop(false), pondering(false), holding_result(false){}
+
+        ~UciEngine(){
+            stop_search();
+        }
+
+        void run();
+
+    private:
+        Game game;
+        TranspositionTable table;
+        int hash_mb;
+        int threads;
+
+        std::thread searcher;
+        std::atomic<bool> stop;
+        std::atomic<bool> pondering; // a go ponder search that hasn't had its ponderhit yet
+
+        // UCI doesn't allow bestmove to be sent during go infinite or go ponder until the GUI says stop (or ponderhit),
+        // even if the search is over. The search thread waits on this until then.
+        std::mutex hold_mutex;
+        std::condition_variable hold_released;
+        bool holding_result;
+
+        void set_option(std::istringstream &args);
+        void set_position(std::istringstream &args);
+        void go(std::istringstream &args);
+        void ponderhit();
+        void stop_search();
+        void release_result();
+
+        void search(Game root, GoOptions options);
+        std::vector<Move> principal_variation(Game game, int max_length);
+};
+
+void UciEngine::run(){
+    std::string line;
+    while (std::getline(std::cin, line)){
+        std::istringstream args(line);
+        std::string command;
+        if (!(args >> command))
+            continue;
+
+        if (command == "uci"){
+            send("id name ChessOnline");
+            send("id author Elliot Dziemiela");
+            send("option name Hash type spin default %d min 1 max %d", DEFAULT_HASH_MB, MAX_HASH_MB);
+            send("option name Threads type spin default 1 min 1 max %d", MAX_THREADS);
+            send("option name Ponder type check default false");
+            send("uciok");
+        } else if (command == "isready"){
+            send("readyok");
+        } else if (command == "setoption"){
+            stop_search();
+            set_option(args);
+        } else if (command == "ucinewgame"){
+            stop_search();
+            table.clear();
+            game = Game();
+        } else if (command == "position"){
+            stop_search();
+            set_position(args);
+        } else if (command == "go"){
+            stop_search();
+            go(args);
+        } else if (command == "stop"){
+            stop_search();
+        } else if (command == "ponderhit"){
+            ponderhit();
+        } else if (command == "quit"){
+            break;
+        }
+        // anything else (debug, register, unknown commands) is ignored, as UCI asks
+    }
+}
+
+void UciEngine::set_option(std::istringstream &args){
+    // setoption name <name, which can have spaces> [value <value>]
+    std::string word, name, value;
+    args >> word;
+    if (word != "name")
+        return;
+    while (args >> word && word != "value")
+        name += (name.empty() ? "" : " ") + word;
+    std::getline(args >> std::ws, value);
+
+    if (same_name(name, "Hash")){
+        int mb = atoi(value.c_str());
+        hash_mb = mb < 1 ? 1 : (mb > MAX_HASH_MB ? MAX_HASH_MB : mb);
+        table.resize(hash_mb);
+    } else if (same_name(name, "Threads")){
+        int n = atoi(value.c_str());
+        threads = n < 1 ? 1 : (n > MAX_THREADS ? MAX_THREADS : n);
+    } else if (same_name(name, "Ponder")){
+        // nothing to set up: pondering is just the GUI sending go ponder
+    } else {
+        send("info string unknown option %s", name.c_str());
+    }
+}
+
+void UciEngine::set_position(std::istringstream &args){
+    // position startpos [moves ...] or position fen <fen> [moves ...]
+    std::string word;
+    args >> word;
+    Game position;
+    if (word == "fen"){
+        std::string fen;
+        while (args >> word && word != "moves")
+            fen += (fen.empty() ? "" : " ") + word;
+        if (!position.load_fen(fen.c_str())){
+            send("info string invalid fen %s", fen.c_str());
+            return;
+        }
+    } else if (word == "startpos"){
+        args >> word;
+    } else {
+        return;
+    }
+
+    // GUIs send move lists that run on past a repetition or the fifty move mark nobody claimed. Those moves are still made,
+    // and the position stays drawn: search_position still searches it for the best move, and reports the draw as the score
+    if (word == "moves"){
+        char buf[DEFAULT_BUFLEN];
+        while (args >> word){
+            snprintf(buf, sizeof(buf), "%s", word.c_str());
+            Move move;
+            if (!Game::parse_move(buf, move) || position.make_move(move, position.get_side_to_move()) == MoveResult::Invalid){
+                send("info string illegal move %s", word.c_str());
+                break;
+            }
+        }
+    }
+    game = position;
+}
+
+// How long to think about this move: an even share of the time left over the moves to go (30 if the GUI doesn't say), plus
+// most of the increment, and never more than half of what's left
+static int time_budget(const GoOptions &options, char side){
+    if (options.movetime > 0)
+        return options.movetime;
+    int time_left = (side == 'W') ? options.wtime : options.btime;
+    int increment = (side == 'W') ? options.winc : options.binc;
+    if (time_left < 0)
+        return 0;
+    int moves_to_go = options.movestogo > 0 ? options.movestogo : 30;
+    int budget = time_left / moves_to_go + (increment > 0 ? increment * 3 / 4 : 0);
+    if (budget > time_left / 2)
+        budget = time_left / 2;
+    budget -= MOVE_OVERHEAD_MS;
+    return budget > 1 ? budget : 1;
+}
+
+void UciEngine::go(std::istringstream &args){
+    GoOptions options;
+    options.wtime = options.btime = options.winc = options.binc = options.movestogo = -1;
+    options.movetime = 0;
+    options.depth = 0;
+    options.nodes = 0;
+    options.infinite = false;
+    options.ponder = false;
+
+    std::string word;
+    while (args >> word){
+        if (word == "infinite")
+            options.infinite = true;
+        else if (word == "ponder")
+            options.ponder = true;
+        else if (word == "wtime")
+            args >> options.wtime;
+        else if (word == "btime")
+            args >> options.btime;
+        else if (word == "winc")
+            args >> options.winc;
+        else if (word == "binc")
+            args >> options.binc;
+        else if (word == "movestogo")
+            args >> options.movestogo;
+        else if (word == "movetime")
+            args >> options.movetime;
+        else if (word == "depth")
+            args >> options.depth;
+        else if (word == "nodes")
+            args >> options.nodes;
+    }
+
+    // allocates the table on the first search. This isn't thread safe, so it's done before the search threads start
+    table.new_search();
+    stop = false;
+    pondering = options.ponder;
+    holding_result = options.ponder || options.infinite;
+    searcher = std::thread(&UciEngine::search, this, game, options);
+}
+
+void UciEngine::ponderhit(){
+    // the opponent played the expected move, so the ponder search carries on as a normal search, with its clock starting now
+    pondering = false;
+    std::lock_guard<std::mutex> lock(hold_mutex);
+    if (holding_result){
+        holding_result = false;
+        hold_released.notify_all();
+    }
+}
+
+void UciEngine::release_result(){
+    std::lock_guard<std::mutex> lock(hold_mutex);
+    holding_result = false;
+    hold_released.notify_all();
+}
+
+void UciEngine::stop_search(){
+    if (!searcher.joinable())
+        return;
+    stop = true;
+    release_result();
+    searcher.join();
+}
+
+// Follows the best moves stored in the table from the position. Stops at a position the table doesn't have, or with a move
+// that isn't legal (the entry was overwritten by a different position with the same slot and key bits).
+std::vector<Move> UciEngine::principal_variation(Game game, int max_length){
+    std::vector<Move> pv, legal;
+    for (int i = 0; i < max_length && game.get_draw_reason() == DrawReason::NoDraw; i++){
+        TableEntry entry;
+        if (!table.probe(game.position_key(), entry) || !entry.has_move)
+            break;
+        char side = game.get_side_to_move();
+        game.generate_moves(side, legal);
+        bool is_legal = false;
+        for (const Move &m : legal)
+            is_legal |= same_move(m, entry.best_move);
+        if (!is_legal)
+            break;
+        pv.push_back(entry.best_move);
+        game.make_move(entry.best_move, side);
+    }
+    return pv;
+}
+
+void UciEngine::search(Game root, GoOptions options){
+    char side = root.get_side_to_move();
+    std::atomic<long> nodes(0);
+    auto start = std::chrono::steady_clock::now();
+
+    SearchLimits limits;
+    limits.time_budget_ms = options.infinite ? 0 : time_budget(options, side);
+    limits.max_depth = options.depth;
+    limits.max_nodes = options.nodes;
+    limits.pondering = &pondering;
+    limits.max_ponder_ms = 0;
+    limits.table = &table;
+    limits.shared_cache = NULL;
+    limits.node_counter = &nodes;
+
+    // the helper threads search until the main one is done, without a clock of their own
+    std::atomic<bool> helpers_stop(false);
+    SearchLimits helper_limits = limits;
+    helper_limits.time_budget_ms = 0;
+    helper_limits.max_nodes = 0;
+    helper_limits.pondering = NULL;
+    std::vector<std::thread> helpers;
+    for (int i = 1; i < threads; i++)
+        helpers.emplace_back([&](){ search_position(root, side, helper_limits, helpers_stop); });
+
+    SearchResult result = search_position(root, side, limits, stop, [&](const SearchResult &progress){
+        long elapsed = (long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        long total_nodes = nodes.load();
+        std::string pv;
+        for (const Move &m : principal_variation(root, progress.depth))
+            pv += " " + move_to_uci(m);
+        if (pv.empty())
+            pv = " " + move_to_uci(progress.best_move);
+        send("info depth %d score %s nodes %ld nps %ld time %ld hashfull %d pv%s", progress.depth,
+            format_score(progress.score).c_str(), total_nodes, elapsed > 0 ? total_nodes * 1000 / elapsed : total_nodes,
+            elapsed, table.hashfull(), pv.c_str());
+    });
+
+    helpers_stop = true;
+    for (std::thread &helper : helpers)
+        helper.join();
+
+    {
+        std::unique_lock<std::mutex> lock(hold_mutex);
+        hold_released.wait(lock, [this](){ return !holding_result; });
+    }
+
+    if (!result.found_move){
+        send("bestmove 0000");
+        return;
+    }
+    // the move to ponder on is the reply the search expects, if the table still has it
+    std::vector<Move> pv = principal_variation(root, 2);
+    if (pv.size() == 2 && same_move(pv[0], result.best_move))
+        send("bestmove %s ponder %s", move_to_uci(result.best_move).c_str(), move_to_uci(pv[1]).c_str());
+    else
+        send("bestmove %s", move_to_uci(result.best_move).c_str());
+}
+
+int main(int argc, char* argv[]){
+    if (argc == 3 && strcmp(argv[1], "--eval-weights") == 0){
+        if (!load_eval_weights(argv[2]))
+            return 1;
+    } else if (argc != 1){
+        printf("Usage: uci [--eval-weights FILE]\n");
+        return 1;
+    }
+    // the engine holds a game, so it's only made once the weights are in
+    UciEngine engine;
+    engine.run();
+    return 0;
+}
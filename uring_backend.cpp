@@ -0,0 +1,657 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/io_uring.h>
+#include <vector>
+
+#include "net.h"
+#include "backend.h"
+
+// The io_uring backend. Rather than asking which sockets are ready and then making a syscall per socket, every operation
+// is queued on the submission ring and the whole batch is submitted, and the next batch of completions waited for, with
+// one io_uring_enter() per trip around the loop.
+
+// - Accepting is a single multishot accept, which keeps producing a completion per new connection.
+// - Each connection has a single multishot recv armed. Received data lands in buffers from a ring the kernel picks from
+//   (a provided buffer ring), is copied into the connection's frame buffer, and the buffer goes straight back on the ring.
+// - Sends are copied into slots of one big registered (fixed) buffer, so the kernel doesn't have to map the pages for
+//   every send. One send per connection is in flight at a time, which keeps frames in order.
+// - The engine pool's eventfd and the shard's wake eventfd are watched with multishot polls.
+
+// A connection's socket isn't closed until every operation on it has completed: it's shut down first, which ends its
+// recv, and then closed once ops_in_flight drops to 0. Only then does the shard hear about it, so a Connection is never
+// released while the kernel can still complete something for it.
+
+// Handing the shard over to another server (see handoff.h) first cancels everything in flight and waits for the
+// completions, so no operation on a socket is left in this ring once the socket belongs to the new server. Sockets are
+// non-blocking, as they are with epoll, so either backend can take the other's over as they are. io_uring waits for them
+// to be ready itself.
+
+// The raw syscalls are used, since liburing isn't always installed.
+
+#define RING_ENTRIES 4096
+#define RECV_BUFFERS 4096 // must be a power of 2
+#define RECV_BUFFER_SIZE 4096
+#define RECV_GROUP 0
+#define SEND_SLOTS 1024
+#define SEND_SLOT_SIZE 8192
+
+// what a completion is for, kept in the top byte of its user_data. The rest is a Connection pointer or a send slot
+enum UringOp {AcceptOp = 1, ResumeAcceptOp, RecvOp, SendOp, EnginePollOp, TimerPollOp, WakePollOp, CancelOp};
+
+static uint64_t make_user_data(UringOp op, uint64_t value){
+    return ((uint64_t)op << 56) | value;
+}
+
+struct UringLoop {
+    int ring_fd;
+    unsigned sq_entries, cq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sqe_tail; // SQEs written so far, published to the kernel on the next submit
+    void *ring_mem;
+    size_t ring_mem_size;
+
+    // The provided buffer ring. It's an array of io_uring_buf, with the ring's tail overlaid on bufs[0].resv. It isn't
+    // accessed through struct io_uring_buf_ring, since compiled as C++ that struct's bufs member doesn't start at offset 0
+    struct io_uring_buf *bufs;
+    uint16_t *buf_ring_tail;
+    unsigned buf_tail;
+    char *recv_buffers;
+
+    char *send_area; // SEND_SLOTS slots of SEND_SLOT_SIZE bytes, registered as fixed buffer 0
+    bool fixed_sends; // false if the send area couldn't be registered (i.e. RLIMIT_MEMLOCK), in which case plain sends are used
+    std::vector<Connection*> slot_owner;
+    std::vector<int> free_slots;
+    std::vector<Connection*> starved; // connections waiting for a free send slot
+
+    Shard *shard;
+    socket_t listen_fd;
+    socket_t resume_fd; // INVALID_SOCKET without a state directory or --gateway
+    int wake_fd;
+    long in_flight; // recvs and sends submitted that haven't completed for good yet
+    bool quiescing; // handing off: nothing new is started, and cancelled operations aren't errors
+    long syscalls; // every io_uring_enter() and other syscall made, for comparing backends
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *params){
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags){
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args){
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Creates the ring, asking for a single issuer and deferred task work (completion work only runs when this thread
+// enters the ring, rather than interrupting it), and falling back on older kernels that don't have those
+static int create_ring(UringLoop &loop){
+    const unsigned flag_sets[3] = {
+        IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN,
+        IORING_SETUP_CQSIZE
+    };
+    struct io_uring_params params;
+    int fd = -1;
+    for (unsigned flags : flag_sets){
+        memset(&params, 0, sizeof(params));
+        params.flags = flags;
+        params.cq_entries = RING_ENTRIES * 4; // multishot operations can post many completions per submission
+        fd = uring_setup(RING_ENTRIES, &params);
+        if (fd >= 0 || errno != EINVAL)
+            break;
+    }
+    if (fd < 0)
+        return -1;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)){
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    loop.ring_mem_size = (sq_size > cq_size) ? sq_size : cq_size;
+    loop.ring_mem = mmap(NULL, loop.ring_mem_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    void *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        fd, IORING_OFF_SQES);
+    if (loop.ring_mem == MAP_FAILED || sqes == MAP_FAILED){
+        close(fd);
+        return -1;
+    }
+
+    char *ring = (char*)loop.ring_mem;
+    loop.ring_fd = fd;
+    loop.sq_entries = params.sq_entries;
+    loop.cq_entries = params.cq_entries;
+    loop.sq_head = (unsigned*)(ring + params.sq_off.head);
+    loop.sq_tail = (unsigned*)(ring + params.sq_off.tail);
+    loop.sq_mask = (unsigned*)(ring + params.sq_off.ring_mask);
+    loop.sq_array = (unsigned*)(ring + params.sq_off.array);
+    loop.cq_head = (unsigned*)(ring + params.cq_off.head);
+    loop.cq_tail = (unsigned*)(ring + params.cq_off.tail);
+    loop.cq_mask = (unsigned*)(ring + params.cq_off.ring_mask);
+    loop.cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+    loop.sqes = (struct io_uring_sqe*)sqes;
+    loop.sqe_tail = *loop.sq_tail;
+    return fd;
+}
+
+// Publishes the SQEs written since the last call, and optionally waits for at least one completion
+static int submit(UringLoop &loop, bool wait){
+    __atomic_store_n(loop.sq_tail, loop.sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = loop.sqe_tail - __atomic_load_n(loop.sq_head, __ATOMIC_ACQUIRE);
+    loop.syscalls++;
+    return uring_enter(loop.ring_fd, to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+}
+
+static struct io_uring_sqe *get_sqe(UringLoop &loop){
+    // the submission ring is full, so hand what's there to the kernel first
+    while (loop.sqe_tail - __atomic_load_n(loop.sq_head, __ATOMIC_ACQUIRE) >= loop.sq_entries)
+        submit(loop, false);
+    unsigned index = loop.sqe_tail & *loop.sq_mask;
+    loop.sq_array[index] = index;
+    loop.sqe_tail++;
+    struct io_uring_sqe *sqe = &loop.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void recycle_recv_buffer(UringLoop &loop, unsigned bid){
+    struct io_uring_buf *buf = &loop.bufs[loop.buf_tail & (RECV_BUFFERS - 1)];
+    buf->addr = (uint64_t)(loop.recv_buffers + (size_t)bid * RECV_BUFFER_SIZE);
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = (uint16_t)bid;
+    loop.buf_tail++;
+    __atomic_store_n(loop.buf_ring_tail, (uint16_t)loop.buf_tail, __ATOMIC_RELEASE);
+}
+
+static bool setup_buffers(UringLoop &loop){
+    // the provided buffer ring for receives
+    size_t ring_size = RECV_BUFFERS * sizeof(struct io_uring_buf);
+    void *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    loop.recv_buffers = (char*)malloc((size_t)RECV_BUFFERS * RECV_BUFFER_SIZE);
+    if (ring == MAP_FAILED || loop.recv_buffers == NULL)
+        return false;
+    loop.bufs = (struct io_uring_buf*)ring;
+    loop.buf_ring_tail = &loop.bufs[0].resv;
+    loop.buf_tail = 0;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)ring;
+    reg.ring_entries = RECV_BUFFERS;
+    reg.bgid = RECV_GROUP;
+    if (uring_register(loop.ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return false;
+    for (unsigned bid = 0; bid < RECV_BUFFERS; bid++)
+        recycle_recv_buffer(loop, bid);
+
+    // the send slots, as one registered buffer
+    size_t send_size = (size_t)SEND_SLOTS * SEND_SLOT_SIZE;
+    loop.send_area = (char*)mmap(NULL, send_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (loop.send_area == MAP_FAILED)
+        return false;
+    struct iovec iov;
+    iov.iov_base = loop.send_area;
+    iov.iov_len = send_size;
+    loop.fixed_sends = uring_register(loop.ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    if (!loop.fixed_sends)
+        printf("[shard %d] Couldn't register send buffers (error %d), using plain sends.\n", loop.shard->get_index(), errno);
+
+    loop.slot_owner.assign(SEND_SLOTS, NULL);
+    for (int i = SEND_SLOTS - 1; i >= 0; i--)
+        loop.free_slots.push_back(i);
+    return true;
+}
+
+static void arm_accept(UringLoop &loop, bool resuming){
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = resuming ? loop.resume_fd : loop.listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = make_user_data(resuming ? ResumeAcceptOp : AcceptOp, 0);
+}
+
+static void arm_poll(UringLoop &loop, int fd, UringOp op){
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = make_user_data(op, 0);
+}
+
+static void arm_recv(UringLoop &loop, Connection *c){
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_GROUP;
+    sqe->user_data = make_user_data(RecvOp, (uint64_t)c);
+    c->ops_in_flight++;
+    loop.in_flight++;
+}
+
+// closes a connection that's been shut down, once nothing is in flight on it
+static void maybe_close(UringLoop &loop, Connection *c){
+    if (c->ops_in_flight > 0 || c->closed)
+        return;
+    net_close(c->fd);
+    loop.syscalls++;
+    loop.shard->close_connection(c);
+}
+
+static void begin_shutdown(UringLoop &loop, Connection *c){
+    if (!c->shutting_down){
+        c->shutting_down = true;
+        shutdown(c->fd, SHUT_RDWR); // ends the connection's multishot recv
+        loop.syscalls++;
+    }
+    maybe_close(loop, c);
+}
+
+// Starts sending a connection's queued output, if it isn't already sending. A connection that isn't reading what it's sent
+// is shut down instead
+static void flush_connection(UringLoop &loop, Connection *c){
+    if (c->too_slow && !c->shutting_down && !c->closed && !loop.quiescing){
+        begin_shutdown(loop, c);
+        return;
+    }
+    if (c->send_in_flight || c->shutting_down || c->closed || loop.quiescing)
+        return;
+    size_t remaining = c->outbuf.size() - c->out_offset;
+    if (remaining == 0){
+        loop.shard->output_sent(c);
+        if (c->close_after_flush)
+            begin_shutdown(loop, c);
+        return;
+    }
+    if (loop.free_slots.empty()){
+        // waiting for a slot counts as an operation in flight, so the connection isn't released while it's on the list
+        c->send_in_flight = true;
+        c->ops_in_flight++;
+        loop.starved.push_back(c);
+        return;
+    }
+
+    TimelineSpan span(TimelineSend, c->fd);
+    int slot = loop.free_slots.back();
+    loop.free_slots.pop_back();
+    loop.slot_owner[slot] = c;
+    size_t len = (remaining < SEND_SLOT_SIZE) ? remaining : SEND_SLOT_SIZE;
+    span.arg = len;
+    char *buf = loop.send_area + (size_t)slot * SEND_SLOT_SIZE;
+    memcpy(buf, c->outbuf.data() + c->out_offset, len);
+
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    if (loop.fixed_sends){
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = 0;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = (unsigned)len;
+    sqe->user_data = make_user_data(SendOp, (uint64_t)slot);
+    c->send_in_flight = true;
+    c->ops_in_flight++;
+    loop.in_flight++;
+}
+
+static void handle_send(UringLoop &loop, int slot, int res){
+    Connection *c = loop.slot_owner[slot];
+    loop.slot_owner[slot] = NULL;
+    loop.free_slots.push_back(slot);
+    c->send_in_flight = false;
+    c->ops_in_flight--;
+    loop.in_flight--;
+    // a send cancelled for a handoff sent nothing, and what it had is still in outbuf
+    if (res == -ECANCELED && loop.quiescing){
+        if (c->shutting_down)
+            maybe_close(loop, c);
+    } else if (res < 0)
+        begin_shutdown(loop, c);
+    else if (c->shutting_down)
+        maybe_close(loop, c);
+    else {
+        c->out_offset += res;
+        flush_connection(loop, c);
+    }
+
+    // hand the slot to a connection that's been waiting for one
+    while (!loop.free_slots.empty() && !loop.starved.empty()){
+        Connection *waiting = loop.starved.back();
+        loop.starved.pop_back();
+        waiting->send_in_flight = false;
+        waiting->ops_in_flight--;
+        if (waiting->shutting_down)
+            maybe_close(loop, waiting);
+        else
+            flush_connection(loop, waiting);
+    }
+}
+
+static void handle_recv(UringLoop &loop, Connection *c, int res, unsigned flags){
+    if (flags & IORING_CQE_F_BUFFER){
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0 && !c->shutting_down && !c->closed){
+            TimelineSpan span(TimelineRecv, c->fd, res);
+            loop.shard->receive(c, loop.recv_buffers + (size_t)bid * RECV_BUFFER_SIZE, res);
+        }
+        recycle_recv_buffer(loop, bid);
+    }
+    if (flags & IORING_CQE_F_MORE)
+        return;
+
+    // The multishot recv has ended. It's re-armed if it only stopped because the buffer ring ran dry, unless the shard is
+    // being handed off, when the connection is left as it is
+    c->ops_in_flight--;
+    loop.in_flight--;
+    if (loop.quiescing && (res > 0 || res == -ENOBUFS || res == -ECANCELED)){
+        if (c->shutting_down)
+            maybe_close(loop, c);
+    } else if ((res > 0 || res == -ENOBUFS) && !c->shutting_down)
+        arm_recv(loop, c);
+    else
+        begin_shutdown(loop, c);
+}
+
+static void handle_accept(UringLoop &loop, int res, unsigned flags, bool resuming){
+    if (!(flags & IORING_CQE_F_MORE) && !loop.quiescing)
+        arm_accept(loop, resuming);
+    if (res < 0){
+        if (res != -EAGAIN && res != -EINTR && !(res == -ECANCELED && loop.quiescing))
+            printf("[shard %d] accept error: %d\n", loop.shard->get_index(), -res);
+        return;
+    }
+    int one = 1;
+    setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    loop.syscalls++;
+    Connection *c = loop.shard->open_connection(res, resuming);
+    if (c == NULL){
+        net_close(res);
+        return;
+    }
+    if (!loop.quiescing)
+        arm_recv(loop, c);
+}
+
+// Cancels every operation on the ring and waits until the last recv and send has completed. Data received meanwhile goes
+// to the shard as usual, and whatever hasn't been sent stays in the connections' outbufs. The cancel is repeated until
+// nothing is left, since an operation that was already running when it went in isn't cancelled
+static void quiesce(UringLoop &loop){
+    loop.quiescing = true;
+    // connections waiting for a send slot aren't in the ring at all
+    for (Connection *c : loop.starved){
+        c->send_in_flight = false;
+        c->ops_in_flight--;
+        if (c->shutting_down)
+            maybe_close(loop, c);
+    }
+    loop.starved.clear();
+
+    bool cancel_pending = false;
+    while (1){
+        if (!cancel_pending){
+            if (loop.in_flight == 0)
+                break;
+            struct io_uring_sqe *sqe = get_sqe(loop);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+            sqe->user_data = make_user_data(CancelOp, 0);
+            cancel_pending = true;
+        }
+        if (submit(loop, true) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY){
+            printf("[shard %d] io_uring_enter() error: %d\n", loop.shard->get_index(), errno);
+            return;
+        }
+        unsigned head = *loop.cq_head;
+        unsigned tail = __atomic_load_n(loop.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++){
+            struct io_uring_cqe *cqe = &loop.cqes[head & *loop.cq_mask];
+            UringOp op = (UringOp)(cqe->user_data >> 56);
+            uint64_t value = cqe->user_data & ((1ULL << 56) - 1);
+            if (op == RecvOp)
+                handle_recv(loop, (Connection*)value, cqe->res, cqe->flags);
+            else if (op == SendOp)
+                handle_send(loop, (int)value, cqe->res);
+            else if (op == AcceptOp || op == ResumeAcceptOp)
+                handle_accept(loop, cqe->res, cqe->flags, op == ResumeAcceptOp);
+            else if (op == CancelOp)
+                cancel_pending = false;
+        }
+        __atomic_store_n(loop.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+// Arms the accepts and polls and a recv on every open connection, and starts sending whatever they have queued. This is
+// how a shard starts, and how one carries on after a handoff that fell through
+static void arm_everything(UringLoop &loop){
+    Shard &shard = *loop.shard;
+    loop.quiescing = false;
+    arm_accept(loop, false);
+    if (loop.resume_fd != INVALID_SOCKET)
+        arm_accept(loop, true);
+    arm_poll(loop, loop.wake_fd, WakePollOp);
+    if (shard.engine_fd() >= 0)
+        arm_poll(loop, shard.engine_fd(), EnginePollOp);
+    if (shard.timer_fd() >= 0)
+        arm_poll(loop, shard.timer_fd(), TimerPollOp);
+    std::vector<Connection*> open;
+    shard.open_connections(open);
+    for (Connection *c : open){
+        arm_recv(loop, c);
+        flush_connection(loop, c);
+    }
+    for (Connection *c : shard.pending_writes)
+        c->write_pending = false;
+    shard.pending_writes.clear();
+}
+
+bool uring_supported(){
+    UringLoop loop;
+    if (create_ring(loop) < 0)
+        return false;
+    // multishot recv and provided buffer rings came in with Linux 6.0, which is also when IORING_OP_SEND_ZC appeared
+    std::vector<char> probe_mem(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op), 0);
+    struct io_uring_probe *probe = (struct io_uring_probe*)probe_mem.data();
+    bool supported = uring_register(loop.ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0
+        && probe->last_op >= IORING_OP_SEND_ZC;
+    munmap(loop.ring_mem, loop.ring_mem_size);
+    munmap(loop.sqes, loop.sq_entries * sizeof(struct io_uring_sqe));
+    close(loop.ring_fd);
+    return supported;
+}
+
+void run_uring_shard(int index, const ServerOptions &options, ShardControl &control){
+    char thread_name[32];
+    snprintf(thread_name, sizeof(thread_name), "shard %d (io_uring)", index);
+    timeline_name_thread(thread_name);
+
+    const ShardHandoff *adopt = control.adopt;
+    // an adopting shard listens on the sockets it was handed
+    socket_t listen_fd = (adopt != NULL) ? adopt->fds[0] : net_listen(options.port, true);
+    if (listen_fd == INVALID_SOCKET || !net_set_nonblocking(listen_fd)){
+        printf("[shard %d] Couldn't listen on port %s.\n", index, options.port);
+        exit(1);
+    }
+
+    socket_t resume_fd = INVALID_SOCKET;
+    if (adopt != NULL && adopt->header.listen_fds > 1){
+        resume_fd = adopt->fds[1];
+    } else if (options.shard_config.state_dir != NULL || options.gateway){
+        char resume_port[16];
+        snprintf(resume_port, sizeof(resume_port), "%d", options.resume_port + index);
+        resume_fd = net_listen(resume_port, false);
+        if (resume_fd == INVALID_SOCKET || !net_set_nonblocking(resume_fd)){
+            printf("[shard %d] Couldn't listen on port %s.\n", index, resume_port);
+            exit(1);
+        }
+    }
+
+    Shard shard(index, options.shard_config, adopt);
+    UringLoop loop;
+    loop.shard = &shard;
+    loop.listen_fd = listen_fd;
+    loop.resume_fd = resume_fd;
+    loop.wake_fd = control.wake_fd;
+    loop.in_flight = 0;
+    loop.quiescing = false;
+    loop.syscalls = 0;
+    if (create_ring(loop) < 0 || !setup_buffers(loop)){
+        printf("[shard %d] io_uring setup error: %d\n", index, errno);
+        exit(1);
+    }
+
+    // A new server's shard has everything copied set up, but can't arm a recv on a socket the old shard is still reading
+    // from, so it arms everything once it has the final handoff
+    shard.adopted.clear();
+    if (adopt != NULL){
+        control.finish();
+        control.wait_answer();
+        std::vector<socket_t> dropped;
+        shard.adopt_final(*control.adopt_final, dropped);
+        for (socket_t fd : dropped)
+            net_close(fd);
+        shard.adopted.clear();
+    }
+    arm_everything(loop);
+    if (adopt != NULL){
+        control.started_ns = handoff_clock_ns();
+        control.finish();
+    }
+
+    bool running = true;
+    bool copying = false;
+    while (running){
+        // while copying for a handoff, the loop comes back round without waiting to copy the next chunk
+        if (submit(loop, !shard.copying()) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY){
+            printf("[shard %d] io_uring_enter() error: %d\n", index, errno);
+            break;
+        }
+
+        // every completion there is is handled in the batch
+        shard.begin_batch(false);
+        ShardRequest request = NoRequest;
+        unsigned head = *loop.cq_head;
+        unsigned tail = __atomic_load_n(loop.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++){
+            struct io_uring_cqe *cqe = &loop.cqes[head & *loop.cq_mask];
+            UringOp op = (UringOp)(cqe->user_data >> 56);
+            uint64_t value = cqe->user_data & ((1ULL << 56) - 1);
+            switch (op){
+                case AcceptOp:
+                    handle_accept(loop, cqe->res, cqe->flags, false);
+                    break;
+                case ResumeAcceptOp:
+                    handle_accept(loop, cqe->res, cqe->flags, true);
+                    break;
+                case RecvOp:
+                    handle_recv(loop, (Connection*)value, cqe->res, cqe->flags);
+                    break;
+                case SendOp:
+                    handle_send(loop, (int)value, cqe->res);
+                    break;
+                case EnginePollOp:
+                    shard.handle_engine_completions();
+                    if (!(cqe->flags & IORING_CQE_F_MORE))
+                        arm_poll(loop, shard.engine_fd(), EnginePollOp);
+                    break;
+                case TimerPollOp:
+                    shard.handle_timer();
+                    if (!(cqe->flags & IORING_CQE_F_MORE))
+                        arm_poll(loop, shard.timer_fd(), TimerPollOp);
+                    break;
+                case WakePollOp:
+                    request = control.take_request();
+                    if (!(cqe->flags & IORING_CQE_F_MORE))
+                        arm_poll(loop, loop.wake_fd, WakePollOp);
+                    break;
+                case CancelOp:
+                    break;
+            }
+        }
+        __atomic_store_n(loop.cq_head, head, __ATOMIC_RELEASE);
+
+        shard.end_batch();
+
+        // start sending everything the shard queued while handling this batch. The sends go to the kernel with the
+        // next io_uring_enter()
+        for (size_t i = 0; i < shard.pending_writes.size(); i++){
+            Connection *c = shard.pending_writes[i];
+            c->write_pending = false;
+            flush_connection(loop, c);
+        }
+        shard.pending_writes.clear();
+        shard.release_closed();
+
+        if (copying && !shard.copying()){
+            copying = false;
+            control.finish();
+        }
+        if (request == StopShard){
+            running = false;
+        } else if (request == CopyShard){
+            ShardHandoff &copy = control.copy;
+            copy.header.listen_fds = (resume_fd != INVALID_SOCKET) ? 2 : 1;
+            copy.fds.push_back(listen_fd);
+            if (resume_fd != INVALID_SOCKET)
+                copy.fds.push_back(resume_fd);
+            shard.start_copy(copy);
+            copying = true;
+        } else if (request == HandOffShard){
+            // The moves that arrived while the ring drained are made before exporting. Whatever hasn't been sent stays
+            // in the connections' outbufs, and goes in the handoff
+            uint64_t stopped_ns = handoff_clock_ns();
+            quiesce(loop);
+            shard.end_batch();
+            for (Connection *c : shard.pending_writes)
+                c->write_pending = false;
+            shard.pending_writes.clear();
+            shard.release_closed();
+            shard.export_final(control.copy, control.final);
+            control.final.header.stopped_ns = stopped_ns;
+            control.finish();
+            if (control.wait_answer()){
+                shard.handed_over();
+                running = false;
+            } else {
+                arm_everything(loop);
+            }
+        }
+    }
+
+    long frames = shard.frames_received + shard.frames_queued;
+    printf("[shard %d] io_uring: %ld syscalls for %ld frames (%.2f per frame)%s\n", index, loop.syscalls, frames,
+        frames ? (double)loop.syscalls / frames : 0.0, loop.fixed_sends ? "" : ", without registered buffers");
+    // Closing the ring cancels whatever is still in flight. After a handoff, closing the sockets only closes this process's
+    // copies of them. With the ring gone nothing is registered any more, so the buffers can go too
+    close(loop.ring_fd);
+    munmap(loop.ring_mem, loop.ring_mem_size);
+    munmap(loop.sqes, loop.sq_entries * sizeof(struct io_uring_sqe));
+    munmap(loop.bufs, RECV_BUFFERS * sizeof(struct io_uring_buf));
+    munmap(loop.send_area, (size_t)SEND_SLOTS * SEND_SLOT_SIZE);
+    free(loop.recv_buffers);
+    net_close(listen_fd);
+    if (resume_fd != INVALID_SOCKET)
+        net_close(resume_fd);
+}
@@ -2,6 +2,10 @@
 #define UTILS_H
 
 #define DEFAULT_PORT "27015"
+// a server keeping its games across restarts takes players coming back to them on this port plus the shard's index
+#define DEFAULT_RESUME_PORT 27016
+// a game's number keeps the index of the shard that has it above this bit
+#define GAME_SHARD_SHIFT 48
 #define DEFAULT_BUFLEN 2048
 
 enum MoveResult {
@@ -10,4 +14,13 @@ enum MoveResult {
     ValidWithReplace
 };
 
+// Why a game ended in a draw. NoDraw while the game is still going (or was won).
+enum DrawReason {
+    NoDraw,
+    Stalemate,
+    ThreefoldRepetition,
+    FiftyMoveRule,
+    InsufficientMaterial
+};
+
 #endif // UTILS_H
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "variant.h"
+
+// The knights' places among the five tiles left once the bishops and queen are placed, by the number left over at the end
+static const int knight_places[10][2] = {
+    {0,1},{0,2},{0,3},{0,4},{1,2},{1,3},{1,4},{2,3},{2,4},{3,4}
+};
+
+// puts piece on the index-th still empty tile of rank
+static void place_on_empty(char rank[8], int index, char piece){
+    for (int col = 0; col < 8; col++){
+        if (rank[col] != ' ')
+            continue;
+        if (index-- == 0){
+            rank[col] = piece;
+            return;
+        }
+    }
+}
+
+// Scharnagl's numbering: the number is taken apart into the light squared bishop's file (b, d, f or h), the dark squared
+// bishop's (a, c, e or g), the queen's place among the six tiles left and the knights' among the five after that. The king
+// goes between the two rooks on the last three tiles
+void chess960_back_rank(int start_position, char rank[8]){
+    int n = start_position % CHESS960_POSITIONS;
+    if (n < 0)
+        n += CHESS960_POSITIONS;
+    for (int col = 0; col < 8; col++)
+        rank[col] = ' ';
+
+    rank[2 * (n % 4) + 1] = 'B';
+    n /= 4;
+    rank[2 * (n % 4)] = 'B';
+    n /= 4;
+    place_on_empty(rank, n % 6, 'Q');
+    n /= 6;
+    // once the first knight is down, the second knight's place is one fewer empty tile along
+    place_on_empty(rank, knight_places[n][0], 'N');
+    place_on_empty(rank, knight_places[n][1] - 1, 'N');
+    place_on_empty(rank, 0, 'R');
+    place_on_empty(rank, 0, 'K');
+    place_on_empty(rank, 0, 'R');
+}
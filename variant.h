@@ -0,0 +1,65 @@
+#ifndef VARIANT_H
+#define VARIANT_H
+
+#include <cstdint>
+
+// Rules policies for BasicGame (see game.h). Each variant is a compile time parameter of the game, so its differences from
+// standard chess are resolved by the compiler and standard chess pays nothing for the variants existing:
+// - StandardChess: the rules the server plays
+// - Chess960: the back rank is shuffled (one of 960 start positions), and the king and rooks castle from wherever they start
+// - KingOfTheHill: standard chess, and a king that reaches one of the four center tiles wins the game
+
+// the start position numbered 518 in Chess960's numbering is the standard one
+#define STANDARD_START_POSITION 518
+#define CHESS960_POSITIONS 960
+
+// The files the king and rooks castle from, for variants where they always start where they do in standard chess. Nothing
+// is stored, so every check against them folds into a constant. side 0 is the rook on the a side of the king, side 1 the
+// rook on the h side
+struct FixedCastleSquares {
+    static constexpr int king_col(char color){
+        return (void)color, 4;
+    }
+    static constexpr int rook_col(char color, int side){
+        return (void)color, (side == 0) ? 0 : 7;
+    }
+};
+
+// The files the king and rooks castle from, for variants where they start somewhere else. Kept separately for each color,
+// since a FEN can give them different files
+struct ShuffledCastleSquares {
+    int8_t king_cols[2]; // White's, Black's
+    int8_t rook_cols[2][2]; // by color, then side
+
+    int king_col(char color) const {
+        return king_cols[color == 'B'];
+    }
+    int rook_col(char color, int side) const {
+        return rook_cols[color == 'B'][side];
+    }
+};
+
+struct StandardChess {
+    typedef FixedCastleSquares CastleSquares;
+    static const bool shuffled_start = false;
+    static const bool king_of_the_hill = false;
+};
+
+// A castle is typed as the king moving onto its own rook (i.e. "b1a1"), since the king may only move one tile, or none, when
+// it castles. The king still ends on the c or g file and the rook on the d or f file, as in standard chess
+struct Chess960 {
+    typedef ShuffledCastleSquares CastleSquares;
+    static const bool shuffled_start = true;
+    static const bool king_of_the_hill = false;
+};
+
+struct KingOfTheHill {
+    typedef FixedCastleSquares CastleSquares;
+    static const bool shuffled_start = false;
+    static const bool king_of_the_hill = true;
+};
+
+// writes the back rank of a Chess960 start position (0 to 959, in Scharnagl's numbering) into rank as piece types, a file first
+void chess960_back_rank(int start_position, char rank[8]);
+
+#endif // VARIANT_H